@@ -0,0 +1,357 @@
+/**
+ * Throughput of drivercore.c request handling in user mode, see driverhost.h.
+ * Every thread checks data it reads, so the run doubles as a stress test: exit code is 1 on any mismatch.
+ *
+ * Usage: corebench [--threads N] [--seconds S]
+ */
+
+#include "driverhost.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_PID ((void *)(UINT_PTR)1000)
+#define BENCH_BASE ((UINT_PTR)0x10000000)
+#define BENCH_SIZE ((SIZE_T)16 * 1024 * 1024)
+#define BENCH_MAX_THREADS 64
+
+// Atomic counters of threads live in the last page of region
+#define BENCH_COUNTERS (BENCH_BASE + BENCH_SIZE - DRIVER_PAGE_SIZE)
+
+// Clock is read once per this many requests
+#define BENCH_CHECK_INTERVAL 1024
+
+// Every read is checked at its ends, each this many-th one fully, so checks don't dominate large reads
+#define BENCH_FULL_CHECK_INTERVAL 64
+
+enum BenchKind
+{
+	BenchRead,
+	BenchReadDirect,
+	BenchResidency,
+	BenchAtomic,
+	BenchModuleBase,
+};
+
+struct BenchCase
+{
+	const char *Name;
+	enum BenchKind Kind;
+	SIZE_T Size;
+};
+
+static const struct BenchCase BenchCases[] =
+{
+	{ "read 16 buffered", BenchRead, 16 },
+	{ "read 4K buffered", BenchRead, 0x1000 },
+	{ "read 4K direct", BenchReadDirect, 0x1000 },
+	{ "read 64K direct", BenchReadDirect, 0x10000 },
+	{ "residency 64K", BenchResidency, 0x10000 },
+	{ "atomic fetch add", BenchAtomic, 8 },
+	{ "module base", BenchModuleBase, 0 },
+};
+
+struct BenchThread
+{
+	pthread_t Thread;
+	struct CDriverHost *Host;
+	const struct BenchCase *Case;
+	ULONG Index;
+	double Deadline;
+
+	UINT64 Requests;
+	UINT64 Errors;
+};
+
+#pragma pack(push, 1)
+struct BenchRequestAtomic
+{
+	struct CRequestAtomic Header;
+	struct CAtomicOperation Operation;
+};
+
+struct BenchRequestModuleBase
+{
+	struct CRequestModuleBase Header;
+	WCHAR Name[9];
+};
+#pragma pack(pop)
+
+static const WCHAR BenchModuleName[9] = { 'g', 'a', 'm', 'e', '.', 'e', 'x', 'e', 0 };
+
+static double
+BenchNow(
+	VOID
+)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static UCHAR
+BenchPattern(
+	_In_ UINT_PTR Address
+)
+{
+	return (UCHAR)(Address * 7 + (Address >> 12));
+}
+
+static BOOLEAN
+BenchCheck(
+	_In_ UINT_PTR Address,
+	_In_ const UCHAR *Data,
+	_In_ SIZE_T Size,
+	_In_ BOOLEAN Full
+)
+{
+	SIZE_T i;
+
+	if (!Full)
+		return Data[0] == BenchPattern(Address) && Data[Size - 1] == BenchPattern(Address + Size - 1);
+
+	for (i = 0; i < Size; i++)
+	{
+		if (Data[i] != BenchPattern(Address + i))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+// Next address of xorshift walk over region, so reads don't stay in one cache line
+static UINT_PTR
+BenchNextAddress(
+	_Inout_ UINT64 *State,
+	_In_ SIZE_T Size
+)
+{
+	*State ^= *State << 13;
+	*State ^= *State >> 7;
+	*State ^= *State << 17;
+
+	return BENCH_BASE + (UINT_PTR)(*State % (BENCH_COUNTERS - BENCH_BASE - Size));
+}
+
+static BOOLEAN
+BenchRequest(
+	_In_ struct BenchThread *Thread,
+	_Inout_ UINT64 *State,
+	_Out_ UCHAR *Output
+)
+{
+	NTSTATUS status;
+	ULONG wrote;
+	SIZE_T size = Thread->Case->Size;
+	UINT_PTR address;
+	struct CRequestReadProcessMemory read;
+	struct CRequestQueryResidency residency;
+	struct BenchRequestAtomic atomic;
+	struct BenchRequestModuleBase moduleBase;
+	struct CAtomicResult result;
+	void *base;
+
+	switch (Thread->Case->Kind)
+	{
+		case BenchRead:
+		case BenchReadDirect:
+			address = BenchNextAddress(State, size);
+
+			read.pid = BENCH_PID;
+			read.ptr = (void *)address;
+			read.size = size;
+
+			status = DriverHostIoControl(Thread->Host,
+				Thread->Case->Kind == BenchRead ? CTL_RequestReadProcessMemory : CTL_RequestReadProcessMemoryDirect,
+				&read, sizeof(read), Output, (ULONG)size, &wrote);
+
+			return NT_SUCCESS(status) && wrote == size &&
+				BenchCheck(address, Output, size, Thread->Requests % BENCH_FULL_CHECK_INTERVAL == 0);
+
+		case BenchResidency:
+			residency.pid = BENCH_PID;
+			residency.ptr = (void *)BenchNextAddress(State, size);
+			residency.size = size;
+
+			status = DriverHostIoControl(Thread->Host, CTL_RequestQueryResidency,
+				&residency, sizeof(residency), Output, (ULONG)DRIVER_RESIDENCY_BITMAP_SIZE(residency.ptr, size), &wrote);
+
+			// Every page is resident
+			return NT_SUCCESS(status) && Output[0] != 0;
+
+		case BenchAtomic:
+			memset(&atomic, 0, sizeof(atomic));
+			atomic.Header.pid = BENCH_PID;
+			atomic.Header.count = 1;
+			atomic.Operation.ptr = (void *)(BENCH_COUNTERS + Thread->Index * sizeof(UINT64));
+			atomic.Operation.op = DRIVER_ATOMIC_FETCH_ADD;
+			atomic.Operation.size = sizeof(UINT64);
+			atomic.Operation.operand = 1;
+
+			status = DriverHostIoControl(Thread->Host, CTL_RequestAtomic, &atomic, sizeof(atomic), &result, sizeof(result), &wrote);
+
+			// Counter of thread is touched only by the thread
+			return NT_SUCCESS(status) && NT_SUCCESS(result.status) && result.previous == Thread->Requests;
+
+		case BenchModuleBase:
+			moduleBase.Header.pid = BENCH_PID;
+			moduleBase.Header.size = 8;
+			memcpy(moduleBase.Name, BenchModuleName, sizeof(moduleBase.Name));
+
+			status = DriverHostIoControl(Thread->Host, CTL_RequestModuleBase, &moduleBase, sizeof(moduleBase), &base, sizeof(base), &wrote);
+
+			return NT_SUCCESS(status) && base == (void *)BENCH_BASE;
+
+		default:
+			return FALSE;
+	}
+}
+
+static void *
+BenchWorker(
+	_In_ void *Context
+)
+{
+	struct BenchThread *thread = Context;
+	UINT64 state = 0x9E3779B97F4A7C15ull * (thread->Index + 1);
+	UCHAR *output = malloc(thread->Case->Size + DRIVER_PAGE_SIZE);
+	ULONG i;
+
+	if (output == NULL)
+	{
+		thread->Errors++;
+		return NULL;
+	}
+
+	while (BenchNow() < thread->Deadline)
+	{
+		for (i = 0; i < BENCH_CHECK_INTERVAL; i++)
+		{
+			if (!BenchRequest(thread, &state, output))
+				thread->Errors++;
+
+			thread->Requests++;
+		}
+	}
+
+	free(output);
+
+	return NULL;
+}
+
+static BOOLEAN
+BenchRun(
+	_In_ struct CDriverHost *Host,
+	_In_ const struct BenchCase *Case,
+	_In_ ULONG ThreadCount,
+	_In_ double Seconds
+)
+{
+	struct BenchThread threads[BENCH_MAX_THREADS];
+	UINT64 requests = 0;
+	UINT64 errors = 0;
+	double start;
+	double elapsed;
+	ULONG i;
+
+	start = BenchNow();
+
+	for (i = 0; i < ThreadCount; i++)
+	{
+		memset(&threads[i], 0, sizeof(threads[i]));
+		threads[i].Host = Host;
+		threads[i].Case = Case;
+		threads[i].Index = i;
+		threads[i].Deadline = start + Seconds;
+
+		if (pthread_create(&threads[i].Thread, NULL, BenchWorker, &threads[i]) != 0)
+		{
+			fprintf(stderr, "pthread_create failed\n");
+			exit(1);
+		}
+	}
+
+	for (i = 0; i < ThreadCount; i++)
+	{
+		pthread_join(threads[i].Thread, NULL);
+
+		requests += threads[i].Requests;
+		errors += threads[i].Errors;
+	}
+
+	elapsed = BenchNow() - start;
+
+	printf("%-18s %2u threads: %12.0f requests/s", Case->Name, ThreadCount, (double)requests / elapsed);
+
+	if (Case->Kind == BenchRead || Case->Kind == BenchReadDirect)
+		printf(" %10.1f MB/s", (double)(requests * Case->Size) / elapsed / (1024 * 1024));
+
+	printf(", errors %llu\n", (unsigned long long)errors);
+
+	return errors == 0;
+}
+
+int
+main(
+	int argc,
+	char **argv
+)
+{
+	struct CDriverHost *host;
+	PUCHAR data;
+	SIZE_T i;
+	ULONG threads = 1;
+	double seconds = 1.0;
+	BOOLEAN passed = TRUE;
+	int arg;
+
+	for (arg = 1; arg < argc; arg++)
+	{
+		if (strcmp(argv[arg], "--threads") == 0 && arg + 1 < argc)
+			threads = (ULONG)strtoul(argv[++arg], NULL, 10);
+		else if (strcmp(argv[arg], "--seconds") == 0 && arg + 1 < argc)
+			seconds = strtod(argv[++arg], NULL);
+		else
+		{
+			fprintf(stderr, "usage: %s [--threads N] [--seconds S]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	if (threads == 0 || threads > BENCH_MAX_THREADS)
+	{
+		fprintf(stderr, "thread count must be 1..%d\n", BENCH_MAX_THREADS);
+		return 2;
+	}
+
+	host = DriverHostCreate();
+
+	if (host == NULL)
+		return 1;
+
+	data = DriverHostAddRegion(host, BENCH_PID, (void *)BENCH_BASE, BENCH_SIZE, 0x04);
+
+	if (data == NULL || !NT_SUCCESS(DriverHostAddModule(host, BENCH_PID, BenchModuleName, 8, (void *)BENCH_BASE)))
+		return 1;
+
+	for (i = 0; i < BENCH_COUNTERS - BENCH_BASE; i++)
+		data[i] = BenchPattern(BENCH_BASE + i);
+
+	for (i = 0; i < sizeof(BenchCases) / sizeof(BenchCases[0]); i++)
+	{
+		// Counters restart for every run of atomic case
+		memset(data + (BENCH_COUNTERS - BENCH_BASE), 0, DRIVER_PAGE_SIZE);
+
+		if (!BenchRun(host, &BenchCases[i], threads, seconds))
+			passed = FALSE;
+	}
+
+	DriverHostDestroy(host);
+
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,163 @@
+/**
+ * Throughput of CDriverHelper::ReqReadProcessMemoryParallel for `Chunks` 1..64 against one plain ReqReadProcessMemory.
+ * Reads memory of the benchmark itself: one range stays in working set, the other is trimmed out of it before every read,
+ * so its pages are soft faulted back in by driver workers. Every read is checked, exit code is 1 on any mismatch.
+ * Needs installed driver with DRIVER_FEATURE_PARALLEL_READ.
+ *
+ * Usage: parallelbench [--size MB] [--repeats N]
+ */
+
+#include "driverapi.hpp"
+
+#include <windows.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <vector>
+
+// Plain read in the table
+static const uint32_t SingleRead = 0;
+
+static const uint32_t ChunkCounts[] = { SingleRead, 1, 2, 4, 8, 16, 32, 64 };
+
+struct CParallelBench
+{
+	CDriverHelper Helper;
+	void *Pid;
+	int Repeats;
+
+	std::vector<uint8_t> Warm;
+	std::vector<uint8_t> Trimmed;
+	std::vector<uint8_t> Out;
+};
+
+// Reads one byte per page, so pages are back in working set
+static void Touch(const std::vector<uint8_t> &Buffer)
+{
+	volatile uint8_t Sum = 0;
+
+	for (size_t i = 0; i < Buffer.size(); i += DRIVER_PAGE_SIZE)
+		Sum += Buffer[i];
+}
+
+static void Fill(std::vector<uint8_t> &Buffer, uint8_t Seed)
+{
+	for (size_t i = 0; i < Buffer.size(); i++)
+		Buffer[i] = (uint8_t)(i * 7 + (i >> 12) + Seed);
+}
+
+// Best of repeats in MB/s, negative if any read came back different from source
+static double Measure(CParallelBench &Bench, const std::vector<uint8_t> &Source, uint32_t Chunks, bool Trim)
+{
+	double Best = 0.0;
+
+	for (int i = 0; i < Bench.Repeats; i++)
+	{
+		if (Trim)
+		{
+			// Empties working set of the whole process, so everything but source is touched back before timing
+			SetProcessWorkingSetSize(GetCurrentProcess(), (SIZE_T)-1, (SIZE_T)-1);
+			Touch(Bench.Warm);
+		}
+
+		Touch(Bench.Out);
+
+		auto Start = std::chrono::steady_clock::now();
+
+		if (Chunks == SingleRead)
+			Bench.Helper.ReqReadProcessMemory(Bench.Pid, const_cast<uint8_t *>(Source.data()), Source.size(), Bench.Out.data());
+		else
+			Bench.Helper.ReqReadProcessMemoryParallel(Bench.Pid, const_cast<uint8_t *>(Source.data()), Source.size(), Bench.Out.data(), Chunks);
+
+		std::chrono::duration<double> Elapsed = std::chrono::steady_clock::now() - Start;
+
+		if (memcmp(Bench.Out.data(), Source.data(), Source.size()) != 0)
+			return -1.0;
+
+		double Rate = (double)Source.size() / Elapsed.count() / (1024 * 1024);
+
+		if (Rate > Best)
+			Best = Rate;
+	}
+
+	return Best;
+}
+
+int main(int argc, char **argv)
+{
+	size_t SizeMb = 64;
+	int Repeats = 5;
+
+	for (int Arg = 1; Arg < argc; Arg++)
+	{
+		if (strcmp(argv[Arg], "--size") == 0 && Arg + 1 < argc)
+			SizeMb = (size_t)strtoul(argv[++Arg], NULL, 10);
+		else if (strcmp(argv[Arg], "--repeats") == 0 && Arg + 1 < argc)
+			Repeats = atoi(argv[++Arg]);
+		else
+		{
+			fprintf(stderr, "usage: %s [--size MB] [--repeats N]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	if (SizeMb == 0 || Repeats <= 0)
+	{
+		fprintf(stderr, "size and repeats must be positive\n");
+		return 2;
+	}
+
+	bool Passed = true;
+
+	try
+	{
+		CParallelBench Bench;
+		Bench.Pid = reinterpret_cast<void *>((uintptr_t)GetCurrentProcessId());
+		Bench.Repeats = Repeats;
+
+		if (!Bench.Helper.HasFeature(DRIVER_FEATURE_PARALLEL_READ))
+		{
+			fprintf(stderr, "driver doesn't support parallel reads\n");
+			return 1;
+		}
+
+		Bench.Warm.resize(SizeMb * 1024 * 1024);
+		Bench.Trimmed.resize(SizeMb * 1024 * 1024);
+		Bench.Out.resize(SizeMb * 1024 * 1024);
+
+		Fill(Bench.Warm, 0);
+		Fill(Bench.Trimmed, 0x55);
+
+		printf("%zu MB, best of %d\n", SizeMb, Repeats);
+		printf("%-8s %12s %12s\n", "chunks", "warm MB/s", "trimmed MB/s");
+
+		for (uint32_t Chunks : ChunkCounts)
+		{
+			double Warm = Measure(Bench, Bench.Warm, Chunks, false);
+			double Trimmed = Measure(Bench, Bench.Trimmed, Chunks, true);
+
+			if (Chunks == SingleRead)
+				printf("%-8s", "single");
+			else
+				printf("%-8u", Chunks);
+
+			printf(" %12.1f %12.1f\n", Warm, Trimmed);
+
+			if (Warm < 0.0 || Trimmed < 0.0)
+				Passed = false;
+		}
+	}
+	catch (const std::exception &e)
+	{
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+
+	if (!Passed)
+		fprintf(stderr, "read data differs from source\n");
+
+	return Passed ? 0 : 1;
+}
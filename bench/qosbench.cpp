@@ -0,0 +1,228 @@
+/**
+ * Latency of small interactive reads alone and next to bulk dumps, see CDriverHelper::ReqReadProcessMemoryBulk.
+ * One thread reads 16 bytes at a time, another one dumps 64 MB with bulk reads in the second run only. Both read memory
+ * of the benchmark itself. Each interactive call is timed here, so no sample is lost under load. With --trace, calls are
+ * also recorded by CDriverTrace and its summary of latest records is printed after each run.
+ * Every read is checked, exit code is 1 on any mismatch.
+ *
+ * Usage: qosbench [--seconds S] [--trace]
+ */
+
+#include "driverapi.hpp"
+#include "drivertrace.hpp"
+
+#include <windows.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+static const size_t SmallSize = 16;
+static const size_t DumpSize = (size_t)64 * 1024 * 1024;
+
+struct CQosBench
+{
+	void *Pid;
+	bool Trace;
+	std::vector<uint8_t> Source;
+
+	// Microseconds of each interactive call of current run, written by interactive thread only
+	std::vector<double> Latencies;
+
+	std::atomic<bool> Stop;
+	std::atomic<bool> Failed;
+	std::atomic<uint64_t> DumpedBytes;
+};
+
+static uint8_t Pattern(size_t Offset)
+{
+	return (uint8_t)(Offset * 7 + (Offset >> 12));
+}
+
+static void RunInteractive(CQosBench &Bench)
+{
+	try
+	{
+		CDriverHelper Helper;
+		Helper.ReqSetPriority(DRIVER_PRIORITY_INTERACTIVE);
+
+		uint64_t State = 0x9E3779B97F4A7C15ull;
+		uint8_t Buffer[SmallSize];
+
+		while (!Bench.Stop)
+		{
+			// Xorshift walk, so reads don't stay in one cache line
+			State ^= State << 13;
+			State ^= State >> 7;
+			State ^= State << 17;
+
+			size_t Offset = (size_t)(State % (Bench.Source.size() - SmallSize));
+
+			auto Start = std::chrono::steady_clock::now();
+			Helper.ReqReadProcessMemory(Bench.Pid, Bench.Source.data() + Offset, SmallSize, Buffer);
+			std::chrono::duration<double, std::micro> Elapsed = std::chrono::steady_clock::now() - Start;
+
+			Bench.Latencies.push_back(Elapsed.count());
+
+			if (Buffer[0] != Pattern(Offset) || Buffer[SmallSize - 1] != Pattern(Offset + SmallSize - 1))
+				Bench.Failed = true;
+		}
+	}
+	catch (const std::exception &e)
+	{
+		fprintf(stderr, "interactive: %s\n", e.what());
+		Bench.Failed = true;
+	}
+}
+
+static void RunDump(CQosBench &Bench)
+{
+	try
+	{
+		CDriverHelper Helper;
+		std::vector<uint8_t> Out(DumpSize);
+
+		while (!Bench.Stop)
+		{
+			Helper.ReqReadProcessMemoryBulk(Bench.Pid, Bench.Source.data(), DumpSize, Out.data());
+
+			if (Out[0] != Pattern(0) || Out[DumpSize - 1] != Pattern(DumpSize - 1))
+				Bench.Failed = true;
+
+			Bench.DumpedBytes += DumpSize;
+		}
+	}
+	catch (const std::exception &e)
+	{
+		fprintf(stderr, "dump: %s\n", e.what());
+		Bench.Failed = true;
+	}
+}
+
+// Latency below which `Fraction` of sorted `Latencies` are
+static double Percentile(const std::vector<double> &Latencies, double Fraction)
+{
+	return Latencies[std::min(Latencies.size() - 1, (size_t)(Fraction * Latencies.size()))];
+}
+
+static void PrintSummary(const char *pName, std::vector<double> &Latencies)
+{
+	if (Latencies.empty())
+	{
+		printf("%-9s no calls", pName);
+		return;
+	}
+
+	std::sort(Latencies.begin(), Latencies.end());
+
+	printf("%-9s %10zu calls  p50 %8.1f us  p99 %8.1f us  max %8.1f us",
+		pName, Latencies.size(), Percentile(Latencies, 0.5), Percentile(Latencies, 0.99), Latencies.back());
+}
+
+static void Run(CQosBench &Bench, const char *pName, bool Dump, double Seconds)
+{
+	Bench.Stop = false;
+	Bench.DumpedBytes = 0;
+	Bench.Latencies.clear();
+
+	CDriverTrace::Clear();
+
+	auto Start = std::chrono::steady_clock::now();
+	auto Deadline = Start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(Seconds));
+
+	std::thread Interactive(RunInteractive, std::ref(Bench));
+	std::thread Dumper;
+
+	if (Dump)
+		Dumper = std::thread(RunDump, std::ref(Bench));
+
+	std::this_thread::sleep_until(Deadline);
+
+	Bench.Stop = true;
+	Interactive.join();
+
+	if (Dumper.joinable())
+		Dumper.join();
+
+	std::chrono::duration<double> Elapsed = std::chrono::steady_clock::now() - Start;
+
+	PrintSummary(pName, Bench.Latencies);
+
+	if (Dump)
+		printf("  dump %8.1f MB/s", (double)Bench.DumpedBytes / Elapsed.count() / (1024 * 1024));
+
+	printf("\n");
+
+	if (Bench.Trace)
+	{
+		// Rings keep only latest records of each thread, so this may miss older calls
+		fflush(stdout);
+		CDriverTrace::WriteSummary(std::cout, CDriverTrace::Summarize(CDriverTrace::Collect()));
+		std::cout.flush();
+	}
+}
+
+int main(int argc, char **argv)
+{
+	double Seconds = 5.0;
+	bool Trace = false;
+
+	for (int Arg = 1; Arg < argc; Arg++)
+	{
+		if (strcmp(argv[Arg], "--seconds") == 0 && Arg + 1 < argc)
+			Seconds = strtod(argv[++Arg], NULL);
+		else if (strcmp(argv[Arg], "--trace") == 0)
+			Trace = true;
+		else
+		{
+			fprintf(stderr, "usage: %s [--seconds S] [--trace]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	if (Seconds <= 0.0)
+	{
+		fprintf(stderr, "seconds must be positive\n");
+		return 2;
+	}
+
+	try
+	{
+		CDriverHelper Helper;
+
+		if (!Helper.HasFeature(DRIVER_FEATURE_QOS))
+			fprintf(stderr, "driver has no QoS, bulk reads are served as ordinary ones\n");
+	}
+	catch (const std::exception &e)
+	{
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+
+	CQosBench Bench;
+	Bench.Pid = reinterpret_cast<void *>((uintptr_t)GetCurrentProcessId());
+	Bench.Trace = Trace;
+	Bench.Failed = false;
+	Bench.Source.resize(DumpSize);
+
+	for (size_t i = 0; i < Bench.Source.size(); i++)
+		Bench.Source[i] = Pattern(i);
+
+	CDriverTrace::SetEnabled(Trace);
+
+	Run(Bench, "dump off", false, Seconds);
+	Run(Bench, "dump on", true, Seconds);
+
+	if (Bench.Failed)
+		fprintf(stderr, "read data differs from source\n");
+
+	return Bench.Failed ? 1 : 0;
+}
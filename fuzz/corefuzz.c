@@ -0,0 +1,130 @@
+/**
+ * libFuzzer entry over DriverHostIoControl: every input is one request sent to a fresh host.
+ *
+ * Input layout: control code selector (1 byte), output length (2 bytes, little endian), input buffer (rest).
+ * Selector below the count of known codes picks one of them, others take raw code from the first 4 bytes of input buffer.
+ * Host has one process, so pid and addresses below are worth putting into a dictionary.
+ */
+
+#include "driverhost.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FUZZ_PID ((void *)(UINT_PTR)1)
+#define FUZZ_BASE ((UINT_PTR)0x10000)
+#define FUZZ_SIZE ((SIZE_T)0x4000)
+
+static const ULONG FuzzCodes[] =
+{
+	CTL_RequestVersion,
+	CTL_RequestReadProcessMemory,
+	CTL_RequestWriteProcessMemory,
+	CTL_RequestModuleBase,
+	CTL_RequestSubscribeEvents,
+	CTL_RequestWaitEvents,
+	CTL_RequestAtomic,
+	CTL_RequestCapabilities,
+	CTL_RequestReadProcessMemoryDirect,
+	CTL_RequestQueryRegions,
+	CTL_RequestSetPriority,
+	CTL_RequestReadProcessMemoryBulk,
+	CTL_RequestReadProcessMemoryResident,
+	CTL_RequestQueryResidency,
+	CTL_RequestMirror,
+	CTL_RequestReadProcessMemoryParallel,
+};
+
+static const WCHAR FuzzModuleName[] = { 'a', '.', 'e', 'x', 'e' };
+
+static struct CDriverHost *
+FuzzCreateHost(
+	VOID
+)
+{
+	struct CDriverHost *host = DriverHostCreate();
+	PUCHAR data;
+
+	if (host == NULL)
+		abort();
+
+	// Writable region followed by read only one, with a hole after both
+	data = DriverHostAddRegion(host, FUZZ_PID, (void *)FUZZ_BASE, FUZZ_SIZE, 0x04);
+
+	if (data == NULL || DriverHostAddRegion(host, FUZZ_PID, (void *)(FUZZ_BASE + FUZZ_SIZE), FUZZ_SIZE, 0x02) == NULL)
+		abort();
+
+	memset(data, 0xA5, FUZZ_SIZE);
+
+	DriverHostSetResident(host, FUZZ_PID, (void *)(FUZZ_BASE + DRIVER_PAGE_SIZE), DRIVER_PAGE_SIZE, FALSE);
+	DriverHostAddModule(host, FUZZ_PID, FuzzModuleName, sizeof(FuzzModuleName) / sizeof(FuzzModuleName[0]), (void *)FUZZ_BASE);
+
+	return host;
+}
+
+int
+LLVMFuzzerTestOneInput(
+	const uint8_t *Data,
+	size_t Size
+)
+{
+	struct CDriverHost *host;
+	ULONG code;
+	ULONG outputLength;
+	ULONG inputLength;
+	void *input = NULL;
+	void *output = NULL;
+	ULONG wroteBytes;
+	NTSTATUS status;
+
+	if (Size < 3)
+		return 0;
+
+	outputLength = Data[1] | (ULONG)Data[2] << 8;
+	Data += 3;
+	Size -= 3;
+
+	if (Data[-3] < sizeof(FuzzCodes) / sizeof(FuzzCodes[0]))
+	{
+		code = FuzzCodes[Data[-3]];
+	}
+	else
+	{
+		if (Size < sizeof(code))
+			return 0;
+
+		memcpy(&code, Data, sizeof(code));
+		Data += sizeof(code);
+		Size -= sizeof(code);
+	}
+
+	inputLength = (ULONG)Size;
+
+	// Exact sizes, so sanitizers catch any access past caller's buffers
+	if (inputLength != 0)
+	{
+		input = malloc(inputLength);
+		memcpy(input, Data, inputLength);
+	}
+
+	if (outputLength != 0)
+		output = malloc(outputLength);
+
+	host = FuzzCreateHost();
+
+	status = DriverHostIoControl(host, code, input, inputLength, output, outputLength, &wroteBytes);
+
+	if (!NT_SUCCESS(status) && wroteBytes != 0)
+		abort();
+
+	if (wroteBytes > outputLength)
+		abort();
+
+	DriverHostDestroy(host);
+
+	free(output);
+	free(input);
+
+	return 0;
+}
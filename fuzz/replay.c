@@ -0,0 +1,129 @@
+/**
+ * Runs LLVMFuzzerTestOneInput without libFuzzer.
+ * Usage: corefuzz_replay FILE... replays corpus files, corefuzz_replay --runs N sends N generated inputs.
+ * Generated inputs are built from words of the host layout, so most of them get past size checks.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int
+LLVMFuzzerTestOneInput(
+	const uint8_t *Data,
+	size_t Size
+);
+
+#define REPLAY_MAX_INPUT 512
+
+static const uint64_t ReplayWords[] =
+{
+	0, 1, 2, 4, 5, 8, 16, 24, 40, 0x1000, 0xFFF, 0x1001, 0x4000, 0x8000,
+	0x10000, 0x10008, 0x10FFC, 0x11000, 0x13FF8, 0x14000, 0x17FFF, 0x18000,
+	0xFFFFFFFF, 0xFFFFFFFFFFFFFFFFull, 0x8000000000000000ull,
+};
+
+static uint64_t ReplayState = 0x2545F4914F6CDD1Dull;
+
+static uint64_t
+ReplayRandom(
+	void
+)
+{
+	ReplayState ^= ReplayState << 13;
+	ReplayState ^= ReplayState >> 7;
+	ReplayState ^= ReplayState << 17;
+
+	return ReplayState;
+}
+
+static int
+ReplayFile(
+	const char *Path
+)
+{
+	FILE *file = fopen(Path, "rb");
+	uint8_t *data;
+	long size;
+
+	if (file == NULL)
+	{
+		fprintf(stderr, "can't open %s\n", Path);
+		return 1;
+	}
+
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	data = malloc(size != 0 ? (size_t)size : 1);
+
+	if (data == NULL || fread(data, 1, (size_t)size, file) != (size_t)size)
+	{
+		fclose(file);
+		free(data);
+		return 1;
+	}
+
+	fclose(file);
+
+	LLVMFuzzerTestOneInput(data, (size_t)size);
+	free(data);
+
+	return 0;
+}
+
+static void
+ReplayGenerated(
+	unsigned long Runs
+)
+{
+	uint8_t data[REPLAY_MAX_INPUT];
+	uint64_t word;
+	size_t size;
+	size_t offset;
+	unsigned long run;
+
+	for (run = 0; run < Runs; run++)
+	{
+		size = 3 + (size_t)(ReplayRandom() % (REPLAY_MAX_INPUT - 3));
+
+		// Known codes mostly, raw ones sometimes
+		data[0] = (uint8_t)(ReplayRandom() % 20);
+
+		// Output length is a layout word too, or small random value
+		word = ReplayRandom() % 2 ? ReplayWords[ReplayRandom() % (sizeof(ReplayWords) / sizeof(ReplayWords[0]))] : ReplayRandom() % 0x200;
+		data[1] = (uint8_t)word;
+		data[2] = (uint8_t)(word >> 8);
+
+		for (offset = 3; offset < size; offset += sizeof(word))
+		{
+			word = ReplayRandom() % 4 != 0 ? ReplayWords[ReplayRandom() % (sizeof(ReplayWords) / sizeof(ReplayWords[0]))] : ReplayRandom();
+			memcpy(data + offset, &word, size - offset < sizeof(word) ? size - offset : sizeof(word));
+		}
+
+		LLVMFuzzerTestOneInput(data, size);
+	}
+}
+
+int
+main(
+	int argc,
+	char **argv
+)
+{
+	int failed = 0;
+	int arg;
+
+	if (argc == 3 && strcmp(argv[1], "--runs") == 0)
+	{
+		ReplayGenerated(strtoul(argv[2], NULL, 10));
+		return 0;
+	}
+
+	for (arg = 1; arg < argc; arg++)
+		failed |= ReplayFile(argv[arg]);
+
+	return failed;
+}
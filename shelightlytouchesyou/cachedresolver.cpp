@@ -0,0 +1,62 @@
+#include "offsetcache.hpp"
+
+#include <string>
+
+CCachedResolver::CCachedResolver(const CRemotePEParser &Parser, COffsetCache &Cache) :
+	m_Parser(Parser),
+	m_Cache(Cache)
+{
+}
+
+void *CCachedResolver::GetExport(void *ModuleBase, const char *pExportName) const
+{
+	CModuleIdentity Identity = m_Parser.ReadIdentity(ModuleBase);
+	std::string Key = std::string("export:") + pExportName;
+
+	uint32_t Rva;
+
+	if (m_Cache.Find(Identity, Key.c_str(), Rva))
+		return static_cast<char *>(ModuleBase) + Rva;
+
+	void *Result = m_Parser.GetExport(ModuleBase, pExportName);
+
+	// Forwarded exports land in other modules and can't be stored relative to this one
+	size_t Offset = static_cast<char *>(Result) - static_cast<char *>(ModuleBase);
+
+	if (Result >= ModuleBase && Offset < Identity.SizeOfImage)
+		m_Cache.Store(Identity, Key.c_str(), static_cast<uint32_t>(Offset));
+
+	return Result;
+}
+
+void *CCachedResolver::GetExport(const char *pModuleName, const char *pExportName) const
+{
+	return GetExport(m_Parser.GetModuleBase(pModuleName), pExportName);
+}
+
+std::vector<void *> CCachedResolver::Scan(void *ModuleBase, const char *pPatternKey, const ScanFunction &Scanner) const
+{
+	CModuleIdentity Identity = m_Parser.ReadIdentity(ModuleBase);
+	std::string Key = std::string("scan:") + pPatternKey;
+
+	std::vector<uint32_t> Hits;
+
+	if (!m_Cache.FindHits(Identity, Key.c_str(), Hits))
+	{
+		Hits = Scanner(m_Parser.GetModule(ModuleBase));
+		m_Cache.StoreHits(Identity, Key.c_str(), Hits);
+	}
+
+	std::vector<void *> Result;
+	Result.reserve(Hits.size());
+
+	for (uint32_t Rva : Hits)
+		Result.push_back(static_cast<char *>(ModuleBase) + Rva);
+
+	return Result;
+}
+
+std::vector<void *> CCachedResolver::Scan(const char *pModuleName, const char *pPatternKey, const ScanFunction &Scanner) const
+{
+	return Scan(m_Parser.GetModuleBase(pModuleName), pPatternKey, Scanner);
+}
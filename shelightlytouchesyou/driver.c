@@ -1,6 +1,11 @@
 #include "driver.h"
 
-#include "pebhelper.h"
+#include "drivercore.h"
+#include "driverevents.h"
+#include "drivermemory.h"
+#include "drivermirror.h"
+#include "driverparallel.h"
+#include "driverqos.h"
 
 #include <ntifs.h>
 #include <ntddk.h>
@@ -9,16 +14,28 @@
 DRIVER_INITIALIZE DriverEntry;
 EVT_WDF_DRIVER_UNLOAD DriverUnload;
 EVT_WDF_IO_QUEUE_IO_DEFAULT EvtDeviceIoDefault;
+EVT_WDF_DEVICE_FILE_CREATE EvtDeviceFileCreate;
+EVT_WDF_FILE_CLEANUP EvtFileCleanup;
 
-typedef NTSTATUS(*QUERY_INFO_PROCESS) (
-	__in HANDLE ProcessHandle,
-	__in PROCESSINFOCLASS ProcessInformationClass,
-	__out_bcount(ProcessInformationLength) PVOID ProcessInformation,
-	__in ULONG ProcessInformationLength,
-	__out_opt PULONG ReturnLength
-);
+#define DRIVER_FEATURES (DRIVER_FEATURE_EVENTS | DRIVER_FEATURE_ATOMIC | DRIVER_FEATURE_DIRECT_READ | DRIVER_FEATURE_QUERY_REGIONS | DRIVER_FEATURE_QOS | DRIVER_FEATURE_RESIDENCY | DRIVER_FEATURE_MIRROR | DRIVER_FEATURE_PARALLEL_READ)
+#define DRIVER_BUFFER_METHODS (DRIVER_BUFFER_METHOD_BUFFERED | DRIVER_BUFFER_METHOD_OUT_DIRECT)
 
-QUERY_INFO_PROCESS ZwQueryInformationProcess;
+static const struct CDriverPlatform KernelPlatform =
+{
+	NULL,
+	DRIVER_BUFFER_METHODS,
+	DRIVER_FEATURES,
+	KernelLookupProcess,
+	KernelReleaseProcess,
+	KernelAttach,
+	KernelDetach,
+	KernelCopyFrom,
+	KernelCopyTo,
+	KernelAtomic,
+	KernelCopyResident,
+	KernelModuleBase,
+	KernelQueryRegions,
+};
 
 NTSTATUS
 CreateCDODevice(
@@ -30,6 +47,8 @@ CreateCDODevice(
 	WDFDEVICE device;
 	WDFQUEUE queue;
 	WDF_OBJECT_ATTRIBUTES attributes;
+	WDF_OBJECT_ATTRIBUTES fileAttributes;
+	WDF_FILEOBJECT_CONFIG fileConfig;
 	WDF_IO_QUEUE_CONFIG ioQConfig;
 
 	PAGED_CODE();
@@ -44,6 +63,10 @@ CreateCDODevice(
 	DECLARE_CONST_UNICODE_STRING(MyDeviceName, L"\\Device\\" DRIVER_DEVICE_NAME);
 	WdfDeviceInitAssignName(init, &MyDeviceName);
 
+	WDF_FILEOBJECT_CONFIG_INIT(&fileConfig, EvtDeviceFileCreate, WDF_NO_EVENT_CALLBACK, EvtFileCleanup);
+	WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&fileAttributes, FILE_CONTEXT);
+	WdfDeviceInitSetFileObjectConfig(init, &fileConfig, &fileAttributes);
+
 	WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
 	// TODO: Set type
 	// WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, DEVICE_CONTEXT);
@@ -59,10 +82,21 @@ CreateCDODevice(
 	if (!NT_SUCCESS(status))
 		goto M_ERR;
 
-	WDF_IO_QUEUE_CONFIG_INIT_DEFAULT_QUEUE(&ioQConfig, WdfIoQueueDispatchSequential);
+	// Bulk transfers are moved to QoS worker, the rest runs in caller's thread
+	WDF_IO_QUEUE_CONFIG_INIT_DEFAULT_QUEUE(&ioQConfig, WdfIoQueueDispatchParallel);
 	ioQConfig.EvtIoDefault = EvtDeviceIoDefault;
 	status = WdfIoQueueCreate(device, &ioQConfig, WDF_NO_OBJECT_ATTRIBUTES, &queue);
 
+	if (!NT_SUCCESS(status))
+		goto M_ERR;
+
+	status = DriverEventsCreateQueue(device);
+
+	if (!NT_SUCCESS(status))
+		goto M_ERR;
+
+	status = DriverQosCreateQueue(device);
+
 	if (!NT_SUCCESS(status))
 		goto M_ERR;
 
@@ -101,240 +135,103 @@ DriverEntry(
 	if (!NT_SUCCESS(status))
 		goto M_END;
 
-	DECLARE_CONST_UNICODE_STRING(RoutineName, L"ZwQueryInformationProcess");
-	ZwQueryInformationProcess = (QUERY_INFO_PROCESS)MmGetSystemRoutineAddress((PUNICODE_STRING)&RoutineName);
+	status = DriverMemoryInit();
 
-	if (ZwQueryInformationProcess == NULL)
-	{
-		status = STATUS_UNSUCCESSFUL;
+	if (!NT_SUCCESS(status))
 		goto M_END;
-	}
 
 	status = CreateCDODevice(driver);
 
-M_END:
-	return status;
-}
-
-VOID
-DriverUnload(
-	_In_ WDFDRIVER Driver
-)
-{
-	PAGED_CODE();
-
-	UNREFERENCED_PARAMETER(Driver);
-}
-
-NTSTATUS
-ProcessRequestVersion(
-	_Inout_ struct CResponseVersion *VResponse,
-	_Out_ PULONG WroteBytes
-)
-{
-	const struct CResponseVersion version = { DRIVER_VERSION };
-
-	PAGED_CODE();
-
-	RtlCopyMemory(VResponse, &version, sizeof(struct CResponseVersion));
-
-	*WroteBytes = sizeof(struct CResponseVersion);
-
-	return STATUS_SUCCESS;
-}
-
-NTSTATUS
-ProcessRequestReadProcessMemory(
-	_Inout_ struct CRequestReadProcessMemory *RPMRequest,
-	_Out_ PULONG WroteBytes
-)
-{
-	NTSTATUS status;
-	PEPROCESS process;
-	KAPC_STATE apcState;
-	ULONG writeBytesPending = (ULONG)RPMRequest->size;
-
-	PAGED_CODE();
+	if (!NT_SUCCESS(status))
+		goto M_END;
 
-	status = PsLookupProcessByProcessId(RPMRequest->pid, &process);
+	status = DriverEventsRegister();
 
 	if (!NT_SUCCESS(status))
-		goto M_ERR;
+		goto M_END;
 
-	KeStackAttachProcess(process, &apcState);
+	status = DriverQosStart();
 
-	__try
-	{
-		ProbeForRead(RPMRequest->ptr, RPMRequest->size, 1);
-		RtlCopyMemory(RPMRequest, RPMRequest->ptr, RPMRequest->size);
-	}
-	__except (EXCEPTION_EXECUTE_HANDLER)
+	if (!NT_SUCCESS(status))
 	{
-		status = STATUS_UNSUCCESSFUL;
+		DriverEventsUnregister();
+		goto M_END;
 	}
 
-	KeUnstackDetachProcess(&apcState);
-
-	ObDereferenceObject(process);
-
-M_ERR:
-	*WroteBytes = NT_SUCCESS(status) ? writeBytesPending : 0;
-
-	return status;
-}
-
-NTSTATUS
-ProcessRequestWriteProcessMemory(
-	_Inout_ struct CRequestWriteProcessMemory *WPMRequest
-)
-{
-	NTSTATUS status;
-	PEPROCESS process;
-	KAPC_STATE apcState;
-
-	PAGED_CODE();
-
-	status = PsLookupProcessByProcessId(WPMRequest->pid, &process);
+	status = DriverMirrorStart();
 
 	if (!NT_SUCCESS(status))
-		goto M_ERR;
-
-	KeStackAttachProcess(process, &apcState);
-
-	__try
 	{
-		ProbeForWrite(WPMRequest->ptr, WPMRequest->size, 1);
-		RtlCopyMemory(WPMRequest->ptr, WPMRequest + 1, WPMRequest->size);
+		DriverQosStop();
+		DriverEventsUnregister();
 	}
-	__except (EXCEPTION_EXECUTE_HANDLER)
-	{
-		status = STATUS_UNSUCCESSFUL;
-	}
-
-	KeUnstackDetachProcess(&apcState);
 
-	ObDereferenceObject(process);
-
-M_ERR:
+M_END:
 	return status;
 }
 
-NTSTATUS
-GetModuleHandleFromProcessPEB(
-	_In_ PPEB Peb,
-	_In_ PWCHAR ModuleName,
-	_In_ SIZE_T ModuleNameSize,
-	_Out_ void **Result
+VOID
+DriverUnload(
+	_In_ WDFDRIVER Driver
 )
 {
-	NTSTATUS status = STATUS_UNSUCCESSFUL;
-	PLIST_ENTRY inMemoryOrderModuleList;
-	PLIST_ENTRY tempListItem;
-	UNICODE_STRING searchModuleName;
-	PUNICODE_STRING processModuleName;
-
 	PAGED_CODE();
 
-	searchModuleName.Length = (USHORT)ModuleNameSize * 2;
-	searchModuleName.MaximumLength = (USHORT)ModuleNameSize * 2;
-	searchModuleName.Buffer = ModuleName;
-
-	__try
-	{
-		inMemoryOrderModuleList = PEB_GetInMemoryOrderModuleList(Peb);
-		tempListItem = inMemoryOrderModuleList;
-
-		for (tempListItem = tempListItem->Flink; tempListItem != inMemoryOrderModuleList; tempListItem = tempListItem->Flink)
-		{
-			processModuleName = LDR_DATA_GetFullDllName((PLDR_DATA_TABLE_ENTRY)tempListItem);
-
-			if (RtlEqualUnicodeString(&searchModuleName, processModuleName, TRUE) == TRUE)
-			{
-				*Result = LDR_DATA_GetModuleBase((PLDR_DATA_TABLE_ENTRY)tempListItem);
-
-				status = STATUS_SUCCESS;
-				break;
-			}
-		}
-	}
-	__except (EXCEPTION_EXECUTE_HANDLER)
-	{
-		status = STATUS_UNSUCCESSFUL;
-	}
+	UNREFERENCED_PARAMETER(Driver);
 
-	return status;
+	DriverMirrorStop();
+	DriverQosStop();
+	DriverEventsUnregister();
 }
 
-NTSTATUS
-GetProcessPEB(
-	_In_ HANDLE hProcess,
-	_Out_ PPEB *peb
+VOID
+EvtDeviceFileCreate(
+	_In_ WDFDEVICE     Device,
+	_In_ WDFREQUEST    Request,
+	_In_ WDFFILEOBJECT FileObject
 )
 {
 	NTSTATUS status;
-	PROCESS_BASIC_INFORMATION BasicInfo;
-	ULONG returenLength = 0;
 
 	PAGED_CODE();
 
-	status = ZwQueryInformationProcess(hProcess,
-		ProcessBasicInformation,
-		&BasicInfo,
-		sizeof(BasicInfo),
-		&returenLength);
-
-	if (!NT_SUCCESS(status))
-		goto M_ERR;
+	UNREFERENCED_PARAMETER(Device);
 
-	*peb = BasicInfo.PebBaseAddress;
+	DriverEventsFileCreate(FileObject);
+	status = DriverQosFileCreate(FileObject);
 
-M_ERR:
-	return status;
+	WdfRequestComplete(Request, status);
 }
 
-NTSTATUS
-ProcessRequestModuleBase(
-	_Inout_ struct CRequestModuleBase *MBRequest,
-	_Out_ PULONG WroteBytes
+VOID
+EvtFileCleanup(
+	_In_ WDFFILEOBJECT FileObject
 )
 {
-	NTSTATUS status;
-	PEPROCESS process;
-	HANDLE hProcess;
-	PPEB peb;
-	void *result;
-
 	PAGED_CODE();
 
-	status = PsLookupProcessByProcessId(MBRequest->pid, &process);
-
-	if (!NT_SUCCESS(status))
-		goto M_ERR;
-
-	status = ObOpenObjectByPointer(process, 0, NULL, 0, 0, KernelMode, &hProcess);
-
-	if (!NT_SUCCESS(status))
-		goto M_ERR2;
-
-	status = GetProcessPEB(hProcess, &peb);
-
-	if (!NT_SUCCESS(status))
-		goto M_ERR2;
-
-	status = GetModuleHandleFromProcessPEB(peb, (PWCHAR)(MBRequest + 1), MBRequest->size, &result);
-
-	if (!NT_SUCCESS(status))
-		goto M_ERR2;
-
-	RtlCopyMemory(MBRequest, &result, sizeof(result));
-
-M_ERR2:
-	ObDereferenceObject(process);
+	DriverEventsFileCleanup(FileObject);
+	DriverMirrorFileCleanup(FileObject);
+}
 
-M_ERR:
-	*WroteBytes = NT_SUCCESS(status) ? sizeof(result) : 0;
+// Bulk worker yields to these
+static BOOLEAN
+IsInteractiveRequest(
+	_In_ ULONG IoControlCode
+)
+{
+	switch (IoControlCode)
+	{
+		case CTL_RequestReadProcessMemory:
+		case CTL_RequestReadProcessMemoryDirect:
+		case CTL_RequestReadProcessMemoryResident:
+		case CTL_RequestWriteProcessMemory:
+		case CTL_RequestAtomic:
+			return TRUE;
 
-	return status;
+		default:
+			return FALSE;
+	}
 }
 
 VOID
@@ -346,13 +243,12 @@ EvtDeviceIoDefault(
 	NTSTATUS status;
 	WDF_REQUEST_PARAMETERS params;
 	PIRP irp;
-	void *buffer;
-	ULONG ioControlCode;
+	struct CDriverCoreRequest coreRequest;
+	BOOLEAN interactive;
+	ULONG wroteBytes;
 
 	PAGED_CODE();
 
-	UNREFERENCED_PARAMETER(Queue);
-
 	WDF_REQUEST_PARAMETERS_INIT(&params);
 
 	WdfRequestGetParameters(
@@ -366,121 +262,103 @@ EvtDeviceIoDefault(
 		goto M_END;
 	}
 
-	ioControlCode = params.Parameters.DeviceIoControl.IoControlCode;
+	irp = WdfRequestWdmGetIrp(Request);
 
-	if (METHOD_FROM_CTL_CODE(ioControlCode) != METHOD_BUFFERED)
+	coreRequest.IoControlCode = params.Parameters.DeviceIoControl.IoControlCode;
+	coreRequest.Buffer = irp->AssociatedIrp.SystemBuffer;
+	coreRequest.InputLength = params.Parameters.DeviceIoControl.InputBufferLength;
+	coreRequest.OutputLength = params.Parameters.DeviceIoControl.OutputBufferLength;
+	coreRequest.Output = NULL;
+
+	// Empty output buffer has no MDL
+	if (METHOD_FROM_CTL_CODE(coreRequest.IoControlCode) == METHOD_OUT_DIRECT && irp->MdlAddress != NULL)
 	{
-		status = STATUS_INVALID_PARAMETER_2;
-		goto M_END;
+		coreRequest.Output = MmGetSystemAddressForMdlSafe(irp->MdlAddress, NormalPagePriority | MdlMappingNoExecute);
+
+		if (coreRequest.Output == NULL)
+		{
+			status = STATUS_INSUFFICIENT_RESOURCES;
+			goto M_END;
+		}
 	}
 
-	irp = WdfRequestWdmGetIrp(Request);
+	status = DriverCoreValidate(&coreRequest);
 
-	buffer = irp->AssociatedIrp.SystemBuffer;
+	if (!NT_SUCCESS(status))
+		goto M_END;
 
-	switch (ioControlCode)
+	// Requests which need WDF objects are served here, the rest goes to the core
+	switch (coreRequest.IoControlCode)
 	{
-		case CTL_RequestVersion:
-			{
-				ULONG wroteBytes;
+		case CTL_RequestReadProcessMemory:
+		case CTL_RequestReadProcessMemoryDirect:
+		case CTL_RequestWriteProcessMemory:
+			if (!DriverQosIsBulk(WdfRequestGetFileObject(Request)))
+				break;
 
-				if (params.Parameters.DeviceIoControl.OutputBufferLength != sizeof(struct CResponseVersion))
-				{
-					status = STATUS_INVALID_BUFFER_SIZE;
-					goto M_END;
-				}
+			// Fall through
 
-				status = ProcessRequestVersion(buffer, &wroteBytes);
+		case CTL_RequestReadProcessMemoryBulk:
+			status = DriverQosForwardBulk(Request);
 
-				irp->IoStatus.Information = wroteBytes;
+			// Forwarded request is owned by bulk queue now
+			if (status == STATUS_PENDING)
+				return;
 
-				goto M_END;
-			}
+			goto M_END;
 
-		case CTL_RequestReadProcessMemory:
-			{
-				ULONG wroteBytes;
+		case CTL_RequestReadProcessMemoryParallel:
+			status = ProcessRequestReadProcessMemoryParallel(Request, WdfIoQueueGetDevice(Queue), coreRequest.Buffer, coreRequest.Output);
 
-				if (params.Parameters.DeviceIoControl.InputBufferLength != sizeof(struct CRequestReadProcessMemory))
-				{
-					status = STATUS_INVALID_BUFFER_SIZE;
-					goto M_END;
-				}
+			// Pending request is completed by its last worker or by cancel routine
+			if (status == STATUS_PENDING)
+				return;
 
-				if (params.Parameters.DeviceIoControl.OutputBufferLength != ((struct CRequestReadProcessMemory *)buffer)->size)
-				{
-					status = STATUS_INVALID_BUFFER_SIZE;
-					goto M_END;
-				}
+			goto M_END;
 
-				status = ProcessRequestReadProcessMemory(buffer, &wroteBytes);
+		case CTL_RequestSetPriority:
+			status = ProcessRequestSetPriority(WdfRequestGetFileObject(Request), coreRequest.Buffer);
+			goto M_END;
 
-				irp->IoStatus.Information = wroteBytes;
+		case CTL_RequestMirror:
+			status = ProcessRequestMirror(Request, WdfRequestGetFileObject(Request), coreRequest.Buffer, coreRequest.Output, coreRequest.OutputLength);
 
-				goto M_END;
-			}
+			// Pending request is owned by mirror worker now
+			if (status == STATUS_PENDING)
+				return;
 
-		case CTL_RequestWriteProcessMemory:
-			{
-				if (params.Parameters.DeviceIoControl.InputBufferLength < sizeof(struct CRequestWriteProcessMemory))
-				{
-					status = STATUS_INVALID_BUFFER_SIZE;
-					goto M_END;
-				}
-
-				if (params.Parameters.DeviceIoControl.InputBufferLength != sizeof(struct CRequestWriteProcessMemory) + ((struct CRequestWriteProcessMemory *)buffer)->size)
-				{
-					status = STATUS_INVALID_BUFFER_SIZE;
-					goto M_END;
-				}
-
-				if (params.Parameters.DeviceIoControl.OutputBufferLength != 0)
-				{
-					status = STATUS_INVALID_BUFFER_SIZE;
-					goto M_END;
-				}
-
-				status = ProcessRequestWriteProcessMemory(buffer);
-
-				goto M_END;
-			}
-
-		case CTL_RequestModuleBase:
-			{
-				ULONG wroteBytes;
-
-				if (params.Parameters.DeviceIoControl.InputBufferLength < sizeof(struct CRequestModuleBase))
-				{
-					status = STATUS_INVALID_BUFFER_SIZE;
-					goto M_END;
-				}
-
-				if (params.Parameters.DeviceIoControl.InputBufferLength != sizeof(struct CRequestModuleBase) + (((struct CRequestModuleBase *)buffer)->size + 1) * sizeof(WCHAR))
-				{
-					status = STATUS_INVALID_BUFFER_SIZE;
-					goto M_END;
-				}
-
-				if (params.Parameters.DeviceIoControl.OutputBufferLength != sizeof(PVOID))
-				{
-					status = STATUS_INVALID_BUFFER_SIZE;
-					goto M_END;
-				}
-
-				status = ProcessRequestModuleBase(buffer, &wroteBytes);
-
-				irp->IoStatus.Information = wroteBytes;
-
-				goto M_END;
-			}
+			goto M_END;
 
-		default:
-			status = STATUS_NOT_IMPLEMENTED;
+		case CTL_RequestSubscribeEvents:
+			status = ProcessRequestSubscribeEvents(WdfRequestGetFileObject(Request));
+			goto M_END;
+
+		case CTL_RequestWaitEvents:
+			status = ProcessRequestWaitEvents(Request, WdfRequestGetFileObject(Request), &wroteBytes);
+
+			// Pending request is owned by events queue now
+			if (status == STATUS_PENDING)
+				return;
+
+			irp->IoStatus.Information = wroteBytes;
 			goto M_END;
+
+		default:
+			break;
 	}
 
+	interactive = IsInteractiveRequest(coreRequest.IoControlCode);
+
+	if (interactive)
+		DriverQosInteractiveBegin();
+
+	status = DriverCoreDispatch(&KernelPlatform, &coreRequest, &wroteBytes);
+
+	if (interactive)
+		DriverQosInteractiveEnd();
+
+	irp->IoStatus.Information = wroteBytes;
+
 M_END:
 	WdfRequestComplete(Request, status);
 }
-
-
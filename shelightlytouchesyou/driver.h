@@ -2,16 +2,108 @@
 #define _DRIVER_H_
 
 #include <stddef.h>
+
+#ifdef _WIN32
 #include <intsafe.h>
+#else
+// Hosts of drivercore.c outside Windows
+#include <stdint.h>
+
+typedef uint8_t UINT8;
+typedef uint16_t UINT16;
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+typedef int32_t INT32;
+typedef int64_t INT64;
+typedef size_t SIZE_T;
+typedef uintptr_t UINT_PTR;
+typedef uint16_t WCHAR;
+
+#define FILE_DEVICE_UNKNOWN 0x00000022
+#define FILE_SPECIAL_ACCESS 0
+#define METHOD_BUFFERED     0
+#define METHOD_OUT_DIRECT   2
+
+#define CTL_CODE(DeviceType, Function, Method, Access) (((DeviceType) << 16) | ((Access) << 14) | ((Function) << 2) | (Method))
+#define METHOD_FROM_CTL_CODE(ctrlCode) ((UINT32)((ctrlCode) & 3))
+#endif
 
 #define DRIVER_DEVICE_NAME L"shelightlytouchesyou"
 
+// Base protocol version. Newer request types are advertised by DRIVER_FEATURE_* bits.
 #define DRIVER_VERSION ((UINT32)1)
 
 #define CTL_RequestVersion            CTL_CODE(FILE_DEVICE_UNKNOWN, 0x0800, METHOD_BUFFERED, FILE_SPECIAL_ACCESS)
 #define CTL_RequestReadProcessMemory  CTL_CODE(FILE_DEVICE_UNKNOWN, 0x0801, METHOD_BUFFERED, FILE_SPECIAL_ACCESS)
 #define CTL_RequestWriteProcessMemory CTL_CODE(FILE_DEVICE_UNKNOWN, 0x0802, METHOD_BUFFERED, FILE_SPECIAL_ACCESS)
 #define CTL_RequestModuleBase         CTL_CODE(FILE_DEVICE_UNKNOWN, 0x0803, METHOD_BUFFERED, FILE_SPECIAL_ACCESS)
+#define CTL_RequestSubscribeEvents    CTL_CODE(FILE_DEVICE_UNKNOWN, 0x0804, METHOD_BUFFERED, FILE_SPECIAL_ACCESS)
+#define CTL_RequestWaitEvents         CTL_CODE(FILE_DEVICE_UNKNOWN, 0x0805, METHOD_BUFFERED, FILE_SPECIAL_ACCESS)
+#define CTL_RequestAtomic             CTL_CODE(FILE_DEVICE_UNKNOWN, 0x0806, METHOD_BUFFERED, FILE_SPECIAL_ACCESS)
+#define CTL_RequestCapabilities       CTL_CODE(FILE_DEVICE_UNKNOWN, 0x0807, METHOD_BUFFERED, FILE_SPECIAL_ACCESS)
+#define CTL_RequestReadProcessMemoryDirect CTL_CODE(FILE_DEVICE_UNKNOWN, 0x0808, METHOD_OUT_DIRECT, FILE_SPECIAL_ACCESS)
+#define CTL_RequestQueryRegions       CTL_CODE(FILE_DEVICE_UNKNOWN, 0x0809, METHOD_BUFFERED, FILE_SPECIAL_ACCESS)
+#define CTL_RequestSetPriority        CTL_CODE(FILE_DEVICE_UNKNOWN, 0x080A, METHOD_BUFFERED, FILE_SPECIAL_ACCESS)
+#define CTL_RequestReadProcessMemoryBulk CTL_CODE(FILE_DEVICE_UNKNOWN, 0x080B, METHOD_OUT_DIRECT, FILE_SPECIAL_ACCESS)
+#define CTL_RequestReadProcessMemoryResident CTL_CODE(FILE_DEVICE_UNKNOWN, 0x080C, METHOD_OUT_DIRECT, FILE_SPECIAL_ACCESS)
+#define CTL_RequestQueryResidency     CTL_CODE(FILE_DEVICE_UNKNOWN, 0x080D, METHOD_BUFFERED, FILE_SPECIAL_ACCESS)
+#define CTL_RequestMirror             CTL_CODE(FILE_DEVICE_UNKNOWN, 0x080E, METHOD_OUT_DIRECT, FILE_SPECIAL_ACCESS)
+#define CTL_RequestReadProcessMemoryParallel CTL_CODE(FILE_DEVICE_UNKNOWN, 0x080F, METHOD_OUT_DIRECT, FILE_SPECIAL_ACCESS)
+
+#define DRIVER_FEATURE_EVENTS      ((UINT64)1 << 0)
+#define DRIVER_FEATURE_ATOMIC      ((UINT64)1 << 1)
+#define DRIVER_FEATURE_DIRECT_READ ((UINT64)1 << 2)
+#define DRIVER_FEATURE_QUERY_REGIONS ((UINT64)1 << 3)
+#define DRIVER_FEATURE_QOS         ((UINT64)1 << 4)
+#define DRIVER_FEATURE_RESIDENCY   ((UINT64)1 << 5)
+#define DRIVER_FEATURE_MIRROR      ((UINT64)1 << 6)
+#define DRIVER_FEATURE_PARALLEL_READ ((UINT64)1 << 7)
+
+#define DRIVER_BUFFER_METHOD_BUFFERED   ((UINT32)1 << METHOD_BUFFERED)
+#define DRIVER_BUFFER_METHOD_OUT_DIRECT ((UINT32)1 << METHOD_OUT_DIRECT)
+
+#define DRIVER_EVENT_PROCESS_CREATE ((UINT32)1)
+#define DRIVER_EVENT_PROCESS_EXIT   ((UINT32)2)
+#define DRIVER_EVENT_IMAGE_LOAD     ((UINT32)3)
+#define DRIVER_EVENT_LOST           ((UINT32)4)
+
+// Count of events queued per handle. Oldest events are dropped on overflow.
+#define DRIVER_EVENT_QUEUE_SIZE 64
+#define DRIVER_EVENT_NAME_SIZE 260
+
+#define DRIVER_ATOMIC_COMPARE_EXCHANGE ((UINT32)1)
+#define DRIVER_ATOMIC_FETCH_ADD        ((UINT32)2)
+#define DRIVER_ATOMIC_FETCH_OR         ((UINT32)3)
+#define DRIVER_ATOMIC_FETCH_AND        ((UINT32)4)
+#define DRIVER_ATOMIC_WRITE_IF_EQUAL   ((UINT32)5)
+
+// Interactive requests run right away, bulk ones are copied in chunks by worker which yields to interactive
+#define DRIVER_PRIORITY_INTERACTIVE 0
+#define DRIVER_PRIORITY_BULK        1
+
+// Residency is reported per page of range [ptr, ptr + size), one bit per page starting from the page of `ptr`
+#define DRIVER_PAGE_SIZE 0x1000
+#define DRIVER_PAGE_COUNT(ptr, size) ((((UINT_PTR)(ptr) & (DRIVER_PAGE_SIZE - 1)) + (size) + DRIVER_PAGE_SIZE - 1) / DRIVER_PAGE_SIZE)
+#define DRIVER_RESIDENCY_BITMAP_SIZE(ptr, size) ((DRIVER_PAGE_COUNT(ptr, size) + 7) / 8)
+
+// Limits of CTL_RequestMirror. Sessions are counted for all handles, one session per handle.
+#define DRIVER_MIRROR_MAX_RANGES      64
+#define DRIVER_MIRROR_MAX_BYTES       0x10000
+#define DRIVER_MIRROR_MIN_INTERVAL_US 500
+#define DRIVER_MIRROR_MAX_INTERVAL_US 1000000
+#define DRIVER_MIRROR_MAX_SESSIONS    8
+
+// Data of each mirrored range starts at 8 byte boundary
+#define DRIVER_MIRROR_ALIGN(size) (((size) + 7) & ~(SIZE_T)7)
+
+// Limits of CTL_RequestReadProcessMemoryParallel. Count of chunks is lowered until each has at least min size.
+// At most max workers chunks of one request are copied at once, each worker takes next chunk when it's done.
+#define DRIVER_PARALLEL_MAX_CHUNKS     64
+#define DRIVER_PARALLEL_MIN_CHUNK_SIZE 0x40000
+#define DRIVER_PARALLEL_MAX_WORKERS    8
+
+// Max count of operations in one CTL_RequestAtomic
+#define DRIVER_ATOMIC_MAX_OPERATIONS 64
 
 #ifdef __cplusplus
 extern "C" {
@@ -22,6 +114,31 @@ struct CResponseVersion
 	UINT32 Version;
 };
 
+/**
+ * Response of CTL_RequestCapabilities.
+ * Drivers without this request support only DRIVER_VERSION 1 requests with METHOD_BUFFERED.
+ *
+ * `MaxBatchCount` is max count of items in one batched request.
+ * `MaxTransferSize` is max count of bytes in one read or write request.
+ * `BufferMethods` is a set of DRIVER_BUFFER_METHOD_* supported by requests.
+ */
+struct CResponseCapabilities
+{
+	UINT32 Version;
+	UINT32 BufferMethods;
+	UINT64 Features;
+	UINT64 MaxBatchCount;
+	UINT64 MaxTransferSize;
+};
+
+/**
+ * Used by CTL_RequestReadProcessMemory, CTL_RequestReadProcessMemoryDirect and CTL_RequestReadProcessMemoryBulk.
+ * Direct variant copies straight into caller's locked output buffer.
+ *
+ * Also used by CTL_RequestReadProcessMemoryResident, which never faults target pages in.
+ * Its output is `size` bytes of data followed by DRIVER_RESIDENCY_BITMAP_SIZE(ptr, size) bytes of bitmap.
+ * Set bit means the page was resident and copied, pages with clear bit are zero filled.
+ */
 struct CRequestReadProcessMemory
 {
 	void *pid;
@@ -29,6 +146,21 @@ struct CRequestReadProcessMemory
 	SIZE_T size;
 };
 
+/**
+ * Same as CTL_RequestReadProcessMemoryDirect, but range is split into `chunks` page aligned chunks.
+ * Chunks are copied by up to DRIVER_PARALLEL_MAX_WORKERS system worker threads, each under its own attach,
+ * so large reads use several cores. `chunks` of 0 lets driver pick count of active processors.
+ * Read fails as a whole if any chunk fails. Canceled read stops after chunks being copied. Handle priority is ignored.
+ */
+struct CRequestReadProcessMemoryParallel
+{
+	void *pid;
+	void *ptr;
+	SIZE_T size;
+	UINT32 chunks;
+	UINT32 reserved;
+};
+
 /**
  * Must be inherited. Data to write lays right after this struct.
  * Must be packed to get right size of structure.
@@ -68,6 +200,164 @@ struct CRequestModuleBase
 	SIZE_T size;
 };
 
+/**
+ * Process and image lifecycle event.
+ * Delivered by CTL_RequestWaitEvents to handles subscribed with CTL_RequestSubscribeEvents.
+ * Output buffer of CTL_RequestWaitEvents is an array of events.
+ * Request stays pending until at least one event is queued for the handle.
+ *
+ * DRIVER_EVENT_PROCESS_CREATE: pid, parentPid, Name.
+ * DRIVER_EVENT_PROCESS_EXIT: pid, parentPid, Name.
+ * DRIVER_EVENT_IMAGE_LOAD: pid, imageBase, imageSize, Name.
+ * DRIVER_EVENT_LOST: `lost` events were dropped, cached state must be rebuilt.
+ *
+ * `Name` is full image path. Paths longer than DRIVER_EVENT_NAME_SIZE - 1 keep their tail.
+ * `NameSize` describes count of WCHAR without null terminator.
+ */
+struct CDriverEvent
+{
+	UINT32 Type;
+	UINT32 NameSize;
+	void *pid;
+	void *parentPid;
+	void *imageBase;
+	SIZE_T imageSize;
+	SIZE_T lost;
+	WCHAR Name[DRIVER_EVENT_NAME_SIZE];
+};
+
+/**
+ * Interlocked operation on 1, 2, 4 or 8 bytes at `ptr`. `ptr` must be aligned to `size`.
+ *
+ * DRIVER_ATOMIC_COMPARE_EXCHANGE: store `operand` if value equals `comparand`.
+ * DRIVER_ATOMIC_FETCH_ADD, DRIVER_ATOMIC_FETCH_OR, DRIVER_ATOMIC_FETCH_AND: apply `operand`.
+ * DRIVER_ATOMIC_WRITE_IF_EQUAL: same as compare exchange, but on mismatch
+ *     all next operations of the request are skipped with STATUS_CANCELLED.
+ */
+struct CAtomicOperation
+{
+	void *ptr;
+	UINT32 op;
+	UINT32 size;
+	UINT64 operand;
+	UINT64 comparand;
+};
+
+/**
+ * Must be inherited. `count` of CAtomicOperation lay right after this struct.
+ * All operations run under single attach to the process.
+ * Output buffer is an array of `count` CAtomicResult.
+ *
+ * Example:
+ * #pragma pack(push, 1)
+ * struct CRequestAtomic2 : CRequestAtomic
+ * {
+ *     struct CAtomicOperation Operations[2]; // count = 2;
+ * }
+ * #pragma pack(pop)
+ */
+struct CRequestAtomic
+{
+	void *pid;
+	SIZE_T count;
+};
+
+/**
+ * `previous` is zero extended value before the operation.
+ * `stored` is 0 if compare exchange didn't match.
+ * `status` is NTSTATUS of the operation.
+ */
+struct CAtomicResult
+{
+	UINT64 previous;
+	INT32 status;
+	UINT32 stored;
+};
+
+/**
+ * Output buffer is DRIVER_RESIDENCY_BITMAP_SIZE(ptr, size) bytes of bitmap. Set bit means resident page.
+ */
+struct CRequestQueryResidency
+{
+	void *pid;
+	void *ptr;
+	SIZE_T size;
+};
+
+struct CMirrorRange
+{
+	void *ptr;
+	SIZE_T size;
+};
+
+/**
+ * Must be inherited. `count` of CMirrorRange lay right after this struct.
+ * Output buffer is shared with driver: CMirrorHeader followed by data of ranges,
+ * each range padded with DRIVER_MIRROR_ALIGN.
+ * Request stays pending while mirroring runs. It ends on cancel, handle close or target process exit.
+ *
+ * Example:
+ * #pragma pack(push, 1)
+ * struct CRequestMirror2 : CRequestMirror
+ * {
+ *     struct CMirrorRange Ranges[2]; // count = 2;
+ * }
+ * #pragma pack(pop)
+ */
+struct CRequestMirror
+{
+	void *pid;
+	UINT32 count;
+	UINT32 intervalUs;
+};
+
+/**
+ * `sequence` is odd while driver updates data. Reader copies data between two equal even reads of it.
+ * `status` is result of last refresh, ranges that failed keep their previous data.
+ * `timestamp` is interrupt time of last refresh in 100ns units.
+ */
+struct CMirrorHeader
+{
+	volatile INT64 sequence;
+	INT64 updates;
+	INT64 timestamp;
+	INT32 status;
+	UINT32 count;
+};
+
+/**
+ * Sets class of read and write requests sent through this handle.
+ * CTL_RequestReadProcessMemoryBulk is bulk regardless of handle class.
+ */
+struct CRequestSetPriority
+{
+	UINT32 priority;
+};
+
+/**
+ * Committed regions are reported starting from region containing `ptr`.
+ * Output buffer is an array of CMemoryRegion. Less regions than fit in it means the end of address space.
+ */
+struct CRequestQueryRegions
+{
+	void *pid;
+	void *ptr;
+};
+
+/**
+ * `state`, `protect` and `type` are MEM_* and PAGE_* values of MEMORY_BASIC_INFORMATION.
+ */
+struct CMemoryRegion
+{
+	void *base;
+	void *allocationBase;
+	SIZE_T size;
+	UINT32 state;
+	UINT32 protect;
+	UINT32 type;
+	UINT32 reserved;
+};
+
 #ifdef __cplusplus
 }
 #endif
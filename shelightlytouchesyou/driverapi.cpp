@@ -1,10 +1,18 @@
 #include "driverapi.hpp"
 #include "driver.h"
+#include "drivertrace.hpp"
+#include "peparser.hpp"
 
 #include <windows.h>
 #include <tlhelp32.h>
+#include <atomic>
+#include <cwctype>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
 #include <stdexcept>
 #include <sstream>
+#include <string>
 
 static void *GetPidByName(const wchar_t *pWideProcName, size_t WideProcNameSize)
 {
@@ -64,61 +72,698 @@ struct CSmallDeleteOnExit
 	}
 };
 
+static HANDLE OpenDriverHandle(DWORD Flags)
+{
+	HANDLE DriverHandle = CreateFileW(L"\\\\.\\" DRIVER_DEVICE_NAME, 0, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, Flags, NULL);
+
+	if (DriverHandle == INVALID_HANDLE_VALUE)
+	{
+		throw std::runtime_error("Can't connect to driver");
+	}
+
+	return DriverHandle;
+}
+
+CDriverEventSubscription::CDriverEventSubscription()
+{
+	m_DriverHandle = OpenDriverHandle(FILE_FLAG_OVERLAPPED);
+	m_WaitEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+
+	if (m_WaitEvent == NULL)
+	{
+		CloseHandle(m_DriverHandle);
+		throw std::runtime_error("CDriverEventSubscription Can't create event");
+	}
+
+	OVERLAPPED Overlapped = {};
+	Overlapped.hEvent = m_WaitEvent;
+
+	DWORD Wrote = 0;
+
+	BOOL result = DeviceIoControl(m_DriverHandle, CTL_RequestSubscribeEvents, NULL, 0, NULL, 0, NULL, &Overlapped);
+
+	if (result == 0 && GetLastError() == ERROR_IO_PENDING)
+		result = GetOverlappedResult(m_DriverHandle, &Overlapped, &Wrote, TRUE);
+
+	if (result == 0)
+	{
+		DWORD Error = GetLastError();
+
+		CloseHandle(m_WaitEvent);
+		CloseHandle(m_DriverHandle);
+
+		std::stringstream ss;
+		ss << "SubscribeEvents Failed GetLastError = ";
+		ss << Error;
+
+		throw std::runtime_error(ss.str());
+	}
+}
+
+CDriverEventSubscription::~CDriverEventSubscription()
+{
+	// Closing handle cancels pending wait
+	if (m_DriverHandle != nullptr)
+		CloseHandle(m_DriverHandle);
+
+	if (m_WaitEvent != nullptr)
+		CloseHandle(m_WaitEvent);
+}
+
+CDriverEventSubscription::CDriverEventSubscription(CDriverEventSubscription &&Other) :
+	m_DriverHandle(Other.m_DriverHandle),
+	m_WaitEvent(Other.m_WaitEvent)
+{
+	Other.m_DriverHandle = nullptr;
+	Other.m_WaitEvent = nullptr;
+}
+
+size_t CDriverEventSubscription::Wait(CDriverEvent *pEvents, size_t MaxEvents, uint32_t TimeoutMs) const
+{
+	OVERLAPPED Overlapped = {};
+	Overlapped.hEvent = m_WaitEvent;
+
+	DWORD Wrote = 0;
+
+	BOOL result = DeviceIoControl(m_DriverHandle, CTL_RequestWaitEvents, NULL, 0, pEvents, (DWORD)(MaxEvents * sizeof(CDriverEvent)), NULL, &Overlapped);
+
+	if (result == 0 && GetLastError() != ERROR_IO_PENDING)
+	{
+		std::stringstream ss;
+		ss << "WaitEvents Failed GetLastError = ";
+		ss << GetLastError();
+
+		throw std::runtime_error(ss.str());
+	}
+
+	if (result == 0 && WaitForSingleObject(m_WaitEvent, TimeoutMs) == WAIT_TIMEOUT)
+	{
+		// Request may still complete with events before cancel reaches it
+		CancelIoEx(m_DriverHandle, &Overlapped);
+	}
+
+	if (GetOverlappedResult(m_DriverHandle, &Overlapped, &Wrote, TRUE) == 0)
+	{
+		if (GetLastError() == ERROR_OPERATION_ABORTED)
+			return 0;
+
+		std::stringstream ss;
+		ss << "WaitEvents Failed GetLastError = ";
+		ss << GetLastError();
+
+		throw std::runtime_error(ss.str());
+	}
+
+	return Wrote / sizeof(CDriverEvent);
+}
+
+// Snapshot gives up after this many updates raced with it
+static const int MirrorSnapshotTries = 64;
+
+CDriverMirror::CDriverMirror(void *Pid, const CMirrorRange *pRanges, size_t Count, uint32_t IntervalUs) :
+	m_DriverHandle(nullptr),
+	m_pOverlapped(nullptr),
+	m_pBuffer(nullptr),
+	m_DataSize(0)
+{
+	if (Count == 0 || Count > DRIVER_MIRROR_MAX_RANGES)
+	{
+		std::stringstream ss;
+		ss << "Mirror bad count = ";
+		ss << Count;
+
+		throw std::runtime_error(ss.str());
+	}
+
+	for (size_t i = 0; i < Count; i++)
+	{
+		m_Offsets.push_back(m_DataSize);
+		m_DataSize += DRIVER_MIRROR_ALIGN(pRanges[i].size);
+	}
+
+	size_t TotalSize = sizeof(CMirrorHeader) + m_DataSize;
+
+	m_DriverHandle = OpenDriverHandle(FILE_FLAG_OVERLAPPED);
+
+	// Buffer and OVERLAPPED are used by driver until request ends, so they must not move with this object
+	OVERLAPPED *pOverlapped = new OVERLAPPED();
+	m_pOverlapped = pOverlapped;
+
+	pOverlapped->hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+	m_pBuffer = VirtualAlloc(NULL, TotalSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+
+	if (pOverlapped->hEvent == NULL || m_pBuffer == nullptr)
+	{
+		Close();
+		throw std::runtime_error("CDriverMirror Can't allocate resources");
+	}
+
+	CSmallDeleteOnExit ScopeBuffer;
+	size_t RequestSize = sizeof(CRequestMirror) + Count * sizeof(CMirrorRange);
+
+	CRequestMirror *pRequest = ScopeBuffer.Alloc<CRequestMirror>(RequestSize);
+
+	pRequest->pid = Pid;
+	pRequest->count = (UINT32)Count;
+	pRequest->intervalUs = IntervalUs;
+
+	memcpy(pRequest + 1, pRanges, Count * sizeof(CMirrorRange));
+
+	DWORD Wrote = 0;
+
+	BOOL result = DeviceIoControl(m_DriverHandle, CTL_RequestMirror, pRequest, (DWORD)RequestSize, m_pBuffer, (DWORD)TotalSize, &Wrote, pOverlapped);
+
+	// Running session never completes synchronously
+	if (result != 0 || GetLastError() != ERROR_IO_PENDING)
+	{
+		DWORD Error = result != 0 ? ERROR_INVALID_FUNCTION : GetLastError();
+
+		Close();
+
+		std::stringstream ss;
+		ss << "Mirror Failed GetLastError = ";
+		ss << Error;
+
+		throw std::runtime_error(ss.str());
+	}
+}
+
+CDriverMirror::~CDriverMirror()
+{
+	Close();
+}
+
+CDriverMirror::CDriverMirror(CDriverMirror &&Other) :
+	m_DriverHandle(Other.m_DriverHandle),
+	m_pOverlapped(Other.m_pOverlapped),
+	m_pBuffer(Other.m_pBuffer),
+	m_DataSize(Other.m_DataSize),
+	m_Offsets(std::move(Other.m_Offsets))
+{
+	Other.m_DriverHandle = nullptr;
+	Other.m_pOverlapped = nullptr;
+	Other.m_pBuffer = nullptr;
+}
+
+void CDriverMirror::Close()
+{
+	OVERLAPPED *pOverlapped = static_cast<OVERLAPPED *>(m_pOverlapped);
+
+	if (m_DriverHandle != nullptr && pOverlapped != nullptr && pOverlapped->hEvent != NULL)
+	{
+		// Driver writes into buffer until request is really gone
+		DWORD Wrote = 0;
+		CancelIoEx(m_DriverHandle, pOverlapped);
+		GetOverlappedResult(m_DriverHandle, pOverlapped, &Wrote, TRUE);
+	}
+
+	if (m_DriverHandle != nullptr)
+		CloseHandle(m_DriverHandle);
+
+	if (pOverlapped != nullptr)
+	{
+		if (pOverlapped->hEvent != NULL)
+			CloseHandle(pOverlapped->hEvent);
+
+		delete pOverlapped;
+	}
+
+	if (m_pBuffer != nullptr)
+		VirtualFree(m_pBuffer, 0, MEM_RELEASE);
+
+	m_DriverHandle = nullptr;
+	m_pOverlapped = nullptr;
+	m_pBuffer = nullptr;
+}
+
+bool CDriverMirror::IsActive() const
+{
+	return m_pOverlapped != nullptr && !HasOverlappedIoCompleted(static_cast<OVERLAPPED *>(m_pOverlapped));
+}
+
+bool CDriverMirror::Snapshot(void *pOut, CMirrorHeader *pHeader) const
+{
+	volatile CMirrorHeader *pShared = static_cast<volatile CMirrorHeader *>(m_pBuffer);
+	const void *pData = static_cast<CMirrorHeader *>(m_pBuffer) + 1;
+
+	for (int i = 0; i < MirrorSnapshotTries; i++)
+	{
+		INT64 Sequence = pShared->sequence;
+
+		// Driver is in the middle of update
+		if (Sequence & 1)
+		{
+			YieldProcessor();
+			continue;
+		}
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		memcpy(pOut, pData, m_DataSize);
+
+		if (pHeader != nullptr)
+		{
+			pHeader->updates = pShared->updates;
+			pHeader->timestamp = pShared->timestamp;
+			pHeader->status = pShared->status;
+			pHeader->count = pShared->count;
+		}
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		if (pShared->sequence == Sequence)
+		{
+			if (pHeader != nullptr)
+				pHeader->sequence = Sequence;
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Below this size copying through system buffer is cheaper than locking pages
+static const size_t DirectReadMinSize = 0x4000;
+
 CDriverHelper::CDriverHelper()
 {
-	m_DriverHandle = CreateFileW(L"\\\\.\\" DRIVER_DEVICE_NAME, 0, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+	m_DriverHandle = OpenDriverHandle(0);
+
+	try
+	{
+		if (!ReqCapabilities(&m_Capabilities))
+		{
+			m_Capabilities.Version = ReqVersion();
+			m_Capabilities.BufferMethods = DRIVER_BUFFER_METHOD_BUFFERED;
+			m_Capabilities.Features = 0;
+			m_Capabilities.MaxBatchCount = 0;
+			m_Capabilities.MaxTransferSize = MAXDWORD;
+		}
+	}
+	catch (...)
+	{
+		CloseHandle(m_DriverHandle);
+		throw;
+	}
+
+	// Request sizes are passed as DWORD
+	if (m_Capabilities.MaxTransferSize == 0 || m_Capabilities.MaxTransferSize > MAXDWORD)
+		m_Capabilities.MaxTransferSize = MAXDWORD;
+
+	if (m_Capabilities.MaxBatchCount > DRIVER_ATOMIC_MAX_OPERATIONS)
+		m_Capabilities.MaxBatchCount = DRIVER_ATOMIC_MAX_OPERATIONS;
+}
+
+CDriverHelper::~CDriverHelper()
+{
+	CloseHandle(m_DriverHandle);
+}
+
+bool CDriverHelper::ReqCapabilities(CResponseCapabilities *pResponse) const
+{
+	DRIVER_TRACE_SCOPE("ReqCapabilities", nullptr, sizeof(*pResponse));
+
+	DWORD Wrote = 0;
+
+	BOOL result = DeviceIoControl(m_DriverHandle, CTL_RequestCapabilities, NULL, 0, pResponse, sizeof(*pResponse), &Wrote, NULL);
+
+	if (result == 0)
+	{
+		// Unknown request
+		if (GetLastError() == ERROR_INVALID_FUNCTION)
+			return false;
+
+		std::stringstream ss;
+		ss << "ReqCapabilities Failed GetLastError = ";
+		ss << GetLastError();
+
+		throw std::runtime_error(ss.str());
+	}
+
+	if (Wrote != sizeof(*pResponse))
+	{
+		std::stringstream ss;
+		ss << "ReqCapabilities wrote = ";
+		ss << Wrote;
+
+		throw std::runtime_error(ss.str());
+	}
+
+	if (pResponse->Version < DRIVER_VERSION)
+	{
+		std::stringstream ss;
+		ss << "ReqCapabilities version is too old = ";
+		ss << pResponse->Version;
+
+		throw std::runtime_error(ss.str());
+	}
+
+	return true;
+}
+
+uint32_t CDriverHelper::ReqVersion() const
+{
+	DRIVER_TRACE_SCOPE("ReqVersion", nullptr, 0);
+
+	CResponseVersion Response;
+
+	DWORD Wrote = 0;
+
+	BOOL result = DeviceIoControl(m_DriverHandle, CTL_RequestVersion, NULL, 0, &Response, sizeof(Response), &Wrote, NULL);
+
+	if (result == 0)
+	{
+		std::stringstream ss;
+		ss << "ReqVersion Failed GetLastError = ";
+		ss << GetLastError();
+
+		throw std::runtime_error(ss.str());
+	}
+
+	if (Wrote != sizeof(Response))
+	{
+		std::stringstream ss;
+		ss << "ReqVersion wrote = ";
+		ss << Wrote;
+
+		throw std::runtime_error(ss.str());
+	}
+
+	if (Response.Version < DRIVER_VERSION)
+	{
+		std::stringstream ss;
+		ss << "ReqVersion version is too old = ";
+		ss << Response.Version;
+
+		throw std::runtime_error(ss.str());
+	}
+
+	return Response.Version;
+}
+
+void CDriverHelper::ReqReadProcessMemory(void *Pid, void *Addr, size_t Size, void *Out) const
+{
+	ReqReadProcessMemoryChunks(Pid, Addr, Size, Out, false);
+}
+
+void CDriverHelper::ReqReadProcessMemoryBulk(void *Pid, void *Addr, size_t Size, void *Out) const
+{
+	// Bulk read is direct, empty output has nothing to lock
+	bool Bulk = Size != 0 && HasFeature(DRIVER_FEATURE_QOS);
+
+	ReqReadProcessMemoryChunks(Pid, Addr, Size, Out, Bulk);
+}
+
+void CDriverHelper::ReqReadProcessMemoryChunks(void *Pid, void *Addr, size_t Size, void *Out, bool Bulk) const
+{
+	size_t MaxChunk = (size_t)m_Capabilities.MaxTransferSize;
+
+	while (Size > MaxChunk)
+	{
+		ReqReadProcessMemoryChunk(Pid, Addr, MaxChunk, Out, Bulk);
+
+		Addr = static_cast<char *>(Addr) + MaxChunk;
+		Out = static_cast<char *>(Out) + MaxChunk;
+		Size -= MaxChunk;
+	}
+
+	ReqReadProcessMemoryChunk(Pid, Addr, Size, Out, Bulk);
+}
+
+void CDriverHelper::ReqReadProcessMemoryChunk(void *Pid, void *Addr, size_t Size, void *Out, bool Bulk) const
+{
+	CRequestReadProcessMemory Request;
+	Request.pid = Pid;
+	Request.ptr = Addr;
+	Request.size = Size;
+
+	DWORD ControlCode = CTL_RequestReadProcessMemory;
+
+	if (Bulk)
+		ControlCode = CTL_RequestReadProcessMemoryBulk;
+	else if (Size >= DirectReadMinSize && HasFeature(DRIVER_FEATURE_DIRECT_READ))
+		ControlCode = CTL_RequestReadProcessMemoryDirect;
+
+	DRIVER_TRACE_SCOPE(Bulk ? "ReqReadProcessMemoryBulk" : ControlCode == CTL_RequestReadProcessMemoryDirect ? "ReqReadProcessMemoryDirect" : "ReqReadProcessMemory", Pid, Size);
+
+	DWORD Wrote = 0;
+
+	BOOL result = DeviceIoControl(m_DriverHandle, ControlCode, &Request, sizeof(Request), Out, (DWORD)Size, &Wrote, NULL);
+
+	if (result == 0)
+	{
+		std::stringstream ss;
+		ss << "ReqReadProcessMemory Failed GetLastError = ";
+		ss << GetLastError();
+
+		throw std::runtime_error(ss.str());
+	}
+
+	if (Wrote != Size)
+	{
+		std::stringstream ss;
+		ss << "ReqReadProcessMemory wrote = ";
+		ss << Wrote;
+
+		throw std::runtime_error(ss.str());
+	}
+}
+
+void CDriverHelper::ReqReadProcessMemoryParallel(void *Pid, void *Addr, size_t Size, void *Out, uint32_t Chunks) const
+{
+	// Parallel read is direct, empty output has nothing to lock
+	if (Size == 0 || !HasFeature(DRIVER_FEATURE_PARALLEL_READ))
+	{
+		ReqReadProcessMemory(Pid, Addr, Size, Out);
+		return;
+	}
+
+	size_t MaxChunk = (size_t)m_Capabilities.MaxTransferSize;
+
+	while (Size > MaxChunk)
+	{
+		ReqReadProcessMemoryParallelChunk(Pid, Addr, MaxChunk, Out, Chunks);
+
+		Addr = static_cast<char *>(Addr) + MaxChunk;
+		Out = static_cast<char *>(Out) + MaxChunk;
+		Size -= MaxChunk;
+	}
+
+	ReqReadProcessMemoryParallelChunk(Pid, Addr, Size, Out, Chunks);
+}
+
+void CDriverHelper::ReqReadProcessMemoryParallelChunk(void *Pid, void *Addr, size_t Size, void *Out, uint32_t Chunks) const
+{
+	DRIVER_TRACE_SCOPE("ReqReadProcessMemoryParallel", Pid, Size);
+
+	CRequestReadProcessMemoryParallel Request;
+	Request.pid = Pid;
+	Request.ptr = Addr;
+	Request.size = Size;
+	Request.chunks = Chunks < DRIVER_PARALLEL_MAX_CHUNKS ? Chunks : DRIVER_PARALLEL_MAX_CHUNKS;
+	Request.reserved = 0;
+
+	DWORD Wrote = 0;
+
+	BOOL result = DeviceIoControl(m_DriverHandle, CTL_RequestReadProcessMemoryParallel, &Request, sizeof(Request), Out, (DWORD)Size, &Wrote, NULL);
+
+	if (result == 0)
+	{
+		std::stringstream ss;
+		ss << "ReqReadProcessMemoryParallel Failed GetLastError = ";
+		ss << GetLastError();
+
+		throw std::runtime_error(ss.str());
+	}
+
+	if (Wrote != Size)
+	{
+		std::stringstream ss;
+		ss << "ReqReadProcessMemoryParallel wrote = ";
+		ss << Wrote;
+
+		throw std::runtime_error(ss.str());
+	}
+}
+
+void CDriverHelper::ReqWriteProcessMemory(void *Pid, void *Addr, size_t Size, const void *From) const
+{
+	size_t MaxChunk = (size_t)m_Capabilities.MaxTransferSize - sizeof(CRequestWriteProcessMemory);
+
+	while (Size > MaxChunk)
+	{
+		ReqWriteProcessMemoryChunk(Pid, Addr, MaxChunk, From);
+
+		Addr = static_cast<char *>(Addr) + MaxChunk;
+		From = static_cast<const char *>(From) + MaxChunk;
+		Size -= MaxChunk;
+	}
+
+	ReqWriteProcessMemoryChunk(Pid, Addr, Size, From);
+}
+
+void CDriverHelper::ReqWriteProcessMemoryChunk(void *Pid, void *Addr, size_t Size, const void *From) const
+{
+	DRIVER_TRACE_SCOPE("ReqWriteProcessMemory", Pid, Size);
+
+	CSmallDeleteOnExit ScopeBuffer;
+	size_t TotalSize = sizeof(CRequestWriteProcessMemory) + Size;
+
+	CRequestWriteProcessMemory *pRequest = ScopeBuffer.Alloc<CRequestWriteProcessMemory>(TotalSize);
+
+	pRequest->pid = Pid;
+	pRequest->ptr = Addr;
+	pRequest->size = Size;
+
+	memcpy(pRequest + 1, From, Size);
+
+	BOOL result = DeviceIoControl(m_DriverHandle, CTL_RequestWriteProcessMemory, pRequest, (DWORD)TotalSize, NULL, 0, NULL, NULL);
+
+	if (result == 0)
+	{
+		std::stringstream ss;
+		ss << "ReqWriteProcessMemory Failed GetLastError = ";
+		ss << GetLastError();
+
+		throw std::runtime_error(ss.str());
+	}
+}
+
+void *CDriverHelper::ReqGetModuleBase(void *Pid, const wchar_t *pWideModuleName, size_t WideModuleNameSize) const
+{
+	DRIVER_TRACE_SCOPE("ReqGetModuleBase", Pid, 0);
+
+	CSmallDeleteOnExit ScopeBuffer;
+	size_t StrWideSize = (WideModuleNameSize + 1) * sizeof(wchar_t);
+	size_t TotalSize = sizeof(CRequestModuleBase) + StrWideSize;
+
+	CRequestModuleBase *pRequest = ScopeBuffer.Alloc<CRequestModuleBase>(TotalSize);
+
+	pRequest->pid = Pid;
+	pRequest->size = WideModuleNameSize;
+
+	memcpy(pRequest + 1, pWideModuleName, StrWideSize);
+
+	DWORD Wrote = 0;
+	void *Response = nullptr;
+
+	BOOL result = DeviceIoControl(m_DriverHandle, CTL_RequestModuleBase, pRequest, (DWORD)TotalSize, &Response, sizeof(Response), &Wrote, NULL);
+
+	if (result == 0)
+	{
+		std::stringstream ss;
+		ss << "ReqGetModuleBase Failed GetLastError = ";
+		ss << GetLastError();
+
+		throw std::runtime_error(ss.str());
+	}
+
+	if (Wrote != sizeof(Response))
+	{
+		std::stringstream ss;
+		ss << "ReqGetModuleBase wrote = ";
+		ss << Wrote;
+
+		throw std::runtime_error(ss.str());
+	}
+
+	return Response;
+}
+
+void *CDriverHelper::ReqGetModuleBase(void *Pid, const char *pModuleName, size_t ModuleNameSize) const
+{
+	CSmallDeleteOnExit ScopeBuffer;
+
+	size_t WideModuleNameSize = MultiByteToWideChar(CP_UTF8, 0, pModuleName, (DWORD)ModuleNameSize, nullptr, 0);
+
+	wchar_t *pWideModuleName = ScopeBuffer.Alloc<wchar_t>(WideModuleNameSize * 2);
+
+	MultiByteToWideChar(CP_UTF8, 0, pModuleName, (DWORD)ModuleNameSize, pWideModuleName, (DWORD)WideModuleNameSize);
+
+	return ReqGetModuleBase(Pid, pWideModuleName, WideModuleNameSize);
+}
+
+void *CDriverHelper::ReqGetModuleBase(void *Pid, const wchar_t *pWideModuleName) const
+{
+	size_t WideModuleNameSize = wcslen(pWideModuleName);
+	return ReqGetModuleBase(Pid, pWideModuleName, WideModuleNameSize);
+}
+
+void *CDriverHelper::ReqGetModuleBase(void *Pid, const char *pModuleName) const
+{
+	size_t ModuleNameSize = strlen(pModuleName);
+	return ReqGetModuleBase(Pid, pModuleName, ModuleNameSize);
+}
+
+void CDriverHelper::ReqAtomic(void *Pid, const CAtomicOperation *pOperations, size_t Count, CAtomicResult *pResults) const
+{
+	DRIVER_TRACE_SCOPE("ReqAtomic", Pid, Count);
 
-	if (m_DriverHandle == INVALID_HANDLE_VALUE)
+	if (!HasFeature(DRIVER_FEATURE_ATOMIC))
+		throw std::runtime_error("ReqAtomic is not supported by driver");
+
+	if (Count == 0 || Count > m_Capabilities.MaxBatchCount)
 	{
-		throw std::runtime_error("Can't connect to driver");
+		std::stringstream ss;
+		ss << "ReqAtomic bad count = ";
+		ss << Count;
+
+		throw std::runtime_error(ss.str());
 	}
-}
 
-CDriverHelper::~CDriverHelper()
-{
-	CloseHandle(m_DriverHandle);
-}
+	CSmallDeleteOnExit ScopeBuffer;
+	size_t TotalSize = sizeof(CRequestAtomic) + Count * sizeof(CAtomicOperation);
+	size_t ResultsSize = Count * sizeof(CAtomicResult);
 
-uint32_t CDriverHelper::ReqVersion() const
-{
-	CResponseVersion Response;
+	CRequestAtomic *pRequest = ScopeBuffer.Alloc<CRequestAtomic>(TotalSize);
+
+	pRequest->pid = Pid;
+	pRequest->count = Count;
+
+	memcpy(pRequest + 1, pOperations, Count * sizeof(CAtomicOperation));
 
 	DWORD Wrote = 0;
 
-	BOOL result = DeviceIoControl(m_DriverHandle, CTL_RequestVersion, NULL, 0, &Response, sizeof(Response), &Wrote, NULL);
+	BOOL result = DeviceIoControl(m_DriverHandle, CTL_RequestAtomic, pRequest, (DWORD)TotalSize, pResults, (DWORD)ResultsSize, &Wrote, NULL);
 
 	if (result == 0)
 	{
 		std::stringstream ss;
-		ss << "ReqVersion Failed GetLastError = ";
+		ss << "ReqAtomic Failed GetLastError = ";
 		ss << GetLastError();
 
 		throw std::runtime_error(ss.str());
 	}
 
-	if (Wrote != sizeof(Response))
+	if (Wrote != ResultsSize)
 	{
 		std::stringstream ss;
-		ss << "ReqVersion wrote = ";
+		ss << "ReqAtomic wrote = ";
 		ss << Wrote;
 
 		throw std::runtime_error(ss.str());
 	}
+}
 
-	if (Response.Version != DRIVER_VERSION)
+void CDriverHelper::ReqReadProcessMemoryResident(void *Pid, void *Addr, size_t Size, void *pOut) const
+{
+	DRIVER_TRACE_SCOPE("ReqReadProcessMemoryResident", Pid, Size);
+
+	if (!HasFeature(DRIVER_FEATURE_RESIDENCY))
+		throw std::runtime_error("ReqReadProcessMemoryResident is not supported by driver");
+
+	size_t TotalSize = Size + DRIVER_RESIDENCY_BITMAP_SIZE(Addr, Size);
+
+	if (Size == 0 || TotalSize > MAXDWORD)
 	{
 		std::stringstream ss;
-		ss << "ReqVersion version don't match = ";
-		ss << Response.Version;
+		ss << "ReqReadProcessMemoryResident bad size = ";
+		ss << Size;
 
 		throw std::runtime_error(ss.str());
 	}
 
-	return Response.Version;
-}
-
-void CDriverHelper::ReqReadProcessMemory(void *Pid, void *Addr, size_t Size, void *Out) const
-{
 	CRequestReadProcessMemory Request;
 	Request.pid = Pid;
 	Request.ptr = Addr;
@@ -126,123 +771,296 @@ void CDriverHelper::ReqReadProcessMemory(void *Pid, void *Addr, size_t Size, voi
 
 	DWORD Wrote = 0;
 
-	BOOL result = DeviceIoControl(m_DriverHandle, CTL_RequestReadProcessMemory, &Request, sizeof(Request), Out, (DWORD)Size, &Wrote, NULL);
+	BOOL result = DeviceIoControl(m_DriverHandle, CTL_RequestReadProcessMemoryResident, &Request, sizeof(Request), pOut, (DWORD)TotalSize, &Wrote, NULL);
 
 	if (result == 0)
 	{
 		std::stringstream ss;
-		ss << "ReqReadProcessMemory Failed GetLastError = ";
+		ss << "ReqReadProcessMemoryResident Failed GetLastError = ";
 		ss << GetLastError();
 
 		throw std::runtime_error(ss.str());
 	}
 
-	if (Wrote != Size)
+	if (Wrote != TotalSize)
 	{
 		std::stringstream ss;
-		ss << "ReqReadProcessMemory wrote = ";
+		ss << "ReqReadProcessMemoryResident wrote = ";
 		ss << Wrote;
 
 		throw std::runtime_error(ss.str());
 	}
 }
 
-void CDriverHelper::ReqWriteProcessMemory(void *Pid, void *Addr, size_t Size, const void *From) const
+void CDriverHelper::ReqQueryResidency(void *Pid, void *Addr, size_t Size, uint8_t *pPresent) const
 {
+	DRIVER_TRACE_SCOPE("ReqQueryResidency", Pid, Size);
+
+	if (!HasFeature(DRIVER_FEATURE_RESIDENCY))
+		throw std::runtime_error("ReqQueryResidency is not supported by driver");
+
+	size_t BitmapSize = DRIVER_RESIDENCY_BITMAP_SIZE(Addr, Size);
+
+	if (Size == 0 || Size > MAXDWORD)
+	{
+		std::stringstream ss;
+		ss << "ReqQueryResidency bad size = ";
+		ss << Size;
+
+		throw std::runtime_error(ss.str());
+	}
+
 	CSmallDeleteOnExit ScopeBuffer;
-	size_t TotalSize = sizeof(CRequestWriteProcessMemory) + Size;
 
-	CRequestWriteProcessMemory *pRequest = ScopeBuffer.Alloc<CRequestWriteProcessMemory>(TotalSize);
+	// System buffer holds both request and bitmap
+	size_t BufferSize = sizeof(CRequestQueryResidency) > BitmapSize ? sizeof(CRequestQueryResidency) : BitmapSize;
+
+	CRequestQueryResidency *pRequest = ScopeBuffer.Alloc<CRequestQueryResidency>(BufferSize);
 
 	pRequest->pid = Pid;
 	pRequest->ptr = Addr;
 	pRequest->size = Size;
 
-	memcpy(pRequest + 1, From, Size);
+	DWORD Wrote = 0;
 
-	BOOL result = DeviceIoControl(m_DriverHandle, CTL_RequestWriteProcessMemory, pRequest, (DWORD)TotalSize, NULL, 0, NULL, NULL);
+	BOOL result = DeviceIoControl(m_DriverHandle, CTL_RequestQueryResidency, pRequest, sizeof(CRequestQueryResidency), pRequest, (DWORD)BitmapSize, &Wrote, NULL);
 
 	if (result == 0)
 	{
 		std::stringstream ss;
-		ss << "ReqWriteProcessMemory Failed GetLastError = ";
+		ss << "ReqQueryResidency Failed GetLastError = ";
 		ss << GetLastError();
 
 		throw std::runtime_error(ss.str());
 	}
+
+	if (Wrote != BitmapSize)
+	{
+		std::stringstream ss;
+		ss << "ReqQueryResidency wrote = ";
+		ss << Wrote;
+
+		throw std::runtime_error(ss.str());
+	}
+
+	memcpy(pPresent, pRequest, BitmapSize);
 }
 
-void *CDriverHelper::ReqGetModuleBase(void *Pid, const wchar_t *pWideModuleName, size_t WideModuleNameSize) const
+void CDriverHelper::ReqSetPriority(uint32_t Priority) const
 {
-	CSmallDeleteOnExit ScopeBuffer;
-	size_t StrWideSize = (WideModuleNameSize + 1) * sizeof(wchar_t);
-	size_t TotalSize = sizeof(CRequestModuleBase) + StrWideSize;
+	DRIVER_TRACE_SCOPE("ReqSetPriority", nullptr, 0);
 
-	CRequestModuleBase *pRequest = ScopeBuffer.Alloc<CRequestModuleBase>(TotalSize);
+	if (!HasFeature(DRIVER_FEATURE_QOS))
+		throw std::runtime_error("ReqSetPriority is not supported by driver");
 
-	pRequest->pid = Pid;
-	pRequest->size = WideModuleNameSize;
+	CRequestSetPriority Request;
+	Request.priority = Priority;
 
-	memcpy(pRequest + 1, pWideModuleName, StrWideSize);
+	DWORD Wrote = 0;
+
+	BOOL result = DeviceIoControl(m_DriverHandle, CTL_RequestSetPriority, &Request, sizeof(Request), NULL, 0, &Wrote, NULL);
+
+	if (result == 0)
+	{
+		std::stringstream ss;
+		ss << "ReqSetPriority Failed GetLastError = ";
+		ss << GetLastError();
+
+		throw std::runtime_error(ss.str());
+	}
+}
+
+size_t CDriverHelper::ReqQueryRegions(void *Pid, void *Start, CMemoryRegion *pRegions, size_t MaxRegions) const
+{
+	DRIVER_TRACE_SCOPE("ReqQueryRegions", Pid, MaxRegions);
+
+	if (!HasFeature(DRIVER_FEATURE_QUERY_REGIONS))
+		throw std::runtime_error("ReqQueryRegions is not supported by driver");
+
+	CRequestQueryRegions Request;
+	Request.pid = Pid;
+	Request.ptr = Start;
 
 	DWORD Wrote = 0;
-	void *Response = nullptr;
 
-	BOOL result = DeviceIoControl(m_DriverHandle, CTL_RequestModuleBase, pRequest, (DWORD)TotalSize, &Response, sizeof(Response), &Wrote, NULL);
+	BOOL result = DeviceIoControl(m_DriverHandle, CTL_RequestQueryRegions, &Request, sizeof(Request), pRegions, (DWORD)(MaxRegions * sizeof(CMemoryRegion)), &Wrote, NULL);
 
 	if (result == 0)
 	{
 		std::stringstream ss;
-		ss << "ReqGetModuleBase Failed GetLastError = ";
+		ss << "ReqQueryRegions Failed GetLastError = ";
 		ss << GetLastError();
 
 		throw std::runtime_error(ss.str());
 	}
 
-	if (Wrote != sizeof(Response))
+	if (Wrote % sizeof(CMemoryRegion) != 0)
 	{
 		std::stringstream ss;
-		ss << "ReqGetModuleBase wrote = ";
+		ss << "ReqQueryRegions wrote = ";
 		ss << Wrote;
 
 		throw std::runtime_error(ss.str());
 	}
 
-	return Response;
+	return Wrote / sizeof(CMemoryRegion);
 }
 
-void *CDriverHelper::ReqGetModuleBase(void *Pid, const char *pModuleName, size_t ModuleNameSize) const
+CDriverEventSubscription CDriverHelper::SubscribeEvents() const
 {
-	CSmallDeleteOnExit ScopeBuffer;
-
-	size_t WideModuleNameSize = MultiByteToWideChar(CP_UTF8, 0, pModuleName, (DWORD)ModuleNameSize, nullptr, 0);
+	if (!HasFeature(DRIVER_FEATURE_EVENTS))
+		throw std::runtime_error("SubscribeEvents is not supported by driver");
 
-	wchar_t *pWideModuleName = ScopeBuffer.Alloc<wchar_t>(WideModuleNameSize * 2);
+	return CDriverEventSubscription();
+}
 
-	MultiByteToWideChar(CP_UTF8, 0, pModuleName, (DWORD)ModuleNameSize, pWideModuleName, (DWORD)WideModuleNameSize);
+CDriverMirror CDriverHelper::Mirror(void *Pid, const CMirrorRange *pRanges, size_t Count, uint32_t IntervalUs) const
+{
+	if (!HasFeature(DRIVER_FEATURE_MIRROR))
+		throw std::runtime_error("Mirror is not supported by driver");
 
-	return ReqGetModuleBase(Pid, pWideModuleName, WideModuleNameSize);
+	return CDriverMirror(Pid, pRanges, Count, IntervalUs);
 }
 
-void *CDriverHelper::ReqGetModuleBase(void *Pid, const wchar_t *pWideModuleName) const
+// Non-writable sections of modules found by CDriverProcessHelper::GetModuleBase
+struct CSectionCache
 {
-	size_t WideModuleNameSize = wcslen(pWideModuleName);
-	return ReqGetModuleBase(Pid, pWideModuleName, WideModuleNameSize);
-}
+	struct CSection
+	{
+		void *ModuleBase;
+		std::vector<uint8_t> Data;
+	};
 
-void *CDriverHelper::ReqGetModuleBase(void *Pid, const char *pModuleName) const
+	std::shared_mutex Lock;
+
+	// Base by lowercase module name
+	std::map<std::wstring, void *> Modules;
+
+	// By start address. Modules don't overlap, so sections of one module are adjacent.
+	std::map<uintptr_t, CSection> Sections;
+
+	bool Read(void *Addr, size_t Size, void *Out)
+	{
+		std::shared_lock<std::shared_mutex> Guard(Lock);
+
+		uintptr_t Start = reinterpret_cast<uintptr_t>(Addr);
+		auto it = Sections.upper_bound(Start);
+
+		if (it == Sections.begin())
+			return false;
+
+		--it;
+
+		size_t Offset = Start - it->first;
+		const std::vector<uint8_t> &Data = it->second.Data;
+
+		if (Offset >= Data.size() || Size > Data.size() - Offset)
+			return false;
+
+		memcpy(Out, Data.data() + Offset, Size);
+		return true;
+	}
+
+	// Lock must be held exclusively
+	void EraseModule(void *ModuleBase)
+	{
+		auto it = Sections.lower_bound(reinterpret_cast<uintptr_t>(ModuleBase));
+
+		while (it != Sections.end() && it->second.ModuleBase == ModuleBase)
+			it = Sections.erase(it);
+
+		for (auto mit = Modules.begin(); mit != Modules.end();)
+		{
+			if (mit->second == ModuleBase)
+				mit = Modules.erase(mit);
+			else
+				++mit;
+		}
+	}
+
+	// Lock must be held exclusively
+	void EraseRange(void *Addr, size_t Size)
+	{
+		uintptr_t Start = reinterpret_cast<uintptr_t>(Addr);
+		std::vector<void *> Stale;
+
+		auto it = Sections.upper_bound(Start);
+
+		if (it != Sections.begin())
+			--it;
+
+		for (; it != Sections.end(); ++it)
+		{
+			if (it->first >= Start)
+			{
+				if (it->first - Start >= Size)
+					break;
+			}
+			else if (Start - it->first >= it->second.Data.size())
+			{
+				continue;
+			}
+
+			Stale.push_back(it->second.ModuleBase);
+		}
+
+		for (void *ModuleBase : Stale)
+			EraseModule(ModuleBase);
+	}
+};
+
+static std::map<uintptr_t, CSectionCache::CSection> ReadImmutableSections(const CDriverBackend &Helper, void *Pid, void *ModuleBase)
 {
-	size_t ModuleNameSize = strlen(pModuleName);
-	return ReqGetModuleBase(Pid, pModuleName, ModuleNameSize);
+	std::map<uintptr_t, CSectionCache::CSection> Result;
+	std::vector<CRemoteSection> Sections;
+
+	// Helper of its own has no section cache, so headers always come from target
+	CDriverProcessHelper Process(Helper, Pid);
+
+	try
+	{
+		Sections = CRemotePEParser(Process).ReadSections(ModuleBase);
+	}
+	catch (const std::runtime_error &)
+	{
+		return Result;
+	}
+
+	for (const CRemoteSection &Section : Sections)
+	{
+		if ((Section.Characteristics & IMAGE_SCN_MEM_WRITE) != 0 || Section.VirtualSize == 0)
+			continue;
+
+		char *pSection = static_cast<char *>(ModuleBase) + Section.VirtualAddress;
+
+		CSectionCache::CSection Cached;
+		Cached.ModuleBase = ModuleBase;
+		Cached.Data.resize(Section.VirtualSize);
+
+		// Single read per section, not worth interactive priority
+		try
+		{
+			Helper.ReqReadProcessMemoryBulk(Pid, pSection, Cached.Data.size(), Cached.Data.data());
+		}
+		catch (const std::runtime_error &)
+		{
+			// Reads of this section keep going to the driver
+			continue;
+		}
+
+		Result.emplace(reinterpret_cast<uintptr_t>(pSection), std::move(Cached));
+	}
+
+	return Result;
 }
 
-CDriverProcessHelper::CDriverProcessHelper(const CDriverHelper &Helper, void *Pid) :
+CDriverProcessHelper::CDriverProcessHelper(const CDriverBackend &Helper, void *Pid) :
 	m_Helper(Helper),
 	m_ProcessPid(Pid)
 {
 }
 
-CDriverProcessHelper::CDriverProcessHelper(const CDriverHelper &Helper, const wchar_t *pWideProcName, size_t WideProcNameSize) :
+CDriverProcessHelper::CDriverProcessHelper(const CDriverBackend &Helper, const wchar_t *pWideProcName, size_t WideProcNameSize) :
 	m_Helper(Helper)
 {
 	m_ProcessPid = GetPidByName(pWideProcName, WideProcNameSize);
@@ -265,7 +1083,7 @@ CDriverProcessHelper::CDriverProcessHelper(const CDriverHelper &Helper, const wc
 	}
 }
 
-CDriverProcessHelper::CDriverProcessHelper(const CDriverHelper &Helper, const char *pProcName, size_t ProcNameSize) :
+CDriverProcessHelper::CDriverProcessHelper(const CDriverBackend &Helper, const char *pProcName, size_t ProcNameSize) :
 	m_Helper(Helper)
 {
 	CSmallDeleteOnExit ScopeBuffer;
@@ -288,42 +1106,237 @@ CDriverProcessHelper::CDriverProcessHelper(const CDriverHelper &Helper, const ch
 	}
 }
 
-CDriverProcessHelper::CDriverProcessHelper(const CDriverHelper &Helper, const wchar_t *pWideProcName) :
+CDriverProcessHelper::CDriverProcessHelper(const CDriverBackend &Helper, const wchar_t *pWideProcName) :
 	CDriverProcessHelper(Helper, pWideProcName, wcslen(pWideProcName))
 {
 }
 
-CDriverProcessHelper::CDriverProcessHelper(const CDriverHelper &Helper, const char *pProcName) :
+CDriverProcessHelper::CDriverProcessHelper(const CDriverBackend &Helper, const char *pProcName) :
 	CDriverProcessHelper(Helper, pProcName, strlen(pProcName))
 {
 }
 
+CDriverProcessHelper::~CDriverProcessHelper() = default;
+
+void CDriverProcessHelper::EnableSectionCache()
+{
+	if (m_pSectionCache == nullptr)
+		m_pSectionCache = std::make_shared<CSectionCache>();
+}
+
+void CDriverProcessHelper::InvalidateSectionCache(void *ModuleBase) const
+{
+	if (m_pSectionCache == nullptr)
+		return;
+
+	std::unique_lock<std::shared_mutex> Guard(m_pSectionCache->Lock);
+	m_pSectionCache->EraseModule(ModuleBase);
+}
+
+void CDriverProcessHelper::ClearSectionCache() const
+{
+	if (m_pSectionCache == nullptr)
+		return;
+
+	std::unique_lock<std::shared_mutex> Guard(m_pSectionCache->Lock);
+	m_pSectionCache->Modules.clear();
+	m_pSectionCache->Sections.clear();
+}
+
+void CDriverProcessHelper::CacheModuleSections(const wchar_t *pWideModuleName, size_t WideModuleNameSize, void *ModuleBase) const
+{
+	std::wstring Name(pWideModuleName, WideModuleNameSize);
+
+	for (wchar_t &c : Name)
+		c = (wchar_t)towlower(c);
+
+	{
+		std::shared_lock<std::shared_mutex> Guard(m_pSectionCache->Lock);
+
+		auto it = m_pSectionCache->Modules.find(Name);
+
+		if (it != m_pSectionCache->Modules.end() && it->second == ModuleBase)
+			return;
+	}
+
+	// Read outside of lock. Module is remembered even if some or all sections failed to read,
+	// so every GetModuleBase doesn't repeat failing reads until module is invalidated.
+	std::map<uintptr_t, CSectionCache::CSection> Sections = ReadImmutableSections(m_Helper, m_ProcessPid, ModuleBase);
+
+	std::unique_lock<std::shared_mutex> Guard(m_pSectionCache->Lock);
+
+	auto it = m_pSectionCache->Modules.find(Name);
+
+	if (it != m_pSectionCache->Modules.end())
+	{
+		// Another thread was faster
+		if (it->second == ModuleBase)
+			return;
+
+		// Module was reloaded at another base
+		m_pSectionCache->EraseModule(it->second);
+	}
+
+	// Stale copy of another module which was unloaded from this range
+	for (auto &Section : Sections)
+		m_pSectionCache->EraseRange(reinterpret_cast<void *>(Section.first), Section.second.Data.size());
+
+	for (auto &Section : Sections)
+		m_pSectionCache->Sections.emplace(Section.first, std::move(Section.second));
+
+	m_pSectionCache->Modules[Name] = ModuleBase;
+}
+
 void CDriverProcessHelper::ReadProcessMemory(void *Addr, size_t Size, void *Out) const
 {
+	if (m_pSectionCache != nullptr && m_pSectionCache->Read(Addr, Size, Out))
+		return;
+
 	m_Helper.ReqReadProcessMemory(m_ProcessPid, Addr, Size, Out);
 }
 
+void CDriverProcessHelper::ReadProcessMemoryBulk(void *Addr, size_t Size, void *Out) const
+{
+	m_Helper.ReqReadProcessMemoryBulk(m_ProcessPid, Addr, Size, Out);
+}
+
+bool CDriverProcessHelper::ReadResident(void *Addr, size_t Size, void *Out, std::vector<uint8_t> *pPresent) const
+{
+	CSmallDeleteOnExit ScopeBuffer;
+	size_t BitmapSize = DRIVER_RESIDENCY_BITMAP_SIZE(Addr, Size);
+
+	char *pBuffer = ScopeBuffer.Alloc<char>(Size + BitmapSize);
+
+	m_Helper.ReqReadProcessMemoryResident(m_ProcessPid, Addr, Size, pBuffer);
+
+	memcpy(Out, pBuffer, Size);
+
+	const uint8_t *pBitmap = reinterpret_cast<const uint8_t *>(pBuffer + Size);
+	size_t PageCount = DRIVER_PAGE_COUNT(Addr, Size);
+	bool AllPresent = true;
+
+	for (size_t i = 0; i < PageCount && AllPresent; i++)
+		AllPresent = (pBitmap[i / 8] >> (i % 8) & 1) != 0;
+
+	if (pPresent != nullptr)
+		pPresent->assign(pBitmap, pBitmap + BitmapSize);
+
+	return AllPresent;
+}
+
+std::vector<uint8_t> CDriverProcessHelper::QueryResidency(void *Addr, size_t Size) const
+{
+	std::vector<uint8_t> Present(DRIVER_RESIDENCY_BITMAP_SIZE(Addr, Size));
+
+	m_Helper.ReqQueryResidency(m_ProcessPid, Addr, Size, Present.data());
+
+	return Present;
+}
+
 void CDriverProcessHelper::WriteProcessMemory(void *Addr, size_t Size, const void *From) const
 {
+	if (m_pSectionCache != nullptr)
+	{
+		std::unique_lock<std::shared_mutex> Guard(m_pSectionCache->Lock);
+		m_pSectionCache->EraseRange(Addr, Size);
+	}
+
 	m_Helper.ReqWriteProcessMemory(m_ProcessPid, Addr, Size, From);
 }
 
+void CDriverProcessHelper::Atomic(const CAtomicOperation *pOperations, size_t Count, CAtomicResult *pResults) const
+{
+	m_Helper.ReqAtomic(m_ProcessPid, pOperations, Count, pResults);
+}
+
+uint64_t CDriverProcessHelper::AtomicSingle(uint32_t Op, void *Addr, size_t Size, uint64_t Operand, uint64_t Comparand, bool *pStored) const
+{
+	CAtomicOperation Operation;
+	Operation.ptr = Addr;
+	Operation.op = Op;
+	Operation.size = (uint32_t)Size;
+	Operation.operand = Operand;
+	Operation.comparand = Comparand;
+
+	CAtomicResult Result;
+
+	m_Helper.ReqAtomic(m_ProcessPid, &Operation, 1, &Result);
+
+	if (Result.status < 0)
+	{
+		std::stringstream ss;
+		ss << "Atomic operation Failed status = ";
+		ss << std::hex << (uint32_t)Result.status;
+
+		throw std::runtime_error(ss.str());
+	}
+
+	if (pStored != nullptr)
+		*pStored = Result.stored != 0;
+
+	return Result.previous;
+}
+
+std::vector<CMemoryRegion> CDriverProcessHelper::QueryRegions() const
+{
+	const size_t BatchSize = 256;
+
+	std::vector<CMemoryRegion> Regions;
+	void *Start = nullptr;
+
+	for (;;)
+	{
+		size_t Offset = Regions.size();
+		Regions.resize(Offset + BatchSize);
+
+		size_t Count = m_Helper.ReqQueryRegions(m_ProcessPid, Start, &Regions[Offset], BatchSize);
+
+		Regions.resize(Offset + Count);
+
+		if (Count < BatchSize)
+			break;
+
+		const CMemoryRegion &Last = Regions.back();
+		Start = static_cast<char *>(Last.base) + Last.size;
+	}
+
+	return Regions;
+}
+
+CDriverMirror CDriverProcessHelper::Mirror(const CMirrorRange *pRanges, size_t Count, uint32_t IntervalUs) const
+{
+	return m_Helper.Mirror(m_ProcessPid, pRanges, Count, IntervalUs);
+}
+
 void *CDriverProcessHelper::GetModuleBase(const wchar_t *pWideModuleName, size_t WideModuleNameSize) const
 {
-	return m_Helper.ReqGetModuleBase(m_ProcessPid, pWideModuleName, WideModuleNameSize);
+	void *ModuleBase = m_Helper.ReqGetModuleBase(m_ProcessPid, pWideModuleName, WideModuleNameSize);
+
+	if (m_pSectionCache != nullptr && ModuleBase != nullptr)
+		CacheModuleSections(pWideModuleName, WideModuleNameSize, ModuleBase);
+
+	return ModuleBase;
 }
 
 void *CDriverProcessHelper::GetModuleBase(const char *pModuleName, size_t ModuleNameSize) const
 {
-	return m_Helper.ReqGetModuleBase(m_ProcessPid, pModuleName, ModuleNameSize);
+	CSmallDeleteOnExit ScopeBuffer;
+
+	size_t WideModuleNameSize = MultiByteToWideChar(CP_UTF8, 0, pModuleName, (DWORD)ModuleNameSize, nullptr, 0);
+
+	wchar_t *pWideModuleName = ScopeBuffer.Alloc<wchar_t>(WideModuleNameSize * 2);
+
+	MultiByteToWideChar(CP_UTF8, 0, pModuleName, (DWORD)ModuleNameSize, pWideModuleName, (DWORD)WideModuleNameSize);
+
+	return GetModuleBase(pWideModuleName, WideModuleNameSize);
 }
 
 void *CDriverProcessHelper::GetModuleBase(const wchar_t *pWideModuleName) const
 {
-	return m_Helper.ReqGetModuleBase(m_ProcessPid, pWideModuleName);
+	return GetModuleBase(pWideModuleName, wcslen(pWideModuleName));
 }
 
 void *CDriverProcessHelper::GetModuleBase(const char *pModuleName) const
 {
-	return m_Helper.ReqGetModuleBase(m_ProcessPid, pModuleName);
+	return GetModuleBase(pModuleName, strlen(pModuleName));
 }
@@ -1,45 +1,246 @@
 #ifndef _DRIVER_HELPER_H_
 #define _DRIVER_HELPER_H_
 
+#include "driver.h"
+
 #include <cstdint>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+/**
+ * Own handle to driver which receives process and image lifecycle events.
+ * Events are queued by driver from the moment of construction.
+ * Wait must not be called from several threads at once.
+ */
+class CDriverEventSubscription
+{
+	void *m_DriverHandle;
+	void *m_WaitEvent;
+
+public:
+
+	CDriverEventSubscription();
+	~CDriverEventSubscription();
+
+	CDriverEventSubscription(CDriverEventSubscription &&Other);
+	CDriverEventSubscription(const CDriverEventSubscription &) = delete;
+	CDriverEventSubscription &operator=(const CDriverEventSubscription &) = delete;
+
+	/**
+	 * Blocks until driver delivers events or `TimeoutMs` passes.
+	 * Returns count of events written to `pEvents`, 0 on timeout.
+	 */
+	size_t Wait(CDriverEvent *pEvents, size_t MaxEvents, uint32_t TimeoutMs) const;
+};
+
+/**
+ * Own handle to driver which copies registered ranges of target process into shared buffer
+ * every interval, see CTL_RequestMirror.
+ * Mirroring stops on destruction or when target process exits.
+ */
+class CDriverMirror
+{
+	void *m_DriverHandle;
+	void *m_pOverlapped;
+	void *m_pBuffer;
+	size_t m_DataSize;
+	std::vector<size_t> m_Offsets;
+
+	void Close();
+
+public:
+
+	CDriverMirror(void *Pid, const CMirrorRange *pRanges, size_t Count, uint32_t IntervalUs);
+	~CDriverMirror();
+
+	CDriverMirror(CDriverMirror &&Other);
+	CDriverMirror(const CDriverMirror &) = delete;
+	CDriverMirror &operator=(const CDriverMirror &) = delete;
+
+	// Size of snapshot, ranges are padded with DRIVER_MIRROR_ALIGN
+	size_t GetDataSize() const { return m_DataSize; }
+	size_t GetRangeOffset(size_t Index) const { return m_Offsets[Index]; }
+
+	// False once driver stopped mirroring, last snapshot stays readable
+	bool IsActive() const;
+
+	/**
+	 * Copies consistent snapshot of all ranges to `pOut` without blocking or calling driver.
+	 * Returns false if driver kept updating during every attempt.
+	 * `pHeader` receives status and timestamp of copied update, `updates` is 0 before the first one.
+	 */
+	bool Snapshot(void *pOut, CMirrorHeader *pHeader = nullptr) const;
+};
 
-class CDriverHelper
+/**
+ * Requests CDriverProcessHelper is built on.
+ * Implemented by driver itself (CDriverHelper) and by backends which serve some of them without it.
+ * Unsupported requests throw.
+ */
+class CDriverBackend
+{
+public:
+
+	virtual ~CDriverBackend() {}
+
+	virtual void ReqReadProcessMemory(void *Pid, void *Addr, size_t Size, void *Out) const = 0;
+	virtual void ReqReadProcessMemoryBulk(void *Pid, void *Addr, size_t Size, void *Out) const = 0;
+	virtual void ReqReadProcessMemoryResident(void *Pid, void *Addr, size_t Size, void *pOut) const = 0;
+	virtual void ReqQueryResidency(void *Pid, void *Addr, size_t Size, uint8_t *pPresent) const = 0;
+	virtual void ReqWriteProcessMemory(void *Pid, void *Addr, size_t Size, const void *From) const = 0;
+	virtual void *ReqGetModuleBase(void *Pid, const wchar_t *pModuleName, size_t ModuleNameSize) const = 0;
+	virtual void ReqAtomic(void *Pid, const CAtomicOperation *pOperations, size_t Count, CAtomicResult *pResults) const = 0;
+	virtual size_t ReqQueryRegions(void *Pid, void *Start, CMemoryRegion *pRegions, size_t MaxRegions) const = 0;
+	virtual CDriverMirror Mirror(void *Pid, const CMirrorRange *pRanges, size_t Count, uint32_t IntervalUs) const = 0;
+};
+
+/**
+ * Transport is picked at construction from driver capabilities.
+ * Drivers without capability query get single METHOD_BUFFERED requests only.
+ */
+class CDriverHelper : public CDriverBackend
 {
 	void *m_DriverHandle;
+	CResponseCapabilities m_Capabilities;
+
+	void ReqReadProcessMemoryChunks(void *Pid, void *Addr, size_t Size, void *Out, bool Bulk) const;
+	void ReqReadProcessMemoryChunk(void *Pid, void *Addr, size_t Size, void *Out, bool Bulk) const;
+	void ReqReadProcessMemoryParallelChunk(void *Pid, void *Addr, size_t Size, void *Out, uint32_t Chunks) const;
+	void ReqWriteProcessMemoryChunk(void *Pid, void *Addr, size_t Size, const void *From) const;
 
 public:
 
 	CDriverHelper();
 	~CDriverHelper();
 
+	const CResponseCapabilities &GetCapabilities() const { return m_Capabilities; }
+	bool HasFeature(uint64_t Feature) const { return (m_Capabilities.Features & Feature) != 0; }
+
+	// Returns false if driver predates capability query
+	bool ReqCapabilities(CResponseCapabilities *pResponse) const;
+
+	// Throws only if driver is older than DRIVER_VERSION
 	uint32_t ReqVersion() const;
-	void ReqReadProcessMemory(void *Pid, void *Addr, size_t Size, void *Out) const;
-	void ReqWriteProcessMemory(void *Pid, void *Addr, size_t Size, const void *From) const;
-	void *ReqGetModuleBase(void *Pid, const wchar_t *pModuleName, size_t ModuleNameSize) const;
+	void ReqReadProcessMemory(void *Pid, void *Addr, size_t Size, void *Out) const override;
+	void ReqWriteProcessMemory(void *Pid, void *Addr, size_t Size, const void *From) const override;
+	void *ReqGetModuleBase(void *Pid, const wchar_t *pModuleName, size_t ModuleNameSize) const override;
+
+	/**
+	 * Bulk read is copied by driver worker in chunks and yields to interactive requests of all clients.
+	 * Drivers without DRIVER_FEATURE_QOS get ordinary read.
+	 */
+	void ReqReadProcessMemoryBulk(void *Pid, void *Addr, size_t Size, void *Out) const override;
+
+	/**
+	 * Large read split by driver into `Chunks` parts copied on several cores, see CTL_RequestReadProcessMemoryParallel.
+	 * `Chunks` of 0 lets driver pick. Drivers without DRIVER_FEATURE_PARALLEL_READ get ordinary read.
+	 */
+	void ReqReadProcessMemoryParallel(void *Pid, void *Addr, size_t Size, void *Out, uint32_t Chunks = 0) const;
+
+	/**
+	 * Reads without faulting target pages in, see CTL_RequestReadProcessMemoryResident.
+	 * `pOut` must have room for `Size` + DRIVER_RESIDENCY_BITMAP_SIZE(Addr, Size) bytes, bitmap is written after data.
+	 */
+	void ReqReadProcessMemoryResident(void *Pid, void *Addr, size_t Size, void *pOut) const override;
+
+	// `pPresent` must have room for DRIVER_RESIDENCY_BITMAP_SIZE(Addr, Size) bytes
+	void ReqQueryResidency(void *Pid, void *Addr, size_t Size, uint8_t *pPresent) const override;
+
+	// DRIVER_PRIORITY_* of every read and write sent through this helper
+	void ReqSetPriority(uint32_t Priority) const;
 
 	void *ReqGetModuleBase(void *Pid, const char *pModuleName, size_t ModuleNameSize) const;
 	void *ReqGetModuleBase(void *Pid, const wchar_t *pModuleName) const;
 	void *ReqGetModuleBase(void *Pid, const char *pModuleName) const;
+
+	void ReqAtomic(void *Pid, const CAtomicOperation *pOperations, size_t Count, CAtomicResult *pResults) const override;
+
+	// Returns count of committed regions written, less than `MaxRegions` at the end of address space
+	size_t ReqQueryRegions(void *Pid, void *Start, CMemoryRegion *pRegions, size_t MaxRegions) const override;
+
+	CDriverEventSubscription SubscribeEvents() const;
+
+	CDriverMirror Mirror(void *Pid, const CMirrorRange *pRanges, size_t Count, uint32_t IntervalUs) const override;
 };
 
+struct CSectionCache;
+
 class CDriverProcessHelper
 {
-	const CDriverHelper &m_Helper;
+	const CDriverBackend &m_Helper;
 	void *m_ProcessPid;
 
+	// Null until EnableSectionCache, copies of helper share it
+	std::shared_ptr<CSectionCache> m_pSectionCache;
+
+	void CacheModuleSections(const wchar_t *pWideModuleName, size_t WideModuleNameSize, void *ModuleBase) const;
+
+	template <typename T>
+	static uint64_t ToAtomicValue(const T &Value)
+	{
+		static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8, "Atomic operations support only 1, 2, 4 and 8 byte values");
+
+		uint64_t Result = 0;
+		memcpy(&Result, &Value, sizeof(T));
+		return Result;
+	}
+
+	template <typename T>
+	static T FromAtomicValue(uint64_t Value)
+	{
+		T Result;
+		memcpy(&Result, &Value, sizeof(T));
+		return Result;
+	}
+
+	uint64_t AtomicSingle(uint32_t Op, void *Addr, size_t Size, uint64_t Operand, uint64_t Comparand, bool *pStored) const;
+
 public:
 
-	CDriverProcessHelper(const CDriverHelper &Helper, void *Pid);
+	CDriverProcessHelper(const CDriverBackend &Helper, void *Pid);
 
-	CDriverProcessHelper(const CDriverHelper &Helper, const wchar_t *pProcName, size_t ProcNameSize);
+	CDriverProcessHelper(const CDriverBackend &Helper, const wchar_t *pProcName, size_t ProcNameSize);
 
-	CDriverProcessHelper(const CDriverHelper &Helper, const char *pProcName, size_t ProcNameSize);
-	CDriverProcessHelper(const CDriverHelper &Helper, const wchar_t *pProcName);
-	CDriverProcessHelper(const CDriverHelper &Helper, const char *pProcName);
+	CDriverProcessHelper(const CDriverBackend &Helper, const char *pProcName, size_t ProcNameSize);
+	CDriverProcessHelper(const CDriverBackend &Helper, const wchar_t *pProcName);
+	CDriverProcessHelper(const CDriverBackend &Helper, const char *pProcName);
+
+	~CDriverProcessHelper();
+
+	void *GetPid() const { return m_ProcessPid; }
+
+	/**
+	 * From now on GetModuleBase copies non-writable sections of found module once, and reads which fall entirely
+	 * inside one of them are served from the copy without a request.
+	 * Copy is dropped when module is found at another base or is written through this helper.
+	 * Sections which failed to read are not retried until module is invalidated or found at another base.
+	 * Changes made by target itself are not seen, use InvalidateSectionCache for self modifying modules.
+	 * Must be called before helper is shared between threads or copied, copies made after that share the cache.
+	 */
+	void EnableSectionCache();
+	void InvalidateSectionCache(void *ModuleBase) const;
+	void ClearSectionCache() const;
 
 	void ReadProcessMemory(void *Addr, size_t Size, void *Out) const;
 	void WriteProcessMemory(void *Addr, size_t Size, const void *From) const;
 
+	// For dumps and sweeps, see CDriverHelper::ReqReadProcessMemoryBulk
+	void ReadProcessMemoryBulk(void *Addr, size_t Size, void *Out) const;
+
+	/**
+	 * Copies only resident pages, others are zero filled. Returns true if all pages were resident.
+	 * `pPresent` receives bitmap with one bit per page, starting from page of `Addr`.
+	 */
+	bool ReadResident(void *Addr, size_t Size, void *Out, std::vector<uint8_t> *pPresent = nullptr) const;
+	std::vector<uint8_t> QueryResidency(void *Addr, size_t Size) const;
+
+	static bool IsPagePresent(const std::vector<uint8_t> &Present, size_t Page)
+	{
+		return (Present[Page / 8] >> (Page % 8) & 1) != 0;
+	}
+
 	template <typename T>
 	T Read(void *Addr) const
 	{
@@ -54,6 +255,59 @@ public:
 		WriteProcessMemory(Addr, sizeof(T), &Value);
 	}
 
+	/**
+	 * Runs up to GetCapabilities().MaxBatchCount operations under single attach.
+	 * Per operation status is reported in results, only request failure throws.
+	 */
+	void Atomic(const CAtomicOperation *pOperations, size_t Count, CAtomicResult *pResults) const;
+
+	/**
+	 * Returns value before the operation. `Addr` must be aligned to sizeof(T).
+	 */
+	template <typename T>
+	T CompareExchange(void *Addr, const T &Exchange, const T &Comparand) const
+	{
+		return FromAtomicValue<T>(AtomicSingle(DRIVER_ATOMIC_COMPARE_EXCHANGE, Addr, sizeof(T), ToAtomicValue(Exchange), ToAtomicValue(Comparand), nullptr));
+	}
+
+	template <typename T>
+	T FetchAdd(void *Addr, const T &Value) const
+	{
+		static_assert(std::is_integral<T>::value, "FetchAdd supports only integral types");
+		return FromAtomicValue<T>(AtomicSingle(DRIVER_ATOMIC_FETCH_ADD, Addr, sizeof(T), ToAtomicValue(Value), 0, nullptr));
+	}
+
+	template <typename T>
+	T FetchOr(void *Addr, const T &Value) const
+	{
+		static_assert(std::is_integral<T>::value, "FetchOr supports only integral types");
+		return FromAtomicValue<T>(AtomicSingle(DRIVER_ATOMIC_FETCH_OR, Addr, sizeof(T), ToAtomicValue(Value), 0, nullptr));
+	}
+
+	template <typename T>
+	T FetchAnd(void *Addr, const T &Value) const
+	{
+		static_assert(std::is_integral<T>::value, "FetchAnd supports only integral types");
+		return FromAtomicValue<T>(AtomicSingle(DRIVER_ATOMIC_FETCH_AND, Addr, sizeof(T), ToAtomicValue(Value), 0, nullptr));
+	}
+
+	/**
+	 * Returns true if `Value` was written.
+	 */
+	template <typename T>
+	bool WriteIfEqual(void *Addr, const T &Value, const T &Expected) const
+	{
+		bool Stored;
+		AtomicSingle(DRIVER_ATOMIC_WRITE_IF_EQUAL, Addr, sizeof(T), ToAtomicValue(Value), ToAtomicValue(Expected), &Stored);
+		return Stored;
+	}
+
+	// All committed regions in address order
+	std::vector<CMemoryRegion> QueryRegions() const;
+
+	// For values polled every frame, see CDriverMirror
+	CDriverMirror Mirror(const CMirrorRange *pRanges, size_t Count, uint32_t IntervalUs) const;
+
 	void *GetModuleBase(const wchar_t *pModuleName, size_t ModuleNameSize) const;
 
 	void *GetModuleBase(const char *pModuleName, size_t ModuleNameSize) const;
@@ -0,0 +1,921 @@
+#include "drivercache.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * Layout of broker file: header, request ring, calls, slots.
+ * Every field is written by broker only, except ring cells and calls which clients fill.
+ * Everything shared is lock free. Ring cell or call claimed by client which died before it finished them
+ * is taken back by broker after CacheReclaimUs, so crashed client can't block broker or other clients.
+ */
+static const uint32_t CacheMagic = 0x48434452;
+static const uint32_t CacheVersion = 2;
+static const uint32_t CacheRingSize = 1024;
+static const uint32_t CacheCallCount = 8;
+
+// Input and output of one call
+static const size_t CacheCallDataSize = 0x10000;
+
+// Client holds ring cell or call only for a few stores, one that holds it this long is dead
+static const uint64_t CacheReclaimUs = 200000;
+
+// Broker reads at most this many adjacent pages with one request
+static const size_t CacheMaxRunPages = 64;
+
+// Client posts its misses again after this long, pages may have been evicted before it copied them
+static const uint64_t CacheRepostUs = 2000;
+
+static const int CacheSlotTries = 64;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Broker file needs address free atomics");
+
+struct CDriverCacheHeader
+{
+	// Set last by broker, after everything else is initialized
+	std::atomic<uint32_t> Magic;
+	uint32_t Version;
+	uint32_t SlotCount;
+	uint32_t RingSize;
+
+	// Time of last broker loop
+	std::atomic<uint64_t> Heartbeat;
+
+	std::atomic<uint64_t> RingHead;
+	std::atomic<uint64_t> RingTail;
+
+	uint32_t CallCount;
+	uint32_t Reserved32;
+	uint64_t Reserved[2];
+};
+
+static_assert(offsetof(CDriverCacheHeader, RingHead) == CDriverCacheBroker::RingHeadOffset, "RingHeadOffset doesn't match header");
+
+/**
+ * Cell of bounded queue with per cell sequence, many clients post and broker takes.
+ * Fields are atomic because cell taken back from dead client may still be written by it if it was only stalled.
+ */
+struct CDriverCacheRequest
+{
+	std::atomic<uint64_t> Sequence;
+	std::atomic<uint64_t> Pid;
+	std::atomic<uint64_t> Page;
+	std::atomic<uint64_t> PostTime;
+};
+
+enum ECacheCallState
+{
+	CacheCallFree,
+	CacheCallClaimed,
+	CacheCallPosted,
+	CacheCallRunning,
+	CacheCallDone,
+};
+
+enum ECacheCallKind
+{
+	CacheCallWrite = 1,
+	CacheCallModuleBase,
+	CacheCallQueryRegions,
+};
+
+static uint64_t CacheCallState(uint64_t Generation, ECacheCallState State)
+{
+	return Generation << 8 | State;
+}
+
+/**
+ * Request which client waits for, broker sends it to backend between page reads.
+ * Client claims free call, fills it and posts. Broker runs it, puts output to `Data` and `Size` and marks it done.
+ * On failure `Status` is nonzero and `Data` holds error message.
+ */
+struct CDriverCacheCall
+{
+	// Generation of claim in high bits, ECacheCallState in low byte
+	std::atomic<uint64_t> State;
+
+	uint64_t Kind;
+	uint64_t Pid;
+	uint64_t Addr;
+	uint64_t Size;
+	uint64_t Status;
+	uint64_t Result;
+	uint64_t Reserved;
+
+	uint8_t Data[CacheCallDataSize];
+};
+
+/**
+ * Copy of one page. `Sequence` is odd while broker rewrites slot.
+ * `FetchTime` is taken before the read, so data is at least as new as it.
+ */
+struct CDriverCacheSlot
+{
+	std::atomic<uint64_t> Sequence;
+	std::atomic<uint64_t> Pid;
+	std::atomic<uint64_t> Page;
+	std::atomic<uint64_t> FetchTime;
+
+	// Zero if page was read
+	std::atomic<uint64_t> Status;
+
+	uint64_t Reserved[3];
+
+	uint8_t Data[DRIVER_PAGE_SIZE];
+};
+
+static_assert(sizeof(CDriverCacheHeader) % 64 == 0 && sizeof(CDriverCacheCall) % 64 == 0 && sizeof(CDriverCacheSlot) % 64 == 0,
+	"Broker file records must keep cache line alignment");
+
+static size_t CacheRingOffset()
+{
+	return sizeof(CDriverCacheHeader);
+}
+
+static size_t CacheCallsOffset(uint32_t RingSize)
+{
+	size_t Offset = CacheRingOffset() + RingSize * sizeof(CDriverCacheRequest);
+	return (Offset + 63) & ~(size_t)63;
+}
+
+static size_t CacheSlotsOffset(uint32_t RingSize, uint32_t CallCount)
+{
+	return CacheCallsOffset(RingSize) + CallCount * sizeof(CDriverCacheCall);
+}
+
+static size_t CacheFileSize(uint32_t RingSize, uint32_t CallCount, uint32_t SlotCount)
+{
+	return CacheSlotsOffset(RingSize, CallCount) + (size_t)SlotCount * sizeof(CDriverCacheSlot);
+}
+
+// Sets of two slots are picked by mask
+static uint32_t CacheRoundSlotCount(uint32_t SlotCount)
+{
+	uint32_t Result = 2;
+
+	while (Result < SlotCount)
+		Result *= 2;
+
+	return Result;
+}
+
+// Steady clock is system wide on both Windows and POSIX, so broker and clients agree on it
+static uint64_t CacheNow()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void CacheBackoff(uint32_t &Spins)
+{
+	if (Spins++ < 64)
+		std::this_thread::yield();
+	else
+		std::this_thread::sleep_for(std::chrono::microseconds(50));
+}
+
+// Page may live in one of two adjacent slots
+static size_t CacheSlotSet(uint64_t Pid, uint64_t Page, uint32_t SlotCount)
+{
+	uint64_t Hash = (Page / DRIVER_PAGE_SIZE) * 0x9E3779B97F4A7C15ull ^ Pid * 0xC2B2AE3D27D4EB4Full;
+	Hash ^= Hash >> 29;
+
+	return (size_t)(Hash & (SlotCount - 1)) & ~(size_t)1;
+}
+
+enum ECacheLookup
+{
+	CacheMiss,
+	CacheHit,
+	CacheFailed,
+};
+
+/**
+ * Copies part of page inside [Start, End) to `Out` which receives [Start, End), `Out` may be NULL to only look up.
+ * Copy must be fetched not earlier than `MinTime`.
+ */
+static ECacheLookup CacheCopyPage(CDriverCacheSlot *pSlots, uint32_t SlotCount, uint64_t Pid, uint64_t Page, uint64_t MinTime, uint64_t Start, uint64_t End, void *Out)
+{
+	size_t Set = CacheSlotSet(Pid, Page, SlotCount);
+
+	uint64_t CopyStart = std::max(Start, Page);
+	uint64_t CopyEnd = std::min(End, Page + DRIVER_PAGE_SIZE);
+
+	for (size_t Way = 0; Way < 2; Way++)
+	{
+		CDriverCacheSlot &Slot = pSlots[Set + Way];
+
+		for (int i = 0; i < CacheSlotTries; i++)
+		{
+			uint64_t Sequence = Slot.Sequence.load(std::memory_order_acquire);
+
+			// Broker is in the middle of update
+			if (Sequence & 1)
+			{
+				std::this_thread::yield();
+				continue;
+			}
+
+			if (Slot.Pid.load(std::memory_order_relaxed) != Pid || Slot.Page.load(std::memory_order_relaxed) != Page)
+				break;
+
+			if (Slot.FetchTime.load(std::memory_order_relaxed) < MinTime)
+				break;
+
+			uint64_t Status = Slot.Status.load(std::memory_order_relaxed);
+
+			if (Status == 0 && Out != nullptr)
+				memcpy(static_cast<uint8_t *>(Out) + (CopyStart - Start), Slot.Data + (CopyStart - Page), (size_t)(CopyEnd - CopyStart));
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+
+			if (Slot.Sequence.load(std::memory_order_relaxed) == Sequence)
+				return Status == 0 ? CacheHit : CacheFailed;
+		}
+	}
+
+	return CacheMiss;
+}
+
+CDriverCacheBroker::CDriverCacheBroker(const CDriverBackend &Backend, const char *pPath, uint32_t SlotCount) :
+	m_Backend(Backend),
+	m_File(pPath, CacheFileSize(CacheRingSize, CacheCallCount, CacheRoundSlotCount(SlotCount))),
+	m_Stop(false),
+	m_BackendReads(0),
+	m_ServedPages(0)
+{
+	uint32_t RoundedSlotCount = CacheRoundSlotCount(SlotCount);
+
+	CDriverCacheHeader *pHeader = new (m_File.Data()) CDriverCacheHeader();
+
+	pHeader->Magic.store(0, std::memory_order_relaxed);
+	pHeader->Version = CacheVersion;
+	pHeader->SlotCount = RoundedSlotCount;
+	pHeader->RingSize = CacheRingSize;
+	pHeader->Heartbeat.store(CacheNow(), std::memory_order_relaxed);
+	pHeader->RingHead.store(0, std::memory_order_relaxed);
+	pHeader->RingTail.store(0, std::memory_order_relaxed);
+	pHeader->CallCount = CacheCallCount;
+
+	CDriverCacheRequest *pRing = m_File.At<CDriverCacheRequest>(CacheRingOffset());
+
+	for (uint32_t i = 0; i < CacheRingSize; i++)
+	{
+		new (&pRing[i]) CDriverCacheRequest();
+		pRing[i].Sequence.store(i, std::memory_order_relaxed);
+	}
+
+	CDriverCacheCall *pCalls = m_File.At<CDriverCacheCall>(CacheCallsOffset(CacheRingSize));
+
+	for (uint32_t i = 0; i < CacheCallCount; i++)
+	{
+		new (&pCalls[i]) CDriverCacheCall();
+		pCalls[i].State.store(CacheCallState(0, CacheCallFree), std::memory_order_relaxed);
+	}
+
+	CDriverCacheSlot *pSlots = m_File.At<CDriverCacheSlot>(CacheSlotsOffset(CacheRingSize, CacheCallCount));
+
+	for (uint32_t i = 0; i < RoundedSlotCount; i++)
+	{
+		new (&pSlots[i]) CDriverCacheSlot();
+		pSlots[i].Sequence.store(0, std::memory_order_relaxed);
+		pSlots[i].Pid.store(0, std::memory_order_relaxed);
+		pSlots[i].Page.store(UINT64_MAX, std::memory_order_relaxed);
+		pSlots[i].FetchTime.store(0, std::memory_order_relaxed);
+		pSlots[i].Status.store(0, std::memory_order_relaxed);
+	}
+
+	pHeader->Magic.store(CacheMagic, std::memory_order_release);
+
+	m_Thread = std::thread(&CDriverCacheBroker::Serve, this);
+}
+
+CDriverCacheBroker::~CDriverCacheBroker()
+{
+	m_Stop.store(true, std::memory_order_relaxed);
+	m_Thread.join();
+
+	// Clients fail fast instead of waiting for heartbeat timeout
+	m_File.At<CDriverCacheHeader>(0)->Magic.store(0, std::memory_order_release);
+}
+
+void CDriverCacheBroker::Serve()
+{
+	struct CPending
+	{
+		uint64_t Pid;
+		uint64_t Page;
+		uint64_t PostTime;
+	};
+
+	CDriverCacheHeader *pHeader = m_File.At<CDriverCacheHeader>(0);
+	CDriverCacheRequest *pRing = m_File.At<CDriverCacheRequest>(CacheRingOffset());
+	CDriverCacheCall *pCalls = m_File.At<CDriverCacheCall>(CacheCallsOffset(pHeader->RingSize));
+	CDriverCacheSlot *pSlots = m_File.At<CDriverCacheSlot>(CacheSlotsOffset(pHeader->RingSize, pHeader->CallCount));
+	uint32_t SlotCount = pHeader->SlotCount;
+
+	std::vector<CPending> Pending;
+	std::vector<uint8_t> Buffer(CacheMaxRunPages * DRIVER_PAGE_SIZE);
+	std::vector<uint64_t> Statuses(CacheMaxRunPages);
+	uint32_t Spins = 0;
+
+	// Claimed ring cell and calls which didn't change since given time, see CacheReclaimUs
+	uint64_t StuckTail = UINT64_MAX;
+	uint64_t StuckSince = 0;
+	std::vector<uint64_t> CallSeen(pHeader->CallCount, 0);
+	std::vector<uint64_t> CallSeenSince(pHeader->CallCount, 0);
+
+	auto Publish = [&](uint64_t Pid, uint64_t Page, uint64_t FetchTime, uint64_t Status, const uint8_t *pData)
+	{
+		size_t Set = CacheSlotSet(Pid, Page, SlotCount);
+
+		// Older copy of the same page, otherwise the least recently fetched slot of set
+		size_t Index = Set;
+
+		if (pSlots[Set].Pid.load(std::memory_order_relaxed) == Pid && pSlots[Set].Page.load(std::memory_order_relaxed) == Page)
+			Index = Set;
+		else if (pSlots[Set + 1].Pid.load(std::memory_order_relaxed) == Pid && pSlots[Set + 1].Page.load(std::memory_order_relaxed) == Page)
+			Index = Set + 1;
+		else if (pSlots[Set + 1].FetchTime.load(std::memory_order_relaxed) < pSlots[Set].FetchTime.load(std::memory_order_relaxed))
+			Index = Set + 1;
+
+		CDriverCacheSlot &Slot = pSlots[Index];
+
+		uint64_t Sequence = Slot.Sequence.load(std::memory_order_relaxed);
+		Slot.Sequence.store(Sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		Slot.Pid.store(Pid, std::memory_order_relaxed);
+		Slot.Page.store(Page, std::memory_order_relaxed);
+		Slot.FetchTime.store(FetchTime, std::memory_order_relaxed);
+		Slot.Status.store(Status, std::memory_order_relaxed);
+
+		if (Status == 0)
+			memcpy(Slot.Data, pData, DRIVER_PAGE_SIZE);
+
+		Slot.Sequence.store(Sequence + 2, std::memory_order_release);
+	};
+
+	// Copies of pages are stale after write
+	auto Drop = [&](uint64_t Pid, uint64_t Start, uint64_t Size)
+	{
+		for (uint64_t Page = Start & ~(uint64_t)(DRIVER_PAGE_SIZE - 1); Page < Start + Size; Page += DRIVER_PAGE_SIZE)
+		{
+			size_t Set = CacheSlotSet(Pid, Page, SlotCount);
+
+			for (size_t Index = Set; Index < Set + 2; Index++)
+			{
+				CDriverCacheSlot &Slot = pSlots[Index];
+
+				if (Slot.Pid.load(std::memory_order_relaxed) != Pid || Slot.Page.load(std::memory_order_relaxed) != Page)
+					continue;
+
+				uint64_t Sequence = Slot.Sequence.load(std::memory_order_relaxed);
+				Slot.Sequence.store(Sequence + 1, std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_release);
+
+				Slot.Page.store(UINT64_MAX, std::memory_order_relaxed);
+				Slot.FetchTime.store(0, std::memory_order_relaxed);
+
+				Slot.Sequence.store(Sequence + 2, std::memory_order_release);
+			}
+		}
+	};
+
+	auto RunCall = [&](CDriverCacheCall &Call)
+	{
+		void *Pid = reinterpret_cast<void *>(Call.Pid);
+		void *Addr = reinterpret_cast<void *>(Call.Addr);
+
+		try
+		{
+			switch (Call.Kind)
+			{
+				case CacheCallWrite:
+					if (Call.Size > CacheCallDataSize)
+						throw std::runtime_error("ReqWriteProcessMemory call is too large");
+
+					m_Backend.ReqWriteProcessMemory(Pid, Addr, (size_t)Call.Size, Call.Data);
+					Drop(Call.Pid, Call.Addr, Call.Size);
+					Call.Size = 0;
+					break;
+
+				case CacheCallModuleBase:
+					if (Call.Size > CacheCallDataSize / sizeof(wchar_t))
+						throw std::runtime_error("ReqGetModuleBase call is too large");
+
+					Call.Result = reinterpret_cast<uint64_t>(m_Backend.ReqGetModuleBase(Pid, reinterpret_cast<const wchar_t *>(Call.Data), (size_t)Call.Size));
+					Call.Size = 0;
+					break;
+
+				case CacheCallQueryRegions:
+					if (Call.Size > CacheCallDataSize / sizeof(CMemoryRegion))
+						throw std::runtime_error("ReqQueryRegions call is too large");
+
+					Call.Result = m_Backend.ReqQueryRegions(Pid, Addr, reinterpret_cast<CMemoryRegion *>(Call.Data), (size_t)Call.Size);
+					Call.Size = Call.Result * sizeof(CMemoryRegion);
+					break;
+
+				default:
+					throw std::runtime_error("Unknown call of cache broker");
+			}
+
+			Call.Status = 0;
+		}
+		catch (const std::runtime_error &e)
+		{
+			size_t Length = std::min(strlen(e.what()), CacheCallDataSize - 1);
+
+			memcpy(Call.Data, e.what(), Length);
+			Call.Data[Length] = 0;
+
+			Call.Status = 1;
+			Call.Size = 0;
+		}
+	};
+
+	auto ServeCalls = [&](uint64_t Now)
+	{
+		bool Served = false;
+
+		for (uint32_t i = 0; i < pHeader->CallCount; i++)
+		{
+			CDriverCacheCall &Call = pCalls[i];
+			uint64_t State = Call.State.load(std::memory_order_acquire);
+			uint64_t Generation = State >> 8;
+
+			switch (State & 0xFF)
+			{
+				case CacheCallPosted:
+					// Client which gave up waiting withdraws its call
+					if (!Call.State.compare_exchange_strong(State, CacheCallState(Generation, CacheCallRunning), std::memory_order_acquire))
+						break;
+
+					RunCall(Call);
+					Call.State.store(CacheCallState(Generation, CacheCallDone), std::memory_order_release);
+					Served = true;
+					break;
+
+				case CacheCallClaimed:
+				case CacheCallDone:
+					if (CallSeen[i] != State)
+					{
+						CallSeen[i] = State;
+						CallSeenSince[i] = Now;
+					}
+					else if (Now - CallSeenSince[i] > CacheReclaimUs)
+					{
+						Call.State.compare_exchange_strong(State, CacheCallState(Generation, CacheCallFree), std::memory_order_relaxed);
+					}
+					break;
+			}
+		}
+
+		return Served;
+	};
+
+	while (!m_Stop.load(std::memory_order_relaxed))
+	{
+		uint64_t Now = CacheNow();
+
+		pHeader->Heartbeat.store(Now, std::memory_order_relaxed);
+
+		bool Served = ServeCalls(Now);
+
+		Pending.clear();
+
+		uint64_t Tail = pHeader->RingTail.load(std::memory_order_relaxed);
+
+		for (;;)
+		{
+			CDriverCacheRequest &Cell = pRing[Tail % CacheRingSize];
+			uint64_t Sequence = Cell.Sequence.load(std::memory_order_acquire);
+
+			if (Sequence != Tail + 1)
+			{
+				// Claimed by client but not filled yet
+				if (Sequence == Tail && pHeader->RingHead.load(std::memory_order_relaxed) > Tail)
+				{
+					if (StuckTail != Tail)
+					{
+						StuckTail = Tail;
+						StuckSince = Now;
+					}
+					else if (Now - StuckSince > CacheReclaimUs && Cell.Sequence.compare_exchange_strong(Sequence, Tail + CacheRingSize, std::memory_order_relaxed))
+					{
+						Tail++;
+						continue;
+					}
+				}
+
+				break;
+			}
+
+			Pending.push_back({ Cell.Pid.load(std::memory_order_relaxed), Cell.Page.load(std::memory_order_relaxed), Cell.PostTime.load(std::memory_order_relaxed) });
+
+			Cell.Sequence.store(Tail + CacheRingSize, std::memory_order_release);
+			Tail++;
+		}
+
+		pHeader->RingTail.store(Tail, std::memory_order_relaxed);
+
+		if (Pending.empty())
+		{
+			if (Served)
+				Spins = 0;
+			else
+				CacheBackoff(Spins);
+
+			continue;
+		}
+
+		Spins = 0;
+
+		// Several clients asking for the same page get one read, new enough for the latest of them
+		std::sort(Pending.begin(), Pending.end(), [](const CPending &a, const CPending &b)
+		{
+			return a.Pid != b.Pid ? a.Pid < b.Pid : a.Page != b.Page ? a.Page < b.Page : a.PostTime > b.PostTime;
+		});
+
+		Pending.erase(std::unique(Pending.begin(), Pending.end(), [](const CPending &a, const CPending &b)
+		{
+			return a.Pid == b.Pid && a.Page == b.Page;
+		}), Pending.end());
+
+		// Read by request of another client since this one was posted
+		Pending.erase(std::remove_if(Pending.begin(), Pending.end(), [&](const CPending &Request)
+		{
+			return CacheCopyPage(pSlots, SlotCount, Request.Pid, Request.Page, Request.PostTime, 0, 0, nullptr) != CacheMiss;
+		}), Pending.end());
+
+		for (size_t Begin = 0; Begin < Pending.size();)
+		{
+			size_t End = Begin + 1;
+
+			while (End < Pending.size() && End - Begin < CacheMaxRunPages && Pending[End].Pid == Pending[Begin].Pid && Pending[End].Page == Pending[End - 1].Page + DRIVER_PAGE_SIZE)
+				End++;
+
+			size_t RunPages = End - Begin;
+			void *Pid = reinterpret_cast<void *>(Pending[Begin].Pid);
+			uint64_t FetchTime = CacheNow();
+
+			try
+			{
+				m_Backend.ReqReadProcessMemory(Pid, reinterpret_cast<void *>(Pending[Begin].Page), RunPages * DRIVER_PAGE_SIZE, Buffer.data());
+				m_BackendReads.fetch_add(1, std::memory_order_relaxed);
+
+				std::fill(Statuses.begin(), Statuses.begin() + RunPages, 0);
+			}
+			catch (const std::runtime_error &)
+			{
+				m_BackendReads.fetch_add(1, std::memory_order_relaxed);
+
+				// Find out which pages of run are unreadable
+				for (size_t i = 0; i < RunPages && RunPages > 1; i++)
+				{
+					try
+					{
+						m_Backend.ReqReadProcessMemory(Pid, reinterpret_cast<void *>(Pending[Begin + i].Page), DRIVER_PAGE_SIZE, Buffer.data() + i * DRIVER_PAGE_SIZE);
+						Statuses[i] = 0;
+					}
+					catch (const std::runtime_error &)
+					{
+						Statuses[i] = 1;
+					}
+
+					m_BackendReads.fetch_add(1, std::memory_order_relaxed);
+				}
+
+				if (RunPages == 1)
+					Statuses[0] = 1;
+			}
+
+			for (size_t i = 0; i < RunPages; i++)
+				Publish(Pending[Begin + i].Pid, Pending[Begin + i].Page, FetchTime, Statuses[i], Buffer.data() + i * DRIVER_PAGE_SIZE);
+
+			m_ServedPages.fetch_add(RunPages, std::memory_order_relaxed);
+
+			Begin = End;
+		}
+	}
+}
+
+CDriverCacheClient::CDriverCacheClient(const char *pPath, uint64_t MaxAgeUs, uint32_t TimeoutMs) :
+	m_File(pPath, 0),
+	m_MaxAgeUs(MaxAgeUs),
+	m_TimeoutMs(TimeoutMs)
+{
+	const CDriverCacheHeader *pHeader = m_File.At<CDriverCacheHeader>(0);
+
+	if (m_File.Size() < sizeof(CDriverCacheHeader) ||
+		pHeader->Magic.load(std::memory_order_acquire) != CacheMagic ||
+		pHeader->Version != CacheVersion ||
+		m_File.Size() < CacheFileSize(pHeader->RingSize, pHeader->CallCount, pHeader->SlotCount))
+	{
+		std::stringstream ss;
+		ss << "CDriverCacheClient no broker at ";
+		ss << pPath;
+
+		throw std::runtime_error(ss.str());
+	}
+
+	if (CacheNow() - pHeader->Heartbeat.load(std::memory_order_relaxed) > (uint64_t)m_TimeoutMs * 1000)
+	{
+		std::stringstream ss;
+		ss << "CDriverCacheClient broker at ";
+		ss << pPath;
+		ss << " doesn't respond";
+
+		throw std::runtime_error(ss.str());
+	}
+}
+
+void CDriverCacheClient::ReqReadProcessMemory(void *Pid, void *Addr, size_t Size, void *Out) const
+{
+	CDriverCacheHeader *pHeader = m_File.At<CDriverCacheHeader>(0);
+	CDriverCacheRequest *pRing = m_File.At<CDriverCacheRequest>(CacheRingOffset());
+	CDriverCacheSlot *pSlots = m_File.At<CDriverCacheSlot>(CacheSlotsOffset(pHeader->RingSize, pHeader->CallCount));
+	uint32_t SlotCount = pHeader->SlotCount;
+
+	uint64_t ProcessId = reinterpret_cast<uint64_t>(Pid);
+	uint64_t Start = reinterpret_cast<uint64_t>(Addr);
+	uint64_t End = Start + Size;
+
+	uint64_t Now = CacheNow();
+	uint64_t MinTime = Now > m_MaxAgeUs ? Now - m_MaxAgeUs : 0;
+
+	std::vector<uint64_t> Missing;
+
+	auto Throw = [&](const char *pWhat, uint64_t Page)
+	{
+		std::stringstream ss;
+		ss << "ReqReadProcessMemory ";
+		ss << pWhat;
+		ss << " at page 0x";
+		ss << std::hex << Page;
+
+		throw std::runtime_error(ss.str());
+	};
+
+	for (uint64_t Page = Start & ~(uint64_t)(DRIVER_PAGE_SIZE - 1); Page < End; Page += DRIVER_PAGE_SIZE)
+	{
+		ECacheLookup Result = CacheCopyPage(pSlots, SlotCount, ProcessId, Page, MinTime, Start, End, Out);
+
+		if (Result == CacheFailed)
+			Throw("Failed", Page);
+
+		if (Result == CacheMiss)
+			Missing.push_back(Page);
+	}
+
+	// Misses must be read after they are posted
+	uint64_t PostTime = Now;
+	uint64_t LastPost = 0;
+	uint64_t Deadline = Now + (uint64_t)m_TimeoutMs * 1000;
+	uint32_t Spins = 0;
+
+	while (!Missing.empty())
+	{
+		Now = CacheNow();
+
+		if (Now > Deadline || pHeader->Magic.load(std::memory_order_relaxed) != CacheMagic)
+			Throw("broker doesn't respond", Missing.front());
+
+		if (LastPost == 0 || Now - LastPost >= CacheRepostUs)
+		{
+			LastPost = Now;
+
+			for (uint64_t Page : Missing)
+			{
+				uint64_t Head = pHeader->RingHead.load(std::memory_order_relaxed);
+
+				for (;;)
+				{
+					CDriverCacheRequest &Cell = pRing[Head % pHeader->RingSize];
+					int64_t Difference = (int64_t)(Cell.Sequence.load(std::memory_order_acquire) - Head);
+
+					if (Difference == 0)
+					{
+						if (!pHeader->RingHead.compare_exchange_weak(Head, Head + 1, std::memory_order_relaxed))
+							continue;
+
+						Cell.Pid.store(ProcessId, std::memory_order_relaxed);
+						Cell.Page.store(Page, std::memory_order_relaxed);
+						Cell.PostTime.store(PostTime, std::memory_order_relaxed);
+
+						// Fails if broker took cell back because we were stalled, then page is posted again later
+						uint64_t Claimed = Head;
+						Cell.Sequence.compare_exchange_strong(Claimed, Head + 1, std::memory_order_release, std::memory_order_relaxed);
+						break;
+					}
+
+					// Ring is full, the rest is posted again later
+					if (Difference < 0)
+						break;
+
+					Head = pHeader->RingHead.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		CacheBackoff(Spins);
+
+		Missing.erase(std::remove_if(Missing.begin(), Missing.end(), [&](uint64_t Page)
+		{
+			ECacheLookup Result = CacheCopyPage(pSlots, SlotCount, ProcessId, Page, PostTime, Start, End, Out);
+
+			if (Result == CacheFailed)
+				Throw("Failed", Page);
+
+			return Result == CacheHit;
+		}), Missing.end());
+	}
+}
+
+void CDriverCacheClient::ReqReadProcessMemoryBulk(void *Pid, void *Addr, size_t Size, void *Out) const
+{
+	ReqReadProcessMemory(Pid, Addr, Size, Out);
+}
+
+void CDriverCacheClient::ReqReadProcessMemoryResident(void *, void *, size_t, void *) const
+{
+	throw std::runtime_error("ReqReadProcessMemoryResident is not supported by cache broker");
+}
+
+void CDriverCacheClient::ReqQueryResidency(void *, void *, size_t, uint8_t *) const
+{
+	throw std::runtime_error("ReqQueryResidency is not supported by cache broker");
+}
+
+uint64_t CDriverCacheClient::Call(const char *pName, uint32_t Kind, void *Pid, uint64_t Addr, uint64_t Size, const void *pInput, size_t InputSize, void *pOutput, size_t OutputSize) const
+{
+	CDriverCacheHeader *pHeader = m_File.At<CDriverCacheHeader>(0);
+	CDriverCacheCall *pCalls = m_File.At<CDriverCacheCall>(CacheCallsOffset(pHeader->RingSize));
+
+	uint64_t Deadline = CacheNow() + (uint64_t)m_TimeoutMs * 1000;
+	uint32_t Spins = 0;
+
+	auto Throw = [&](const char *pWhat)
+	{
+		std::stringstream ss;
+		ss << pName;
+		ss << " ";
+		ss << pWhat;
+
+		throw std::runtime_error(ss.str());
+	};
+
+	auto CheckBroker = [&]()
+	{
+		if (CacheNow() > Deadline || pHeader->Magic.load(std::memory_order_relaxed) != CacheMagic)
+			Throw("broker doesn't respond");
+	};
+
+	CDriverCacheCall *pCall = nullptr;
+	uint64_t Generation = 0;
+
+	while (pCall == nullptr)
+	{
+		for (uint32_t i = 0; i < pHeader->CallCount && pCall == nullptr; i++)
+		{
+			uint64_t State = pCalls[i].State.load(std::memory_order_relaxed);
+
+			if ((State & 0xFF) != CacheCallFree)
+				continue;
+
+			Generation = (State >> 8) + 1;
+
+			if (pCalls[i].State.compare_exchange_strong(State, CacheCallState(Generation, CacheCallClaimed), std::memory_order_acquire))
+				pCall = &pCalls[i];
+		}
+
+		if (pCall == nullptr)
+		{
+			CheckBroker();
+			CacheBackoff(Spins);
+		}
+	}
+
+	pCall->Kind = Kind;
+	pCall->Pid = reinterpret_cast<uint64_t>(Pid);
+	pCall->Addr = Addr;
+	pCall->Size = Size;
+
+	if (InputSize != 0)
+		memcpy(pCall->Data, pInput, InputSize);
+
+	uint64_t State = CacheCallState(Generation, CacheCallClaimed);
+
+	if (!pCall->State.compare_exchange_strong(State, CacheCallState(Generation, CacheCallPosted), std::memory_order_release))
+		Throw("call was taken back by broker");
+
+	Spins = 0;
+
+	for (;;)
+	{
+		State = pCall->State.load(std::memory_order_acquire);
+
+		if (State == CacheCallState(Generation, CacheCallDone))
+			break;
+
+		if (State >> 8 != Generation)
+			Throw("call was taken back by broker");
+
+		try
+		{
+			CheckBroker();
+		}
+		catch (const std::runtime_error &)
+		{
+			// Broker didn't take call yet, otherwise it frees call when done
+			State = CacheCallState(Generation, CacheCallPosted);
+			pCall->State.compare_exchange_strong(State, CacheCallState(Generation, CacheCallFree), std::memory_order_relaxed);
+			throw;
+		}
+
+		CacheBackoff(Spins);
+	}
+
+	uint64_t Status = pCall->Status;
+	uint64_t Result = pCall->Result;
+	std::string Error;
+
+	if (Status != 0)
+		Error.assign(reinterpret_cast<const char *>(pCall->Data), strnlen(reinterpret_cast<const char *>(pCall->Data), CacheCallDataSize));
+	else if (OutputSize != 0)
+		memcpy(pOutput, pCall->Data, std::min<size_t>(OutputSize, (size_t)pCall->Size));
+
+	State = CacheCallState(Generation, CacheCallDone);
+
+	// Output could be overwritten by another client if broker took call back meanwhile
+	if (!pCall->State.compare_exchange_strong(State, CacheCallState(Generation, CacheCallFree), std::memory_order_relaxed))
+		Throw("call was taken back by broker");
+
+	if (Status != 0)
+		throw std::runtime_error(Error);
+
+	return Result;
+}
+
+void CDriverCacheClient::ReqWriteProcessMemory(void *Pid, void *Addr, size_t Size, const void *From) const
+{
+	do
+	{
+		size_t Chunk = std::min(Size, CacheCallDataSize);
+
+		Call("ReqWriteProcessMemory", CacheCallWrite, Pid, reinterpret_cast<uint64_t>(Addr), Chunk, From, Chunk, nullptr, 0);
+
+		Addr = static_cast<char *>(Addr) + Chunk;
+		From = static_cast<const char *>(From) + Chunk;
+		Size -= Chunk;
+	}
+	while (Size != 0);
+}
+
+void *CDriverCacheClient::ReqGetModuleBase(void *Pid, const wchar_t *pModuleName, size_t ModuleNameSize) const
+{
+	if (ModuleNameSize > CacheCallDataSize / sizeof(wchar_t))
+		throw std::runtime_error("ReqGetModuleBase module name is too long");
+
+	return reinterpret_cast<void *>(Call("ReqGetModuleBase", CacheCallModuleBase, Pid, 0, ModuleNameSize, pModuleName, ModuleNameSize * sizeof(wchar_t), nullptr, 0));
+}
+
+void CDriverCacheClient::ReqAtomic(void *, const CAtomicOperation *, size_t, CAtomicResult *) const
+{
+	throw std::runtime_error("ReqAtomic is not supported by cache broker");
+}
+
+size_t CDriverCacheClient::ReqQueryRegions(void *Pid, void *Start, CMemoryRegion *pRegions, size_t MaxRegions) const
+{
+	static const size_t CallMaxRegions = CacheCallDataSize / sizeof(CMemoryRegion);
+
+	size_t Count = 0;
+
+	// Broker answers at most CallMaxRegions at once, query goes on from the end of last one
+	while (Count < MaxRegions)
+	{
+		size_t Asked = std::min(MaxRegions - Count, CallMaxRegions);
+
+		size_t Got = (size_t)Call("ReqQueryRegions", CacheCallQueryRegions, Pid, reinterpret_cast<uint64_t>(Start), Asked, nullptr, 0, pRegions + Count, Asked * sizeof(CMemoryRegion));
+
+		Count += Got;
+
+		if (Got < Asked)
+			break;
+
+		const CMemoryRegion &Last = pRegions[Count - 1];
+		Start = static_cast<char *>(Last.base) + Last.size;
+	}
+
+	return Count;
+}
+
+CDriverMirror CDriverCacheClient::Mirror(void *, const CMirrorRange *, size_t, uint32_t) const
+{
+	throw std::runtime_error("Mirror is not supported by cache broker");
+}
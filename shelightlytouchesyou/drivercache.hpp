@@ -0,0 +1,89 @@
+#ifndef _DRIVER_CACHE_H_
+#define _DRIVER_CACHE_H_
+
+#include "driverapi.hpp"
+#include "mappedfile.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+/**
+ * Serves page reads of several client processes from one backend, usually the only CDriverHelper on the host.
+ * Pages live in file `pPath` mapped by broker and every CDriverCacheClient. Page read for one client is served to all
+ * others until it's older than they accept, so driver traffic follows count of distinct pages, not count of clients.
+ * Misses are posted to a ring in the same file and read by broker thread, adjacent pages in one request.
+ * Put the file on tmpfs (/dev/shm) on POSIX hosts.
+ */
+class CDriverCacheBroker
+{
+	const CDriverBackend &m_Backend;
+	CMappedFile m_File;
+
+	std::atomic<bool> m_Stop;
+	std::atomic<uint64_t> m_BackendReads;
+	std::atomic<uint64_t> m_ServedPages;
+
+	std::thread m_Thread;
+
+	void Serve();
+
+public:
+
+	static const uint32_t DefaultSlotCount = 4096;
+
+	// Offset of count of claimed ring cells in file, for tests of clients dying between claim and post
+	static const size_t RingHeadOffset = 24;
+
+	/**
+	 * Existing file is reset, clients attached to previous broker of `pPath` must reattach.
+	 * `SlotCount` pages are cached, it's rounded up to power of two.
+	 */
+	CDriverCacheBroker(const CDriverBackend &Backend, const char *pPath, uint32_t SlotCount = DefaultSlotCount);
+	~CDriverCacheBroker();
+
+	CDriverCacheBroker(const CDriverCacheBroker &) = delete;
+	CDriverCacheBroker &operator=(const CDriverCacheBroker &) = delete;
+
+	// Requests sent to backend and pages they read, pages already fresh enough are not counted
+	uint64_t GetBackendReads() const { return m_BackendReads.load(std::memory_order_relaxed); }
+	uint64_t GetServedPages() const { return m_ServedPages.load(std::memory_order_relaxed); }
+};
+
+/**
+ * Backend for CDriverProcessHelper which reads through broker of `pPath`.
+ * Copy of page is used until it's older than `MaxAgeUs`, usually length of client tick.
+ * Reads fail like driver ones: all or nothing.
+ * Writes, module bases and regions are sent to broker which runs them on its backend while client waits,
+ * written pages are dropped from cache. Writes larger than 64 KB are sent in parts. Other requests throw.
+ */
+class CDriverCacheClient : public CDriverBackend
+{
+	CMappedFile m_File;
+	uint64_t m_MaxAgeUs;
+	uint32_t m_TimeoutMs;
+
+	// Waits for broker to run request, returns its result. Up to `OutputSize` bytes of output are copied to `pOutput`.
+	uint64_t Call(const char *pName, uint32_t Kind, void *Pid, uint64_t Addr, uint64_t Size, const void *pInput, size_t InputSize, void *pOutput, size_t OutputSize) const;
+
+public:
+
+	// Throws if broker is not running. Broker is considered gone after `TimeoutMs` without an answer.
+	CDriverCacheClient(const char *pPath, uint64_t MaxAgeUs, uint32_t TimeoutMs = 1000);
+
+	CDriverCacheClient(const CDriverCacheClient &) = delete;
+	CDriverCacheClient &operator=(const CDriverCacheClient &) = delete;
+
+	void ReqReadProcessMemory(void *Pid, void *Addr, size_t Size, void *Out) const override;
+	void ReqReadProcessMemoryBulk(void *Pid, void *Addr, size_t Size, void *Out) const override;
+	void ReqReadProcessMemoryResident(void *Pid, void *Addr, size_t Size, void *pOut) const override;
+	void ReqQueryResidency(void *Pid, void *Addr, size_t Size, uint8_t *pPresent) const override;
+	void ReqWriteProcessMemory(void *Pid, void *Addr, size_t Size, const void *From) const override;
+	void *ReqGetModuleBase(void *Pid, const wchar_t *pModuleName, size_t ModuleNameSize) const override;
+	void ReqAtomic(void *Pid, const CAtomicOperation *pOperations, size_t Count, CAtomicResult *pResults) const override;
+	size_t ReqQueryRegions(void *Pid, void *Start, CMemoryRegion *pRegions, size_t MaxRegions) const override;
+	CDriverMirror Mirror(void *Pid, const CMirrorRange *pRanges, size_t Count, uint32_t IntervalUs) const override;
+};
+
+#endif // _DRIVER_CACHE_H_
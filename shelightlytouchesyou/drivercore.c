@@ -0,0 +1,598 @@
+#include "drivercore.h"
+
+static NTSTATUS
+CoreValidateRead(
+	_In_ const struct CDriverCoreRequest *Request
+)
+{
+	if (Request->InputLength != sizeof(struct CRequestReadProcessMemory))
+		return STATUS_INVALID_BUFFER_SIZE;
+
+	if (Request->OutputLength != ((struct CRequestReadProcessMemory *)Request->Buffer)->size)
+		return STATUS_INVALID_BUFFER_SIZE;
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS
+DriverCoreValidate(
+	_In_ const struct CDriverCoreRequest *Request
+)
+{
+	NTSTATUS status;
+	SIZE_T count;
+	void *buffer = Request->Buffer;
+
+	PAGED_CODE();
+
+	// Known requests use only these, so the rest is rejected before any buffer is looked at
+	if (METHOD_FROM_CTL_CODE(Request->IoControlCode) != METHOD_BUFFERED &&
+		METHOD_FROM_CTL_CODE(Request->IoControlCode) != METHOD_OUT_DIRECT)
+		return STATUS_INVALID_PARAMETER_2;
+
+	switch (Request->IoControlCode)
+	{
+		case CTL_RequestVersion:
+			if (Request->OutputLength != sizeof(struct CResponseVersion))
+				return STATUS_INVALID_BUFFER_SIZE;
+
+			return STATUS_SUCCESS;
+
+		case CTL_RequestCapabilities:
+			if (Request->OutputLength != sizeof(struct CResponseCapabilities))
+				return STATUS_INVALID_BUFFER_SIZE;
+
+			return STATUS_SUCCESS;
+
+		case CTL_RequestReadProcessMemory:
+			return CoreValidateRead(Request);
+
+		case CTL_RequestReadProcessMemoryDirect:
+		case CTL_RequestReadProcessMemoryBulk:
+			status = CoreValidateRead(Request);
+
+			if (!NT_SUCCESS(status))
+				return status;
+
+			// Empty output buffer has no MDL
+			if (Request->Output == NULL)
+				return STATUS_INVALID_BUFFER_SIZE;
+
+			return STATUS_SUCCESS;
+
+		case CTL_RequestReadProcessMemoryResident:
+			{
+				struct CRequestReadProcessMemory *request = buffer;
+
+				if (Request->InputLength != sizeof(struct CRequestReadProcessMemory))
+					return STATUS_INVALID_BUFFER_SIZE;
+
+				if (request->size > MAXULONG ||
+					Request->OutputLength != request->size + DRIVER_RESIDENCY_BITMAP_SIZE(request->ptr, request->size))
+					return STATUS_INVALID_BUFFER_SIZE;
+
+				if (Request->Output == NULL)
+					return STATUS_INVALID_BUFFER_SIZE;
+
+				return STATUS_SUCCESS;
+			}
+
+		case CTL_RequestReadProcessMemoryParallel:
+			{
+				struct CRequestReadProcessMemoryParallel *request = buffer;
+
+				if (Request->InputLength != sizeof(struct CRequestReadProcessMemoryParallel))
+					return STATUS_INVALID_BUFFER_SIZE;
+
+				if (Request->OutputLength != request->size)
+					return STATUS_INVALID_BUFFER_SIZE;
+
+				// Empty output buffer has no MDL
+				if (Request->Output == NULL)
+					return STATUS_INVALID_BUFFER_SIZE;
+
+				if (request->chunks > DRIVER_PARALLEL_MAX_CHUNKS || request->reserved != 0)
+					return STATUS_INVALID_PARAMETER;
+
+				return STATUS_SUCCESS;
+			}
+
+		case CTL_RequestQueryResidency:
+			{
+				struct CRequestQueryResidency *request = buffer;
+
+				if (Request->InputLength != sizeof(struct CRequestQueryResidency))
+					return STATUS_INVALID_BUFFER_SIZE;
+
+				if (request->size == 0 ||
+					request->size > MAXULONG ||
+					Request->OutputLength != DRIVER_RESIDENCY_BITMAP_SIZE(request->ptr, request->size))
+					return STATUS_INVALID_BUFFER_SIZE;
+
+				return STATUS_SUCCESS;
+			}
+
+		case CTL_RequestSetPriority:
+			if (Request->InputLength != sizeof(struct CRequestSetPriority))
+				return STATUS_INVALID_BUFFER_SIZE;
+
+			return STATUS_SUCCESS;
+
+		case CTL_RequestWriteProcessMemory:
+			if (Request->InputLength < sizeof(struct CRequestWriteProcessMemory))
+				return STATUS_INVALID_BUFFER_SIZE;
+
+			if (Request->InputLength != sizeof(struct CRequestWriteProcessMemory) + ((struct CRequestWriteProcessMemory *)buffer)->size)
+				return STATUS_INVALID_BUFFER_SIZE;
+
+			if (Request->OutputLength != 0)
+				return STATUS_INVALID_BUFFER_SIZE;
+
+			return STATUS_SUCCESS;
+
+		case CTL_RequestModuleBase:
+			if (Request->InputLength < sizeof(struct CRequestModuleBase))
+				return STATUS_INVALID_BUFFER_SIZE;
+
+			if (Request->InputLength != sizeof(struct CRequestModuleBase) + (((struct CRequestModuleBase *)buffer)->size + 1) * sizeof(WCHAR))
+				return STATUS_INVALID_BUFFER_SIZE;
+
+			if (Request->OutputLength != sizeof(void *))
+				return STATUS_INVALID_BUFFER_SIZE;
+
+			return STATUS_SUCCESS;
+
+		case CTL_RequestAtomic:
+			if (Request->InputLength < sizeof(struct CRequestAtomic))
+				return STATUS_INVALID_BUFFER_SIZE;
+
+			count = ((struct CRequestAtomic *)buffer)->count;
+
+			if (count == 0 || count > DRIVER_ATOMIC_MAX_OPERATIONS)
+				return STATUS_INVALID_PARAMETER;
+
+			if (Request->InputLength != sizeof(struct CRequestAtomic) + count * sizeof(struct CAtomicOperation))
+				return STATUS_INVALID_BUFFER_SIZE;
+
+			if (Request->OutputLength != count * sizeof(struct CAtomicResult))
+				return STATUS_INVALID_BUFFER_SIZE;
+
+			return STATUS_SUCCESS;
+
+		case CTL_RequestQueryRegions:
+			if (Request->InputLength != sizeof(struct CRequestQueryRegions))
+				return STATUS_INVALID_BUFFER_SIZE;
+
+			if (Request->OutputLength < sizeof(struct CMemoryRegion))
+				return STATUS_INVALID_BUFFER_SIZE;
+
+			return STATUS_SUCCESS;
+
+		case CTL_RequestMirror:
+			if (Request->InputLength < sizeof(struct CRequestMirror))
+				return STATUS_INVALID_BUFFER_SIZE;
+
+			count = ((struct CRequestMirror *)buffer)->count;
+
+			if (count == 0 || count > DRIVER_MIRROR_MAX_RANGES)
+				return STATUS_INVALID_PARAMETER;
+
+			if (Request->InputLength != sizeof(struct CRequestMirror) + count * sizeof(struct CMirrorRange))
+				return STATUS_INVALID_BUFFER_SIZE;
+
+			// Output size depends on ranges, it is checked when session starts
+			if (Request->Output == NULL)
+				return STATUS_INVALID_BUFFER_SIZE;
+
+			return STATUS_SUCCESS;
+
+		case CTL_RequestSubscribeEvents:
+			if (Request->InputLength != 0 || Request->OutputLength != 0)
+				return STATUS_INVALID_BUFFER_SIZE;
+
+			return STATUS_SUCCESS;
+
+		case CTL_RequestWaitEvents:
+			if (Request->InputLength != 0)
+				return STATUS_INVALID_BUFFER_SIZE;
+
+			if (Request->OutputLength < sizeof(struct CDriverEvent) ||
+				Request->OutputLength % sizeof(struct CDriverEvent) != 0)
+				return STATUS_INVALID_BUFFER_SIZE;
+
+			return STATUS_SUCCESS;
+
+		default:
+			return STATUS_NOT_IMPLEMENTED;
+	}
+}
+
+static NTSTATUS
+CoreCopyFromProcess(
+	_In_ const struct CDriverPlatform *Platform,
+	_In_ void *Pid,
+	_In_ void *Source,
+	_Out_ void *Destination,
+	_In_ SIZE_T Size
+)
+{
+	NTSTATUS status;
+	void *process;
+	struct CDriverAttachState attach;
+
+	status = Platform->LookupProcess(Platform->Context, Pid, &process);
+
+	if (!NT_SUCCESS(status))
+		return status;
+
+	Platform->Attach(Platform->Context, process, &attach);
+	status = Platform->CopyFrom(Platform->Context, &attach, Source, Destination, Size);
+	Platform->Detach(Platform->Context, &attach);
+
+	Platform->ReleaseProcess(Platform->Context, process);
+
+	return status;
+}
+
+static NTSTATUS
+CoreCopyResidentFromProcess(
+	_In_ const struct CDriverPlatform *Platform,
+	_In_ void *Pid,
+	_In_ void *Source,
+	_Out_opt_ void *Destination,
+	_In_ SIZE_T Size,
+	_Out_ PUCHAR Present
+)
+{
+	NTSTATUS status;
+	void *process;
+	struct CDriverAttachState attach;
+
+	RtlZeroMemory(Present, DRIVER_RESIDENCY_BITMAP_SIZE(Source, Size));
+
+	status = Platform->LookupProcess(Platform->Context, Pid, &process);
+
+	if (!NT_SUCCESS(status))
+		return status;
+
+	Platform->Attach(Platform->Context, process, &attach);
+	status = Platform->CopyResident(Platform->Context, &attach, Source, Destination, Size, Present);
+	Platform->Detach(Platform->Context, &attach);
+
+	Platform->ReleaseProcess(Platform->Context, process);
+
+	return status;
+}
+
+static NTSTATUS
+ProcessRequestVersion(
+	_Inout_ struct CResponseVersion *VResponse,
+	_Out_ PULONG WroteBytes
+)
+{
+	const struct CResponseVersion version = { DRIVER_VERSION };
+
+	RtlCopyMemory(VResponse, &version, sizeof(struct CResponseVersion));
+
+	*WroteBytes = sizeof(struct CResponseVersion);
+
+	return STATUS_SUCCESS;
+}
+
+static NTSTATUS
+ProcessRequestCapabilities(
+	_In_ const struct CDriverPlatform *Platform,
+	_Inout_ struct CResponseCapabilities *CResponse,
+	_Out_ PULONG WroteBytes
+)
+{
+	struct CResponseCapabilities capabilities;
+
+	capabilities.Version = DRIVER_VERSION;
+	capabilities.BufferMethods = Platform->BufferMethods;
+	capabilities.Features = Platform->Features;
+	capabilities.MaxBatchCount = DRIVER_ATOMIC_MAX_OPERATIONS;
+	capabilities.MaxTransferSize = MAXULONG;
+
+	RtlCopyMemory(CResponse, &capabilities, sizeof(struct CResponseCapabilities));
+
+	*WroteBytes = sizeof(struct CResponseCapabilities);
+
+	return STATUS_SUCCESS;
+}
+
+static NTSTATUS
+ProcessRequestReadProcessMemory(
+	_In_ const struct CDriverPlatform *Platform,
+	_Inout_ struct CRequestReadProcessMemory *RPMRequest,
+	_Out_ PULONG WroteBytes
+)
+{
+	NTSTATUS status;
+	ULONG writeBytesPending = (ULONG)RPMRequest->size;
+
+	// Request fields are read before the copy overwrites them
+	status = CoreCopyFromProcess(Platform, RPMRequest->pid, RPMRequest->ptr, RPMRequest, RPMRequest->size);
+
+	*WroteBytes = NT_SUCCESS(status) ? writeBytesPending : 0;
+
+	return status;
+}
+
+static NTSTATUS
+ProcessRequestReadProcessMemoryDirect(
+	_In_ const struct CDriverPlatform *Platform,
+	_In_ struct CRequestReadProcessMemory *RPMRequest,
+	_Out_ void *Output,
+	_Out_ PULONG WroteBytes
+)
+{
+	NTSTATUS status;
+
+	status = CoreCopyFromProcess(Platform, RPMRequest->pid, RPMRequest->ptr, Output, RPMRequest->size);
+
+	*WroteBytes = NT_SUCCESS(status) ? (ULONG)RPMRequest->size : 0;
+
+	return status;
+}
+
+// Hosts without worker threads copy parallel read in one piece
+static NTSTATUS
+ProcessRequestReadProcessMemoryParallel(
+	_In_ const struct CDriverPlatform *Platform,
+	_In_ struct CRequestReadProcessMemoryParallel *RPMRequest,
+	_Out_ void *Output,
+	_Out_ PULONG WroteBytes
+)
+{
+	NTSTATUS status;
+
+	status = CoreCopyFromProcess(Platform, RPMRequest->pid, RPMRequest->ptr, Output, RPMRequest->size);
+
+	*WroteBytes = NT_SUCCESS(status) ? (ULONG)RPMRequest->size : 0;
+
+	return status;
+}
+
+static NTSTATUS
+ProcessRequestReadProcessMemoryResident(
+	_In_ const struct CDriverPlatform *Platform,
+	_In_ struct CRequestReadProcessMemory *RPMRequest,
+	_Out_ PUCHAR Output,
+	_Out_ PULONG WroteBytes
+)
+{
+	NTSTATUS status;
+
+	status = CoreCopyResidentFromProcess(Platform, RPMRequest->pid, RPMRequest->ptr, Output, RPMRequest->size, Output + RPMRequest->size);
+
+	*WroteBytes = NT_SUCCESS(status) ? (ULONG)(RPMRequest->size + DRIVER_RESIDENCY_BITMAP_SIZE(RPMRequest->ptr, RPMRequest->size)) : 0;
+
+	return status;
+}
+
+static NTSTATUS
+ProcessRequestQueryResidency(
+	_In_ const struct CDriverPlatform *Platform,
+	_Inout_ struct CRequestQueryResidency *QRRequest,
+	_Out_ PULONG WroteBytes
+)
+{
+	NTSTATUS status;
+	struct CRequestQueryResidency request;
+
+	// Bitmap overwrites the request
+	RtlCopyMemory(&request, QRRequest, sizeof(request));
+
+	status = CoreCopyResidentFromProcess(Platform, request.pid, request.ptr, NULL, request.size, (PUCHAR)QRRequest);
+
+	*WroteBytes = NT_SUCCESS(status) ? (ULONG)DRIVER_RESIDENCY_BITMAP_SIZE(request.ptr, request.size) : 0;
+
+	return status;
+}
+
+static NTSTATUS
+ProcessRequestWriteProcessMemory(
+	_In_ const struct CDriverPlatform *Platform,
+	_Inout_ struct CRequestWriteProcessMemory *WPMRequest
+)
+{
+	NTSTATUS status;
+	void *process;
+	struct CDriverAttachState attach;
+
+	status = Platform->LookupProcess(Platform->Context, WPMRequest->pid, &process);
+
+	if (!NT_SUCCESS(status))
+		return status;
+
+	Platform->Attach(Platform->Context, process, &attach);
+	status = Platform->CopyTo(Platform->Context, &attach, WPMRequest->ptr, WPMRequest + 1, WPMRequest->size);
+	Platform->Detach(Platform->Context, &attach);
+
+	Platform->ReleaseProcess(Platform->Context, process);
+
+	return status;
+}
+
+static NTSTATUS
+AtomicExecute(
+	_In_ const struct CDriverPlatform *Platform,
+	_In_ struct CDriverAttachState *Attach,
+	_In_ const struct CAtomicOperation *Operation,
+	_Out_ struct CAtomicResult *Result
+)
+{
+	if (Operation->size != 1 && Operation->size != 2 && Operation->size != 4 && Operation->size != 8)
+		return STATUS_INVALID_PARAMETER;
+
+	if (((UINT_PTR)Operation->ptr & (Operation->size - 1)) != 0)
+		return STATUS_DATATYPE_MISALIGNMENT;
+
+	return Platform->Atomic(Platform->Context, Attach, Operation, Result);
+}
+
+/**
+ * Results overwrite operations in the same system buffer.
+ * Result `i` ends before operation `i` begins, so each operation is copied before its result is written.
+ */
+static NTSTATUS
+ProcessRequestAtomic(
+	_In_ const struct CDriverPlatform *Platform,
+	_Inout_ struct CRequestAtomic *ARequest,
+	_Out_ PULONG WroteBytes
+)
+{
+	NTSTATUS status;
+	void *process;
+	struct CDriverAttachState attach;
+	SIZE_T i;
+	SIZE_T count = ARequest->count;
+	BOOLEAN skip = FALSE;
+	struct CAtomicOperation operation;
+	struct CAtomicResult result;
+	struct CAtomicOperation *operations = (struct CAtomicOperation *)(ARequest + 1);
+	struct CAtomicResult *results = (struct CAtomicResult *)ARequest;
+
+	status = Platform->LookupProcess(Platform->Context, ARequest->pid, &process);
+
+	if (!NT_SUCCESS(status))
+		goto M_ERR;
+
+	Platform->Attach(Platform->Context, process, &attach);
+
+	for (i = 0; i < count; i++)
+	{
+		RtlCopyMemory(&operation, &operations[i], sizeof(operation));
+		RtlZeroMemory(&result, sizeof(result));
+
+		result.status = skip ? STATUS_CANCELLED : AtomicExecute(Platform, &attach, &operation, &result);
+
+		if (operation.op == DRIVER_ATOMIC_WRITE_IF_EQUAL && (!NT_SUCCESS(result.status) || !result.stored))
+			skip = TRUE;
+
+		RtlCopyMemory(&results[i], &result, sizeof(result));
+	}
+
+	Platform->Detach(Platform->Context, &attach);
+
+	Platform->ReleaseProcess(Platform->Context, process);
+
+M_ERR:
+	*WroteBytes = NT_SUCCESS(status) ? (ULONG)(count * sizeof(struct CAtomicResult)) : 0;
+
+	return status;
+}
+
+static NTSTATUS
+ProcessRequestModuleBase(
+	_In_ const struct CDriverPlatform *Platform,
+	_Inout_ struct CRequestModuleBase *MBRequest,
+	_Out_ PULONG WroteBytes
+)
+{
+	NTSTATUS status;
+	void *process;
+	void *result;
+
+	status = Platform->LookupProcess(Platform->Context, MBRequest->pid, &process);
+
+	if (!NT_SUCCESS(status))
+		goto M_ERR;
+
+	status = Platform->ModuleBase(Platform->Context, process, (const WCHAR *)(MBRequest + 1), MBRequest->size, &result);
+
+	if (NT_SUCCESS(status))
+		RtlCopyMemory(MBRequest, &result, sizeof(result));
+
+	Platform->ReleaseProcess(Platform->Context, process);
+
+M_ERR:
+	*WroteBytes = NT_SUCCESS(status) ? sizeof(result) : 0;
+
+	return status;
+}
+
+static NTSTATUS
+ProcessRequestQueryRegions(
+	_In_ const struct CDriverPlatform *Platform,
+	_Inout_ struct CRequestQueryRegions *QRRequest,
+	_In_ ULONG MaxRegions,
+	_Out_ PULONG WroteBytes
+)
+{
+	NTSTATUS status;
+	void *process;
+	ULONG count = 0;
+
+	status = Platform->LookupProcess(Platform->Context, QRRequest->pid, &process);
+
+	if (!NT_SUCCESS(status))
+		goto M_ERR;
+
+	// Regions overwrite the request, so `ptr` is passed by value
+	status = Platform->QueryRegions(Platform->Context, process, QRRequest->ptr, (struct CMemoryRegion *)QRRequest, MaxRegions, &count);
+
+	Platform->ReleaseProcess(Platform->Context, process);
+
+M_ERR:
+	*WroteBytes = NT_SUCCESS(status) ? count * sizeof(struct CMemoryRegion) : 0;
+
+	return status;
+}
+
+NTSTATUS
+DriverCoreDispatch(
+	_In_ const struct CDriverPlatform *Platform,
+	_Inout_ struct CDriverCoreRequest *Request,
+	_Out_ PULONG WroteBytes
+)
+{
+	void *buffer = Request->Buffer;
+
+	PAGED_CODE();
+
+	*WroteBytes = 0;
+
+	switch (Request->IoControlCode)
+	{
+		case CTL_RequestVersion:
+			return ProcessRequestVersion(buffer, WroteBytes);
+
+		case CTL_RequestCapabilities:
+			return ProcessRequestCapabilities(Platform, buffer, WroteBytes);
+
+		case CTL_RequestReadProcessMemory:
+			return ProcessRequestReadProcessMemory(Platform, buffer, WroteBytes);
+
+		// Kernel forwards bulk reads to QoS worker before they get here
+		case CTL_RequestReadProcessMemoryDirect:
+		case CTL_RequestReadProcessMemoryBulk:
+			return ProcessRequestReadProcessMemoryDirect(Platform, buffer, Request->Output, WroteBytes);
+
+		// Kernel splits parallel reads across system workers before they get here
+		case CTL_RequestReadProcessMemoryParallel:
+			return ProcessRequestReadProcessMemoryParallel(Platform, buffer, Request->Output, WroteBytes);
+
+		case CTL_RequestReadProcessMemoryResident:
+			return ProcessRequestReadProcessMemoryResident(Platform, buffer, Request->Output, WroteBytes);
+
+		case CTL_RequestQueryResidency:
+			return ProcessRequestQueryResidency(Platform, buffer, WroteBytes);
+
+		case CTL_RequestWriteProcessMemory:
+			return ProcessRequestWriteProcessMemory(Platform, buffer);
+
+		case CTL_RequestModuleBase:
+			return ProcessRequestModuleBase(Platform, buffer, WroteBytes);
+
+		case CTL_RequestAtomic:
+			return ProcessRequestAtomic(Platform, buffer, WroteBytes);
+
+		case CTL_RequestQueryRegions:
+			return ProcessRequestQueryRegions(Platform, buffer, (ULONG)(Request->OutputLength / sizeof(struct CMemoryRegion)), WroteBytes);
+
+		default:
+			return STATUS_NOT_SUPPORTED;
+	}
+}
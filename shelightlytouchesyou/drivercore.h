@@ -0,0 +1,130 @@
+#ifndef _DRIVER_CORE_H_
+#define _DRIVER_CORE_H_
+
+#include "driver.h"
+
+#ifdef _KERNEL_MODE
+#include <ntifs.h>
+#else
+// Just enough of kernel headers for user mode hosts, see driverhost.c
+#include <string.h>
+
+typedef INT32 NTSTATUS;
+typedef UINT32 ULONG, *PULONG;
+typedef UINT8 UCHAR, *PUCHAR;
+typedef UCHAR BOOLEAN;
+
+#define VOID void
+#define TRUE 1
+#define FALSE 0
+#define MAXULONG 0xFFFFFFFFu
+
+#define NT_SUCCESS(Status) ((NTSTATUS)(Status) >= 0)
+
+#define STATUS_SUCCESS             ((NTSTATUS)0x00000000L)
+#define STATUS_UNSUCCESSFUL        ((NTSTATUS)0xC0000001L)
+#define STATUS_NOT_IMPLEMENTED     ((NTSTATUS)0xC0000002L)
+#define STATUS_INVALID_PARAMETER   ((NTSTATUS)0xC000000DL)
+#define STATUS_ACCESS_VIOLATION    ((NTSTATUS)0xC0000005L)
+#define STATUS_INVALID_PARAMETER_2 ((NTSTATUS)0xC00000F0L)
+#define STATUS_INVALID_BUFFER_SIZE ((NTSTATUS)0xC0000206L)
+#define STATUS_NOT_SUPPORTED       ((NTSTATUS)0xC00000BBL)
+#define STATUS_CANCELLED           ((NTSTATUS)0xC0000120L)
+#define STATUS_NO_MEMORY           ((NTSTATUS)0xC0000017L)
+#define STATUS_NOT_FOUND           ((NTSTATUS)0xC0000225L)
+#define STATUS_INVALID_CID         ((NTSTATUS)0xC000000BL)
+#define STATUS_DATATYPE_MISALIGNMENT ((NTSTATUS)0x80000002L)
+
+#define RtlCopyMemory(Destination, Source, Length) memcpy((Destination), (Source), (Length))
+#define RtlZeroMemory(Destination, Length) memset((Destination), 0, (Length))
+
+#define PAGED_CODE()
+#define UNREFERENCED_PARAMETER(P) ((void)(P))
+
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Out_opt_
+#define _Inout_
+#endif
+
+/**
+ * Bookkeeping of attach to target address space.
+ * Kernel keeps KAPC_STATE in `Opaque`.
+ */
+struct CDriverAttachState
+{
+	void *Process;
+	void *Opaque[8];
+};
+
+/**
+ * Everything request handlers need from the system.
+ * Memory operations run between Attach and Detach. They must fail instead of faulting on bad addresses.
+ */
+struct CDriverPlatform
+{
+	void *Context;
+
+	// Reported by CTL_RequestCapabilities
+	UINT32 BufferMethods;
+	UINT64 Features;
+
+	// Returns referenced process
+	NTSTATUS (*LookupProcess)(void *Context, void *Pid, void **Process);
+	VOID (*ReleaseProcess)(void *Context, void *Process);
+
+	VOID (*Attach)(void *Context, void *Process, struct CDriverAttachState *State);
+	VOID (*Detach)(void *Context, struct CDriverAttachState *State);
+
+	NTSTATUS (*CopyFrom)(void *Context, struct CDriverAttachState *State, const void *Source, void *Destination, SIZE_T Size);
+	NTSTATUS (*CopyTo)(void *Context, struct CDriverAttachState *State, void *Destination, const void *Source, SIZE_T Size);
+
+	// Size and alignment are checked already
+	NTSTATUS (*Atomic)(void *Context, struct CDriverAttachState *State, const struct CAtomicOperation *Operation, struct CAtomicResult *Result);
+
+	/**
+	 * Copies only resident pages and zero fills others. `Destination` may be NULL to only query residency.
+	 * `Present` is zeroed already, bit of each copied page must be set.
+	 */
+	NTSTATUS (*CopyResident)(void *Context, struct CDriverAttachState *State, const void *Source, void *Destination, SIZE_T Size, PUCHAR Present);
+
+	// Not attached
+	NTSTATUS (*ModuleBase)(void *Context, void *Process, const WCHAR *Name, SIZE_T NameSize, void **Result);
+	NTSTATUS (*QueryRegions)(void *Context, void *Process, void *Start, struct CMemoryRegion *Regions, ULONG MaxRegions, PULONG Count);
+};
+
+/**
+ * Device control request as I/O manager delivers it.
+ * `Buffer` holds input and receives buffered output.
+ * `Output` is mapped output buffer of METHOD_OUT_DIRECT requests, NULL if it is empty.
+ */
+struct CDriverCoreRequest
+{
+	ULONG IoControlCode;
+	void *Buffer;
+	SIZE_T InputLength;
+	SIZE_T OutputLength;
+	void *Output;
+};
+
+/**
+ * Checks transfer method and buffer sizes of every known request, including those served outside of the core.
+ */
+NTSTATUS
+DriverCoreValidate(
+	_In_ const struct CDriverCoreRequest *Request
+);
+
+/**
+ * Request must be validated already.
+ * Returns STATUS_NOT_SUPPORTED for requests which need the host: events, priority, mirroring.
+ */
+NTSTATUS
+DriverCoreDispatch(
+	_In_ const struct CDriverPlatform *Platform,
+	_Inout_ struct CDriverCoreRequest *Request,
+	_Out_ PULONG WroteBytes
+);
+
+#endif // _DRIVER_CORE_H_
@@ -0,0 +1,439 @@
+#include "driverevents.h"
+
+#define DRIVER_EVENTS_TAG 'vEtS'
+
+// Protects subscribers list and event queues of all file contexts
+static KSPIN_LOCK EventsLock;
+static LIST_ENTRY EventsSubscribers;
+
+// Manual queue of pending CTL_RequestWaitEvents of all handles
+static WDFQUEUE EventsWaitQueue;
+
+static BOOLEAN ProcessNotifyRegistered;
+static BOOLEAN ImageNotifyRegistered;
+
+static VOID
+CopyEventName(
+	_Inout_ struct CDriverEvent *Event,
+	_In_opt_ PCUNICODE_STRING Name
+)
+{
+	ULONG count;
+	ULONG skip = 0;
+
+	if (Name == NULL || Name->Buffer == NULL)
+		return;
+
+	count = Name->Length / sizeof(WCHAR);
+
+	// Keep tail of long paths, it has the file name
+	if (count > DRIVER_EVENT_NAME_SIZE - 1)
+	{
+		skip = count - (DRIVER_EVENT_NAME_SIZE - 1);
+		count = DRIVER_EVENT_NAME_SIZE - 1;
+	}
+
+	RtlCopyMemory(Event->Name, Name->Buffer + skip, count * sizeof(WCHAR));
+	Event->Name[count] = L'\0';
+	Event->NameSize = count;
+}
+
+// Must be called under EventsLock
+static VOID
+FileContextPushEvent(
+	_Inout_ PFILE_CONTEXT Context,
+	_In_ const struct CDriverEvent *Event
+)
+{
+	ULONG tail;
+
+	if (Context->EventsCount == DRIVER_EVENT_QUEUE_SIZE)
+	{
+		Context->EventsHead = (Context->EventsHead + 1) % DRIVER_EVENT_QUEUE_SIZE;
+		Context->EventsCount--;
+		Context->EventsLost++;
+	}
+
+	tail = (Context->EventsHead + Context->EventsCount) % DRIVER_EVENT_QUEUE_SIZE;
+
+	RtlCopyMemory(&Context->Events[tail], Event, sizeof(struct CDriverEvent));
+	Context->EventsCount++;
+}
+
+// Must be called under EventsLock
+static ULONG
+FileContextPopEvents(
+	_Inout_ PFILE_CONTEXT Context,
+	_Out_writes_(MaxCount) struct CDriverEvent *Out,
+	_In_ ULONG MaxCount
+)
+{
+	ULONG count = 0;
+
+	if (Context->EventsLost != 0 && count < MaxCount)
+	{
+		RtlZeroMemory(&Out[count], sizeof(struct CDriverEvent));
+		Out[count].Type = DRIVER_EVENT_LOST;
+		Out[count].lost = Context->EventsLost;
+
+		Context->EventsLost = 0;
+		count++;
+	}
+
+	while (Context->EventsCount != 0 && count < MaxCount)
+	{
+		RtlCopyMemory(&Out[count], &Context->Events[Context->EventsHead], sizeof(struct CDriverEvent));
+
+		Context->EventsHead = (Context->EventsHead + 1) % DRIVER_EVENT_QUEUE_SIZE;
+		Context->EventsCount--;
+		count++;
+	}
+
+	return count * sizeof(struct CDriverEvent);
+}
+
+static BOOLEAN
+FileContextHasEvents(
+	_In_ PFILE_CONTEXT Context
+)
+{
+	return Context->EventsCount != 0 || Context->EventsLost != 0;
+}
+
+// Completes pending waits of every handle which has events
+static VOID
+DeliverEvents(
+	VOID
+)
+{
+	NTSTATUS status;
+	KIRQL oldIrql;
+	PLIST_ENTRY entry;
+	PFILE_CONTEXT context;
+	WDFREQUEST request;
+	struct CDriverEvent *buffer;
+	size_t length;
+	ULONG wroteBytes;
+
+	for (;;)
+	{
+		request = NULL;
+		status = STATUS_SUCCESS;
+		wroteBytes = 0;
+
+		KeAcquireSpinLock(&EventsLock, &oldIrql);
+
+		for (entry = EventsSubscribers.Flink; entry != &EventsSubscribers; entry = entry->Flink)
+		{
+			context = CONTAINING_RECORD(entry, FILE_CONTEXT, SubscriberLink);
+
+			if (!FileContextHasEvents(context))
+				continue;
+
+			if (!NT_SUCCESS(WdfIoQueueRetrieveRequestByFileObject(EventsWaitQueue, context->FileObject, &request)))
+			{
+				request = NULL;
+				continue;
+			}
+
+			status = WdfRequestRetrieveOutputBuffer(request, sizeof(struct CDriverEvent), (PVOID *)&buffer, &length);
+
+			if (NT_SUCCESS(status))
+				wroteBytes = FileContextPopEvents(context, buffer, (ULONG)(length / sizeof(struct CDriverEvent)));
+
+			break;
+		}
+
+		KeReleaseSpinLock(&EventsLock, oldIrql);
+
+		if (request == NULL)
+			break;
+
+		WdfRequestCompleteWithInformation(request, status, wroteBytes);
+	}
+}
+
+static VOID
+PushEvent(
+	_In_ const struct CDriverEvent *Event
+)
+{
+	KIRQL oldIrql;
+	PLIST_ENTRY entry;
+
+	KeAcquireSpinLock(&EventsLock, &oldIrql);
+
+	for (entry = EventsSubscribers.Flink; entry != &EventsSubscribers; entry = entry->Flink)
+		FileContextPushEvent(CONTAINING_RECORD(entry, FILE_CONTEXT, SubscriberLink), Event);
+
+	KeReleaseSpinLock(&EventsLock, oldIrql);
+
+	DeliverEvents();
+}
+
+static VOID
+ProcessNotifyRoutine(
+	_In_ HANDLE ParentId,
+	_In_ HANDLE ProcessId,
+	_In_ BOOLEAN Create
+)
+{
+	struct CDriverEvent event;
+	PEPROCESS process;
+	PUNICODE_STRING imageName;
+
+	// Nobody listens, don't pay for name lookup
+	if (IsListEmpty(&EventsSubscribers))
+		return;
+
+	RtlZeroMemory(&event, sizeof(event));
+
+	event.Type = Create ? DRIVER_EVENT_PROCESS_CREATE : DRIVER_EVENT_PROCESS_EXIT;
+	event.pid = ProcessId;
+	event.parentPid = ParentId;
+
+	if (NT_SUCCESS(PsLookupProcessByProcessId(ProcessId, &process)))
+	{
+		if (NT_SUCCESS(SeLocateProcessImageName(process, &imageName)))
+		{
+			CopyEventName(&event, imageName);
+			ExFreePool(imageName);
+		}
+
+		ObDereferenceObject(process);
+	}
+
+	PushEvent(&event);
+}
+
+static VOID
+LoadImageNotifyRoutine(
+	_In_opt_ PUNICODE_STRING FullImageName,
+	_In_ HANDLE ProcessId,
+	_In_ PIMAGE_INFO ImageInfo
+)
+{
+	struct CDriverEvent event;
+
+	// Drivers are loaded into System process with zero id
+	if (ImageInfo->SystemModeImage || ProcessId == NULL)
+		return;
+
+	if (IsListEmpty(&EventsSubscribers))
+		return;
+
+	RtlZeroMemory(&event, sizeof(event));
+
+	event.Type = DRIVER_EVENT_IMAGE_LOAD;
+	event.pid = ProcessId;
+	event.imageBase = ImageInfo->ImageBase;
+	event.imageSize = ImageInfo->ImageSize;
+
+	CopyEventName(&event, FullImageName);
+
+	PushEvent(&event);
+}
+
+NTSTATUS
+DriverEventsCreateQueue(
+	_In_ WDFDEVICE Device
+)
+{
+	WDF_IO_QUEUE_CONFIG ioQConfig;
+
+	PAGED_CODE();
+
+	KeInitializeSpinLock(&EventsLock);
+	InitializeListHead(&EventsSubscribers);
+
+	WDF_IO_QUEUE_CONFIG_INIT(&ioQConfig, WdfIoQueueDispatchManual);
+
+	return WdfIoQueueCreate(Device, &ioQConfig, WDF_NO_OBJECT_ATTRIBUTES, &EventsWaitQueue);
+}
+
+NTSTATUS
+DriverEventsRegister(
+	VOID
+)
+{
+	NTSTATUS status;
+
+	PAGED_CODE();
+
+	status = PsSetCreateProcessNotifyRoutine(ProcessNotifyRoutine, FALSE);
+
+	if (!NT_SUCCESS(status))
+		goto M_ERR;
+
+	ProcessNotifyRegistered = TRUE;
+
+	status = PsSetLoadImageNotifyRoutine(LoadImageNotifyRoutine);
+
+	if (!NT_SUCCESS(status))
+		goto M_ERR2;
+
+	ImageNotifyRegistered = TRUE;
+
+	return STATUS_SUCCESS;
+
+M_ERR2:
+	PsSetCreateProcessNotifyRoutine(ProcessNotifyRoutine, TRUE);
+	ProcessNotifyRegistered = FALSE;
+
+M_ERR:
+	return status;
+}
+
+VOID
+DriverEventsUnregister(
+	VOID
+)
+{
+	PAGED_CODE();
+
+	if (ImageNotifyRegistered)
+	{
+		PsRemoveLoadImageNotifyRoutine(LoadImageNotifyRoutine);
+		ImageNotifyRegistered = FALSE;
+	}
+
+	if (ProcessNotifyRegistered)
+	{
+		PsSetCreateProcessNotifyRoutine(ProcessNotifyRoutine, TRUE);
+		ProcessNotifyRegistered = FALSE;
+	}
+}
+
+VOID
+DriverEventsFileCreate(
+	_In_ WDFFILEOBJECT FileObject
+)
+{
+	PFILE_CONTEXT context = GetFileContext(FileObject);
+
+	PAGED_CODE();
+
+	context->FileObject = FileObject;
+	context->Events = NULL;
+	context->EventsHead = 0;
+	context->EventsCount = 0;
+	context->EventsLost = 0;
+
+	InitializeListHead(&context->SubscriberLink);
+}
+
+VOID
+DriverEventsFileCleanup(
+	_In_ WDFFILEOBJECT FileObject
+)
+{
+	PFILE_CONTEXT context = GetFileContext(FileObject);
+	KIRQL oldIrql;
+	WDFREQUEST request;
+	struct CDriverEvent *events;
+
+	PAGED_CODE();
+
+	KeAcquireSpinLock(&EventsLock, &oldIrql);
+
+	RemoveEntryList(&context->SubscriberLink);
+	InitializeListHead(&context->SubscriberLink);
+
+	events = context->Events;
+	context->Events = NULL;
+	context->EventsCount = 0;
+	context->EventsLost = 0;
+
+	KeReleaseSpinLock(&EventsLock, oldIrql);
+
+	while (NT_SUCCESS(WdfIoQueueRetrieveRequestByFileObject(EventsWaitQueue, FileObject, &request)))
+		WdfRequestComplete(request, STATUS_CANCELLED);
+
+	if (events != NULL)
+		ExFreePoolWithTag(events, DRIVER_EVENTS_TAG);
+}
+
+NTSTATUS
+ProcessRequestSubscribeEvents(
+	_In_ WDFFILEOBJECT FileObject
+)
+{
+	PFILE_CONTEXT context = GetFileContext(FileObject);
+	KIRQL oldIrql;
+	struct CDriverEvent *events;
+
+	PAGED_CODE();
+
+	events = ExAllocatePoolWithTag(NonPagedPoolNx, sizeof(struct CDriverEvent) * DRIVER_EVENT_QUEUE_SIZE, DRIVER_EVENTS_TAG);
+
+	if (events == NULL)
+		return STATUS_INSUFFICIENT_RESOURCES;
+
+	KeAcquireSpinLock(&EventsLock, &oldIrql);
+
+	if (context->Events == NULL)
+	{
+		context->Events = events;
+		context->EventsHead = 0;
+		context->EventsCount = 0;
+		context->EventsLost = 0;
+
+		InsertTailList(&EventsSubscribers, &context->SubscriberLink);
+
+		events = NULL;
+	}
+
+	KeReleaseSpinLock(&EventsLock, oldIrql);
+
+	// Handle was already subscribed
+	if (events != NULL)
+		ExFreePoolWithTag(events, DRIVER_EVENTS_TAG);
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS
+ProcessRequestWaitEvents(
+	_In_ WDFREQUEST Request,
+	_In_ WDFFILEOBJECT FileObject,
+	_Out_ PULONG WroteBytes
+)
+{
+	NTSTATUS status;
+	PFILE_CONTEXT context = GetFileContext(FileObject);
+	KIRQL oldIrql;
+	struct CDriverEvent *buffer;
+	size_t length;
+
+	PAGED_CODE();
+
+	*WroteBytes = 0;
+
+	status = WdfRequestRetrieveOutputBuffer(Request, sizeof(struct CDriverEvent), (PVOID *)&buffer, &length);
+
+	if (!NT_SUCCESS(status))
+		return status;
+
+	KeAcquireSpinLock(&EventsLock, &oldIrql);
+
+	if (context->Events == NULL)
+	{
+		status = STATUS_INVALID_DEVICE_STATE;
+	}
+	else if (FileContextHasEvents(context))
+	{
+		*WroteBytes = FileContextPopEvents(context, buffer, (ULONG)(length / sizeof(struct CDriverEvent)));
+	}
+	else
+	{
+		// Checked and queued under the lock, so callbacks can't miss this request
+		status = WdfRequestForwardToIoQueue(Request, EventsWaitQueue);
+
+		if (NT_SUCCESS(status))
+			status = STATUS_PENDING;
+	}
+
+	KeReleaseSpinLock(&EventsLock, oldIrql);
+
+	return status;
+}
@@ -0,0 +1,63 @@
+#ifndef _DRIVER_EVENTS_H_
+#define _DRIVER_EVENTS_H_
+
+#include "driver.h"
+
+#include <ntifs.h>
+#include <wdf.h>
+
+typedef struct _FILE_CONTEXT
+{
+	WDFFILEOBJECT FileObject;
+
+	// Linked into subscribers list while `Events` is allocated
+	LIST_ENTRY SubscriberLink;
+	struct CDriverEvent *Events;
+	ULONG EventsHead;
+	ULONG EventsCount;
+	SIZE_T EventsLost;
+} FILE_CONTEXT, *PFILE_CONTEXT;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(FILE_CONTEXT, GetFileContext);
+
+NTSTATUS
+DriverEventsCreateQueue(
+	_In_ WDFDEVICE Device
+);
+
+NTSTATUS
+DriverEventsRegister(
+	VOID
+);
+
+VOID
+DriverEventsUnregister(
+	VOID
+);
+
+VOID
+DriverEventsFileCreate(
+	_In_ WDFFILEOBJECT FileObject
+);
+
+VOID
+DriverEventsFileCleanup(
+	_In_ WDFFILEOBJECT FileObject
+);
+
+NTSTATUS
+ProcessRequestSubscribeEvents(
+	_In_ WDFFILEOBJECT FileObject
+);
+
+/**
+ * Returns STATUS_PENDING if request was queued. Such request is completed later by event callbacks.
+ */
+NTSTATUS
+ProcessRequestWaitEvents(
+	_In_ WDFREQUEST Request,
+	_In_ WDFFILEOBJECT FileObject,
+	_Out_ PULONG WroteBytes
+);
+
+#endif // _DRIVER_EVENTS_H_
@@ -0,0 +1,720 @@
+#include "driverhost.h"
+
+#include <stdlib.h>
+
+#define DRIVER_HOST_MEM_COMMIT  0x1000
+#define DRIVER_HOST_MEM_PRIVATE 0x20000
+
+// PAGE_READWRITE, PAGE_WRITECOPY, PAGE_EXECUTE_READWRITE, PAGE_EXECUTE_WRITECOPY
+#define DRIVER_HOST_PAGE_WRITABLE (0x04 | 0x08 | 0x40 | 0x80)
+
+#define DRIVER_HOST_FEATURES (DRIVER_FEATURE_ATOMIC | DRIVER_FEATURE_DIRECT_READ | DRIVER_FEATURE_QUERY_REGIONS | DRIVER_FEATURE_RESIDENCY)
+
+// System buffers up to this size live on stack
+#define DRIVER_HOST_SMALL_BUFFER 256
+
+struct CHostRegion
+{
+	UINT_PTR Base;
+	SIZE_T Size;
+	UINT32 Protect;
+	PUCHAR Data;
+
+	// Bit per page
+	PUCHAR Resident;
+};
+
+struct CHostModule
+{
+	WCHAR *Name;
+	SIZE_T NameSize;
+	void *Base;
+};
+
+struct CHostProcess
+{
+	void *Pid;
+
+	// Sorted by base
+	struct CHostRegion *Regions;
+	SIZE_T RegionCount;
+
+	struct CHostModule *Modules;
+	SIZE_T ModuleCount;
+};
+
+struct CDriverHost
+{
+	struct CDriverPlatform Platform;
+
+	struct CHostProcess *Processes;
+	SIZE_T ProcessCount;
+};
+
+static struct CHostProcess *
+HostFindProcess(
+	_In_ struct CDriverHost *Host,
+	_In_ void *Pid
+)
+{
+	SIZE_T i;
+
+	for (i = 0; i < Host->ProcessCount; i++)
+	{
+		if (Host->Processes[i].Pid == Pid)
+			return &Host->Processes[i];
+	}
+
+	return NULL;
+}
+
+// Region containing `Address`
+static struct CHostRegion *
+HostFindRegion(
+	_In_ struct CHostProcess *Process,
+	_In_ UINT_PTR Address
+)
+{
+	SIZE_T low = 0;
+	SIZE_T high = Process->RegionCount;
+	SIZE_T middle;
+	struct CHostRegion *region;
+
+	while (low < high)
+	{
+		middle = low + (high - low) / 2;
+		region = &Process->Regions[middle];
+
+		if (Address < region->Base)
+			high = middle;
+		else if (Address - region->Base >= region->Size)
+			low = middle + 1;
+		else
+			return region;
+	}
+
+	return NULL;
+}
+
+/**
+ * Copies between `Buffer` and simulated memory, range may span adjacent regions.
+ * Fails as a faulting copy would: bytes before the gap may be copied already.
+ */
+static NTSTATUS
+HostCopy(
+	_In_ struct CHostProcess *Process,
+	_In_ UINT_PTR Address,
+	_Inout_ PUCHAR Buffer,
+	_In_ SIZE_T Size,
+	_In_ BOOLEAN Write
+)
+{
+	struct CHostRegion *region;
+	SIZE_T offset;
+	SIZE_T chunk;
+
+	if (Address + Size < Address)
+		return STATUS_UNSUCCESSFUL;
+
+	while (Size != 0)
+	{
+		region = HostFindRegion(Process, Address);
+
+		if (region == NULL || (Write && (region->Protect & DRIVER_HOST_PAGE_WRITABLE) == 0))
+			return STATUS_UNSUCCESSFUL;
+
+		offset = Address - region->Base;
+		chunk = region->Size - offset;
+
+		if (chunk > Size)
+			chunk = Size;
+
+		if (Write)
+			memcpy(region->Data + offset, Buffer, chunk);
+		else
+			memcpy(Buffer, region->Data + offset, chunk);
+
+		Address += chunk;
+		Buffer += chunk;
+		Size -= chunk;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+static NTSTATUS
+HostLookupProcess(
+	_In_ void *Context,
+	_In_ void *Pid,
+	_Out_ void **Process
+)
+{
+	*Process = HostFindProcess(Context, Pid);
+
+	return *Process != NULL ? STATUS_SUCCESS : STATUS_INVALID_CID;
+}
+
+static VOID
+HostReleaseProcess(
+	_In_ void *Context,
+	_In_ void *Process
+)
+{
+	UNREFERENCED_PARAMETER(Context);
+	UNREFERENCED_PARAMETER(Process);
+}
+
+static VOID
+HostAttach(
+	_In_ void *Context,
+	_In_ void *Process,
+	_Out_ struct CDriverAttachState *State
+)
+{
+	UNREFERENCED_PARAMETER(Context);
+
+	State->Process = Process;
+}
+
+static VOID
+HostDetach(
+	_In_ void *Context,
+	_In_ struct CDriverAttachState *State
+)
+{
+	UNREFERENCED_PARAMETER(Context);
+
+	State->Process = NULL;
+}
+
+static NTSTATUS
+HostCopyFrom(
+	_In_ void *Context,
+	_In_ struct CDriverAttachState *State,
+	_In_ const void *Source,
+	_Out_ void *Destination,
+	_In_ SIZE_T Size
+)
+{
+	UNREFERENCED_PARAMETER(Context);
+
+	return HostCopy(State->Process, (UINT_PTR)Source, Destination, Size, FALSE);
+}
+
+static NTSTATUS
+HostCopyTo(
+	_In_ void *Context,
+	_In_ struct CDriverAttachState *State,
+	_In_ void *Destination,
+	_In_ const void *Source,
+	_In_ SIZE_T Size
+)
+{
+	UNREFERENCED_PARAMETER(Context);
+
+	return HostCopy(State->Process, (UINT_PTR)Destination, (PUCHAR)Source, Size, TRUE);
+}
+
+#define DEFINE_HOST_ATOMIC_EXECUTE(Name, Type) \
+static NTSTATUS \
+Name( \
+	_Inout_ Type *Target, \
+	_In_ const struct CAtomicOperation *Operation, \
+	_Out_ struct CAtomicResult *Result \
+) \
+{ \
+	Type previous; \
+	\
+	switch (Operation->op) \
+	{ \
+		case DRIVER_ATOMIC_COMPARE_EXCHANGE: \
+		case DRIVER_ATOMIC_WRITE_IF_EQUAL: \
+			previous = (Type)Operation->comparand; \
+			Result->stored = __atomic_compare_exchange_n(Target, &previous, (Type)Operation->operand, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); \
+			break; \
+		\
+		case DRIVER_ATOMIC_FETCH_ADD: \
+			previous = __atomic_fetch_add(Target, (Type)Operation->operand, __ATOMIC_SEQ_CST); \
+			Result->stored = TRUE; \
+			break; \
+		\
+		case DRIVER_ATOMIC_FETCH_OR: \
+			previous = __atomic_fetch_or(Target, (Type)Operation->operand, __ATOMIC_SEQ_CST); \
+			Result->stored = TRUE; \
+			break; \
+		\
+		case DRIVER_ATOMIC_FETCH_AND: \
+			previous = __atomic_fetch_and(Target, (Type)Operation->operand, __ATOMIC_SEQ_CST); \
+			Result->stored = TRUE; \
+			break; \
+		\
+		default: \
+			return STATUS_INVALID_PARAMETER; \
+	} \
+	\
+	Result->previous = (UINT64)previous; \
+	\
+	return STATUS_SUCCESS; \
+}
+
+DEFINE_HOST_ATOMIC_EXECUTE(HostAtomic8, UINT8)
+DEFINE_HOST_ATOMIC_EXECUTE(HostAtomic16, UINT16)
+DEFINE_HOST_ATOMIC_EXECUTE(HostAtomic32, UINT32)
+DEFINE_HOST_ATOMIC_EXECUTE(HostAtomic64, UINT64)
+
+static NTSTATUS
+HostAtomic(
+	_In_ void *Context,
+	_In_ struct CDriverAttachState *State,
+	_In_ const struct CAtomicOperation *Operation,
+	_Out_ struct CAtomicResult *Result
+)
+{
+	struct CHostRegion *region;
+	void *target;
+
+	UNREFERENCED_PARAMETER(Context);
+
+	// Aligned operation never crosses a page, so it is inside one region
+	region = HostFindRegion(State->Process, (UINT_PTR)Operation->ptr);
+
+	if (region == NULL || (region->Protect & DRIVER_HOST_PAGE_WRITABLE) == 0)
+		return STATUS_ACCESS_VIOLATION;
+
+	target = region->Data + ((UINT_PTR)Operation->ptr - region->Base);
+
+	switch (Operation->size)
+	{
+		case 1: return HostAtomic8(target, Operation, Result);
+		case 2: return HostAtomic16(target, Operation, Result);
+		case 4: return HostAtomic32(target, Operation, Result);
+		case 8: return HostAtomic64(target, Operation, Result);
+		default: return STATUS_INVALID_PARAMETER;
+	}
+}
+
+static NTSTATUS
+HostCopyResident(
+	_In_ void *Context,
+	_In_ struct CDriverAttachState *State,
+	_In_ const void *Source,
+	_Out_opt_ void *Destination,
+	_In_ SIZE_T Size,
+	_Out_ PUCHAR Present
+)
+{
+	struct CHostRegion *region;
+	UINT_PTR address;
+	SIZE_T regionPage;
+	SIZE_T offset = 0;
+	SIZE_T chunk;
+	SIZE_T page = 0;
+	BOOLEAN present;
+
+	UNREFERENCED_PARAMETER(Context);
+
+	if ((UINT_PTR)Source + Size < (UINT_PTR)Source)
+		return STATUS_UNSUCCESSFUL;
+
+	while (offset < Size)
+	{
+		address = (UINT_PTR)Source + offset;
+		chunk = DRIVER_PAGE_SIZE - (address & (DRIVER_PAGE_SIZE - 1));
+
+		if (chunk > Size - offset)
+			chunk = Size - offset;
+
+		region = HostFindRegion(State->Process, address);
+		present = FALSE;
+
+		if (region != NULL)
+		{
+			regionPage = (address - region->Base) / DRIVER_PAGE_SIZE;
+			present = (region->Resident[regionPage / 8] >> (regionPage % 8) & 1) != 0;
+		}
+
+		if (present)
+		{
+			Present[page / 8] |= (UCHAR)(1 << (page % 8));
+
+			if (Destination != NULL)
+				memcpy((PUCHAR)Destination + offset, region->Data + (address - region->Base), chunk);
+		}
+		else if (Destination != NULL)
+		{
+			memset((PUCHAR)Destination + offset, 0, chunk);
+		}
+
+		offset += chunk;
+		page++;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+static WCHAR
+HostFoldCase(
+	_In_ WCHAR Char
+)
+{
+	return Char >= 'A' && Char <= 'Z' ? (WCHAR)(Char - 'A' + 'a') : Char;
+}
+
+static NTSTATUS
+HostModuleBase(
+	_In_ void *Context,
+	_In_ void *Process,
+	_In_ const WCHAR *Name,
+	_In_ SIZE_T NameSize,
+	_Out_ void **Result
+)
+{
+	struct CHostProcess *process = Process;
+	struct CHostModule *module;
+	SIZE_T i;
+	SIZE_T j;
+
+	UNREFERENCED_PARAMETER(Context);
+
+	for (i = 0; i < process->ModuleCount; i++)
+	{
+		module = &process->Modules[i];
+
+		if (module->NameSize != NameSize)
+			continue;
+
+		for (j = 0; j < NameSize; j++)
+		{
+			if (HostFoldCase(module->Name[j]) != HostFoldCase(Name[j]))
+				break;
+		}
+
+		if (j == NameSize)
+		{
+			*Result = module->Base;
+			return STATUS_SUCCESS;
+		}
+	}
+
+	return STATUS_UNSUCCESSFUL;
+}
+
+static NTSTATUS
+HostQueryRegions(
+	_In_ void *Context,
+	_In_ void *Process,
+	_In_ void *Start,
+	_Out_ struct CMemoryRegion *Regions,
+	_In_ ULONG MaxRegions,
+	_Out_ PULONG Count
+)
+{
+	struct CHostProcess *process = Process;
+	struct CHostRegion *region;
+	struct CMemoryRegion result;
+	SIZE_T i;
+	ULONG count = 0;
+
+	UNREFERENCED_PARAMETER(Context);
+
+	for (i = 0; i < process->RegionCount && count < MaxRegions; i++)
+	{
+		region = &process->Regions[i];
+
+		if (region->Base + region->Size <= (UINT_PTR)Start)
+			continue;
+
+		result.base = (void *)region->Base;
+		result.allocationBase = (void *)region->Base;
+		result.size = region->Size;
+		result.state = DRIVER_HOST_MEM_COMMIT;
+		result.protect = region->Protect;
+		result.type = DRIVER_HOST_MEM_PRIVATE;
+		result.reserved = 0;
+
+		// Regions overwrite the request
+		memcpy(&Regions[count], &result, sizeof(result));
+		count++;
+	}
+
+	*Count = count;
+
+	return STATUS_SUCCESS;
+}
+
+struct CDriverHost *
+DriverHostCreate(
+	VOID
+)
+{
+	struct CDriverHost *host = calloc(1, sizeof(struct CDriverHost));
+
+	if (host == NULL)
+		return NULL;
+
+	host->Platform.Context = host;
+	host->Platform.BufferMethods = DRIVER_BUFFER_METHOD_BUFFERED | DRIVER_BUFFER_METHOD_OUT_DIRECT;
+	host->Platform.Features = DRIVER_HOST_FEATURES;
+	host->Platform.LookupProcess = HostLookupProcess;
+	host->Platform.ReleaseProcess = HostReleaseProcess;
+	host->Platform.Attach = HostAttach;
+	host->Platform.Detach = HostDetach;
+	host->Platform.CopyFrom = HostCopyFrom;
+	host->Platform.CopyTo = HostCopyTo;
+	host->Platform.Atomic = HostAtomic;
+	host->Platform.CopyResident = HostCopyResident;
+	host->Platform.ModuleBase = HostModuleBase;
+	host->Platform.QueryRegions = HostQueryRegions;
+
+	return host;
+}
+
+VOID
+DriverHostDestroy(
+	_In_ struct CDriverHost *Host
+)
+{
+	SIZE_T i;
+	SIZE_T j;
+	struct CHostProcess *process;
+
+	for (i = 0; i < Host->ProcessCount; i++)
+	{
+		process = &Host->Processes[i];
+
+		for (j = 0; j < process->RegionCount; j++)
+		{
+			free(process->Regions[j].Data);
+			free(process->Regions[j].Resident);
+		}
+
+		for (j = 0; j < process->ModuleCount; j++)
+			free(process->Modules[j].Name);
+
+		free(process->Regions);
+		free(process->Modules);
+	}
+
+	free(Host->Processes);
+	free(Host);
+}
+
+static struct CHostProcess *
+HostGetProcess(
+	_In_ struct CDriverHost *Host,
+	_In_ void *Pid
+)
+{
+	struct CHostProcess *process = HostFindProcess(Host, Pid);
+	struct CHostProcess *processes;
+
+	if (process != NULL)
+		return process;
+
+	processes = realloc(Host->Processes, (Host->ProcessCount + 1) * sizeof(struct CHostProcess));
+
+	if (processes == NULL)
+		return NULL;
+
+	Host->Processes = processes;
+
+	process = &Host->Processes[Host->ProcessCount++];
+	memset(process, 0, sizeof(*process));
+	process->Pid = Pid;
+
+	return process;
+}
+
+PUCHAR
+DriverHostAddRegion(
+	_In_ struct CDriverHost *Host,
+	_In_ void *Pid,
+	_In_ void *Base,
+	_In_ SIZE_T Size,
+	_In_ UINT32 Protect
+)
+{
+	struct CHostProcess *process;
+	struct CHostRegion *regions;
+	struct CHostRegion region;
+	SIZE_T index;
+	SIZE_T pages = Size / DRIVER_PAGE_SIZE;
+
+	if (Size == 0 || ((UINT_PTR)Base | Size) & (DRIVER_PAGE_SIZE - 1) || (UINT_PTR)Base + Size < (UINT_PTR)Base)
+		return NULL;
+
+	process = HostGetProcess(Host, Pid);
+
+	if (process == NULL)
+		return NULL;
+
+	for (index = 0; index < process->RegionCount && process->Regions[index].Base < (UINT_PTR)Base; index++)
+		;
+
+	if ((index > 0 && process->Regions[index - 1].Base + process->Regions[index - 1].Size > (UINT_PTR)Base) ||
+		(index < process->RegionCount && process->Regions[index].Base < (UINT_PTR)Base + Size))
+		return NULL;
+
+	regions = realloc(process->Regions, (process->RegionCount + 1) * sizeof(struct CHostRegion));
+
+	if (regions == NULL)
+		return NULL;
+
+	process->Regions = regions;
+
+	region.Base = (UINT_PTR)Base;
+	region.Size = Size;
+	region.Protect = Protect;
+	region.Data = calloc(1, Size);
+	region.Resident = malloc((pages + 7) / 8);
+
+	if (region.Data == NULL || region.Resident == NULL)
+	{
+		free(region.Data);
+		free(region.Resident);
+		return NULL;
+	}
+
+	memset(region.Resident, 0xFF, (pages + 7) / 8);
+
+	memmove(&process->Regions[index + 1], &process->Regions[index], (process->RegionCount - index) * sizeof(struct CHostRegion));
+	process->Regions[index] = region;
+	process->RegionCount++;
+
+	return region.Data;
+}
+
+NTSTATUS
+DriverHostSetResident(
+	_In_ struct CDriverHost *Host,
+	_In_ void *Pid,
+	_In_ void *Address,
+	_In_ SIZE_T Size,
+	_In_ BOOLEAN Resident
+)
+{
+	struct CHostProcess *process = HostFindProcess(Host, Pid);
+	struct CHostRegion *region;
+	UINT_PTR address = (UINT_PTR)Address & ~(UINT_PTR)(DRIVER_PAGE_SIZE - 1);
+	SIZE_T page;
+
+	if (process == NULL)
+		return STATUS_INVALID_CID;
+
+	for (; address < (UINT_PTR)Address + Size; address += DRIVER_PAGE_SIZE)
+	{
+		region = HostFindRegion(process, address);
+
+		if (region == NULL)
+			return STATUS_NOT_FOUND;
+
+		page = (address - region->Base) / DRIVER_PAGE_SIZE;
+
+		if (Resident)
+			region->Resident[page / 8] |= (UCHAR)(1 << (page % 8));
+		else
+			region->Resident[page / 8] &= (UCHAR)~(1 << (page % 8));
+	}
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS
+DriverHostAddModule(
+	_In_ struct CDriverHost *Host,
+	_In_ void *Pid,
+	_In_ const WCHAR *Name,
+	_In_ SIZE_T NameSize,
+	_In_ void *Base
+)
+{
+	struct CHostProcess *process = HostGetProcess(Host, Pid);
+	struct CHostModule *modules;
+	WCHAR *name;
+
+	if (process == NULL)
+		return STATUS_NO_MEMORY;
+
+	modules = realloc(process->Modules, (process->ModuleCount + 1) * sizeof(struct CHostModule));
+
+	if (modules == NULL)
+		return STATUS_NO_MEMORY;
+
+	process->Modules = modules;
+
+	name = malloc((NameSize + 1) * sizeof(WCHAR));
+
+	if (name == NULL)
+		return STATUS_NO_MEMORY;
+
+	memcpy(name, Name, NameSize * sizeof(WCHAR));
+	name[NameSize] = 0;
+
+	process->Modules[process->ModuleCount].Name = name;
+	process->Modules[process->ModuleCount].NameSize = NameSize;
+	process->Modules[process->ModuleCount].Base = Base;
+	process->ModuleCount++;
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS
+DriverHostIoControl(
+	_In_ struct CDriverHost *Host,
+	_In_ ULONG IoControlCode,
+	_In_ const void *Input,
+	_In_ ULONG InputLength,
+	_Out_ void *Output,
+	_In_ ULONG OutputLength,
+	_Out_ PULONG WroteBytes
+)
+{
+	NTSTATUS status;
+	struct CDriverCoreRequest request;
+	UINT64 smallBuffer[DRIVER_HOST_SMALL_BUFFER / sizeof(UINT64)];
+	void *systemBuffer = NULL;
+	SIZE_T systemSize = InputLength;
+	ULONG method = METHOD_FROM_CTL_CODE(IoControlCode);
+	ULONG wroteBytes = 0;
+
+	*WroteBytes = 0;
+
+	// Buffered output goes through the same system buffer as input
+	if (method == METHOD_BUFFERED && OutputLength > systemSize)
+		systemSize = OutputLength;
+
+	if (systemSize != 0)
+	{
+		systemBuffer = systemSize <= sizeof(smallBuffer) ? smallBuffer : malloc(systemSize);
+
+		if (systemBuffer == NULL)
+			return STATUS_NO_MEMORY;
+
+		if (InputLength != 0)
+			memcpy(systemBuffer, Input, InputLength);
+	}
+
+	request.IoControlCode = IoControlCode;
+	request.Buffer = systemBuffer;
+	request.InputLength = InputLength;
+	request.OutputLength = OutputLength;
+	request.Output = method == METHOD_OUT_DIRECT && OutputLength != 0 ? Output : NULL;
+
+	status = DriverCoreValidate(&request);
+
+	if (NT_SUCCESS(status))
+		status = DriverCoreDispatch(&Host->Platform, &request, &wroteBytes);
+
+	if (NT_SUCCESS(status))
+	{
+		if (method == METHOD_BUFFERED && wroteBytes != 0)
+			memcpy(Output, systemBuffer, wroteBytes);
+
+		*WroteBytes = wroteBytes;
+	}
+
+	if (systemBuffer != smallBuffer)
+		free(systemBuffer);
+
+	return status;
+}
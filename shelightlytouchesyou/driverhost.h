@@ -0,0 +1,71 @@
+#ifndef _DRIVER_HOST_H_
+#define _DRIVER_HOST_H_
+
+#include "drivercore.h"
+
+/**
+ * Runs drivercore.c in user mode against simulated processes, so request handling can be profiled and fuzzed
+ * without loading the driver.
+ * Processes, regions and modules must be added before requests are sent. Requests may be sent from several threads at once.
+ */
+struct CDriverHost;
+
+struct CDriverHost *
+DriverHostCreate(
+	VOID
+);
+
+VOID
+DriverHostDestroy(
+	_In_ struct CDriverHost *Host
+);
+
+/**
+ * Process is created by its first region. `Base` and `Size` must be page aligned, regions of process must not overlap.
+ * Returns zero filled memory backing the region, NULL on failure.
+ */
+PUCHAR
+DriverHostAddRegion(
+	_In_ struct CDriverHost *Host,
+	_In_ void *Pid,
+	_In_ void *Base,
+	_In_ SIZE_T Size,
+	_In_ UINT32 Protect
+);
+
+// Pages are resident when added. Non-resident pages are still readable by ordinary reads.
+NTSTATUS
+DriverHostSetResident(
+	_In_ struct CDriverHost *Host,
+	_In_ void *Pid,
+	_In_ void *Address,
+	_In_ SIZE_T Size,
+	_In_ BOOLEAN Resident
+);
+
+// `NameSize` is count of characters
+NTSTATUS
+DriverHostAddModule(
+	_In_ struct CDriverHost *Host,
+	_In_ void *Pid,
+	_In_ const WCHAR *Name,
+	_In_ SIZE_T NameSize,
+	_In_ void *Base
+);
+
+/**
+ * Works like DeviceIoControl on driver handle: buffers are passed the way I/O manager does for transfer method of request.
+ * Requests which need the driver itself (events, priority, mirroring) return STATUS_NOT_SUPPORTED.
+ */
+NTSTATUS
+DriverHostIoControl(
+	_In_ struct CDriverHost *Host,
+	_In_ ULONG IoControlCode,
+	_In_ const void *Input,
+	_In_ ULONG InputLength,
+	_Out_ void *Output,
+	_In_ ULONG OutputLength,
+	_Out_ PULONG WroteBytes
+);
+
+#endif // _DRIVER_HOST_H_
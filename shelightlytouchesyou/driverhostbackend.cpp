@@ -0,0 +1,178 @@
+#include "driverhostbackend.hpp"
+
+extern "C"
+{
+#include "driverhost.h"
+}
+
+#include <stdexcept>
+#include <sstream>
+#include <vector>
+
+// Host takes ULONG lengths like DeviceIoControl does
+static const size_t HostMaxChunk = 0x40000000;
+
+CDriverHostBackend::CDriverHostBackend(CDriverHost *pHost) :
+	m_pHost(pHost)
+{
+}
+
+size_t CDriverHostBackend::Request(const char *pName, uint32_t IoControlCode, const void *pInput, size_t InputSize, void *pOutput, size_t OutputSize) const
+{
+	ULONG Wrote = 0;
+
+	NTSTATUS Status = DriverHostIoControl(m_pHost, IoControlCode, pInput, (ULONG)InputSize, pOutput, (ULONG)OutputSize, &Wrote);
+
+	if (!NT_SUCCESS(Status))
+	{
+		std::stringstream ss;
+		ss << pName;
+		ss << " Failed status = 0x";
+		ss << std::hex << (uint32_t)Status;
+
+		throw std::runtime_error(ss.str());
+	}
+
+	return Wrote;
+}
+
+static void ThrowWrote(const char *pName, size_t Wrote)
+{
+	std::stringstream ss;
+	ss << pName;
+	ss << " wrote = ";
+	ss << Wrote;
+
+	throw std::runtime_error(ss.str());
+}
+
+void CDriverHostBackend::ReqReadProcessMemory(void *Pid, void *Addr, size_t Size, void *Out) const
+{
+	do
+	{
+		CRequestReadProcessMemory Request;
+		Request.pid = Pid;
+		Request.ptr = Addr;
+		Request.size = Size < HostMaxChunk ? Size : HostMaxChunk;
+
+		size_t Wrote = this->Request("ReqReadProcessMemory", CTL_RequestReadProcessMemoryDirect, &Request, sizeof(Request), Out, Request.size);
+
+		if (Wrote != Request.size)
+			ThrowWrote("ReqReadProcessMemory", Wrote);
+
+		Addr = static_cast<char *>(Addr) + Request.size;
+		Out = static_cast<char *>(Out) + Request.size;
+		Size -= Request.size;
+	}
+	while (Size != 0);
+}
+
+void CDriverHostBackend::ReqReadProcessMemoryBulk(void *Pid, void *Addr, size_t Size, void *Out) const
+{
+	ReqReadProcessMemory(Pid, Addr, Size, Out);
+}
+
+void CDriverHostBackend::ReqReadProcessMemoryResident(void *Pid, void *Addr, size_t Size, void *pOut) const
+{
+	size_t TotalSize = Size + DRIVER_RESIDENCY_BITMAP_SIZE(Addr, Size);
+
+	CRequestReadProcessMemory Request;
+	Request.pid = Pid;
+	Request.ptr = Addr;
+	Request.size = Size;
+
+	size_t Wrote = this->Request("ReqReadProcessMemoryResident", CTL_RequestReadProcessMemoryResident, &Request, sizeof(Request), pOut, TotalSize);
+
+	if (Wrote != TotalSize)
+		ThrowWrote("ReqReadProcessMemoryResident", Wrote);
+}
+
+void CDriverHostBackend::ReqQueryResidency(void *Pid, void *Addr, size_t Size, uint8_t *pPresent) const
+{
+	size_t BitmapSize = DRIVER_RESIDENCY_BITMAP_SIZE(Addr, Size);
+
+	CRequestQueryResidency Request;
+	Request.pid = Pid;
+	Request.ptr = Addr;
+	Request.size = Size;
+
+	size_t Wrote = this->Request("ReqQueryResidency", CTL_RequestQueryResidency, &Request, sizeof(Request), pPresent, BitmapSize);
+
+	if (Wrote != BitmapSize)
+		ThrowWrote("ReqQueryResidency", Wrote);
+}
+
+void CDriverHostBackend::ReqWriteProcessMemory(void *Pid, void *Addr, size_t Size, const void *From) const
+{
+	std::vector<uint8_t> Buffer(sizeof(CRequestWriteProcessMemory) + Size);
+
+	CRequestWriteProcessMemory *pRequest = reinterpret_cast<CRequestWriteProcessMemory *>(Buffer.data());
+	pRequest->pid = Pid;
+	pRequest->ptr = Addr;
+	pRequest->size = Size;
+
+	memcpy(pRequest + 1, From, Size);
+
+	Request("ReqWriteProcessMemory", CTL_RequestWriteProcessMemory, Buffer.data(), Buffer.size(), nullptr, 0);
+}
+
+void *CDriverHostBackend::ReqGetModuleBase(void *Pid, const wchar_t *pModuleName, size_t ModuleNameSize) const
+{
+	// wchar_t is wider than WCHAR outside of Windows
+	std::vector<uint8_t> Buffer(sizeof(CRequestModuleBase) + (ModuleNameSize + 1) * sizeof(WCHAR));
+
+	CRequestModuleBase *pRequest = reinterpret_cast<CRequestModuleBase *>(Buffer.data());
+	pRequest->pid = Pid;
+	pRequest->size = ModuleNameSize;
+
+	WCHAR *pName = reinterpret_cast<WCHAR *>(pRequest + 1);
+
+	for (size_t i = 0; i < ModuleNameSize; i++)
+		pName[i] = (WCHAR)pModuleName[i];
+
+	pName[ModuleNameSize] = 0;
+
+	void *Response = nullptr;
+
+	size_t Wrote = Request("ReqGetModuleBase", CTL_RequestModuleBase, Buffer.data(), Buffer.size(), &Response, sizeof(Response));
+
+	if (Wrote != sizeof(Response))
+		ThrowWrote("ReqGetModuleBase", Wrote);
+
+	return Response;
+}
+
+void CDriverHostBackend::ReqAtomic(void *Pid, const CAtomicOperation *pOperations, size_t Count, CAtomicResult *pResults) const
+{
+	std::vector<uint8_t> Buffer(sizeof(CRequestAtomic) + Count * sizeof(CAtomicOperation));
+
+	CRequestAtomic *pRequest = reinterpret_cast<CRequestAtomic *>(Buffer.data());
+	pRequest->pid = Pid;
+	pRequest->count = Count;
+
+	memcpy(pRequest + 1, pOperations, Count * sizeof(CAtomicOperation));
+
+	size_t Wrote = Request("ReqAtomic", CTL_RequestAtomic, Buffer.data(), Buffer.size(), pResults, Count * sizeof(CAtomicResult));
+
+	if (Wrote != Count * sizeof(CAtomicResult))
+		ThrowWrote("ReqAtomic", Wrote);
+}
+
+size_t CDriverHostBackend::ReqQueryRegions(void *Pid, void *Start, CMemoryRegion *pRegions, size_t MaxRegions) const
+{
+	CRequestQueryRegions Request;
+	Request.pid = Pid;
+	Request.ptr = Start;
+
+	size_t Wrote = this->Request("ReqQueryRegions", CTL_RequestQueryRegions, &Request, sizeof(Request), pRegions, MaxRegions * sizeof(CMemoryRegion));
+
+	if (Wrote % sizeof(CMemoryRegion) != 0)
+		ThrowWrote("ReqQueryRegions", Wrote);
+
+	return Wrote / sizeof(CMemoryRegion);
+}
+
+CDriverMirror CDriverHostBackend::Mirror(void *, const CMirrorRange *, size_t, uint32_t) const
+{
+	throw std::runtime_error("Mirror is not supported by driver host");
+}
@@ -0,0 +1,34 @@
+#ifndef _DRIVER_HOST_BACKEND_H_
+#define _DRIVER_HOST_BACKEND_H_
+
+#include "driverapi.hpp"
+
+struct CDriverHost;
+
+/**
+ * Sends requests to simulated processes of driverhost.c instead of driver, so clients can run on hosts without it.
+ * Host is not owned. Mirror is not supported by host.
+ */
+class CDriverHostBackend : public CDriverBackend
+{
+	CDriverHost *m_pHost;
+
+	// Returns count of bytes written to `pOutput`
+	size_t Request(const char *pName, uint32_t IoControlCode, const void *pInput, size_t InputSize, void *pOutput, size_t OutputSize) const;
+
+public:
+
+	CDriverHostBackend(CDriverHost *pHost);
+
+	void ReqReadProcessMemory(void *Pid, void *Addr, size_t Size, void *Out) const override;
+	void ReqReadProcessMemoryBulk(void *Pid, void *Addr, size_t Size, void *Out) const override;
+	void ReqReadProcessMemoryResident(void *Pid, void *Addr, size_t Size, void *pOut) const override;
+	void ReqQueryResidency(void *Pid, void *Addr, size_t Size, uint8_t *pPresent) const override;
+	void ReqWriteProcessMemory(void *Pid, void *Addr, size_t Size, const void *From) const override;
+	void *ReqGetModuleBase(void *Pid, const wchar_t *pModuleName, size_t ModuleNameSize) const override;
+	void ReqAtomic(void *Pid, const CAtomicOperation *pOperations, size_t Count, CAtomicResult *pResults) const override;
+	size_t ReqQueryRegions(void *Pid, void *Start, CMemoryRegion *pRegions, size_t MaxRegions) const override;
+	CDriverMirror Mirror(void *Pid, const CMirrorRange *pRanges, size_t Count, uint32_t IntervalUs) const override;
+};
+
+#endif // _DRIVER_HOST_BACKEND_H_
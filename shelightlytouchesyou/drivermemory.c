@@ -0,0 +1,454 @@
+#include "drivermemory.h"
+
+#include "pebhelper.h"
+
+typedef NTSTATUS(*QUERY_INFO_PROCESS) (
+	__in HANDLE ProcessHandle,
+	__in PROCESSINFOCLASS ProcessInformationClass,
+	__out_bcount(ProcessInformationLength) PVOID ProcessInformation,
+	__in ULONG ProcessInformationLength,
+	__out_opt PULONG ReturnLength
+);
+
+static QUERY_INFO_PROCESS ZwQueryInformationProcess;
+
+C_ASSERT(sizeof(KAPC_STATE) <= sizeof(((struct CDriverAttachState *)0)->Opaque));
+
+NTSTATUS
+DriverMemoryInit(
+	VOID
+)
+{
+	PAGED_CODE();
+
+	DECLARE_CONST_UNICODE_STRING(RoutineName, L"ZwQueryInformationProcess");
+	ZwQueryInformationProcess = (QUERY_INFO_PROCESS)MmGetSystemRoutineAddress((PUNICODE_STRING)&RoutineName);
+
+	return ZwQueryInformationProcess != NULL ? STATUS_SUCCESS : STATUS_UNSUCCESSFUL;
+}
+
+NTSTATUS
+KernelLookupProcess(
+	_In_ void *Context,
+	_In_ void *Pid,
+	_Out_ void **Process
+)
+{
+	PAGED_CODE();
+
+	UNREFERENCED_PARAMETER(Context);
+
+	return PsLookupProcessByProcessId(Pid, (PEPROCESS *)Process);
+}
+
+VOID
+KernelReleaseProcess(
+	_In_ void *Context,
+	_In_ void *Process
+)
+{
+	UNREFERENCED_PARAMETER(Context);
+
+	ObDereferenceObject(Process);
+}
+
+VOID
+KernelAttach(
+	_In_ void *Context,
+	_In_ void *Process,
+	_Out_ struct CDriverAttachState *State
+)
+{
+	PAGED_CODE();
+
+	UNREFERENCED_PARAMETER(Context);
+
+	State->Process = Process;
+	KeStackAttachProcess(Process, (PKAPC_STATE)State->Opaque);
+}
+
+VOID
+KernelDetach(
+	_In_ void *Context,
+	_In_ struct CDriverAttachState *State
+)
+{
+	PAGED_CODE();
+
+	UNREFERENCED_PARAMETER(Context);
+
+	KeUnstackDetachProcess((PKAPC_STATE)State->Opaque);
+}
+
+NTSTATUS
+KernelCopyFrom(
+	_In_ void *Context,
+	_In_ struct CDriverAttachState *State,
+	_In_ const void *Source,
+	_Out_ void *Destination,
+	_In_ SIZE_T Size
+)
+{
+	PAGED_CODE();
+
+	UNREFERENCED_PARAMETER(Context);
+	UNREFERENCED_PARAMETER(State);
+
+	__try
+	{
+		ProbeForRead((PVOID)Source, Size, 1);
+		RtlCopyMemory(Destination, Source, Size);
+	}
+	__except (EXCEPTION_EXECUTE_HANDLER)
+	{
+		return STATUS_UNSUCCESSFUL;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS
+KernelCopyTo(
+	_In_ void *Context,
+	_In_ struct CDriverAttachState *State,
+	_In_ void *Destination,
+	_In_ const void *Source,
+	_In_ SIZE_T Size
+)
+{
+	PAGED_CODE();
+
+	UNREFERENCED_PARAMETER(Context);
+	UNREFERENCED_PARAMETER(State);
+
+	__try
+	{
+		ProbeForWrite(Destination, Size, 1);
+		RtlCopyMemory(Destination, Source, Size);
+	}
+	__except (EXCEPTION_EXECUTE_HANDLER)
+	{
+		return STATUS_UNSUCCESSFUL;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+#define DEFINE_ATOMIC_EXECUTE(Name, Type, UnsignedType, CompareExchange, ExchangeAdd, Or, And) \
+static NTSTATUS \
+Name( \
+	_Inout_ Type volatile *Target, \
+	_In_ const struct CAtomicOperation *Operation, \
+	_Out_ struct CAtomicResult *Result \
+) \
+{ \
+	Type previous; \
+	\
+	switch (Operation->op) \
+	{ \
+		case DRIVER_ATOMIC_COMPARE_EXCHANGE: \
+		case DRIVER_ATOMIC_WRITE_IF_EQUAL: \
+			previous = CompareExchange(Target, (Type)Operation->operand, (Type)Operation->comparand); \
+			Result->stored = previous == (Type)Operation->comparand; \
+			break; \
+		\
+		case DRIVER_ATOMIC_FETCH_ADD: \
+			previous = ExchangeAdd(Target, (Type)Operation->operand); \
+			Result->stored = TRUE; \
+			break; \
+		\
+		case DRIVER_ATOMIC_FETCH_OR: \
+			previous = Or(Target, (Type)Operation->operand); \
+			Result->stored = TRUE; \
+			break; \
+		\
+		case DRIVER_ATOMIC_FETCH_AND: \
+			previous = And(Target, (Type)Operation->operand); \
+			Result->stored = TRUE; \
+			break; \
+		\
+		default: \
+			return STATUS_INVALID_PARAMETER; \
+	} \
+	\
+	Result->previous = (UINT64)(UnsignedType)previous; \
+	\
+	return STATUS_SUCCESS; \
+}
+
+DEFINE_ATOMIC_EXECUTE(AtomicExecute8, CHAR, UCHAR, _InterlockedCompareExchange8, _InterlockedExchangeAdd8, _InterlockedOr8, _InterlockedAnd8)
+DEFINE_ATOMIC_EXECUTE(AtomicExecute16, SHORT, USHORT, _InterlockedCompareExchange16, _InterlockedExchangeAdd16, _InterlockedOr16, _InterlockedAnd16)
+DEFINE_ATOMIC_EXECUTE(AtomicExecute32, LONG, ULONG, InterlockedCompareExchange, InterlockedExchangeAdd, InterlockedOr, InterlockedAnd)
+DEFINE_ATOMIC_EXECUTE(AtomicExecute64, LONG64, ULONG64, InterlockedCompareExchange64, InterlockedExchangeAdd64, InterlockedOr64, InterlockedAnd64)
+
+NTSTATUS
+KernelAtomic(
+	_In_ void *Context,
+	_In_ struct CDriverAttachState *State,
+	_In_ const struct CAtomicOperation *Operation,
+	_Out_ struct CAtomicResult *Result
+)
+{
+	UNREFERENCED_PARAMETER(Context);
+	UNREFERENCED_PARAMETER(State);
+
+	__try
+	{
+		ProbeForWrite(Operation->ptr, Operation->size, Operation->size);
+
+		switch (Operation->size)
+		{
+			case 1: return AtomicExecute8(Operation->ptr, Operation, Result);
+			case 2: return AtomicExecute16(Operation->ptr, Operation, Result);
+			case 4: return AtomicExecute32(Operation->ptr, Operation, Result);
+			case 8: return AtomicExecute64(Operation->ptr, Operation, Result);
+			default: return STATUS_INVALID_PARAMETER;
+		}
+	}
+	__except (EXCEPTION_EXECUTE_HANDLER)
+	{
+		return STATUS_ACCESS_VIOLATION;
+	}
+}
+
+NTSTATUS
+KernelCopyResident(
+	_In_ void *Context,
+	_In_ struct CDriverAttachState *State,
+	_In_ const void *Source,
+	_Out_opt_ void *Destination,
+	_In_ SIZE_T Size,
+	_Out_ PUCHAR Present
+)
+{
+	MM_COPY_ADDRESS copyAddress;
+	SIZE_T offset = 0;
+	SIZE_T chunk;
+	SIZE_T copied;
+	SIZE_T page = 0;
+	PUCHAR address;
+	BOOLEAN present;
+
+	PAGED_CODE();
+
+	UNREFERENCED_PARAMETER(Context);
+	UNREFERENCED_PARAMETER(State);
+
+	// Only checks that range is in user space, nothing is touched
+	__try
+	{
+		ProbeForRead((PVOID)Source, Size, 1);
+	}
+	__except (EXCEPTION_EXECUTE_HANDLER)
+	{
+		return STATUS_UNSUCCESSFUL;
+	}
+
+	while (offset < Size)
+	{
+		address = (PUCHAR)Source + offset;
+		chunk = DRIVER_PAGE_SIZE - ((ULONG_PTR)address & (DRIVER_PAGE_SIZE - 1));
+
+		if (chunk > Size - offset)
+			chunk = Size - offset;
+
+		// Valid PTE means the page is in working set. Copy goes through physical address, so it can't fault
+		// even if page is trimmed in between.
+		present = MmIsAddressValid(address);
+
+		if (present && Destination != NULL)
+		{
+			copyAddress.PhysicalAddress = MmGetPhysicalAddress(address);
+
+			present = NT_SUCCESS(MmCopyMemory((PUCHAR)Destination + offset, copyAddress, chunk, MM_COPY_MEMORY_PHYSICAL, &copied)) && copied == chunk;
+
+			// Page trimmed or moved to another frame during copy: frame may already belong to someone else,
+			// so data is reported as not present instead of returning it
+			if (present)
+				present = MmIsAddressValid(address) && MmGetPhysicalAddress(address).QuadPart == copyAddress.PhysicalAddress.QuadPart;
+		}
+
+		if (present)
+			Present[page / 8] |= (UCHAR)(1 << (page % 8));
+		else if (Destination != NULL)
+			RtlZeroMemory((PUCHAR)Destination + offset, chunk);
+
+		offset += chunk;
+		page++;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+static NTSTATUS
+GetModuleHandleFromProcessPEB(
+	_In_ PPEB Peb,
+	_In_ PWCHAR ModuleName,
+	_In_ SIZE_T ModuleNameSize,
+	_Out_ void **Result
+)
+{
+	NTSTATUS status = STATUS_UNSUCCESSFUL;
+	PLIST_ENTRY inMemoryOrderModuleList;
+	PLIST_ENTRY tempListItem;
+	UNICODE_STRING searchModuleName;
+	PUNICODE_STRING processModuleName;
+
+	PAGED_CODE();
+
+	searchModuleName.Length = (USHORT)ModuleNameSize * 2;
+	searchModuleName.MaximumLength = (USHORT)ModuleNameSize * 2;
+	searchModuleName.Buffer = ModuleName;
+
+	__try
+	{
+		inMemoryOrderModuleList = PEB_GetInMemoryOrderModuleList(Peb);
+		tempListItem = inMemoryOrderModuleList;
+
+		for (tempListItem = tempListItem->Flink; tempListItem != inMemoryOrderModuleList; tempListItem = tempListItem->Flink)
+		{
+			processModuleName = LDR_DATA_GetFullDllName((PLDR_DATA_TABLE_ENTRY)tempListItem);
+
+			if (RtlEqualUnicodeString(&searchModuleName, processModuleName, TRUE) == TRUE)
+			{
+				*Result = LDR_DATA_GetModuleBase((PLDR_DATA_TABLE_ENTRY)tempListItem);
+
+				status = STATUS_SUCCESS;
+				break;
+			}
+		}
+	}
+	__except (EXCEPTION_EXECUTE_HANDLER)
+	{
+		status = STATUS_UNSUCCESSFUL;
+	}
+
+	return status;
+}
+
+static NTSTATUS
+GetProcessPEB(
+	_In_ HANDLE hProcess,
+	_Out_ PPEB *peb
+)
+{
+	NTSTATUS status;
+	PROCESS_BASIC_INFORMATION BasicInfo;
+	ULONG returenLength = 0;
+
+	PAGED_CODE();
+
+	status = ZwQueryInformationProcess(hProcess,
+		ProcessBasicInformation,
+		&BasicInfo,
+		sizeof(BasicInfo),
+		&returenLength);
+
+	if (!NT_SUCCESS(status))
+		goto M_ERR;
+
+	*peb = BasicInfo.PebBaseAddress;
+
+M_ERR:
+	return status;
+}
+
+NTSTATUS
+KernelModuleBase(
+	_In_ void *Context,
+	_In_ void *Process,
+	_In_ const WCHAR *Name,
+	_In_ SIZE_T NameSize,
+	_Out_ void **Result
+)
+{
+	NTSTATUS status;
+	HANDLE hProcess;
+	PPEB peb;
+
+	PAGED_CODE();
+
+	UNREFERENCED_PARAMETER(Context);
+
+	status = ObOpenObjectByPointer(Process, OBJ_KERNEL_HANDLE, NULL, 0, *PsProcessType, KernelMode, &hProcess);
+
+	if (!NT_SUCCESS(status))
+		goto M_ERR;
+
+	status = GetProcessPEB(hProcess, &peb);
+
+	if (!NT_SUCCESS(status))
+		goto M_ERR_CLOSE;
+
+	status = GetModuleHandleFromProcessPEB(peb, (PWCHAR)Name, NameSize, Result);
+
+M_ERR_CLOSE:
+	ZwClose(hProcess);
+
+M_ERR:
+	return status;
+}
+
+NTSTATUS
+KernelQueryRegions(
+	_In_ void *Context,
+	_In_ void *Process,
+	_In_ void *Start,
+	_Out_ struct CMemoryRegion *Regions,
+	_In_ ULONG MaxRegions,
+	_Out_ PULONG Count
+)
+{
+	NTSTATUS status;
+	HANDLE hProcess;
+	MEMORY_BASIC_INFORMATION info;
+	SIZE_T returnLength;
+	ULONG_PTR address = (ULONG_PTR)Start;
+	ULONG_PTR next;
+	ULONG count = 0;
+	struct CMemoryRegion region;
+
+	PAGED_CODE();
+
+	UNREFERENCED_PARAMETER(Context);
+
+	status = ObOpenObjectByPointer(Process, OBJ_KERNEL_HANDLE, NULL, 0, *PsProcessType, KernelMode, &hProcess);
+
+	if (!NT_SUCCESS(status))
+		goto M_ERR;
+
+	while (count < MaxRegions)
+	{
+		// Fails past the highest user address
+		if (!NT_SUCCESS(ZwQueryVirtualMemory(hProcess, (PVOID)address, MemoryBasicInformation, &info, sizeof(info), &returnLength)))
+			break;
+
+		if (info.State == MEM_COMMIT)
+		{
+			region.base = info.BaseAddress;
+			region.allocationBase = info.AllocationBase;
+			region.size = info.RegionSize;
+			region.state = info.State;
+			region.protect = info.Protect;
+			region.type = info.Type;
+			region.reserved = 0;
+
+			RtlCopyMemory(&Regions[count], &region, sizeof(region));
+			count++;
+		}
+
+		next = (ULONG_PTR)info.BaseAddress + info.RegionSize;
+
+		if (next <= address)
+			break;
+
+		address = next;
+	}
+
+	ZwClose(hProcess);
+
+M_ERR:
+	*Count = count;
+
+	return status;
+}
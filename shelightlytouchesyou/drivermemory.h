@@ -0,0 +1,101 @@
+#ifndef _DRIVER_MEMORY_H_
+#define _DRIVER_MEMORY_H_
+
+#include "drivercore.h"
+
+#include <ntifs.h>
+
+// Resolves routines not exported by headers
+NTSTATUS
+DriverMemoryInit(
+	VOID
+);
+
+// Operations of struct CDriverPlatform, see drivercore.h
+
+NTSTATUS
+KernelLookupProcess(
+	_In_ void *Context,
+	_In_ void *Pid,
+	_Out_ void **Process
+);
+
+VOID
+KernelReleaseProcess(
+	_In_ void *Context,
+	_In_ void *Process
+);
+
+VOID
+KernelAttach(
+	_In_ void *Context,
+	_In_ void *Process,
+	_Out_ struct CDriverAttachState *State
+);
+
+VOID
+KernelDetach(
+	_In_ void *Context,
+	_In_ struct CDriverAttachState *State
+);
+
+NTSTATUS
+KernelCopyFrom(
+	_In_ void *Context,
+	_In_ struct CDriverAttachState *State,
+	_In_ const void *Source,
+	_Out_ void *Destination,
+	_In_ SIZE_T Size
+);
+
+NTSTATUS
+KernelCopyTo(
+	_In_ void *Context,
+	_In_ struct CDriverAttachState *State,
+	_In_ void *Destination,
+	_In_ const void *Source,
+	_In_ SIZE_T Size
+);
+
+NTSTATUS
+KernelAtomic(
+	_In_ void *Context,
+	_In_ struct CDriverAttachState *State,
+	_In_ const struct CAtomicOperation *Operation,
+	_Out_ struct CAtomicResult *Result
+);
+
+/**
+ * Copies only pages resident in target's working set, so target never pages in because of us.
+ * `Destination` and `Present` must be system addresses.
+ */
+NTSTATUS
+KernelCopyResident(
+	_In_ void *Context,
+	_In_ struct CDriverAttachState *State,
+	_In_ const void *Source,
+	_Out_opt_ void *Destination,
+	_In_ SIZE_T Size,
+	_Out_ PUCHAR Present
+);
+
+NTSTATUS
+KernelModuleBase(
+	_In_ void *Context,
+	_In_ void *Process,
+	_In_ const WCHAR *Name,
+	_In_ SIZE_T NameSize,
+	_Out_ void **Result
+);
+
+NTSTATUS
+KernelQueryRegions(
+	_In_ void *Context,
+	_In_ void *Process,
+	_In_ void *Start,
+	_Out_ struct CMemoryRegion *Regions,
+	_In_ ULONG MaxRegions,
+	_Out_ PULONG Count
+);
+
+#endif // _DRIVER_MEMORY_H_
@@ -0,0 +1,468 @@
+#include "drivermirror.h"
+
+#define DRIVER_MIRROR_TAG 'rMtS'
+
+typedef struct _MIRROR_SESSION
+{
+	WDFREQUEST Request;
+	WDFFILEOBJECT FileObject;
+	PEPROCESS Process;
+
+	// System address of output buffer, shared with client
+	struct CMirrorHeader *Shared;
+
+	// Ranges are copied here first, so `sequence` stays odd only for a memcpy and not for page faults
+	PUCHAR Staging;
+	SIZE_T DataSize;
+
+	ULONG Count;
+	struct CMirrorRange Ranges[DRIVER_MIRROR_MAX_RANGES];
+
+	// Interrupt time in 100ns units
+	LONG64 Interval;
+	LONG64 Due;
+
+	// STATUS_PENDING while running, first reason to stop wins
+	volatile LONG StopStatus;
+
+	// Guarded by MirrorLock
+	BOOLEAN Canceled;
+	BOOLEAN Finished;
+} MIRROR_SESSION, *PMIRROR_SESSION;
+
+// Slots are filled by requests and cleared only by worker or by cancel routine of finished session
+static KSPIN_LOCK MirrorLock;
+static PMIRROR_SESSION MirrorSessions[DRIVER_MIRROR_MAX_SESSIONS];
+
+static HANDLE MirrorWorkerHandle;
+static volatile LONG MirrorStopping;
+
+// Set on new session, on stop request and on driver stop
+static KEVENT MirrorWakeEvent;
+
+static VOID
+MirrorSetStop(
+	_In_ PMIRROR_SESSION Session,
+	_In_ NTSTATUS Status
+)
+{
+	InterlockedCompareExchange(&Session->StopStatus, Status, STATUS_PENDING);
+}
+
+static VOID
+MirrorFree(
+	_In_ PMIRROR_SESSION Session
+)
+{
+	ObDereferenceObject(Session->Process);
+	ExFreePoolWithTag(Session, DRIVER_MIRROR_TAG);
+}
+
+static VOID
+MirrorCancel(
+	_In_ WDFREQUEST Request
+)
+{
+	ULONG i;
+	KIRQL oldIrql;
+	PMIRROR_SESSION session;
+
+	KeAcquireSpinLock(&MirrorLock, &oldIrql);
+
+	for (i = 0; i < DRIVER_MIRROR_MAX_SESSIONS; i++)
+	{
+		session = MirrorSessions[i];
+
+		if (session == NULL || session->Request != Request)
+			continue;
+
+		// Worker gave up the request already, completion is on us
+		if (session->Finished)
+		{
+			MirrorSessions[i] = NULL;
+			KeReleaseSpinLock(&MirrorLock, oldIrql);
+
+			WdfRequestComplete(Request, STATUS_CANCELLED);
+			MirrorFree(session);
+			return;
+		}
+
+		session->Canceled = TRUE;
+		MirrorSetStop(session, STATUS_CANCELLED);
+		break;
+	}
+
+	KeReleaseSpinLock(&MirrorLock, oldIrql);
+
+	KeSetEvent(&MirrorWakeEvent, IO_NO_INCREMENT, FALSE);
+}
+
+// Session of slot owned by worker, NULL if slot is empty or its finished session is left to cancel routine to free
+static PMIRROR_SESSION
+MirrorGet(
+	_In_ ULONG Index
+)
+{
+	KIRQL oldIrql;
+	PMIRROR_SESSION session;
+
+	KeAcquireSpinLock(&MirrorLock, &oldIrql);
+	session = MirrorSessions[Index];
+
+	if (session != NULL && session->Finished)
+		session = NULL;
+
+	KeReleaseSpinLock(&MirrorLock, oldIrql);
+
+	return session;
+}
+
+static VOID
+MirrorFinish(
+	_In_ ULONG Index,
+	_In_ PMIRROR_SESSION Session
+)
+{
+	NTSTATUS status;
+	KIRQL oldIrql;
+
+	PAGED_CODE();
+
+	status = WdfRequestUnmarkCancelable(Session->Request);
+
+	KeAcquireSpinLock(&MirrorLock, &oldIrql);
+
+	// Cancel routine is about to run and completes the request itself
+	if (status == STATUS_CANCELLED && !Session->Canceled)
+	{
+		Session->Finished = TRUE;
+		KeReleaseSpinLock(&MirrorLock, oldIrql);
+		return;
+	}
+
+	MirrorSessions[Index] = NULL;
+
+	KeReleaseSpinLock(&MirrorLock, oldIrql);
+
+	WdfRequestComplete(Session->Request, status == STATUS_CANCELLED ? STATUS_CANCELLED : Session->StopStatus);
+	MirrorFree(Session);
+}
+
+static VOID
+MirrorRefresh(
+	_In_ PMIRROR_SESSION Session
+)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	KAPC_STATE apcState;
+	LARGE_INTEGER timeout;
+	PUCHAR staging = Session->Staging;
+	ULONG i;
+
+	PAGED_CODE();
+
+	// Process object is signaled once process exits
+	timeout.QuadPart = 0;
+
+	if (KeWaitForSingleObject(Session->Process, Executive, KernelMode, FALSE, &timeout) != STATUS_TIMEOUT)
+	{
+		MirrorSetStop(Session, STATUS_PROCESS_IS_TERMINATING);
+		return;
+	}
+
+	KeStackAttachProcess(Session->Process, &apcState);
+
+	for (i = 0; i < Session->Count; i++)
+	{
+		__try
+		{
+			ProbeForRead(Session->Ranges[i].ptr, Session->Ranges[i].size, 1);
+			RtlCopyMemory(staging, Session->Ranges[i].ptr, Session->Ranges[i].size);
+		}
+		__except (EXCEPTION_EXECUTE_HANDLER)
+		{
+			status = STATUS_PARTIAL_COPY;
+		}
+
+		staging += DRIVER_MIRROR_ALIGN(Session->Ranges[i].size);
+	}
+
+	KeUnstackDetachProcess(&apcState);
+
+	// Interlocked operations are full barriers, data never becomes visible outside odd `sequence`
+	InterlockedIncrement64(&Session->Shared->sequence);
+
+	RtlCopyMemory(Session->Shared + 1, Session->Staging, Session->DataSize);
+	Session->Shared->status = status;
+	Session->Shared->timestamp = (INT64)KeQueryInterruptTime();
+	Session->Shared->updates++;
+
+	InterlockedIncrement64(&Session->Shared->sequence);
+}
+
+static VOID
+MirrorWorker(
+	_In_ PVOID Context
+)
+{
+	ULONG i;
+	ULONG active;
+	BOOLEAN resolutionSet = FALSE;
+	LONG64 now;
+	LONG64 earliest;
+	LARGE_INTEGER timeout;
+	PMIRROR_SESSION session;
+
+	PAGED_CODE();
+
+	UNREFERENCED_PARAMETER(Context);
+
+	while (!MirrorStopping)
+	{
+		active = 0;
+		earliest = MAXLONG64;
+
+		for (i = 0; i < DRIVER_MIRROR_MAX_SESSIONS; i++)
+		{
+			session = MirrorGet(i);
+
+			if (session == NULL)
+				continue;
+
+			if (session->StopStatus == STATUS_PENDING)
+			{
+				now = (LONG64)KeQueryInterruptTime();
+
+				if (session->Due <= now)
+				{
+					MirrorRefresh(session);
+
+					// Missed ticks are dropped, not caught up
+					session->Due += session->Interval;
+
+					if (session->Due <= now)
+						session->Due = now + session->Interval;
+				}
+			}
+
+			if (session->StopStatus != STATUS_PENDING)
+			{
+				MirrorFinish(i, session);
+				continue;
+			}
+
+			active++;
+
+			if (session->Due < earliest)
+				earliest = session->Due;
+		}
+
+		// Default clock tick is too coarse for sub-15ms intervals, keep it fine only while sessions run
+		if ((active != 0) != resolutionSet)
+		{
+			ExSetTimerResolution(DRIVER_MIRROR_MIN_INTERVAL_US * 10, !resolutionSet);
+			resolutionSet = !resolutionSet;
+		}
+
+		if (active == 0)
+		{
+			KeWaitForSingleObject(&MirrorWakeEvent, Executive, KernelMode, FALSE, NULL);
+			continue;
+		}
+
+		now = (LONG64)KeQueryInterruptTime();
+
+		if (earliest <= now)
+			continue;
+
+		timeout.QuadPart = now - earliest;
+
+		KeWaitForSingleObject(&MirrorWakeEvent, Executive, KernelMode, FALSE, &timeout);
+	}
+
+	for (i = 0; i < DRIVER_MIRROR_MAX_SESSIONS; i++)
+	{
+		session = MirrorGet(i);
+
+		if (session == NULL)
+			continue;
+
+		MirrorSetStop(session, STATUS_CANCELLED);
+		MirrorFinish(i, session);
+	}
+
+	if (resolutionSet)
+		ExSetTimerResolution(0, FALSE);
+
+	PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+NTSTATUS
+DriverMirrorStart(
+	VOID
+)
+{
+	OBJECT_ATTRIBUTES attributes;
+
+	PAGED_CODE();
+
+	KeInitializeSpinLock(&MirrorLock);
+	KeInitializeEvent(&MirrorWakeEvent, SynchronizationEvent, FALSE);
+
+	RtlZeroMemory(MirrorSessions, sizeof(MirrorSessions));
+	MirrorStopping = 0;
+
+	InitializeObjectAttributes(&attributes, NULL, OBJ_KERNEL_HANDLE, NULL, NULL);
+
+	return PsCreateSystemThread(&MirrorWorkerHandle, THREAD_ALL_ACCESS, &attributes, NULL, NULL, MirrorWorker, NULL);
+}
+
+VOID
+DriverMirrorStop(
+	VOID
+)
+{
+	PAGED_CODE();
+
+	InterlockedExchange(&MirrorStopping, 1);
+	KeSetEvent(&MirrorWakeEvent, IO_NO_INCREMENT, FALSE);
+
+	ZwWaitForSingleObject(MirrorWorkerHandle, FALSE, NULL);
+	ZwClose(MirrorWorkerHandle);
+}
+
+VOID
+DriverMirrorFileCleanup(
+	_In_ WDFFILEOBJECT FileObject
+)
+{
+	ULONG i;
+	KIRQL oldIrql;
+	BOOLEAN found = FALSE;
+
+	PAGED_CODE();
+
+	KeAcquireSpinLock(&MirrorLock, &oldIrql);
+
+	for (i = 0; i < DRIVER_MIRROR_MAX_SESSIONS; i++)
+	{
+		if (MirrorSessions[i] != NULL && MirrorSessions[i]->FileObject == FileObject)
+		{
+			MirrorSetStop(MirrorSessions[i], STATUS_CANCELLED);
+			found = TRUE;
+		}
+	}
+
+	KeReleaseSpinLock(&MirrorLock, oldIrql);
+
+	if (found)
+		KeSetEvent(&MirrorWakeEvent, IO_NO_INCREMENT, FALSE);
+}
+
+NTSTATUS
+ProcessRequestMirror(
+	_In_ WDFREQUEST Request,
+	_In_ WDFFILEOBJECT FileObject,
+	_In_ struct CRequestMirror *MRequest,
+	_Out_ struct CMirrorHeader *Shared,
+	_In_ SIZE_T OutputSize
+)
+{
+	NTSTATUS status;
+	KIRQL oldIrql;
+	ULONG i;
+	ULONG slot = DRIVER_MIRROR_MAX_SESSIONS;
+	SIZE_T dataSize = 0;
+	struct CMirrorRange *ranges = (struct CMirrorRange *)(MRequest + 1);
+	PMIRROR_SESSION session;
+
+	PAGED_CODE();
+
+	if (MRequest->intervalUs < DRIVER_MIRROR_MIN_INTERVAL_US || MRequest->intervalUs > DRIVER_MIRROR_MAX_INTERVAL_US)
+		return STATUS_INVALID_PARAMETER;
+
+	for (i = 0; i < MRequest->count; i++)
+	{
+		if (ranges[i].size == 0 || ranges[i].size > DRIVER_MIRROR_MAX_BYTES)
+			return STATUS_INVALID_PARAMETER;
+
+		dataSize += DRIVER_MIRROR_ALIGN(ranges[i].size);
+	}
+
+	if (dataSize > DRIVER_MIRROR_MAX_BYTES)
+		return STATUS_INVALID_PARAMETER;
+
+	if (OutputSize != sizeof(struct CMirrorHeader) + dataSize)
+		return STATUS_INVALID_BUFFER_SIZE;
+
+	session = ExAllocatePoolWithTag(NonPagedPoolNx, sizeof(MIRROR_SESSION) + dataSize, DRIVER_MIRROR_TAG);
+
+	if (session == NULL)
+		return STATUS_INSUFFICIENT_RESOURCES;
+
+	RtlZeroMemory(session, sizeof(MIRROR_SESSION) + dataSize);
+
+	status = PsLookupProcessByProcessId(MRequest->pid, &session->Process);
+
+	if (!NT_SUCCESS(status))
+		goto M_ERR_FREE;
+
+	session->Request = Request;
+	session->FileObject = FileObject;
+	session->Shared = Shared;
+	session->Staging = (PUCHAR)(session + 1);
+	session->DataSize = dataSize;
+	session->Count = MRequest->count;
+	session->Interval = (LONG64)MRequest->intervalUs * 10;
+	session->Due = (LONG64)KeQueryInterruptTime();
+	session->StopStatus = STATUS_PENDING;
+
+	RtlCopyMemory(session->Ranges, ranges, MRequest->count * sizeof(struct CMirrorRange));
+
+	RtlZeroMemory(Shared, OutputSize);
+	Shared->count = MRequest->count;
+
+	KeAcquireSpinLock(&MirrorLock, &oldIrql);
+
+	for (i = 0; i < DRIVER_MIRROR_MAX_SESSIONS; i++)
+	{
+		if (MirrorSessions[i] == NULL)
+		{
+			if (slot == DRIVER_MIRROR_MAX_SESSIONS)
+				slot = i;
+		}
+		else if (MirrorSessions[i]->FileObject == FileObject)
+		{
+			// One session per handle
+			status = STATUS_DEVICE_BUSY;
+			goto M_ERR_UNLOCK;
+		}
+	}
+
+	if (slot == DRIVER_MIRROR_MAX_SESSIONS)
+	{
+		status = STATUS_TOO_MANY_SESSIONS;
+		goto M_ERR_UNLOCK;
+	}
+
+	status = WdfRequestMarkCancelableEx(Request, MirrorCancel);
+
+	if (!NT_SUCCESS(status))
+		goto M_ERR_UNLOCK;
+
+	MirrorSessions[slot] = session;
+
+	KeReleaseSpinLock(&MirrorLock, oldIrql);
+
+	KeSetEvent(&MirrorWakeEvent, IO_NO_INCREMENT, FALSE);
+
+	return STATUS_PENDING;
+
+M_ERR_UNLOCK:
+	KeReleaseSpinLock(&MirrorLock, oldIrql);
+	ObDereferenceObject(session->Process);
+
+M_ERR_FREE:
+	ExFreePoolWithTag(session, DRIVER_MIRROR_TAG);
+	return status;
+}
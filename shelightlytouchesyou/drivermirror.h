@@ -0,0 +1,38 @@
+#ifndef _DRIVER_MIRROR_H_
+#define _DRIVER_MIRROR_H_
+
+#include "driver.h"
+
+#include <ntifs.h>
+#include <wdf.h>
+
+NTSTATUS
+DriverMirrorStart(
+	VOID
+);
+
+VOID
+DriverMirrorStop(
+	VOID
+);
+
+// Stops sessions started through this handle
+VOID
+DriverMirrorFileCleanup(
+	_In_ WDFFILEOBJECT FileObject
+);
+
+/**
+ * Input size and `count` must be validated already. `Shared` is mapped output buffer.
+ * Returns STATUS_PENDING if session was started. Such request is completed later by mirror worker.
+ */
+NTSTATUS
+ProcessRequestMirror(
+	_In_ WDFREQUEST Request,
+	_In_ WDFFILEOBJECT FileObject,
+	_In_ struct CRequestMirror *MRequest,
+	_Out_ struct CMirrorHeader *Shared,
+	_In_ SIZE_T OutputSize
+);
+
+#endif // _DRIVER_MIRROR_H_
@@ -0,0 +1,257 @@
+#include "driverparallel.h"
+
+#define DRIVER_PARALLEL_TAG 'rPtS'
+
+typedef struct _PARALLEL_READ
+{
+	WDFREQUEST Request;
+	PEPROCESS Process;
+	PUCHAR Target;
+	PUCHAR Buffer; // system address
+	SIZE_T Size;
+	SIZE_T ChunkSize;
+	ULONG ChunkCount;
+
+	// Workers take chunks in order, so only WorkerCount of them are in flight
+	volatile LONG NextChunk;
+
+	// Workers still running, the last one to finish gives up its request
+	volatile LONG Workers;
+
+	// One for workers and one for cancel routine, whoever drops the last completes the request
+	volatile LONG References;
+
+	// STATUS_SUCCESS until a chunk fails or request is canceled, first one wins
+	volatile LONG Status;
+
+	ULONG WorkerCount;
+	PIO_WORKITEM WorkItems[DRIVER_PARALLEL_MAX_WORKERS];
+} PARALLEL_READ, *PPARALLEL_READ;
+
+typedef struct _PARALLEL_REQUEST_CONTEXT
+{
+	PPARALLEL_READ Read;
+} PARALLEL_REQUEST_CONTEXT, *PPARALLEL_REQUEST_CONTEXT;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(PARALLEL_REQUEST_CONTEXT, GetParallelRequestContext);
+
+static VOID
+ParallelFree(
+	_In_ PPARALLEL_READ Read
+)
+{
+	ULONG i;
+
+	for (i = 0; i < Read->WorkerCount; i++)
+	{
+		if (Read->WorkItems[i] != NULL)
+			IoFreeWorkItem(Read->WorkItems[i]);
+	}
+
+	ObDereferenceObject(Read->Process);
+	ExFreePoolWithTag(Read, DRIVER_PARALLEL_TAG);
+}
+
+static VOID
+ParallelRelease(
+	_In_ PPARALLEL_READ Read
+)
+{
+	NTSTATUS status;
+
+	if (InterlockedDecrement(&Read->References) != 0)
+		return;
+
+	status = Read->Status;
+	WdfRequestCompleteWithInformation(Read->Request, status, NT_SUCCESS(status) ? Read->Size : 0);
+
+	ParallelFree(Read);
+}
+
+static EVT_WDF_REQUEST_CANCEL ParallelCancel;
+
+static VOID
+ParallelCancel(
+	_In_ WDFREQUEST Request
+)
+{
+	PPARALLEL_READ read = GetParallelRequestContext(Request)->Read;
+
+	// Workers stop after chunks they are copying
+	InterlockedCompareExchange(&read->Status, STATUS_CANCELLED, STATUS_SUCCESS);
+
+	ParallelRelease(read);
+}
+
+static IO_WORKITEM_ROUTINE ParallelWorker;
+
+static VOID
+ParallelWorker(
+	_In_ PDEVICE_OBJECT DeviceObject,
+	_In_opt_ PVOID Context
+)
+{
+	NTSTATUS status;
+	PPARALLEL_READ read = Context;
+	KAPC_STATE apcState;
+	SIZE_T offset;
+	SIZE_T size;
+	LONG index;
+
+	PAGED_CODE();
+
+	UNREFERENCED_PARAMETER(DeviceObject);
+
+	for (;;)
+	{
+		index = InterlockedIncrement(&read->NextChunk) - 1;
+
+		// Chunk after a failed one would be thrown away anyway
+		if ((ULONG)index >= read->ChunkCount || read->Status != STATUS_SUCCESS)
+			break;
+
+		offset = (SIZE_T)index * read->ChunkSize;
+		size = min(read->ChunkSize, read->Size - offset);
+		status = STATUS_SUCCESS;
+
+		KeStackAttachProcess(read->Process, &apcState);
+
+		__try
+		{
+			ProbeForRead(read->Target + offset, size, 1);
+			RtlCopyMemory(read->Buffer + offset, read->Target + offset, size);
+		}
+		__except (EXCEPTION_EXECUTE_HANDLER)
+		{
+			status = STATUS_UNSUCCESSFUL;
+		}
+
+		KeUnstackDetachProcess(&apcState);
+
+		if (!NT_SUCCESS(status))
+			InterlockedCompareExchange(&read->Status, status, STATUS_SUCCESS);
+	}
+
+	if (InterlockedDecrement(&read->Workers) != 0)
+		return;
+
+	// Cancel routine which already ran or is about to run drops its own reference
+	if (WdfRequestUnmarkCancelable(read->Request) != STATUS_CANCELLED)
+		ParallelRelease(read);
+
+	// Work items of other workers are not touched by them after the decrement
+	ParallelRelease(read);
+}
+
+// Page aligned chunks of at least DRIVER_PARALLEL_MIN_CHUNK_SIZE, except the last one
+static SIZE_T
+ParallelChunkSize(
+	_In_ SIZE_T Size,
+	_In_ ULONG Chunks
+)
+{
+	SIZE_T chunkSize;
+
+	if (Chunks == 0)
+		Chunks = KeQueryActiveProcessorCount(NULL);
+
+	if (Chunks > DRIVER_PARALLEL_MAX_CHUNKS)
+		Chunks = DRIVER_PARALLEL_MAX_CHUNKS;
+
+	if (Chunks == 0)
+		Chunks = 1;
+
+	chunkSize = (Size + Chunks - 1) / Chunks;
+
+	if (chunkSize < DRIVER_PARALLEL_MIN_CHUNK_SIZE)
+		chunkSize = DRIVER_PARALLEL_MIN_CHUNK_SIZE;
+
+	return (chunkSize + DRIVER_PAGE_SIZE - 1) & ~(SIZE_T)(DRIVER_PAGE_SIZE - 1);
+}
+
+NTSTATUS
+ProcessRequestReadProcessMemoryParallel(
+	_In_ WDFREQUEST Request,
+	_In_ WDFDEVICE Device,
+	_In_ struct CRequestReadProcessMemoryParallel *RPMRequest,
+	_Out_ void *Output
+)
+{
+	NTSTATUS status;
+	PDEVICE_OBJECT deviceObject = WdfDeviceWdmGetDeviceObject(Device);
+	SIZE_T chunkSize = ParallelChunkSize(RPMRequest->size, RPMRequest->chunks);
+	ULONG count = (ULONG)((RPMRequest->size + chunkSize - 1) / chunkSize);
+	ULONG workers = KeQueryActiveProcessorCount(NULL);
+	WDF_OBJECT_ATTRIBUTES attributes;
+	PPARALLEL_REQUEST_CONTEXT context;
+	PPARALLEL_READ read;
+	ULONG i;
+
+	PAGED_CODE();
+
+	read = ExAllocatePoolWithTag(NonPagedPoolNx, sizeof(PARALLEL_READ), DRIVER_PARALLEL_TAG);
+
+	if (read == NULL)
+		return STATUS_INSUFFICIENT_RESOURCES;
+
+	RtlZeroMemory(read, sizeof(PARALLEL_READ));
+
+	status = PsLookupProcessByProcessId(RPMRequest->pid, &read->Process);
+
+	if (!NT_SUCCESS(status))
+		goto M_ERR_FREE;
+
+	workers = min(workers, DRIVER_PARALLEL_MAX_WORKERS);
+	workers = min(workers, count);
+
+	read->Request = Request;
+	read->Target = RPMRequest->ptr;
+	read->Buffer = Output;
+	read->Size = RPMRequest->size;
+	read->ChunkSize = chunkSize;
+	read->ChunkCount = count;
+	read->Status = STATUS_SUCCESS;
+	read->WorkerCount = max(workers, 1);
+
+	// Everything is allocated before the first worker is queued, so a queued request can't fail half way
+	for (i = 0; i < read->WorkerCount; i++)
+	{
+		read->WorkItems[i] = IoAllocateWorkItem(deviceObject);
+
+		if (read->WorkItems[i] == NULL)
+		{
+			status = STATUS_INSUFFICIENT_RESOURCES;
+			goto M_ERR_RELEASE;
+		}
+	}
+
+	WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, PARALLEL_REQUEST_CONTEXT);
+
+	status = WdfObjectAllocateContext(Request, &attributes, (PVOID *)&context);
+
+	if (!NT_SUCCESS(status))
+		goto M_ERR_RELEASE;
+
+	context->Read = read;
+	read->Workers = read->WorkerCount;
+	read->References = 2;
+
+	// Already canceled request is completed by caller with STATUS_CANCELLED
+	status = WdfRequestMarkCancelableEx(Request, ParallelCancel);
+
+	if (!NT_SUCCESS(status))
+		goto M_ERR_RELEASE;
+
+	for (i = 0; i < read->WorkerCount; i++)
+		IoQueueWorkItem(read->WorkItems[i], ParallelWorker, DelayedWorkQueue, read);
+
+	return STATUS_PENDING;
+
+M_ERR_RELEASE:
+	ParallelFree(read);
+	return status;
+
+M_ERR_FREE:
+	ExFreePoolWithTag(read, DRIVER_PARALLEL_TAG);
+	return status;
+}
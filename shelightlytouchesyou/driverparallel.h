@@ -0,0 +1,22 @@
+#ifndef _DRIVER_PARALLEL_H_
+#define _DRIVER_PARALLEL_H_
+
+#include "driver.h"
+
+#include <ntifs.h>
+#include <wdf.h>
+
+/**
+ * Request must be validated already. `Output` is mapped output buffer.
+ * Returns STATUS_PENDING if workers were queued. Such request is completed later by the last worker to finish,
+ * or by cancel routine if it runs after that.
+ */
+NTSTATUS
+ProcessRequestReadProcessMemoryParallel(
+	_In_ WDFREQUEST Request,
+	_In_ WDFDEVICE Device,
+	_In_ struct CRequestReadProcessMemoryParallel *RPMRequest,
+	_Out_ void *Output
+);
+
+#endif // _DRIVER_PARALLEL_H_
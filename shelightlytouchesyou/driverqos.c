@@ -0,0 +1,423 @@
+#include "driverqos.h"
+
+#include "drivermemory.h"
+
+// Bulk transfer is copied by this much between checks for interactive requests
+#define DRIVER_QOS_CHUNK_SIZE 0x10000
+
+// Max count of bulk requests served at once
+#define DRIVER_QOS_MAX_ACTIVE 16
+
+// Max wait for interactive requests before next chunk, so bulk still progresses under load. 2ms in 100ns units.
+#define DRIVER_QOS_MAX_YIELD (-2LL * 10 * 1000)
+
+// Context of handle, allocated next to the one of events module
+typedef struct _QOS_FILE_CONTEXT
+{
+	ULONG Priority;
+
+	// Bulk bytes served to this handle, handle with the least of them is served next
+	LONG64 BulkBytes;
+} QOS_FILE_CONTEXT, *PQOS_FILE_CONTEXT;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(QOS_FILE_CONTEXT, GetQosFileContext);
+
+typedef struct _QOS_BULK_REQUEST
+{
+	WDFREQUEST Request;
+	PQOS_FILE_CONTEXT File;
+	BOOLEAN Write;
+	void *Pid;
+	PUCHAR Target;
+	PUCHAR Buffer; // system address
+	SIZE_T Size;
+	SIZE_T Done;
+} QOS_BULK_REQUEST, *PQOS_BULK_REQUEST;
+
+// Manual queue of bulk requests of all handles
+static WDFQUEUE QosBulkQueue;
+
+static HANDLE QosWorkerHandle;
+static volatile LONG QosStopping;
+
+// Set on new bulk request and on stop
+static KEVENT QosWakeEvent;
+
+// Set while no interactive request runs. Races only let worker copy one chunk early.
+static KEVENT QosIdleEvent;
+static volatile LONG QosInteractiveCount;
+
+// Owned by worker thread
+static QOS_BULK_REQUEST QosActive[DRIVER_QOS_MAX_ACTIVE];
+static ULONG QosActiveCount;
+
+// Bulk bytes of the handle served last. New handles start here, so past usage of others is not held against them.
+static LONG64 QosVirtualTime;
+
+static NTSTATUS
+QosDecode(
+	_In_ WDFREQUEST Request,
+	_Out_ PQOS_BULK_REQUEST Bulk
+)
+{
+	WDF_REQUEST_PARAMETERS params;
+	PIRP irp = WdfRequestWdmGetIrp(Request);
+	struct CRequestReadProcessMemory *readRequest = irp->AssociatedIrp.SystemBuffer;
+	struct CRequestWriteProcessMemory *writeRequest = irp->AssociatedIrp.SystemBuffer;
+
+	PAGED_CODE();
+
+	WDF_REQUEST_PARAMETERS_INIT(&params);
+
+	WdfRequestGetParameters(
+		Request,
+		&params
+	);
+
+	RtlZeroMemory(Bulk, sizeof(*Bulk));
+	Bulk->Request = Request;
+	Bulk->File = GetQosFileContext(WdfRequestGetFileObject(Request));
+
+	switch (params.Parameters.DeviceIoControl.IoControlCode)
+	{
+		case CTL_RequestReadProcessMemory:
+			Bulk->Pid = readRequest->pid;
+			Bulk->Target = readRequest->ptr;
+			Bulk->Size = readRequest->size;
+
+			// Output overwrites the request, its fields are copied above
+			Bulk->Buffer = (PUCHAR)readRequest;
+
+			return STATUS_SUCCESS;
+
+		case CTL_RequestReadProcessMemoryDirect:
+		case CTL_RequestReadProcessMemoryBulk:
+			Bulk->Pid = readRequest->pid;
+			Bulk->Target = readRequest->ptr;
+			Bulk->Size = readRequest->size;
+			Bulk->Buffer = MmGetSystemAddressForMdlSafe(irp->MdlAddress, NormalPagePriority | MdlMappingNoExecute);
+
+			return Bulk->Buffer != NULL ? STATUS_SUCCESS : STATUS_INSUFFICIENT_RESOURCES;
+
+		case CTL_RequestWriteProcessMemory:
+			Bulk->Write = TRUE;
+			Bulk->Pid = writeRequest->pid;
+			Bulk->Target = writeRequest->ptr;
+			Bulk->Size = writeRequest->size;
+			Bulk->Buffer = (PUCHAR)(writeRequest + 1);
+
+			return STATUS_SUCCESS;
+
+		default:
+			return STATUS_INVALID_PARAMETER;
+	}
+}
+
+static VOID
+QosFillActive(
+	VOID
+)
+{
+	NTSTATUS status;
+	WDFREQUEST request;
+	PQOS_BULK_REQUEST bulk;
+
+	PAGED_CODE();
+
+	while (QosActiveCount < DRIVER_QOS_MAX_ACTIVE && NT_SUCCESS(WdfIoQueueRetrieveNextRequest(QosBulkQueue, &request)))
+	{
+		bulk = &QosActive[QosActiveCount];
+
+		status = QosDecode(request, bulk);
+
+		if (!NT_SUCCESS(status))
+		{
+			WdfRequestComplete(request, status);
+			continue;
+		}
+
+		if (bulk->File->BulkBytes < QosVirtualTime)
+			bulk->File->BulkBytes = QosVirtualTime;
+
+		QosActiveCount++;
+	}
+}
+
+// Handle with least bulk bytes served goes next
+static ULONG
+QosPickNext(
+	VOID
+)
+{
+	ULONG i;
+	ULONG next = 0;
+
+	for (i = 1; i < QosActiveCount; i++)
+	{
+		if (QosActive[i].File->BulkBytes < QosActive[next].File->BulkBytes)
+			next = i;
+	}
+
+	return next;
+}
+
+static VOID
+QosYield(
+	VOID
+)
+{
+	LARGE_INTEGER timeout;
+
+	PAGED_CODE();
+
+	if (QosInteractiveCount == 0)
+		return;
+
+	timeout.QuadPart = DRIVER_QOS_MAX_YIELD;
+
+	KeWaitForSingleObject(&QosIdleEvent, Executive, KernelMode, FALSE, &timeout);
+}
+
+// Process is looked up for every chunk, so bulk request of exited process ends at its next chunk
+static NTSTATUS
+QosCopyChunk(
+	_In_ PQOS_BULK_REQUEST Bulk,
+	_In_ SIZE_T Size
+)
+{
+	NTSTATUS status;
+	void *process;
+	struct CDriverAttachState attach;
+
+	PAGED_CODE();
+
+	status = KernelLookupProcess(NULL, Bulk->Pid, &process);
+
+	if (!NT_SUCCESS(status))
+		return status;
+
+	KernelAttach(NULL, process, &attach);
+
+	if (Bulk->Write)
+		status = KernelCopyTo(NULL, &attach, Bulk->Target + Bulk->Done, Bulk->Buffer + Bulk->Done, Size);
+	else
+		status = KernelCopyFrom(NULL, &attach, Bulk->Target + Bulk->Done, Bulk->Buffer + Bulk->Done, Size);
+
+	KernelDetach(NULL, &attach);
+
+	KernelReleaseProcess(NULL, process);
+
+	return status;
+}
+
+static VOID
+QosServeChunk(
+	_In_ ULONG Index
+)
+{
+	NTSTATUS status;
+	PQOS_BULK_REQUEST bulk = &QosActive[Index];
+	SIZE_T chunk;
+
+	PAGED_CODE();
+
+	if (WdfRequestIsCanceled(bulk->Request))
+	{
+		status = STATUS_CANCELLED;
+		goto M_COMPLETE;
+	}
+
+	QosYield();
+
+	chunk = bulk->Size - bulk->Done;
+
+	if (chunk > DRIVER_QOS_CHUNK_SIZE)
+		chunk = DRIVER_QOS_CHUNK_SIZE;
+
+	status = QosCopyChunk(bulk, chunk);
+
+	if (!NT_SUCCESS(status))
+		goto M_COMPLETE;
+
+	bulk->Done += chunk;
+	bulk->File->BulkBytes += chunk;
+	QosVirtualTime = bulk->File->BulkBytes;
+
+	if (bulk->Done < bulk->Size)
+		return;
+
+M_COMPLETE:
+	// Same information as interactive path: read size for reads, nothing for writes
+	WdfRequestCompleteWithInformation(bulk->Request, status, NT_SUCCESS(status) && !bulk->Write ? bulk->Size : 0);
+
+	QosActive[Index] = QosActive[--QosActiveCount];
+}
+
+static VOID
+QosWorker(
+	_In_ PVOID Context
+)
+{
+	ULONG i;
+	WDFREQUEST request;
+
+	PAGED_CODE();
+
+	UNREFERENCED_PARAMETER(Context);
+
+	while (!QosStopping)
+	{
+		QosFillActive();
+
+		if (QosActiveCount == 0)
+		{
+			KeWaitForSingleObject(&QosWakeEvent, Executive, KernelMode, FALSE, NULL);
+			continue;
+		}
+
+		QosServeChunk(QosPickNext());
+	}
+
+	for (i = 0; i < QosActiveCount; i++)
+		WdfRequestComplete(QosActive[i].Request, STATUS_CANCELLED);
+
+	QosActiveCount = 0;
+
+	while (NT_SUCCESS(WdfIoQueueRetrieveNextRequest(QosBulkQueue, &request)))
+		WdfRequestComplete(request, STATUS_CANCELLED);
+
+	PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+NTSTATUS
+DriverQosCreateQueue(
+	_In_ WDFDEVICE Device
+)
+{
+	WDF_IO_QUEUE_CONFIG ioQConfig;
+
+	PAGED_CODE();
+
+	WDF_IO_QUEUE_CONFIG_INIT(&ioQConfig, WdfIoQueueDispatchManual);
+
+	return WdfIoQueueCreate(Device, &ioQConfig, WDF_NO_OBJECT_ATTRIBUTES, &QosBulkQueue);
+}
+
+NTSTATUS
+DriverQosStart(
+	VOID
+)
+{
+	OBJECT_ATTRIBUTES attributes;
+
+	PAGED_CODE();
+
+	KeInitializeEvent(&QosWakeEvent, SynchronizationEvent, FALSE);
+	KeInitializeEvent(&QosIdleEvent, NotificationEvent, TRUE);
+
+	QosStopping = 0;
+	QosInteractiveCount = 0;
+
+	InitializeObjectAttributes(&attributes, NULL, OBJ_KERNEL_HANDLE, NULL, NULL);
+
+	return PsCreateSystemThread(&QosWorkerHandle, THREAD_ALL_ACCESS, &attributes, NULL, NULL, QosWorker, NULL);
+}
+
+VOID
+DriverQosStop(
+	VOID
+)
+{
+	PAGED_CODE();
+
+	InterlockedExchange(&QosStopping, 1);
+	KeSetEvent(&QosWakeEvent, IO_NO_INCREMENT, FALSE);
+
+	ZwWaitForSingleObject(QosWorkerHandle, FALSE, NULL);
+	ZwClose(QosWorkerHandle);
+}
+
+NTSTATUS
+DriverQosFileCreate(
+	_In_ WDFFILEOBJECT FileObject
+)
+{
+	NTSTATUS status;
+	WDF_OBJECT_ATTRIBUTES attributes;
+	PQOS_FILE_CONTEXT context;
+
+	PAGED_CODE();
+
+	WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, QOS_FILE_CONTEXT);
+
+	status = WdfObjectAllocateContext(FileObject, &attributes, (PVOID *)&context);
+
+	if (!NT_SUCCESS(status))
+		return status;
+
+	context->Priority = DRIVER_PRIORITY_INTERACTIVE;
+	context->BulkBytes = 0;
+
+	return STATUS_SUCCESS;
+}
+
+BOOLEAN
+DriverQosIsBulk(
+	_In_ WDFFILEOBJECT FileObject
+)
+{
+	return GetQosFileContext(FileObject)->Priority == DRIVER_PRIORITY_BULK;
+}
+
+NTSTATUS
+DriverQosForwardBulk(
+	_In_ WDFREQUEST Request
+)
+{
+	NTSTATUS status;
+
+	PAGED_CODE();
+
+	status = WdfRequestForwardToIoQueue(Request, QosBulkQueue);
+
+	if (!NT_SUCCESS(status))
+		return status;
+
+	KeSetEvent(&QosWakeEvent, IO_NO_INCREMENT, FALSE);
+
+	return STATUS_PENDING;
+}
+
+VOID
+DriverQosInteractiveBegin(
+	VOID
+)
+{
+	if (InterlockedIncrement(&QosInteractiveCount) == 1)
+		KeClearEvent(&QosIdleEvent);
+}
+
+VOID
+DriverQosInteractiveEnd(
+	VOID
+)
+{
+	if (InterlockedDecrement(&QosInteractiveCount) == 0)
+		KeSetEvent(&QosIdleEvent, IO_NO_INCREMENT, FALSE);
+}
+
+NTSTATUS
+ProcessRequestSetPriority(
+	_In_ WDFFILEOBJECT FileObject,
+	_In_ struct CRequestSetPriority *SPRequest
+)
+{
+	PAGED_CODE();
+
+	if (SPRequest->priority != DRIVER_PRIORITY_INTERACTIVE && SPRequest->priority != DRIVER_PRIORITY_BULK)
+		return STATUS_INVALID_PARAMETER;
+
+	GetQosFileContext(FileObject)->Priority = SPRequest->priority;
+
+	return STATUS_SUCCESS;
+}
@@ -0,0 +1,63 @@
+#ifndef _DRIVER_QOS_H_
+#define _DRIVER_QOS_H_
+
+#include "driver.h"
+
+#include <ntifs.h>
+#include <wdf.h>
+
+NTSTATUS
+DriverQosCreateQueue(
+	_In_ WDFDEVICE Device
+);
+
+NTSTATUS
+DriverQosStart(
+	VOID
+);
+
+VOID
+DriverQosStop(
+	VOID
+);
+
+/**
+ * Allocates QoS context of handle, it starts as interactive.
+ */
+NTSTATUS
+DriverQosFileCreate(
+	_In_ WDFFILEOBJECT FileObject
+);
+
+BOOLEAN
+DriverQosIsBulk(
+	_In_ WDFFILEOBJECT FileObject
+);
+
+/**
+ * Request must be validated already.
+ * Returns STATUS_PENDING if request was forwarded. Such request is completed later by bulk worker.
+ */
+NTSTATUS
+DriverQosForwardBulk(
+	_In_ WDFREQUEST Request
+);
+
+// Bulk worker yields while any interactive request is between these calls
+VOID
+DriverQosInteractiveBegin(
+	VOID
+);
+
+VOID
+DriverQosInteractiveEnd(
+	VOID
+);
+
+NTSTATUS
+ProcessRequestSetPriority(
+	_In_ WDFFILEOBJECT FileObject,
+	_In_ struct CRequestSetPriority *SPRequest
+);
+
+#endif // _DRIVER_QOS_H_
@@ -0,0 +1,859 @@
+#include "driversnapshot.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <cwctype>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <sstream>
+#include <thread>
+
+static const uint32_t SnapshotMagic = 0x50534C53; // 'SLSP'
+static const uint32_t SnapshotVersion = 2;
+
+// File is made of page sized blocks, block 0 is header so it also means page was not captured
+static const size_t SnapshotBlockSize = DRIVER_PAGE_SIZE;
+static const uint32_t SnapshotNoPage = 0;
+
+static const size_t SnapshotModuleNameSize = 64;
+
+// PAGE_* and MEM_* values, file is built on hosts without Windows headers too
+static const uint32_t SnapshotPageNoAccess = 0x01;
+static const uint32_t SnapshotPageGuard = 0x100;
+static const uint32_t SnapshotMemCommit = 0x1000;
+
+static const size_t SnapshotQueryRegionsBatch = 256;
+
+struct CSnapshotHeader
+{
+	uint32_t Magic;
+	uint32_t Version;
+
+	// Committed part of file, blocks past it are left by unfinished dump
+	uint64_t BlockCount;
+
+	// Block of newest snapshot record, 0 if there are none. Written last by dump, so it's the commit point.
+	uint64_t LastSnapshot;
+
+	// Lags behind by one if dump stopped right after commit, readers count the chain instead
+	uint32_t SnapshotCount;
+	uint32_t Reserved;
+};
+
+/**
+ * Starts at its own block, after pages it refers to.
+ * Followed by CSnapshotRegion[RegionCount], CSnapshotModule[ModuleCount], CSnapshotPageHash[NewPageCount]
+ * and uint32_t PageBlocks[PageCount].
+ */
+struct CSnapshotRecord
+{
+	uint64_t PreviousSnapshot;
+	uint64_t Pid;
+	uint64_t Timestamp;
+	uint64_t PageCount;
+	uint32_t RegionCount;
+	uint32_t ModuleCount;
+
+	// Pages first stored by this snapshot
+	uint64_t NewPageCount;
+};
+
+// Page `i` of region is described by PageBlocks[FirstPage + i]
+struct CSnapshotRegion
+{
+	uint64_t Base;
+	uint64_t AllocationBase;
+	uint64_t Size;
+	uint32_t Protect;
+	uint32_t Type;
+	uint64_t FirstPage;
+};
+
+struct CSnapshotModule
+{
+	uint64_t Base;
+	uint64_t Size;
+	uint64_t NameSize;
+	uint16_t Name[SnapshotModuleNameSize];
+};
+
+// Index of CSnapshotStore is rebuilt from these instead of hashing every stored page again
+struct CSnapshotPageHash
+{
+	uint64_t Hash;
+	uint64_t Block;
+};
+
+static void ThrowSnapshotError(const char *pClass, const char *pWhat)
+{
+	std::stringstream ss;
+	ss << pClass;
+	ss << " ";
+	ss << pWhat;
+
+	throw std::runtime_error(ss.str());
+}
+
+static uint64_t RecordSize(const CSnapshotRecord &Record)
+{
+	return sizeof(CSnapshotRecord) +
+		Record.RegionCount * sizeof(CSnapshotRegion) +
+		Record.ModuleCount * sizeof(CSnapshotModule) +
+		Record.NewPageCount * sizeof(CSnapshotPageHash) +
+		Record.PageCount * sizeof(uint32_t);
+}
+
+// Checks that record lies inside committed part of file
+static const CSnapshotRecord *GetRecord(const CMappedFile &File, uint64_t Block, const char *pClass)
+{
+	const CSnapshotHeader *pHeader = File.At<CSnapshotHeader>(0);
+
+	if (Block == 0 || Block >= pHeader->BlockCount)
+		ThrowSnapshotError(pClass, "snapshot record is out of file");
+
+	const CSnapshotRecord *pRecord = File.At<CSnapshotRecord>(Block * SnapshotBlockSize);
+
+	if (pRecord->PageCount > pHeader->BlockCount * SnapshotBlockSize ||
+		pRecord->NewPageCount > pHeader->BlockCount ||
+		RecordSize(*pRecord) > (pHeader->BlockCount - Block) * SnapshotBlockSize)
+		ThrowSnapshotError(pClass, "snapshot record is out of file");
+
+	return pRecord;
+}
+
+// Records are appended, so each one points only to an earlier block and the chain always ends
+static uint64_t GetPreviousRecord(const CMappedFile &File, uint64_t Block, const char *pClass)
+{
+	uint64_t Previous = GetRecord(File, Block, pClass)->PreviousSnapshot;
+
+	if (Previous >= Block)
+		ThrowSnapshotError(pClass, "snapshot record has invalid link");
+
+	return Previous;
+}
+
+// Length of chain of committed records
+static uint32_t CountSnapshots(const CMappedFile &File, const char *pClass)
+{
+	uint32_t Count = 0;
+
+	for (uint64_t Block = File.At<CSnapshotHeader>(0)->LastSnapshot; Block != 0; Count++)
+		Block = GetPreviousRecord(File, Block, pClass);
+
+	return Count;
+}
+
+static const CSnapshotRegion *GetRegions(const CSnapshotRecord *pRecord)
+{
+	return reinterpret_cast<const CSnapshotRegion *>(pRecord + 1);
+}
+
+static const CSnapshotModule *GetModules(const CSnapshotRecord *pRecord)
+{
+	return reinterpret_cast<const CSnapshotModule *>(GetRegions(pRecord) + pRecord->RegionCount);
+}
+
+static const CSnapshotPageHash *GetPageHashes(const CSnapshotRecord *pRecord)
+{
+	return reinterpret_cast<const CSnapshotPageHash *>(GetModules(pRecord) + pRecord->ModuleCount);
+}
+
+static const uint32_t *GetPageBlocks(const CSnapshotRecord *pRecord)
+{
+	return reinterpret_cast<const uint32_t *>(GetPageHashes(pRecord) + pRecord->NewPageCount);
+}
+
+static uint64_t Mix(uint64_t Hash)
+{
+	Hash ^= Hash >> 33;
+	Hash *= 0xFF51AFD7ED558CCDull;
+	Hash ^= Hash >> 33;
+	Hash *= 0xC4CEB9FE1A85EC53ull;
+	Hash ^= Hash >> 33;
+	return Hash;
+}
+
+// Equal hashes are compared byte by byte, so it only has to spread
+static uint64_t HashPage(const uint8_t *pPage)
+{
+	uint64_t Hash = 0xCBF29CE484222325ull;
+
+	for (size_t i = 0; i < SnapshotBlockSize; i += sizeof(uint64_t))
+	{
+		uint64_t Word;
+		memcpy(&Word, pPage + i, sizeof(Word));
+
+		Hash = (Hash ^ Word) * 0x9E3779B97F4A7C15ull;
+		Hash ^= Hash >> 29;
+	}
+
+	return Mix(Hash);
+}
+
+static bool IsReadable(const CSnapshotRegion &Region)
+{
+	return (Region.Protect & 0xFF) != SnapshotPageNoAccess && (Region.Protect & SnapshotPageGuard) == 0;
+}
+
+static bool IsModuleName(const CSnapshotModule &Module, const wchar_t *pName, size_t NameSize)
+{
+	if (Module.NameSize != NameSize)
+		return false;
+
+	for (size_t i = 0; i < NameSize; i++)
+	{
+		if (towlower(Module.Name[i]) != towlower(pName[i]))
+			return false;
+	}
+
+	return true;
+}
+
+static std::vector<CMemoryRegion> QueryAllRegions(const CDriverBackend &Backend, void *Pid)
+{
+	std::vector<CMemoryRegion> Result;
+	void *Start = nullptr;
+
+	for (;;)
+	{
+		size_t Offset = Result.size();
+		Result.resize(Offset + SnapshotQueryRegionsBatch);
+
+		size_t Count = Backend.ReqQueryRegions(Pid, Start, Result.data() + Offset, SnapshotQueryRegionsBatch);
+		Result.resize(Offset + Count);
+
+		if (Count < SnapshotQueryRegionsBatch)
+			break;
+
+		Start = static_cast<char *>(Result.back().base) + Result.back().size;
+	}
+
+	return Result;
+}
+
+static std::vector<CSnapshotModule> FindModules(const CDriverBackend &Backend, void *Pid, const std::vector<CMemoryRegion> &Regions, const wchar_t *const *ppModuleNames, size_t ModuleCount)
+{
+	std::vector<CSnapshotModule> Result;
+
+	for (size_t i = 0; i < ModuleCount; i++)
+	{
+		size_t NameSize = wcslen(ppModuleNames[i]);
+
+		if (NameSize > SnapshotModuleNameSize)
+			ThrowSnapshotError("CSnapshotStore", "module name is too long");
+
+		void *Base = Backend.ReqGetModuleBase(Pid, ppModuleNames[i], NameSize);
+
+		if (Base == nullptr)
+			ThrowSnapshotError("CSnapshotStore", "module is not loaded");
+
+		CSnapshotModule Module = {};
+		Module.Base = reinterpret_cast<uint64_t>(Base);
+		Module.NameSize = NameSize;
+
+		for (size_t c = 0; c < NameSize; c++)
+			Module.Name[c] = (uint16_t)ppModuleNames[i][c];
+
+		// Image sections are separate regions of one allocation
+		for (const CMemoryRegion &Region : Regions)
+		{
+			if (Region.allocationBase == Base)
+				Module.Size = reinterpret_cast<uint64_t>(Region.base) + Region.size - Module.Base;
+		}
+
+		Result.push_back(Module);
+	}
+
+	return Result;
+}
+
+static CSnapshotRegion ToSnapshotRegion(const CMemoryRegion &Region)
+{
+	CSnapshotRegion Result = {};
+	Result.Base = reinterpret_cast<uint64_t>(Region.base);
+	Result.AllocationBase = reinterpret_cast<uint64_t>(Region.allocationBase);
+	Result.Size = Region.size;
+	Result.Protect = Region.protect;
+	Result.Type = Region.type;
+	return Result;
+}
+
+CSnapshotStore::CSnapshotStore(const char *pPath) :
+	m_File(pPath, SnapshotBlockSize),
+	m_NewPages(0),
+	m_SharedPages(0)
+{
+	CSnapshotHeader *pHeader = m_File.At<CSnapshotHeader>(0);
+
+	if (pHeader->Magic == 0 && pHeader->BlockCount == 0)
+	{
+		pHeader->Magic = SnapshotMagic;
+		pHeader->Version = SnapshotVersion;
+		pHeader->BlockCount = 1;
+		pHeader->LastSnapshot = 0;
+		pHeader->SnapshotCount = 0;
+	}
+
+	if (pHeader->Magic != SnapshotMagic || pHeader->Version != SnapshotVersion || pHeader->BlockCount * SnapshotBlockSize > m_File.Size())
+	{
+		std::stringstream ss;
+		ss << "CSnapshotStore ";
+		ss << pPath;
+		ss << " is not a snapshot store";
+
+		throw std::runtime_error(ss.str());
+	}
+
+	m_BlockCount = pHeader->BlockCount;
+
+	// Every snapshot records hashes of pages it added, so pages are not read here.
+	// Hash in file may be wrong, StorePage compares pages before sharing them anyway.
+	for (uint64_t Block = pHeader->LastSnapshot; Block != 0;)
+	{
+		const CSnapshotRecord *pRecord = GetRecord(m_File, Block, "CSnapshotStore");
+		const CSnapshotPageHash *pPageHashes = GetPageHashes(pRecord);
+
+		for (uint64_t i = 0; i < pRecord->NewPageCount; i++)
+		{
+			if (pPageHashes[i].Block != SnapshotNoPage && pPageHashes[i].Block < m_BlockCount)
+				m_Pages.emplace(pPageHashes[i].Hash, (uint32_t)pPageHashes[i].Block);
+		}
+
+		Block = GetPreviousRecord(m_File, Block, "CSnapshotStore");
+	}
+
+	pHeader->SnapshotCount = CountSnapshots(m_File, "CSnapshotStore");
+}
+
+uint32_t CSnapshotStore::GetSnapshotCount() const
+{
+	return m_File.At<CSnapshotHeader>(0)->SnapshotCount;
+}
+
+void CSnapshotStore::Flush() const
+{
+	m_File.Flush();
+}
+
+void CSnapshotStore::Reserve(uint64_t BlockCount)
+{
+	uint64_t Required = (m_BlockCount + BlockCount) * SnapshotBlockSize;
+
+	if (Required <= m_File.Size())
+		return;
+
+	// Remapping is expensive, grow by half of file but not more than a gigabyte at once
+	uint64_t Growth = std::min<uint64_t>(std::max<uint64_t>(m_File.Size() / 2, 64 * SnapshotBlockSize), 0x40000000);
+
+	m_File.Resize((size_t)std::max(Required, m_File.Size() + Growth));
+}
+
+uint32_t CSnapshotStore::StorePage(const uint8_t *pPage, std::vector<CSnapshotPageHash> &NewPages)
+{
+	uint64_t Hash = HashPage(pPage);
+	auto it = m_Pages.find(Hash);
+
+	if (it != m_Pages.end() && memcmp(m_File.At<uint8_t>(it->second * SnapshotBlockSize), pPage, SnapshotBlockSize) == 0)
+	{
+		m_SharedPages++;
+		return it->second;
+	}
+
+	if (m_BlockCount >= UINT32_MAX)
+		ThrowSnapshotError("CSnapshotStore", "file is full");
+
+	Reserve(1);
+
+	uint32_t Block = (uint32_t)m_BlockCount++;
+	memcpy(m_File.At<uint8_t>(Block * SnapshotBlockSize), pPage, SnapshotBlockSize);
+
+	// Colliding page stays unindexed
+	if (it == m_Pages.end())
+	{
+		m_Pages.emplace(Hash, Block);
+		NewPages.push_back({ Hash, Block });
+	}
+
+	m_NewPages++;
+	return Block;
+}
+
+// Empty vector may have no storage, memcpy must not get its null data
+template <typename T>
+static uint8_t *AppendArray(uint8_t *pOut, const std::vector<T> &Items)
+{
+	if (!Items.empty())
+		memcpy(pOut, Items.data(), Items.size() * sizeof(T));
+
+	return pOut + Items.size() * sizeof(T);
+}
+
+struct CSnapshotChunk
+{
+	size_t Region;
+	uint64_t Address;
+	size_t Size;
+	std::vector<uint8_t> Data;
+
+	// One per page
+	std::vector<bool> Readable;
+};
+
+// Splits failed reads in halves, so long unreadable runs cost few requests
+static void ReadChunkRange(const CDriverBackend &Backend, void *Pid, CSnapshotChunk &Chunk, size_t Offset, size_t Size)
+{
+	try
+	{
+		Backend.ReqReadProcessMemoryBulk(Pid, reinterpret_cast<void *>(Chunk.Address + Offset), Size, Chunk.Data.data() + Offset);
+
+		std::fill(Chunk.Readable.begin() + Offset / SnapshotBlockSize, Chunk.Readable.begin() + (Offset + Size) / SnapshotBlockSize, true);
+		return;
+	}
+	catch (const std::runtime_error &)
+	{
+	}
+
+	if (Size == SnapshotBlockSize)
+		return;
+
+	size_t Half = Size / SnapshotBlockSize / 2 * SnapshotBlockSize;
+
+	ReadChunkRange(Backend, Pid, Chunk, Offset, Half);
+	ReadChunkRange(Backend, Pid, Chunk, Offset + Half, Size - Half);
+}
+
+uint32_t CSnapshotStore::Dump(const CDriverBackend &Backend, void *Pid, std::vector<CSnapshotRegion> &Regions, const std::vector<CSnapshotModule> &Modules)
+{
+	std::sort(Regions.begin(), Regions.end(), [](const CSnapshotRegion &a, const CSnapshotRegion &b)
+	{
+		return a.Base < b.Base;
+	});
+
+	uint64_t PageCount = 0;
+
+	for (CSnapshotRegion &Region : Regions)
+	{
+		Region.FirstPage = PageCount;
+		PageCount += Region.Size / SnapshotBlockSize;
+	}
+
+	std::vector<uint32_t> PageBlocks(PageCount, SnapshotNoPage);
+	std::vector<CSnapshotPageHash> NewPages;
+
+	// Reader thread keeps up to PipelineDepth chunks ahead of pages being stored
+	std::mutex Lock;
+	std::condition_variable Produced;
+	std::condition_variable Consumed;
+	std::deque<CSnapshotChunk> Queue;
+	std::exception_ptr ReaderError;
+	bool ReaderDone = false;
+	bool Abort = false;
+
+	std::thread Reader([&]()
+	{
+		try
+		{
+			for (size_t i = 0; i < Regions.size(); i++)
+			{
+				if (!IsReadable(Regions[i]))
+					continue;
+
+				for (uint64_t Offset = 0; Offset < Regions[i].Size; Offset += ChunkSize)
+				{
+					CSnapshotChunk Chunk;
+					Chunk.Region = i;
+					Chunk.Address = Regions[i].Base + Offset;
+					Chunk.Size = (size_t)std::min<uint64_t>((uint64_t)ChunkSize, Regions[i].Size - Offset);
+					Chunk.Data.resize(Chunk.Size);
+					Chunk.Readable.resize(Chunk.Size / SnapshotBlockSize);
+
+					ReadChunkRange(Backend, Pid, Chunk, 0, Chunk.Size);
+
+					std::unique_lock<std::mutex> Guard(Lock);
+
+					Consumed.wait(Guard, [&]() { return Queue.size() < PipelineDepth || Abort; });
+
+					if (Abort)
+						return;
+
+					Queue.push_back(std::move(Chunk));
+					Produced.notify_one();
+				}
+			}
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> Guard(Lock);
+			ReaderError = std::current_exception();
+		}
+
+		std::lock_guard<std::mutex> Guard(Lock);
+		ReaderDone = true;
+		Produced.notify_one();
+	});
+
+	try
+	{
+		for (;;)
+		{
+			CSnapshotChunk Chunk;
+
+			{
+				std::unique_lock<std::mutex> Guard(Lock);
+
+				Produced.wait(Guard, [&]() { return !Queue.empty() || ReaderDone; });
+
+				if (Queue.empty())
+					break;
+
+				Chunk = std::move(Queue.front());
+				Queue.pop_front();
+				Consumed.notify_one();
+			}
+
+			const CSnapshotRegion &Region = Regions[Chunk.Region];
+			uint64_t FirstPage = Region.FirstPage + (Chunk.Address - Region.Base) / SnapshotBlockSize;
+
+			for (size_t i = 0; i < Chunk.Readable.size(); i++)
+			{
+				if (Chunk.Readable[i])
+					PageBlocks[FirstPage + i] = StorePage(Chunk.Data.data() + i * SnapshotBlockSize, NewPages);
+			}
+		}
+	}
+	catch (...)
+	{
+		{
+			std::lock_guard<std::mutex> Guard(Lock);
+			Abort = true;
+			Consumed.notify_one();
+		}
+
+		Reader.join();
+		throw;
+	}
+
+	Reader.join();
+
+	if (ReaderError)
+		std::rethrow_exception(ReaderError);
+
+	CSnapshotHeader *pHeader = m_File.At<CSnapshotHeader>(0);
+
+	CSnapshotRecord Record = {};
+	Record.PreviousSnapshot = pHeader->LastSnapshot;
+	Record.Pid = reinterpret_cast<uint64_t>(Pid);
+	Record.Timestamp = (uint64_t)std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	Record.PageCount = PageCount;
+	Record.RegionCount = (uint32_t)Regions.size();
+	Record.ModuleCount = (uint32_t)Modules.size();
+	Record.NewPageCount = NewPages.size();
+
+	uint64_t RecordBlocks = (RecordSize(Record) + SnapshotBlockSize - 1) / SnapshotBlockSize;
+
+	Reserve(RecordBlocks);
+
+	// Header may have moved with remap
+	pHeader = m_File.At<CSnapshotHeader>(0);
+
+	uint8_t *pRecord = m_File.At<uint8_t>(m_BlockCount * SnapshotBlockSize);
+
+	memcpy(pRecord, &Record, sizeof(Record));
+	pRecord += sizeof(Record);
+
+	pRecord = AppendArray(pRecord, Regions);
+	pRecord = AppendArray(pRecord, Modules);
+	pRecord = AppendArray(pRecord, NewPages);
+	AppendArray(pRecord, PageBlocks);
+
+	// Header covers record before pointing to it, and both are on disk before commit.
+	// Dump stopped at any point leaves either old snapshots and unused blocks, or the new one.
+	uint64_t RecordBlock = m_BlockCount;
+	m_BlockCount += RecordBlocks;
+	pHeader->BlockCount = m_BlockCount;
+
+	m_File.Flush();
+
+	pHeader->LastSnapshot = RecordBlock;
+
+	return pHeader->SnapshotCount++;
+}
+
+uint32_t CSnapshotStore::DumpProcess(const CDriverBackend &Backend, void *Pid, const wchar_t *const *ppModuleNames, size_t ModuleCount)
+{
+	std::vector<CMemoryRegion> AllRegions = QueryAllRegions(Backend, Pid);
+	std::vector<CSnapshotModule> Modules = FindModules(Backend, Pid, AllRegions, ppModuleNames, ModuleCount);
+	std::vector<CSnapshotRegion> Regions;
+
+	for (const CMemoryRegion &Region : AllRegions)
+		Regions.push_back(ToSnapshotRegion(Region));
+
+	return Dump(Backend, Pid, Regions, Modules);
+}
+
+uint32_t CSnapshotStore::DumpModules(const CDriverBackend &Backend, void *Pid, const wchar_t *const *ppModuleNames, size_t ModuleCount)
+{
+	std::vector<CMemoryRegion> AllRegions = QueryAllRegions(Backend, Pid);
+	std::vector<CSnapshotModule> Modules = FindModules(Backend, Pid, AllRegions, ppModuleNames, ModuleCount);
+	std::vector<CSnapshotRegion> Regions;
+
+	for (const CMemoryRegion &Region : AllRegions)
+	{
+		for (const CSnapshotModule &Module : Modules)
+		{
+			if (reinterpret_cast<uint64_t>(Region.allocationBase) == Module.Base)
+			{
+				Regions.push_back(ToSnapshotRegion(Region));
+				break;
+			}
+		}
+	}
+
+	return Dump(Backend, Pid, Regions, Modules);
+}
+
+CSnapshotBackend::CSnapshotBackend(const char *pPath, uint32_t Snapshot) :
+	m_File(pPath, 0, true)
+{
+	const CSnapshotHeader *pHeader = m_File.At<CSnapshotHeader>(0);
+
+	if (m_File.Size() < sizeof(CSnapshotHeader) ||
+		pHeader->Magic != SnapshotMagic ||
+		pHeader->Version != SnapshotVersion ||
+		pHeader->BlockCount * SnapshotBlockSize > m_File.Size())
+	{
+		std::stringstream ss;
+		ss << "CSnapshotBackend ";
+		ss << pPath;
+		ss << " is not a snapshot store";
+
+		throw std::runtime_error(ss.str());
+	}
+
+	uint32_t SnapshotCount = CountSnapshots(m_File, "CSnapshotBackend");
+
+	if (Snapshot == LatestSnapshot)
+		Snapshot = SnapshotCount - 1;
+
+	if (SnapshotCount == 0 || Snapshot >= SnapshotCount)
+		ThrowSnapshotError("CSnapshotBackend", "has no such snapshot");
+
+	m_BlockCount = pHeader->BlockCount;
+
+	uint64_t Block = pHeader->LastSnapshot;
+
+	for (uint32_t i = SnapshotCount - 1; i > Snapshot; i--)
+		Block = GetPreviousRecord(m_File, Block, "CSnapshotBackend");
+
+	const CSnapshotRecord *pRecord = GetRecord(m_File, Block, "CSnapshotBackend");
+
+	// FindPage relies on regions being sorted, disjoint and inside PageBlocks
+	const CSnapshotRegion *pRegions = GetRegions(pRecord);
+
+	for (uint32_t i = 0; i < pRecord->RegionCount; i++)
+	{
+		const CSnapshotRegion &Region = pRegions[i];
+
+		if (Region.Size % SnapshotBlockSize != 0 ||
+			Region.FirstPage > pRecord->PageCount ||
+			Region.Size / SnapshotBlockSize > pRecord->PageCount - Region.FirstPage ||
+			Region.Base + Region.Size < Region.Base ||
+			(i != 0 && Region.Base < pRegions[i - 1].Base + pRegions[i - 1].Size))
+		{
+			ThrowSnapshotError("CSnapshotBackend", "snapshot record has invalid region");
+		}
+	}
+
+	const CSnapshotModule *pModules = GetModules(pRecord);
+
+	for (uint32_t i = 0; i < pRecord->ModuleCount; i++)
+	{
+		if (pModules[i].NameSize > SnapshotModuleNameSize)
+			ThrowSnapshotError("CSnapshotBackend", "snapshot record has invalid module");
+	}
+
+	m_Pid = pRecord->Pid;
+	m_Timestamp = pRecord->Timestamp;
+	m_pRegions = GetRegions(pRecord);
+	m_RegionCount = pRecord->RegionCount;
+	m_pModules = GetModules(pRecord);
+	m_ModuleCount = pRecord->ModuleCount;
+	m_pPageBlocks = GetPageBlocks(pRecord);
+}
+
+void CSnapshotBackend::CheckPid(const char *pName, void *Pid) const
+{
+	if (reinterpret_cast<uint64_t>(Pid) == m_Pid)
+		return;
+
+	std::stringstream ss;
+	ss << pName;
+	ss << " snapshot is of another process";
+
+	throw std::runtime_error(ss.str());
+}
+
+const uint8_t *CSnapshotBackend::FindPage(uint64_t Page) const
+{
+	const CSnapshotRegion *pEnd = m_pRegions + m_RegionCount;
+	const CSnapshotRegion *pRegion = std::upper_bound(m_pRegions, pEnd, Page, [](uint64_t Address, const CSnapshotRegion &Region)
+	{
+		return Address < Region.Base;
+	});
+
+	if (pRegion == m_pRegions)
+		return nullptr;
+
+	pRegion--;
+
+	if (Page - pRegion->Base >= pRegion->Size)
+		return nullptr;
+
+	uint32_t Block = m_pPageBlocks[pRegion->FirstPage + (Page - pRegion->Base) / SnapshotBlockSize];
+
+	if (Block == SnapshotNoPage || Block >= m_BlockCount)
+		return nullptr;
+
+	return m_File.At<uint8_t>(Block * SnapshotBlockSize);
+}
+
+void CSnapshotBackend::ReqReadProcessMemory(void *Pid, void *Addr, size_t Size, void *Out) const
+{
+	CheckPid("ReqReadProcessMemory", Pid);
+
+	uint64_t Start = reinterpret_cast<uint64_t>(Addr);
+	uint64_t End = Start + Size;
+
+	for (uint64_t Page = Start & ~(uint64_t)(SnapshotBlockSize - 1); Page < End; Page += SnapshotBlockSize)
+	{
+		const uint8_t *pPage = FindPage(Page);
+
+		if (pPage == nullptr)
+		{
+			std::stringstream ss;
+			ss << "ReqReadProcessMemory page 0x";
+			ss << std::hex << Page;
+			ss << " is not in snapshot";
+
+			throw std::runtime_error(ss.str());
+		}
+
+		uint64_t CopyStart = std::max(Start, Page);
+		uint64_t CopyEnd = std::min(End, Page + SnapshotBlockSize);
+
+		memcpy(static_cast<uint8_t *>(Out) + (CopyStart - Start), pPage + (CopyStart - Page), (size_t)(CopyEnd - CopyStart));
+	}
+}
+
+void CSnapshotBackend::ReqReadProcessMemoryBulk(void *Pid, void *Addr, size_t Size, void *Out) const
+{
+	ReqReadProcessMemory(Pid, Addr, Size, Out);
+}
+
+void CSnapshotBackend::ReqReadProcessMemoryResident(void *Pid, void *Addr, size_t Size, void *pOut) const
+{
+	CheckPid("ReqReadProcessMemoryResident", Pid);
+
+	uint64_t Start = reinterpret_cast<uint64_t>(Addr);
+	uint64_t End = Start + Size;
+
+	uint8_t *pData = static_cast<uint8_t *>(pOut);
+	uint8_t *pPresent = pData + Size;
+
+	memset(pPresent, 0, DRIVER_RESIDENCY_BITMAP_SIZE(Addr, Size));
+
+	size_t Index = 0;
+
+	for (uint64_t Page = Start & ~(uint64_t)(SnapshotBlockSize - 1); Page < End; Page += SnapshotBlockSize, Index++)
+	{
+		const uint8_t *pPage = FindPage(Page);
+
+		uint64_t CopyStart = std::max(Start, Page);
+		uint64_t CopyEnd = std::min(End, Page + SnapshotBlockSize);
+
+		if (pPage == nullptr)
+		{
+			memset(pData + (CopyStart - Start), 0, (size_t)(CopyEnd - CopyStart));
+			continue;
+		}
+
+		memcpy(pData + (CopyStart - Start), pPage + (CopyStart - Page), (size_t)(CopyEnd - CopyStart));
+		pPresent[Index / 8] |= (uint8_t)(1 << (Index % 8));
+	}
+}
+
+void CSnapshotBackend::ReqQueryResidency(void *Pid, void *Addr, size_t Size, uint8_t *pPresent) const
+{
+	CheckPid("ReqQueryResidency", Pid);
+
+	uint64_t Start = reinterpret_cast<uint64_t>(Addr);
+	uint64_t End = Start + Size;
+
+	memset(pPresent, 0, DRIVER_RESIDENCY_BITMAP_SIZE(Addr, Size));
+
+	size_t Index = 0;
+
+	for (uint64_t Page = Start & ~(uint64_t)(SnapshotBlockSize - 1); Page < End; Page += SnapshotBlockSize, Index++)
+	{
+		if (FindPage(Page) != nullptr)
+			pPresent[Index / 8] |= (uint8_t)(1 << (Index % 8));
+	}
+}
+
+void CSnapshotBackend::ReqWriteProcessMemory(void *, void *, size_t, const void *) const
+{
+	throw std::runtime_error("ReqWriteProcessMemory is not supported by snapshot");
+}
+
+void *CSnapshotBackend::ReqGetModuleBase(void *Pid, const wchar_t *pModuleName, size_t ModuleNameSize) const
+{
+	CheckPid("ReqGetModuleBase", Pid);
+
+	for (uint32_t i = 0; i < m_ModuleCount; i++)
+	{
+		if (IsModuleName(m_pModules[i], pModuleName, ModuleNameSize))
+			return reinterpret_cast<void *>(m_pModules[i].Base);
+	}
+
+	return nullptr;
+}
+
+void CSnapshotBackend::ReqAtomic(void *, const CAtomicOperation *, size_t, CAtomicResult *) const
+{
+	throw std::runtime_error("ReqAtomic is not supported by snapshot");
+}
+
+size_t CSnapshotBackend::ReqQueryRegions(void *Pid, void *Start, CMemoryRegion *pRegions, size_t MaxRegions) const
+{
+	CheckPid("ReqQueryRegions", Pid);
+
+	size_t Count = 0;
+
+	for (uint32_t i = 0; i < m_RegionCount && Count < MaxRegions; i++)
+	{
+		const CSnapshotRegion &Region = m_pRegions[i];
+
+		if (Region.Base + Region.Size <= reinterpret_cast<uint64_t>(Start))
+			continue;
+
+		CMemoryRegion &Result = pRegions[Count++];
+		Result.base = reinterpret_cast<void *>(Region.Base);
+		Result.allocationBase = reinterpret_cast<void *>(Region.AllocationBase);
+		Result.size = (SIZE_T)Region.Size;
+		Result.state = SnapshotMemCommit;
+		Result.protect = Region.Protect;
+		Result.type = Region.Type;
+		Result.reserved = 0;
+	}
+
+	return Count;
+}
+
+CDriverMirror CSnapshotBackend::Mirror(void *, const CMirrorRange *, size_t, uint32_t) const
+{
+	throw std::runtime_error("Mirror is not supported by snapshot");
+}
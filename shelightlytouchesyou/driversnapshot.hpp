@@ -0,0 +1,117 @@
+#ifndef _DRIVER_SNAPSHOT_H_
+#define _DRIVER_SNAPSHOT_H_
+
+#include "driverapi.hpp"
+#include "mappedfile.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+struct CSnapshotRegion;
+struct CSnapshotModule;
+struct CSnapshotPageHash;
+
+/**
+ * Append only file of process snapshots, built to be memory mapped by CSnapshotBackend.
+ * Pages are content addressed: page equal to one already stored by any snapshot of the file is kept once.
+ * Pages which couldn't be read are not stored, so snapshots are sparse.
+ * One writer at a time. Snapshot becomes visible to readers which open file after it is committed.
+ */
+class CSnapshotStore
+{
+	CMappedFile m_File;
+	uint64_t m_BlockCount;
+
+	// First block of every stored page by content hash, built from hashes recorded by snapshots
+	std::unordered_map<uint64_t, uint32_t> m_Pages;
+
+	uint64_t m_NewPages;
+	uint64_t m_SharedPages;
+
+	void Reserve(uint64_t BlockCount);
+	// Appends page to `NewPages` if it's stored and indexed for the first time
+	uint32_t StorePage(const uint8_t *pPage, std::vector<CSnapshotPageHash> &NewPages);
+	uint32_t Dump(const CDriverBackend &Backend, void *Pid, std::vector<CSnapshotRegion> &Regions, const std::vector<CSnapshotModule> &Modules);
+
+public:
+
+	// Bytes read from target with one request, and count of requests in flight while pages are stored
+	static const size_t ChunkSize = 0x100000;
+	static const size_t PipelineDepth = 4;
+
+	// Creates store if file is empty
+	CSnapshotStore(const char *pPath);
+
+	CSnapshotStore(const CSnapshotStore &) = delete;
+	CSnapshotStore &operator=(const CSnapshotStore &) = delete;
+
+	/**
+	 * Stores every committed region of process. Named modules are recorded for CSnapshotBackend::ReqGetModuleBase.
+	 * No access and guard pages are skipped. Returns index of new snapshot.
+	 */
+	uint32_t DumpProcess(const CDriverBackend &Backend, void *Pid, const wchar_t *const *ppModuleNames = nullptr, size_t ModuleCount = 0);
+
+	// Stores only regions of named modules
+	uint32_t DumpModules(const CDriverBackend &Backend, void *Pid, const wchar_t *const *ppModuleNames, size_t ModuleCount);
+
+	uint32_t GetSnapshotCount() const;
+
+	// Pages stored by snapshots dumped through this object, and pages they shared with earlier ones
+	uint64_t GetNewPages() const { return m_NewPages; }
+	uint64_t GetSharedPages() const { return m_SharedPages; }
+
+	void Flush() const;
+};
+
+/**
+ * Serves reads of one snapshot from mapped file, at memory speed and without target.
+ * Captured pages are reported as resident, others fail reads like unreadable memory does.
+ * Writes, atomics and mirroring throw.
+ */
+class CSnapshotBackend : public CDriverBackend
+{
+	CMappedFile m_File;
+	uint64_t m_BlockCount;
+
+	uint64_t m_Pid;
+	uint64_t m_Timestamp;
+
+	const CSnapshotRegion *m_pRegions;
+	uint32_t m_RegionCount;
+
+	const CSnapshotModule *m_pModules;
+	uint32_t m_ModuleCount;
+
+	const uint32_t *m_pPageBlocks;
+
+	const uint8_t *FindPage(uint64_t Page) const;
+	void CheckPid(const char *pName, void *Pid) const;
+
+public:
+
+	static const uint32_t LatestSnapshot = UINT32_MAX;
+
+	CSnapshotBackend(const char *pPath, uint32_t Snapshot = LatestSnapshot);
+
+	CSnapshotBackend(const CSnapshotBackend &) = delete;
+	CSnapshotBackend &operator=(const CSnapshotBackend &) = delete;
+
+	void *GetPid() const { return reinterpret_cast<void *>(m_Pid); }
+
+	// Seconds since Unix epoch
+	uint64_t GetTimestamp() const { return m_Timestamp; }
+
+	void ReqReadProcessMemory(void *Pid, void *Addr, size_t Size, void *Out) const override;
+	void ReqReadProcessMemoryBulk(void *Pid, void *Addr, size_t Size, void *Out) const override;
+	void ReqReadProcessMemoryResident(void *Pid, void *Addr, size_t Size, void *pOut) const override;
+	void ReqQueryResidency(void *Pid, void *Addr, size_t Size, uint8_t *pPresent) const override;
+	void ReqWriteProcessMemory(void *Pid, void *Addr, size_t Size, const void *From) const override;
+	void *ReqGetModuleBase(void *Pid, const wchar_t *pModuleName, size_t ModuleNameSize) const override;
+	void ReqAtomic(void *Pid, const CAtomicOperation *pOperations, size_t Count, CAtomicResult *pResults) const override;
+	size_t ReqQueryRegions(void *Pid, void *Start, CMemoryRegion *pRegions, size_t MaxRegions) const override;
+	CDriverMirror Mirror(void *Pid, const CMirrorRange *pRanges, size_t Count, uint32_t IntervalUs) const override;
+};
+
+#endif // _DRIVER_SNAPSHOT_H_
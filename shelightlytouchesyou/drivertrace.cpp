@@ -0,0 +1,356 @@
+#include "drivertrace.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+struct CDriverTraceRing
+{
+	// Written only by owner thread
+	std::atomic<uint64_t> Head{ 0 };
+
+	// Written only under TraceLock, see CDriverTrace::Clear
+	uint64_t Tail = 0;
+
+	uint32_t ThreadId = 0;
+	CDriverTraceRecord Records[CDriverTrace::RingSize];
+};
+
+static std::atomic<bool> TraceEnabled{ false };
+
+static std::mutex TraceLock;
+
+// Rings of live threads
+static std::vector<std::unique_ptr<CDriverTraceRing>> TraceRings;
+
+// Rings of exited threads, reused by new ones
+static std::vector<std::unique_ptr<CDriverTraceRing>> TraceFreeRings;
+
+// Not yet cleared records of exited threads, RingSize latest ones at most
+static std::vector<CDriverTraceRecord> TraceRetired;
+
+static thread_local CDriverTraceRing *pThreadRing = nullptr;
+
+// Pairs TSC with steady clock for TicksToMicroseconds
+static const auto TraceClockOrigin = std::chrono::steady_clock::now();
+static const uint64_t TraceTicksOrigin = CDriverTrace::ReadTimestamp();
+
+static uint32_t CurrentThreadId()
+{
+#ifdef _WIN32
+	return GetCurrentThreadId();
+#else
+	return (uint32_t)syscall(SYS_gettid);
+#endif
+}
+
+// Appends records of ring not yet cleared. Those which owner thread overwrote while they were copied are dropped.
+static void CollectRing(const CDriverTraceRing &Ring, std::vector<CDriverTraceRecord> &Result)
+{
+	uint64_t Head = Ring.Head.load(std::memory_order_acquire);
+	uint64_t First = std::max(Ring.Tail, Head > CDriverTrace::RingSize ? Head - CDriverTrace::RingSize : 0);
+
+	size_t Begin = Result.size();
+
+	for (uint64_t i = First; i < Head; i++)
+	{
+		Result.push_back(Ring.Records[i % CDriverTrace::RingSize]);
+		Result.back().ThreadId = Ring.ThreadId;
+	}
+
+	std::atomic_thread_fence(std::memory_order_acquire);
+
+	uint64_t NewHead = Ring.Head.load(std::memory_order_relaxed);
+
+	if (NewHead > First + CDriverTrace::RingSize)
+	{
+		size_t Overwritten = (size_t)std::min<uint64_t>(NewHead - First - CDriverTrace::RingSize, Head - First);
+		Result.erase(Result.begin() + Begin, Result.begin() + Begin + Overwritten);
+	}
+}
+
+// Moves records of exiting thread out of its ring, so ring can be reused without losing them
+static void ReleaseThreadRing(CDriverTraceRing *pRing)
+{
+	std::lock_guard<std::mutex> Lock(TraceLock);
+
+	CollectRing(*pRing, TraceRetired);
+
+	if (TraceRetired.size() > CDriverTrace::RingSize)
+		TraceRetired.erase(TraceRetired.begin(), TraceRetired.end() - CDriverTrace::RingSize);
+
+	auto it = std::find_if(TraceRings.begin(), TraceRings.end(), [pRing](const std::unique_ptr<CDriverTraceRing> &Ring)
+	{
+		return Ring.get() == pRing;
+	});
+
+	TraceFreeRings.push_back(std::move(*it));
+	TraceRings.erase(it);
+}
+
+static CDriverTraceRing *RegisterThreadRing()
+{
+	struct CRelease
+	{
+		~CRelease()
+		{
+			ReleaseThreadRing(pThreadRing);
+			pThreadRing = nullptr;
+		}
+	};
+
+	std::unique_ptr<CDriverTraceRing> Ring;
+
+	{
+		std::lock_guard<std::mutex> Lock(TraceLock);
+
+		if (!TraceFreeRings.empty())
+		{
+			Ring = std::move(TraceFreeRings.back());
+			TraceFreeRings.pop_back();
+		}
+	}
+
+	if (Ring == nullptr)
+		Ring = std::make_unique<CDriverTraceRing>();
+
+	Ring->Head.store(0, std::memory_order_relaxed);
+	Ring->Tail = 0;
+	Ring->ThreadId = CurrentThreadId();
+
+	CDriverTraceRing *pRing = Ring.get();
+
+	{
+		std::lock_guard<std::mutex> Lock(TraceLock);
+		TraceRings.push_back(std::move(Ring));
+	}
+
+	// Constructed on first registration of this thread, returns its ring when thread exits
+	static thread_local CRelease Release;
+
+	return pRing;
+}
+
+void CDriverTrace::SetEnabled(bool Enabled)
+{
+	TraceEnabled.store(Enabled, std::memory_order_relaxed);
+}
+
+bool CDriverTrace::IsEnabled()
+{
+	return TraceEnabled.load(std::memory_order_relaxed);
+}
+
+void CDriverTrace::Record(const CDriverTraceRecord &Record)
+{
+	if (pThreadRing == nullptr)
+		pThreadRing = RegisterThreadRing();
+
+	uint64_t Head = pThreadRing->Head.load(std::memory_order_relaxed);
+
+	pThreadRing->Records[Head % RingSize] = Record;
+	pThreadRing->Head.store(Head + 1, std::memory_order_release);
+}
+
+std::vector<CDriverTraceRecord> CDriverTrace::Collect()
+{
+	std::vector<CDriverTraceRecord> Result;
+
+	std::lock_guard<std::mutex> Lock(TraceLock);
+
+	Result = TraceRetired;
+
+	for (const std::unique_ptr<CDriverTraceRing> &Ring : TraceRings)
+		CollectRing(*Ring, Result);
+
+	std::sort(Result.begin(), Result.end(), [](const CDriverTraceRecord &a, const CDriverTraceRecord &b)
+	{
+		return a.Start < b.Start;
+	});
+
+	return Result;
+}
+
+void CDriverTrace::Clear()
+{
+	std::lock_guard<std::mutex> Lock(TraceLock);
+
+	TraceRetired.clear();
+
+	for (const std::unique_ptr<CDriverTraceRing> &Ring : TraceRings)
+		Ring->Tail = Ring->Head.load(std::memory_order_acquire);
+}
+
+double CDriverTrace::TicksToMicroseconds(uint64_t Ticks)
+{
+	static std::once_flag Calibrated;
+	static double TicksPerMicrosecond;
+
+	std::call_once(Calibrated, []()
+	{
+		// Wait until interval since origin is long enough for steady clock resolution
+		for (;;)
+		{
+			uint64_t Now = ReadTimestamp();
+			auto Elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - TraceClockOrigin).count();
+
+			if (Elapsed >= 10000.0)
+			{
+				TicksPerMicrosecond = (double)(Now - TraceTicksOrigin) / Elapsed;
+				break;
+			}
+		}
+	});
+
+	return (double)Ticks / TicksPerMicrosecond;
+}
+
+uint32_t CDriverTrace::LastError()
+{
+#ifdef _WIN32
+	return GetLastError();
+#else
+	return (uint32_t)errno;
+#endif
+}
+
+static void WriteJsonString(std::ostream &Out, const char *pString)
+{
+	Out << '"';
+
+	for (; *pString != '\0'; pString++)
+	{
+		if (*pString == '"' || *pString == '\\')
+			Out << '\\';
+
+		Out << *pString;
+	}
+
+	Out << '"';
+}
+
+void CDriverTrace::WriteChromeTrace(std::ostream &Out, const std::vector<CDriverTraceRecord> &Records)
+{
+	uint64_t Origin = Records.empty() ? 0 : Records.front().Start;
+
+	for (const CDriverTraceRecord &Record : Records)
+		Origin = std::min(Origin, Record.Start);
+
+	Out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+
+	bool First = true;
+
+	for (const CDriverTraceRecord &Record : Records)
+	{
+		if (!First)
+			Out << ',';
+
+		First = false;
+
+		Out << "\n{\"name\":";
+		WriteJsonString(Out, Record.pCallSite);
+		Out << ",\"cat\":\"driver\",\"ph\":\"X\",\"pid\":0,\"tid\":" << Record.ThreadId;
+		Out << ",\"ts\":" << TicksToMicroseconds(Record.Start - Origin);
+		Out << ",\"dur\":" << TicksToMicroseconds(Record.End - Record.Start);
+		Out << ",\"args\":{\"pid\":" << reinterpret_cast<uintptr_t>(Record.Pid);
+		Out << ",\"size\":" << Record.Size;
+		Out << ",\"status\":" << Record.Status << "}}";
+	}
+
+	Out << "\n]}\n";
+}
+
+std::vector<CDriverTraceSummary> CDriverTrace::Summarize(const std::vector<CDriverTraceRecord> &Records)
+{
+	// Same call site may have several copies of its name literal
+	std::map<std::string, std::vector<const CDriverTraceRecord *>> CallSites;
+
+	for (const CDriverTraceRecord &Record : Records)
+		CallSites[Record.pCallSite].push_back(&Record);
+
+	std::vector<CDriverTraceSummary> Result;
+
+	for (auto &CallSite : CallSites)
+	{
+		std::vector<double> Durations;
+		Durations.reserve(CallSite.second.size());
+
+		CDriverTraceSummary Summary = {};
+		Summary.pCallSite = CallSite.second.front()->pCallSite;
+		Summary.Count = CallSite.second.size();
+
+		for (const CDriverTraceRecord *pRecord : CallSite.second)
+		{
+			double Us = TicksToMicroseconds(pRecord->End - pRecord->Start);
+			Durations.push_back(Us);
+
+			if (pRecord->Status != 0)
+				Summary.Failed++;
+			else
+				Summary.Bytes += pRecord->Size;
+
+			size_t Bucket = 0;
+
+			while (Bucket + 1 < sizeof(Summary.Histogram) / sizeof(Summary.Histogram[0]) && Us >= (double)(2ull << Bucket))
+				Bucket++;
+
+			Summary.Histogram[Bucket]++;
+		}
+
+		std::sort(Durations.begin(), Durations.end());
+
+		double Total = 0.0;
+
+		for (double Us : Durations)
+			Total += Us;
+
+		Summary.MeanUs = Total / Durations.size();
+		Summary.P50Us = Durations[(Durations.size() - 1) / 2];
+		Summary.P99Us = Durations[(Durations.size() - 1) * 99 / 100];
+		Summary.MaxUs = Durations.back();
+
+		Result.push_back(Summary);
+	}
+
+	std::sort(Result.begin(), Result.end(), [](const CDriverTraceSummary &a, const CDriverTraceSummary &b)
+	{
+		return a.MeanUs * a.Count > b.MeanUs * b.Count;
+	});
+
+	return Result;
+}
+
+void CDriverTrace::WriteSummary(std::ostream &Out, const std::vector<CDriverTraceSummary> &Summary)
+{
+	for (const CDriverTraceSummary &CallSite : Summary)
+	{
+		Out << CallSite.pCallSite;
+		Out << ": count " << CallSite.Count;
+		Out << ", failed " << CallSite.Failed;
+		Out << ", bytes " << CallSite.Bytes;
+		Out << ", mean " << CallSite.MeanUs << "us";
+		Out << ", p50 " << CallSite.P50Us << "us";
+		Out << ", p99 " << CallSite.P99Us << "us";
+		Out << ", max " << CallSite.MaxUs << "us\n";
+
+		for (size_t i = 0; i < sizeof(CallSite.Histogram) / sizeof(CallSite.Histogram[0]); i++)
+		{
+			if (CallSite.Histogram[i] == 0)
+				continue;
+
+			Out << "  " << (i == 0 ? 0ull : 1ull << i) << ".." << (2ull << i) << "us: " << CallSite.Histogram[i] << "\n";
+		}
+	}
+}
@@ -0,0 +1,139 @@
+#ifndef _DRIVER_TRACE_H_
+#define _DRIVER_TRACE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <ostream>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+/**
+ * One finished call of CDriverHelper.
+ * Timestamps are TSC ticks, use CDriverTrace::TicksToMicroseconds.
+ */
+struct CDriverTraceRecord
+{
+	const char *pCallSite;
+	void *Pid;
+	uint64_t Size;
+	uint64_t Start;
+	uint64_t End;
+
+	// Zero on success, last error if call threw or UINT32_MAX if there was none
+	uint32_t Status;
+
+	// Filled by CDriverTrace::Collect
+	uint32_t ThreadId;
+};
+
+struct CDriverTraceSummary
+{
+	const char *pCallSite;
+	uint64_t Count;
+	uint64_t Failed;
+	uint64_t Bytes;
+
+	double MeanUs;
+	double P50Us;
+	double P99Us;
+	double MaxUs;
+
+	// Bucket `i` counts calls which took [2^i, 2^(i+1)) microseconds, first one also counts faster calls
+	uint64_t Histogram[24];
+};
+
+/**
+ * Calls are recorded only if client is built with DRIVER_API_TRACE, otherwise DRIVER_TRACE_SCOPE expands to nothing
+ * and everything here reports empty trace.
+ * Each thread writes its own ring of RingSize latest records without locks. When thread exits, its records are moved
+ * to one shared list of RingSize latest records of exited threads and its ring is reused by next new thread.
+ */
+class CDriverTrace
+{
+public:
+
+	static const size_t RingSize = 1 << 14;
+
+	// Disabled by default
+	static void SetEnabled(bool Enabled);
+	static bool IsEnabled();
+
+	static void Record(const CDriverTraceRecord &Record);
+
+	// Records of all threads ordered by start. Safe while other threads record, their newest records may be missed.
+	static std::vector<CDriverTraceRecord> Collect();
+
+	// Later Collect calls skip everything recorded so far
+	static void Clear();
+
+	static double TicksToMicroseconds(uint64_t Ticks);
+
+	// Complete events in Chrome trace event format, loads into chrome://tracing and Perfetto
+	static void WriteChromeTrace(std::ostream &Out, const std::vector<CDriverTraceRecord> &Records);
+
+	// Sorted by total time spent
+	static std::vector<CDriverTraceSummary> Summarize(const std::vector<CDriverTraceRecord> &Records);
+	static void WriteSummary(std::ostream &Out, const std::vector<CDriverTraceSummary> &Summary);
+
+	static uint64_t ReadTimestamp() { return __rdtsc(); }
+	static uint32_t LastError();
+};
+
+class CDriverTraceScope
+{
+	CDriverTraceRecord m_Record;
+	int m_Exceptions;
+	bool m_Active;
+
+public:
+
+	CDriverTraceScope(const char *pCallSite, void *Pid, uint64_t Size) :
+		m_Active(CDriverTrace::IsEnabled())
+	{
+		if (!m_Active)
+			return;
+
+		m_Record.pCallSite = pCallSite;
+		m_Record.Pid = Pid;
+		m_Record.Size = Size;
+		m_Record.Status = 0;
+		m_Record.ThreadId = 0;
+		m_Exceptions = std::uncaught_exceptions();
+		m_Record.Start = CDriverTrace::ReadTimestamp();
+	}
+
+	~CDriverTraceScope()
+	{
+		if (!m_Active)
+			return;
+
+		m_Record.End = CDriverTrace::ReadTimestamp();
+
+		if (std::uncaught_exceptions() > m_Exceptions)
+		{
+			m_Record.Status = CDriverTrace::LastError();
+
+			if (m_Record.Status == 0)
+				m_Record.Status = UINT32_MAX;
+		}
+
+		CDriverTrace::Record(m_Record);
+	}
+
+	CDriverTraceScope(const CDriverTraceScope &) = delete;
+	CDriverTraceScope &operator=(const CDriverTraceScope &) = delete;
+};
+
+#ifdef DRIVER_API_TRACE
+#define DRIVER_TRACE_SCOPE(CallSite, Pid, Size) CDriverTraceScope DriverTraceScope((CallSite), (Pid), (uint64_t)(Size))
+#else
+#define DRIVER_TRACE_SCOPE(CallSite, Pid, Size) ((void)0)
+#endif
+
+#endif // _DRIVER_TRACE_H_
@@ -0,0 +1,216 @@
+#include "mappedfile.hpp"
+
+#include <stdexcept>
+#include <sstream>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static void ThrowMappedFileError(const char *pWhat, unsigned long Error)
+{
+	std::stringstream ss;
+	ss << "CMappedFile ";
+	ss << pWhat;
+	ss << " error = ";
+	ss << Error;
+
+	throw std::runtime_error(ss.str());
+}
+
+#ifdef _WIN32
+
+CMappedFile::CMappedFile(const char *pPath, size_t MinSize, bool ReadOnly) :
+	m_ReadOnly(ReadOnly)
+{
+	int WidePathSize = MultiByteToWideChar(CP_UTF8, 0, pPath, -1, nullptr, 0);
+
+	std::vector<wchar_t> WidePath(WidePathSize);
+
+	MultiByteToWideChar(CP_UTF8, 0, pPath, -1, WidePath.data(), WidePathSize);
+
+	DWORD Access = ReadOnly ? GENERIC_READ : (GENERIC_READ | GENERIC_WRITE);
+	DWORD Disposition = ReadOnly ? OPEN_EXISTING : OPEN_ALWAYS;
+
+	m_FileHandle = CreateFileW(WidePath.data(), Access, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, Disposition, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (m_FileHandle == INVALID_HANDLE_VALUE)
+		ThrowMappedFileError("can't open file", GetLastError());
+
+	LARGE_INTEGER FileSize;
+
+	if (GetFileSizeEx(m_FileHandle, &FileSize) == 0)
+	{
+		DWORD Error = GetLastError();
+		CloseHandle(m_FileHandle);
+		ThrowMappedFileError("can't get file size", Error);
+	}
+
+	size_t Size = static_cast<size_t>(FileSize.QuadPart);
+
+	if (!ReadOnly && Size < MinSize)
+		Size = MinSize;
+
+	try
+	{
+		Map(Size);
+	}
+	catch (...)
+	{
+		CloseHandle(m_FileHandle);
+		throw;
+	}
+}
+
+CMappedFile::~CMappedFile()
+{
+	Unmap();
+	CloseHandle(m_FileHandle);
+}
+
+void CMappedFile::Map(size_t Size)
+{
+	if (Size == 0)
+		ThrowMappedFileError("can't map empty file", 0);
+
+	uint64_t Size64 = Size;
+
+	// Mapping bigger than file extends it with zeroes
+	m_MappingHandle = CreateFileMappingW(m_FileHandle, NULL, m_ReadOnly ? PAGE_READONLY : PAGE_READWRITE,
+		static_cast<DWORD>(Size64 >> 32), static_cast<DWORD>(Size64), NULL);
+
+	if (m_MappingHandle == NULL)
+		ThrowMappedFileError("can't create mapping", GetLastError());
+
+	m_pView = MapViewOfFile(m_MappingHandle, m_ReadOnly ? FILE_MAP_READ : FILE_MAP_ALL_ACCESS, 0, 0, Size);
+
+	if (m_pView == NULL)
+	{
+		DWORD Error = GetLastError();
+		CloseHandle(m_MappingHandle);
+		m_MappingHandle = nullptr;
+		ThrowMappedFileError("can't map view", Error);
+	}
+
+	m_Size = Size;
+}
+
+void CMappedFile::Unmap()
+{
+	if (m_pView != nullptr)
+		UnmapViewOfFile(m_pView);
+
+	if (m_MappingHandle != nullptr)
+		CloseHandle(m_MappingHandle);
+
+	m_pView = nullptr;
+	m_MappingHandle = nullptr;
+	m_Size = 0;
+}
+
+void CMappedFile::Flush() const
+{
+	FlushViewOfFile(m_pView, 0);
+}
+
+#else
+
+CMappedFile::CMappedFile(const char *pPath, size_t MinSize, bool ReadOnly) :
+	m_ReadOnly(ReadOnly)
+{
+	int Fd = ReadOnly ? open(pPath, O_RDONLY) : open(pPath, O_RDWR | O_CREAT, 0644);
+
+	if (Fd < 0)
+		ThrowMappedFileError("can't open file", errno);
+
+	m_FileHandle = reinterpret_cast<void *>(static_cast<intptr_t>(Fd));
+
+	struct stat Stat;
+
+	if (fstat(Fd, &Stat) != 0)
+	{
+		int Error = errno;
+		close(Fd);
+		ThrowMappedFileError("can't get file size", Error);
+	}
+
+	size_t Size = static_cast<size_t>(Stat.st_size);
+
+	if (!ReadOnly && Size < MinSize)
+		Size = MinSize;
+
+	try
+	{
+		Map(Size);
+	}
+	catch (...)
+	{
+		close(Fd);
+		throw;
+	}
+}
+
+CMappedFile::~CMappedFile()
+{
+	Unmap();
+	close(static_cast<int>(reinterpret_cast<intptr_t>(m_FileHandle)));
+}
+
+void CMappedFile::Map(size_t Size)
+{
+	int Fd = static_cast<int>(reinterpret_cast<intptr_t>(m_FileHandle));
+
+	if (Size == 0)
+		ThrowMappedFileError("can't map empty file", 0);
+
+	struct stat Stat;
+
+	if (!m_ReadOnly && fstat(Fd, &Stat) == 0 && static_cast<size_t>(Stat.st_size) < Size)
+	{
+		if (ftruncate(Fd, static_cast<off_t>(Size)) != 0)
+			ThrowMappedFileError("can't extend file", errno);
+	}
+
+	void *pView = mmap(nullptr, Size, m_ReadOnly ? PROT_READ : (PROT_READ | PROT_WRITE), MAP_SHARED, Fd, 0);
+
+	if (pView == MAP_FAILED)
+		ThrowMappedFileError("can't map view", errno);
+
+	m_pView = pView;
+	m_Size = Size;
+}
+
+void CMappedFile::Unmap()
+{
+	if (m_pView != nullptr)
+		munmap(m_pView, m_Size);
+
+	m_pView = nullptr;
+	m_Size = 0;
+}
+
+void CMappedFile::Flush() const
+{
+	msync(m_pView, m_Size, MS_ASYNC);
+}
+
+#endif
+
+void CMappedFile::Resize(size_t Size)
+{
+	if (m_ReadOnly)
+		ThrowMappedFileError("can't resize read only file", 0);
+
+	if (Size <= m_Size)
+		return;
+
+	Unmap();
+	Map(Size);
+}
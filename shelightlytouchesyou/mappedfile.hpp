@@ -0,0 +1,48 @@
+#ifndef _MAPPED_FILE_H_
+#define _MAPPED_FILE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Read-write file mapped into memory as a whole.
+ * Builds on Windows (file mapping) and POSIX (mmap).
+ * Resize only grows the file and remaps it, so every pointer into old view becomes invalid.
+ */
+class CMappedFile
+{
+	void *m_FileHandle = nullptr;
+	void *m_MappingHandle = nullptr;
+	void *m_pView = nullptr;
+	size_t m_Size = 0;
+	bool m_ReadOnly = false;
+
+	void Map(size_t Size);
+	void Unmap();
+
+public:
+
+	/**
+	 * Opens or creates file at UTF-8 `pPath`.
+	 * File is extended with zeroes to at least `MinSize` bytes unless opened read only.
+	 */
+	CMappedFile(const char *pPath, size_t MinSize, bool ReadOnly = false);
+	~CMappedFile();
+
+	CMappedFile(const CMappedFile &) = delete;
+	CMappedFile &operator=(const CMappedFile &) = delete;
+
+	void *Data() const { return m_pView; }
+	size_t Size() const { return m_Size; }
+
+	template <typename T>
+	T *At(size_t Offset) const
+	{
+		return reinterpret_cast<T *>(static_cast<char *>(m_pView) + Offset);
+	}
+
+	void Resize(size_t Size);
+	void Flush() const;
+};
+
+#endif // _MAPPED_FILE_H_
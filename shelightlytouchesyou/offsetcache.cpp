@@ -0,0 +1,302 @@
+#include "offsetcache.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <sstream>
+
+static const uint32_t OffsetCacheMagic = 0x43544C53; // 'SLTC'
+static const uint32_t OffsetCacheVersion = 2;
+
+// Entry index reserved for count of scan hits
+static const uint32_t HitsCountIndex = UINT32_MAX;
+
+struct COffsetCacheHeader
+{
+	uint32_t Magic;
+	uint32_t Version;
+	uint32_t Capacity;
+	uint32_t Count;
+
+	// Incremented by every open
+	uint32_t Generation;
+
+	// Keeps entries 8 byte aligned
+	uint32_t Reserved;
+};
+
+static_assert(sizeof(COffsetCacheHeader) == COffsetCache::HeaderSize, "COffsetCache::HeaderSize must match file header");
+
+struct COffsetCacheKey
+{
+	uint64_t Hash; // never 0
+	uint64_t Check; // independent of `Hash`, so a collision of both is not a practical concern
+};
+
+struct COffsetCacheEntry
+{
+	COffsetCacheKey Key; // Key.Hash of 0 means empty slot
+	CModuleIdentity Module;
+	uint32_t Value;
+
+	// Generation of last open which used the entry
+	uint32_t Generation;
+};
+
+static size_t FileSizeFor(uint32_t Capacity)
+{
+	return sizeof(COffsetCacheHeader) + static_cast<size_t>(Capacity) * sizeof(COffsetCacheEntry);
+}
+
+static uint64_t Mix(uint64_t Hash)
+{
+	Hash ^= Hash >> 33;
+	Hash *= 0xFF51AFD7ED558CCDull;
+	Hash ^= Hash >> 33;
+	Hash *= 0xC4CEB9FE1A85EC53ull;
+	Hash ^= Hash >> 33;
+	return Hash;
+}
+
+static COffsetCacheKey HashKey(const char *pKey, uint32_t Index)
+{
+	// FNV-1a for the slot, multiply-rotate with other constants for the check
+	uint64_t Hash = 0xCBF29CE484222325ull;
+	uint64_t Check = 0x243F6A8885A308D3ull;
+	size_t Length = 0;
+
+	for (const char *p = pKey; *p != '\0'; p++, Length++)
+	{
+		Hash ^= static_cast<uint8_t>(*p);
+		Hash *= 0x100000001B3ull;
+
+		Check = (Check ^ static_cast<uint8_t>(*p)) * 0x9FB21C651E98DF25ull;
+		Check = Check << 29 | Check >> 35;
+	}
+
+	COffsetCacheKey Key;
+	Key.Hash = Mix(Hash ^ (static_cast<uint64_t>(Index) * 0x9E3779B97F4A7C15ull));
+	Key.Check = Mix(Check ^ Length ^ (static_cast<uint64_t>(Index) << 40));
+
+	if (Key.Hash == 0)
+		Key.Hash = 1;
+
+	return Key;
+}
+
+static uint64_t SlotHash(const CModuleIdentity &Module, const COffsetCacheKey &Key)
+{
+	return Mix(Key.Hash ^ (static_cast<uint64_t>(Module.TimeDateStamp) << 32 | Module.SizeOfImage) ^ (static_cast<uint64_t>(Module.CheckSum) << 17));
+}
+
+static bool IsPowerOfTwo(uint32_t Value)
+{
+	return Value != 0 && (Value & (Value - 1)) == 0;
+}
+
+COffsetCache::COffsetCache(const char *pPath, uint32_t Capacity, uint32_t MaxCapacity) :
+	m_File(pPath, FileSizeFor(Capacity)),
+	m_MaxCapacity(MaxCapacity)
+{
+	if (!IsPowerOfTwo(Capacity) || !IsPowerOfTwo(MaxCapacity) || Capacity > MaxCapacity)
+		throw std::runtime_error("COffsetCache capacities must be powers of two, initial one not above max");
+
+	COffsetCacheHeader *pHeader = Header();
+
+	bool Valid = pHeader->Magic == OffsetCacheMagic &&
+		pHeader->Version == OffsetCacheVersion &&
+		IsPowerOfTwo(pHeader->Capacity) &&
+		pHeader->Capacity <= m_MaxCapacity &&
+		FileSizeFor(pHeader->Capacity) <= m_File.Size() &&
+		pHeader->Count <= pHeader->Capacity;
+
+	// Unknown or damaged file is a cold cache
+	if (!Valid)
+	{
+		Reset(Capacity);
+		Header()->Generation = 0;
+	}
+
+	Header()->Generation++;
+}
+
+COffsetCacheHeader *COffsetCache::Header() const
+{
+	return m_File.At<COffsetCacheHeader>(0);
+}
+
+COffsetCacheEntry *COffsetCache::Entries() const
+{
+	return m_File.At<COffsetCacheEntry>(sizeof(COffsetCacheHeader));
+}
+
+void COffsetCache::Reset(uint32_t Capacity)
+{
+	m_File.Resize(FileSizeFor(Capacity));
+
+	COffsetCacheHeader *pHeader = Header();
+	pHeader->Magic = OffsetCacheMagic;
+	pHeader->Version = OffsetCacheVersion;
+	pHeader->Capacity = Capacity;
+	pHeader->Count = 0;
+
+	memset(Entries(), 0, static_cast<size_t>(Capacity) * sizeof(COffsetCacheEntry));
+}
+
+void COffsetCache::Grow()
+{
+	COffsetCacheHeader *pHeader = Header();
+	uint32_t Generation = pHeader->Generation;
+	uint32_t Capacity = pHeader->Capacity;
+
+	std::vector<COffsetCacheEntry> Live;
+	Live.reserve(pHeader->Count);
+
+	for (uint32_t i = 0; i < Capacity; i++)
+	{
+		if (Entries()[i].Key.Hash != 0)
+			Live.push_back(Entries()[i]);
+	}
+
+	if (Capacity < m_MaxCapacity)
+	{
+		Capacity *= 2;
+	}
+	else
+	{
+		// Entries of old binaries are never used again, so drop everything not used since this open.
+		// Scan records evicted partially read back as miss.
+		Live.erase(std::remove_if(Live.begin(), Live.end(), [Generation](const COffsetCacheEntry &Entry)
+		{
+			return Entry.Generation != Generation;
+		}), Live.end());
+
+		// Table is full of entries of this open alone, start over
+		if ((Live.size() + 1) * 2 > Capacity)
+			Live.clear();
+	}
+
+	Reset(Capacity);
+
+	// Moved as is, so entries keep generation of their last use
+	for (const COffsetCacheEntry &Entry : Live)
+	{
+		*Lookup(Entry.Module, Entry.Key) = Entry;
+		Header()->Count++;
+	}
+}
+
+COffsetCacheEntry *COffsetCache::Lookup(const CModuleIdentity &Module, const COffsetCacheKey &Key)
+{
+	uint32_t Capacity = Header()->Capacity;
+	uint32_t Mask = Capacity - 1;
+	uint32_t Slot = static_cast<uint32_t>(SlotHash(Module, Key)) & Mask;
+	COffsetCacheEntry *pEntries = Entries();
+
+	for (uint32_t Probe = 0; Probe < Capacity; Probe++, Slot = (Slot + 1) & Mask)
+	{
+		COffsetCacheEntry &Entry = pEntries[Slot];
+
+		if (Entry.Key.Hash == 0 || (Entry.Key.Hash == Key.Hash && Entry.Key.Check == Key.Check && Entry.Module == Module))
+			return &Entry;
+	}
+
+	// Load factor keeps free slots in every table written by this class, so the file was damaged since open
+	Reset(Capacity);
+	return nullptr;
+}
+
+COffsetCacheEntry *COffsetCache::Touch(const CModuleIdentity &Module, const COffsetCacheKey &Key)
+{
+	COffsetCacheEntry *pEntry = Lookup(Module, Key);
+
+	if (pEntry == nullptr || pEntry->Key.Hash == 0)
+		return nullptr;
+
+	pEntry->Generation = Header()->Generation;
+	return pEntry;
+}
+
+void COffsetCache::Insert(const CModuleIdentity &Module, const COffsetCacheKey &Key, uint32_t Value)
+{
+	// Keep load factor under 3/4 so probe sequences stay short and always end
+	if ((Header()->Count + 1) * 4 > Header()->Capacity * 3)
+		Grow();
+
+	COffsetCacheEntry *pEntry = Lookup(Module, Key);
+
+	// Damaged table was reset by lookup
+	if (pEntry == nullptr)
+		pEntry = Lookup(Module, Key);
+
+	if (pEntry->Key.Hash == 0)
+	{
+		pEntry->Module = Module;
+		pEntry->Key = Key;
+		Header()->Count++;
+	}
+
+	pEntry->Value = Value;
+	pEntry->Generation = Header()->Generation;
+}
+
+bool COffsetCache::Find(const CModuleIdentity &Module, const char *pKey, uint32_t &Rva)
+{
+	COffsetCacheEntry *pEntry = Touch(Module, HashKey(pKey, 0));
+
+	if (pEntry == nullptr)
+		return false;
+
+	Rva = pEntry->Value;
+	return true;
+}
+
+void COffsetCache::Store(const CModuleIdentity &Module, const char *pKey, uint32_t Rva)
+{
+	Insert(Module, HashKey(pKey, 0), Rva);
+}
+
+bool COffsetCache::FindHits(const CModuleIdentity &Module, const char *pKey, std::vector<uint32_t> &Hits)
+{
+	COffsetCacheEntry *pCount = Touch(Module, HashKey(pKey, HitsCountIndex));
+
+	if (pCount == nullptr)
+		return false;
+
+	uint32_t Count = pCount->Value;
+
+	Hits.clear();
+	Hits.reserve(Count);
+
+	for (uint32_t i = 0; i < Count; i++)
+	{
+		COffsetCacheEntry *pEntry = Touch(Module, HashKey(pKey, i));
+
+		// Partially written, partially evicted or damaged record
+		if (pEntry == nullptr)
+			return false;
+
+		Hits.push_back(pEntry->Value);
+	}
+
+	return true;
+}
+
+void COffsetCache::StoreHits(const CModuleIdentity &Module, const char *pKey, const std::vector<uint32_t> &Hits)
+{
+	for (uint32_t i = 0; i < static_cast<uint32_t>(Hits.size()); i++)
+		Insert(Module, HashKey(pKey, i), Hits[i]);
+
+	// Count goes last so interrupted store is seen as miss
+	Insert(Module, HashKey(pKey, HitsCountIndex), static_cast<uint32_t>(Hits.size()));
+}
+
+void COffsetCache::Clear()
+{
+	Reset(Header()->Capacity);
+}
+
+void COffsetCache::Flush() const
+{
+	m_File.Flush();
+}
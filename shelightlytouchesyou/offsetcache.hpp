@@ -0,0 +1,79 @@
+#ifndef _OFFSET_CACHE_H_
+#define _OFFSET_CACHE_H_
+
+#include "mappedfile.hpp"
+#include "peparser.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/**
+ * Persistent hash table of RVAs keyed by module identity and string key.
+ * Lives in memory mapped file, so lookups cost no syscalls after open.
+ * Table grows up to `MaxCapacity` entries. When that is full, entries not used since this cache was opened are dropped,
+ * which removes entries of binaries updated since.
+ * Not synchronized between processes: use one file per tool.
+ */
+class COffsetCache
+{
+	CMappedFile m_File;
+	uint32_t m_MaxCapacity;
+
+	struct COffsetCacheHeader *Header() const;
+	struct COffsetCacheEntry *Entries() const;
+
+	// Returns matching or empty slot, nullptr if there is neither and table was reset as damaged
+	struct COffsetCacheEntry *Lookup(const CModuleIdentity &Module, const struct COffsetCacheKey &Key);
+	struct COffsetCacheEntry *Touch(const CModuleIdentity &Module, const struct COffsetCacheKey &Key);
+	void Insert(const CModuleIdentity &Module, const struct COffsetCacheKey &Key, uint32_t Value);
+	void Reset(uint32_t Capacity);
+	void Grow();
+
+public:
+
+	// Entries follow file header of this size
+	static const size_t HeaderSize = 24;
+
+	// Both capacities are counts of entries and must be powers of two
+	COffsetCache(const char *pPath, uint32_t Capacity = 4096, uint32_t MaxCapacity = 65536);
+
+	// Lookups write last use into the file, so they aren't const
+	bool Find(const CModuleIdentity &Module, const char *pKey, uint32_t &Rva);
+	void Store(const CModuleIdentity &Module, const char *pKey, uint32_t Rva);
+
+	bool FindHits(const CModuleIdentity &Module, const char *pKey, std::vector<uint32_t> &Hits);
+	void StoreHits(const CModuleIdentity &Module, const char *pKey, const std::vector<uint32_t> &Hits);
+
+	void Clear();
+	void Flush() const;
+};
+
+/**
+ * Export and signature scan resolution backed by COffsetCache.
+ * Unchanged binaries cost one header read per module instead of export parsing and scanning.
+ */
+class CCachedResolver
+{
+	const CRemotePEParser &m_Parser;
+	COffsetCache &m_Cache;
+
+public:
+
+	// Returns RVAs of all hits inside module
+	using ScanFunction = std::function<std::vector<uint32_t>(const CRemoteModule &Module)>;
+
+	CCachedResolver(const CRemotePEParser &Parser, COffsetCache &Cache);
+
+	void *GetExport(void *ModuleBase, const char *pExportName) const;
+	void *GetExport(const char *pModuleName, const char *pExportName) const;
+
+	/**
+	 * `pPatternKey` must describe pattern uniquely (e.g. pattern string itself).
+	 * `Scanner` runs only on cache miss.
+	 */
+	std::vector<void *> Scan(void *ModuleBase, const char *pPatternKey, const ScanFunction &Scanner) const;
+	std::vector<void *> Scan(const char *pModuleName, const char *pPatternKey, const ScanFunction &Scanner) const;
+};
+
+#endif // _OFFSET_CACHE_H_
@@ -0,0 +1,588 @@
+#include "peparser.hpp"
+#include "driver.h"
+
+#include <windows.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <sstream>
+
+// Headers of almost every image fit into first page
+static const size_t HeadersReadSize = 0x1000;
+static const size_t MaxHeadersSize = 0x100000;
+static const size_t MaxExportDirectorySize = 0x4000000;
+static const size_t MaxExportNamesSpan = 0x1000000;
+static const size_t MaxExportNameLength = 0x200;
+static const int MaxForwarderDepth = 8;
+
+static std::string ToLowerAscii(const char *pStr)
+{
+	std::string Result(pStr);
+
+	std::transform(Result.begin(), Result.end(), Result.begin(), [](char c) {
+		return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+	});
+
+	return Result;
+}
+
+// Virtual module names like api-ms-win-core-synch-l1-2-0 or ext-ms-win-...
+static bool IsApiSetName(const std::string &ModuleName)
+{
+	std::string Lower = ToLowerAscii(ModuleName.c_str());
+
+	return Lower.compare(0, 4, "api-") == 0 || Lower.compare(0, 4, "ext-") == 0;
+}
+
+static void *RvaToPtr(void *ModuleBase, uint32_t Rva)
+{
+	return static_cast<char *>(ModuleBase) + Rva;
+}
+
+// Remote blob of image memory. Serves local pointers for RVAs inside it.
+struct CRemoteBlob
+{
+	uint32_t Rva = 0;
+	std::vector<uint8_t> Data;
+
+	bool Contains(uint32_t ItemRva, size_t ItemSize) const
+	{
+		return ItemRva >= Rva && static_cast<size_t>(ItemRva - Rva) + ItemSize <= Data.size();
+	}
+
+	const void *At(uint32_t ItemRva) const
+	{
+		return Data.data() + (ItemRva - Rva);
+	}
+
+	// Returns nullptr if string isn't null terminated inside blob
+	const char *StringAt(uint32_t ItemRva) const
+	{
+		if (!Contains(ItemRva, 1))
+			return nullptr;
+
+		const char *pStr = static_cast<const char *>(At(ItemRva));
+		size_t MaxLength = Data.size() - (ItemRva - Rva);
+
+		if (memchr(pStr, 0, MaxLength) == nullptr)
+			return nullptr;
+
+		return pStr;
+	}
+
+	void Read(const CDriverProcessHelper &Process, void *ModuleBase, uint32_t BlobRva, size_t Size)
+	{
+		Rva = BlobRva;
+		Data.resize(Size);
+
+		if (Size != 0)
+			Process.ReadProcessMemory(RvaToPtr(ModuleBase, BlobRva), Size, Data.data());
+	}
+};
+
+static void ThrowParseError(void *ModuleBase, const char *pWhat)
+{
+	std::stringstream ss;
+	ss << "CRemotePEParser module ";
+	ss << ModuleBase;
+	ss << " ";
+	ss << pWhat;
+
+	throw std::runtime_error(ss.str());
+}
+
+const CRemoteSection *CRemoteModule::FindSection(const char *pName) const
+{
+	for (const CRemoteSection &Section : m_Sections)
+	{
+		if (strcmp(Section.Name, pName) == 0)
+			return &Section;
+	}
+
+	return nullptr;
+}
+
+bool CRemoteModule::FindExport(const char *pName, uint32_t &Rva, const std::string **pForwarder) const
+{
+	auto it = m_Exports.find(pName);
+
+	if (it == m_Exports.end())
+		return false;
+
+	Rva = it->second;
+
+	auto fit = m_Forwarders.find(Rva);
+	*pForwarder = (fit != m_Forwarders.end()) ? &fit->second : nullptr;
+
+	return true;
+}
+
+bool CRemoteModule::FindExport(uint16_t Ordinal, uint32_t &Rva, const std::string **pForwarder) const
+{
+	if (Ordinal < m_OrdinalBase || Ordinal - m_OrdinalBase >= m_Functions.size())
+		return false;
+
+	Rva = m_Functions[Ordinal - m_OrdinalBase];
+
+	if (Rva == 0)
+		return false;
+
+	auto fit = m_Forwarders.find(Rva);
+	*pForwarder = (fit != m_Forwarders.end()) ? &fit->second : nullptr;
+
+	return true;
+}
+
+CRemotePEParser::CRemotePEParser(const CDriverProcessHelper &Process) :
+	m_Process(Process)
+{
+}
+
+void CRemotePEParser::ReadHeaders(CRemoteModule &Module, bool Sections, uint32_t &ExportRva, uint32_t &ExportSize) const
+{
+	void *ModuleBase = Module.m_Base;
+
+	CRemoteBlob Headers;
+	Headers.Read(m_Process, ModuleBase, 0, HeadersReadSize);
+
+	// Re-read headers only if they don't fit into first read
+	auto RequireHeaders = [&](size_t Size) {
+		if (Size <= Headers.Data.size())
+			return;
+
+		if (Size > MaxHeadersSize)
+			ThrowParseError(ModuleBase, "headers are too big");
+
+		Headers.Read(m_Process, ModuleBase, 0, Size);
+	};
+
+	const IMAGE_DOS_HEADER *pDos = static_cast<const IMAGE_DOS_HEADER *>(Headers.At(0));
+
+	if (pDos->e_magic != IMAGE_DOS_SIGNATURE)
+		ThrowParseError(ModuleBase, "has bad DOS signature");
+
+	uint32_t NtOffset = static_cast<uint32_t>(pDos->e_lfanew);
+
+	RequireHeaders(static_cast<size_t>(NtOffset) + sizeof(IMAGE_NT_HEADERS64));
+
+	const IMAGE_NT_HEADERS32 *pNt32 = static_cast<const IMAGE_NT_HEADERS32 *>(Headers.At(NtOffset));
+	const IMAGE_NT_HEADERS64 *pNt64 = static_cast<const IMAGE_NT_HEADERS64 *>(Headers.At(NtOffset));
+
+	if (pNt32->Signature != IMAGE_NT_SIGNATURE)
+		ThrowParseError(ModuleBase, "has bad NT signature");
+
+	IMAGE_DATA_DIRECTORY ExportDirectory = {};
+	uint32_t NumberOfRvaAndSizes;
+
+	if (pNt32->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC)
+	{
+		Module.m_Is64 = true;
+		Module.m_SizeOfImage = pNt64->OptionalHeader.SizeOfImage;
+		Module.m_CheckSum = pNt64->OptionalHeader.CheckSum;
+		NumberOfRvaAndSizes = pNt64->OptionalHeader.NumberOfRvaAndSizes;
+
+		if (NumberOfRvaAndSizes > IMAGE_DIRECTORY_ENTRY_EXPORT)
+			ExportDirectory = pNt64->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT];
+	}
+	else if (pNt32->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC)
+	{
+		Module.m_Is64 = false;
+		Module.m_SizeOfImage = pNt32->OptionalHeader.SizeOfImage;
+		Module.m_CheckSum = pNt32->OptionalHeader.CheckSum;
+		NumberOfRvaAndSizes = pNt32->OptionalHeader.NumberOfRvaAndSizes;
+
+		if (NumberOfRvaAndSizes > IMAGE_DIRECTORY_ENTRY_EXPORT)
+			ExportDirectory = pNt32->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT];
+	}
+	else
+	{
+		ThrowParseError(ModuleBase, "has unknown optional header magic");
+	}
+
+	Module.m_TimeDateStamp = pNt32->FileHeader.TimeDateStamp;
+
+	ExportRva = ExportDirectory.VirtualAddress;
+	ExportSize = ExportDirectory.Size;
+
+	if (!Sections)
+		return;
+
+	// Section table lays right after optional header
+	uint32_t SectionsOffset = NtOffset + static_cast<uint32_t>(offsetof(IMAGE_NT_HEADERS32, OptionalHeader)) + pNt32->FileHeader.SizeOfOptionalHeader;
+	uint16_t NumberOfSections = pNt32->FileHeader.NumberOfSections;
+
+	RequireHeaders(static_cast<size_t>(SectionsOffset) + NumberOfSections * sizeof(IMAGE_SECTION_HEADER));
+
+	const IMAGE_SECTION_HEADER *pSections = static_cast<const IMAGE_SECTION_HEADER *>(Headers.At(SectionsOffset));
+
+	Module.m_Sections.resize(NumberOfSections);
+
+	for (uint16_t i = 0; i < NumberOfSections; i++)
+	{
+		CRemoteSection &Section = Module.m_Sections[i];
+
+		memcpy(Section.Name, pSections[i].Name, IMAGE_SIZEOF_SHORT_NAME);
+		Section.Name[IMAGE_SIZEOF_SHORT_NAME] = '\0';
+		Section.VirtualAddress = pSections[i].VirtualAddress;
+		Section.VirtualSize = pSections[i].Misc.VirtualSize;
+		Section.Characteristics = pSections[i].Characteristics;
+	}
+}
+
+std::unique_ptr<CRemoteModule> CRemotePEParser::Parse(void *ModuleBase) const
+{
+	std::unique_ptr<CRemoteModule> pModule(new CRemoteModule());
+	pModule->m_Base = ModuleBase;
+
+	uint32_t ExportRva;
+	uint32_t ExportSize;
+	ReadHeaders(*pModule, true, ExportRva, ExportSize);
+
+	IMAGE_DATA_DIRECTORY ExportDirectory = { ExportRva, ExportSize };
+
+	if (ExportDirectory.VirtualAddress == 0 || ExportDirectory.Size < sizeof(IMAGE_EXPORT_DIRECTORY))
+		return pModule;
+
+	if (ExportDirectory.Size > MaxExportDirectorySize || ExportDirectory.VirtualAddress + static_cast<uint64_t>(ExportDirectory.Size) > pModule->m_SizeOfImage)
+		ThrowParseError(ModuleBase, "has bad export directory");
+
+	// Linkers put tables and names inside export directory, so usually that's the last read
+	CRemoteBlob Exports;
+	Exports.Read(m_Process, ModuleBase, ExportDirectory.VirtualAddress, ExportDirectory.Size);
+
+	IMAGE_EXPORT_DIRECTORY Directory;
+	memcpy(&Directory, Exports.At(ExportDirectory.VirtualAddress), sizeof(Directory));
+
+	if (Directory.NumberOfFunctions > 0x10000 || Directory.NumberOfNames > 0x10000)
+		ThrowParseError(ModuleBase, "has bad export table");
+
+	CRemoteBlob FunctionsBlob;
+	CRemoteBlob NamesBlob;
+	CRemoteBlob OrdinalsBlob;
+
+	auto Table = [&](CRemoteBlob &Extra, uint32_t Rva, size_t Size) -> const void * {
+		if (Exports.Contains(Rva, Size))
+			return Exports.At(Rva);
+
+		if (Rva + static_cast<uint64_t>(Size) > pModule->m_SizeOfImage)
+			ThrowParseError(ModuleBase, "has export table outside of image");
+
+		Extra.Read(m_Process, ModuleBase, Rva, Size);
+		return Extra.At(Rva);
+	};
+
+	const uint32_t *pFunctions = static_cast<const uint32_t *>(Table(FunctionsBlob, Directory.AddressOfFunctions, Directory.NumberOfFunctions * sizeof(uint32_t)));
+	const uint32_t *pNames = static_cast<const uint32_t *>(Table(NamesBlob, Directory.AddressOfNames, Directory.NumberOfNames * sizeof(uint32_t)));
+	const uint16_t *pOrdinals = static_cast<const uint16_t *>(Table(OrdinalsBlob, Directory.AddressOfNameOrdinals, Directory.NumberOfNames * sizeof(uint16_t)));
+
+	pModule->m_OrdinalBase = Directory.Base;
+	pModule->m_Functions.assign(pFunctions, pFunctions + Directory.NumberOfFunctions);
+
+	for (uint32_t Rva : pModule->m_Functions)
+	{
+		if (Rva >= ExportDirectory.VirtualAddress && Rva < ExportDirectory.VirtualAddress + ExportDirectory.Size)
+		{
+			const char *pForwarder = Exports.StringAt(Rva);
+
+			if (pForwarder != nullptr)
+				pModule->m_Forwarders.emplace(Rva, pForwarder);
+		}
+	}
+
+	// Names outside of export directory are fetched with one read of their whole span
+	uint32_t MinOuterName = UINT32_MAX;
+	uint32_t MaxOuterName = 0;
+
+	for (uint32_t i = 0; i < Directory.NumberOfNames; i++)
+	{
+		if (Exports.StringAt(pNames[i]) == nullptr)
+		{
+			MinOuterName = std::min(MinOuterName, pNames[i]);
+			MaxOuterName = std::max(MaxOuterName, pNames[i]);
+		}
+	}
+
+	CRemoteBlob OuterNames;
+
+	if (MinOuterName <= MaxOuterName)
+	{
+		uint64_t End = std::min<uint64_t>(static_cast<uint64_t>(MaxOuterName) + MaxExportNameLength, pModule->m_SizeOfImage);
+
+		if (End <= MinOuterName || End - MinOuterName > MaxExportNamesSpan)
+			ThrowParseError(ModuleBase, "has export names scattered over image");
+
+		OuterNames.Read(m_Process, ModuleBase, MinOuterName, static_cast<size_t>(End - MinOuterName));
+	}
+
+	pModule->m_Exports.reserve(Directory.NumberOfNames);
+
+	for (uint32_t i = 0; i < Directory.NumberOfNames; i++)
+	{
+		const char *pName = Exports.StringAt(pNames[i]);
+
+		if (pName == nullptr)
+			pName = OuterNames.StringAt(pNames[i]);
+
+		if (pName == nullptr || pOrdinals[i] >= Directory.NumberOfFunctions)
+			continue;
+
+		pModule->m_Exports.emplace(pName, pFunctions[pOrdinals[i]]);
+	}
+
+	return pModule;
+}
+
+CModuleIdentity CRemotePEParser::ReadIdentity(void *ModuleBase) const
+{
+	auto it = m_Modules.find(ModuleBase);
+
+	if (it != m_Modules.end())
+		return it->second->GetIdentity();
+
+	CRemoteModule Module;
+	Module.m_Base = ModuleBase;
+
+	uint32_t ExportRva;
+	uint32_t ExportSize;
+	ReadHeaders(Module, false, ExportRva, ExportSize);
+
+	return Module.GetIdentity();
+}
+
+std::vector<CRemoteSection> CRemotePEParser::ReadSections(void *ModuleBase) const
+{
+	auto it = m_Modules.find(ModuleBase);
+
+	if (it != m_Modules.end())
+		return it->second->GetSections();
+
+	CRemoteModule Module;
+	Module.m_Base = ModuleBase;
+
+	uint32_t ExportRva;
+	uint32_t ExportSize;
+	ReadHeaders(Module, true, ExportRva, ExportSize);
+
+	return Module.m_Sections;
+}
+
+const CRemoteModule &CRemotePEParser::GetModule(void *ModuleBase) const
+{
+	auto it = m_Modules.find(ModuleBase);
+
+	if (it != m_Modules.end())
+		return *it->second;
+
+	std::unique_ptr<CRemoteModule> pModule = Parse(ModuleBase);
+
+	return *m_Modules.emplace(ModuleBase, std::move(pModule)).first->second;
+}
+
+const CRemoteModule &CRemotePEParser::GetModule(const char *pModuleName) const
+{
+	return GetModule(GetModuleBase(pModuleName));
+}
+
+void *CRemotePEParser::GetModuleBase(const char *pModuleName) const
+{
+	std::string Key = ToLowerAscii(pModuleName);
+
+	auto it = m_ModuleBases.find(Key);
+
+	if (it != m_ModuleBases.end())
+		return it->second;
+
+	void *ModuleBase = m_Process.GetModuleBase(pModuleName);
+
+	m_ModuleBases.emplace(std::move(Key), ModuleBase);
+
+	return ModuleBase;
+}
+
+void *CRemotePEParser::ResolveForwarder(const std::string &Forwarder, int Depth) const
+{
+	size_t Dot = Forwarder.rfind('.');
+
+	if (Dot == std::string::npos || Dot == 0 || Dot + 1 == Forwarder.size())
+	{
+		std::stringstream ss;
+		ss << "CRemotePEParser bad forwarder ";
+		ss << Forwarder;
+
+		throw std::runtime_error(ss.str());
+	}
+
+	std::string ModuleName = Forwarder.substr(0, Dot);
+
+	// API set names are mapped to hosts by schema of target process, which isn't read here.
+	// No module is loaded under such name, so lookup by it would only fail later with a misleading error.
+	if (IsApiSetName(ModuleName))
+	{
+		std::stringstream ss;
+		ss << "CRemotePEParser can't resolve forwarder to API set ";
+		ss << Forwarder;
+
+		throw std::runtime_error(ss.str());
+	}
+
+	ModuleName += ".dll";
+	const char *pExportName = Forwarder.c_str() + Dot + 1;
+
+	const CRemoteModule &Module = GetModule(ModuleName.c_str());
+
+	if (pExportName[0] == '#')
+	{
+		uint32_t Rva;
+		const std::string *pNextForwarder;
+		uint16_t Ordinal = static_cast<uint16_t>(strtoul(pExportName + 1, nullptr, 10));
+
+		if (!Module.FindExport(Ordinal, Rva, &pNextForwarder))
+		{
+			std::stringstream ss;
+			ss << "CRemotePEParser can't resolve forwarder ";
+			ss << Forwarder;
+
+			throw std::runtime_error(ss.str());
+		}
+
+		return GetExport(Module, Rva, pNextForwarder, Depth + 1);
+	}
+
+	return GetExport(Module.GetBase(), pExportName, Depth + 1);
+}
+
+void *CRemotePEParser::GetExport(const CRemoteModule &Module, uint32_t Rva, const std::string *pForwarder, int Depth) const
+{
+	if (pForwarder == nullptr)
+		return RvaToPtr(Module.GetBase(), Rva);
+
+	if (Depth >= MaxForwarderDepth)
+	{
+		std::stringstream ss;
+		ss << "CRemotePEParser forwarder chain is too long ";
+		ss << *pForwarder;
+
+		throw std::runtime_error(ss.str());
+	}
+
+	return ResolveForwarder(*pForwarder, Depth);
+}
+
+void *CRemotePEParser::GetExport(void *ModuleBase, const char *pExportName, int Depth) const
+{
+	const CRemoteModule &Module = GetModule(ModuleBase);
+
+	uint32_t Rva;
+	const std::string *pForwarder;
+
+	if (!Module.FindExport(pExportName, Rva, &pForwarder))
+	{
+		std::stringstream ss;
+		ss << "CRemotePEParser can't find export ";
+		ss << pExportName;
+
+		throw std::runtime_error(ss.str());
+	}
+
+	return GetExport(Module, Rva, pForwarder, Depth);
+}
+
+void *CRemotePEParser::GetExport(void *ModuleBase, const char *pExportName) const
+{
+	return GetExport(ModuleBase, pExportName, 0);
+}
+
+void *CRemotePEParser::GetExport(void *ModuleBase, uint16_t Ordinal) const
+{
+	const CRemoteModule &Module = GetModule(ModuleBase);
+
+	uint32_t Rva;
+	const std::string *pForwarder;
+
+	if (!Module.FindExport(Ordinal, Rva, &pForwarder))
+	{
+		std::stringstream ss;
+		ss << "CRemotePEParser can't find export by ordinal ";
+		ss << Ordinal;
+
+		throw std::runtime_error(ss.str());
+	}
+
+	return GetExport(Module, Rva, pForwarder, 0);
+}
+
+void *CRemotePEParser::GetExport(const char *pModuleName, const char *pExportName) const
+{
+	return GetExport(GetModule(pModuleName).GetBase(), pExportName, 0);
+}
+
+void CRemotePEParser::Invalidate(void *ModuleBase)
+{
+	m_Modules.erase(ModuleBase);
+
+	for (auto it = m_ModuleBases.begin(); it != m_ModuleBases.end();)
+	{
+		if (it->second == ModuleBase)
+			it = m_ModuleBases.erase(it);
+		else
+			++it;
+	}
+}
+
+void CRemotePEParser::Clear()
+{
+	m_Modules.clear();
+	m_ModuleBases.clear();
+}
+
+void CRemotePEParser::OnEvent(const CDriverEvent &Event)
+{
+	if (Event.Type == DRIVER_EVENT_LOST)
+	{
+		Clear();
+		return;
+	}
+
+	if (Event.pid != m_Process.GetPid())
+		return;
+
+	if (Event.Type == DRIVER_EVENT_PROCESS_EXIT)
+	{
+		Clear();
+		return;
+	}
+
+	if (Event.Type != DRIVER_EVENT_IMAGE_LOAD)
+		return;
+
+	// Anything cached at this base belongs to unloaded module
+	Invalidate(Event.imageBase);
+
+	// Module with the same name may have been reloaded at other base. Name isn't terminated when it fills the array.
+	const WCHAR *pNameEnd = Event.Name + std::min<size_t>(Event.NameSize, DRIVER_EVENT_NAME_SIZE);
+	const WCHAR *pFileName = Event.Name;
+
+	for (const WCHAR *p = Event.Name; p != pNameEnd; p++)
+	{
+		if (*p == L'\\' || *p == L'/')
+			pFileName = p + 1;
+	}
+
+	std::string Key;
+
+	for (const WCHAR *p = pFileName; p != pNameEnd; p++)
+	{
+		// Names are cached as lowercase ASCII only
+		if (*p >= 0x80)
+			return;
+
+		Key.push_back(static_cast<char>((*p >= L'A' && *p <= L'Z') ? *p - L'A' + L'a' : *p));
+	}
+
+	auto it = m_ModuleBases.find(Key);
+
+	if (it != m_ModuleBases.end() && it->second != Event.imageBase)
+		Invalidate(it->second);
+}
@@ -0,0 +1,148 @@
+#ifndef _PE_PARSER_H_
+#define _PE_PARSER_H_
+
+#include "driverapi.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Identifies exact build of module regardless of its base address.
+ */
+struct CModuleIdentity
+{
+	uint32_t TimeDateStamp;
+	uint32_t SizeOfImage;
+	uint32_t CheckSum;
+
+	bool operator==(const CModuleIdentity &Other) const
+	{
+		return TimeDateStamp == Other.TimeDateStamp && SizeOfImage == Other.SizeOfImage && CheckSum == Other.CheckSum;
+	}
+
+	bool operator!=(const CModuleIdentity &Other) const
+	{
+		return !(*this == Other);
+	}
+};
+
+struct CRemoteSection
+{
+	char Name[9];
+	uint32_t VirtualAddress;
+	uint32_t VirtualSize;
+	uint32_t Characteristics;
+};
+
+/**
+ * Parsed headers, sections and export index of one module loaded in target process.
+ * Built by CRemotePEParser with a few batched reads, never touches target memory afterwards.
+ */
+class CRemoteModule
+{
+	friend class CRemotePEParser;
+
+	void *m_Base = nullptr;
+	bool m_Is64 = false;
+	uint32_t m_TimeDateStamp = 0;
+	uint32_t m_SizeOfImage = 0;
+	uint32_t m_CheckSum = 0;
+
+	std::vector<CRemoteSection> m_Sections;
+
+	uint32_t m_OrdinalBase = 0;
+	std::vector<uint32_t> m_Functions;
+	std::unordered_map<std::string, uint32_t> m_Exports;
+
+	// Forwarded exports, keyed by export RVA. Value is "Module.Name" or "Module.#Ordinal".
+	std::unordered_map<uint32_t, std::string> m_Forwarders;
+
+public:
+
+	void *GetBase() const { return m_Base; }
+	bool Is64() const { return m_Is64; }
+	uint32_t GetTimeDateStamp() const { return m_TimeDateStamp; }
+	uint32_t GetSizeOfImage() const { return m_SizeOfImage; }
+	uint32_t GetCheckSum() const { return m_CheckSum; }
+	CModuleIdentity GetIdentity() const { return { m_TimeDateStamp, m_SizeOfImage, m_CheckSum }; }
+
+	const std::vector<CRemoteSection> &GetSections() const { return m_Sections; }
+	const CRemoteSection *FindSection(const char *pName) const;
+
+	/**
+	 * Lookup export in local index only.
+	 * Returns false if export doesn't exist.
+	 * `pForwarder` receives forwarder string or nullptr if export is not forwarded.
+	 */
+	bool FindExport(const char *pName, uint32_t &Rva, const std::string **pForwarder) const;
+	bool FindExport(uint16_t Ordinal, uint32_t &Rva, const std::string **pForwarder) const;
+
+	size_t GetExportCount() const { return m_Exports.size(); }
+};
+
+/**
+ * Reads and caches PE images of target process modules.
+ * Each module costs 1-2 reads for headers and 1 read for export directory
+ * (plus a few more for images which keep export tables outside of the directory).
+ */
+class CRemotePEParser
+{
+	const CDriverProcessHelper &m_Process;
+
+	mutable std::unordered_map<void *, std::unique_ptr<CRemoteModule>> m_Modules;
+	mutable std::unordered_map<std::string, void *> m_ModuleBases;
+
+	// Fills identity of module at its m_Base, and section table if `Sections` is set
+	void ReadHeaders(CRemoteModule &Module, bool Sections, uint32_t &ExportRva, uint32_t &ExportSize) const;
+	std::unique_ptr<CRemoteModule> Parse(void *ModuleBase) const;
+	void *ResolveForwarder(const std::string &Forwarder, int Depth) const;
+	void *GetExport(const CRemoteModule &Module, uint32_t Rva, const std::string *pForwarder, int Depth) const;
+	void *GetExport(void *ModuleBase, const char *pExportName, int Depth) const;
+
+public:
+
+	CRemotePEParser(const CDriverProcessHelper &Process);
+
+	const CRemoteModule &GetModule(void *ModuleBase) const;
+	const CRemoteModule &GetModule(const char *pModuleName) const;
+
+	/**
+	 * Module base lookup by name without parsing the module.
+	 */
+	void *GetModuleBase(const char *pModuleName) const;
+
+	/**
+	 * Quick header check. Costs a single read if module isn't parsed yet.
+	 */
+	CModuleIdentity ReadIdentity(void *ModuleBase) const;
+
+	/**
+	 * Section table without export index. Headers larger than a page cost one more read.
+	 */
+	std::vector<CRemoteSection> ReadSections(void *ModuleBase) const;
+
+	/**
+	 * Returns absolute address of export. Forwarders are followed to the final module.
+	 * Throws if module or export doesn't exist, or if forwarder points to API set (api-ms-*, ext-ms-*).
+	 */
+	void *GetExport(void *ModuleBase, const char *pExportName) const;
+	void *GetExport(void *ModuleBase, uint16_t Ordinal) const;
+	void *GetExport(const char *pModuleName, const char *pExportName) const;
+
+	/**
+	 * Drop cached data for module. Must be called when module was unloaded.
+	 */
+	void Invalidate(void *ModuleBase);
+	void Clear();
+
+	/**
+	 * Drops cached data made stale by driver event (see CDriverEventSubscription).
+	 * Events of other processes are ignored.
+	 */
+	void OnEvent(const CDriverEvent &Event);
+};
+
+#endif // _PE_PARSER_H_
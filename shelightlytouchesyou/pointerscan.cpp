@@ -0,0 +1,678 @@
+#include "pointerscan.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <sstream>
+#include <thread>
+
+static const uint32_t PointerScanMagic = 0x53504C53; // 'SLPS'
+static const uint32_t PointerScanVersion = 1;
+
+// Source is read in chunks of this size, failed chunks are retried page by page
+static const uint64_t ScanChunkSize = 0x100000;
+static const uint64_t ScanPageSize = 0x1000;
+
+// Records collected by worker before they are appended to the file
+static const size_t FlushRecordCount = 0x10000;
+
+struct CPointerScanHeader
+{
+	uint32_t Magic; // written last, so interrupted build is invalid
+	uint32_t Version;
+	uint32_t PointerSize;
+	uint32_t ModuleCount;
+	uint64_t RecordCount;
+	uint64_t ModulesOffset;
+	uint64_t RecordsOffset;
+};
+
+struct CPointerScanModuleEntry
+{
+	uint64_t Base;
+	uint64_t Size;
+	char Name[128];
+};
+
+struct CPointerScanRecord
+{
+	uint64_t Target;
+	uint64_t Referrer;
+
+	bool operator<(const CPointerScanRecord &Other) const
+	{
+		return Target != Other.Target ? Target < Other.Target : Referrer < Other.Referrer;
+	}
+};
+
+static uint32_t WorkerCount(uint32_t ThreadCount)
+{
+	if (ThreadCount != 0)
+		return ThreadCount;
+
+	uint32_t Hardware = std::thread::hardware_concurrency();
+	return Hardware != 0 ? Hardware : 1;
+}
+
+// Runs `Worker` on `Count` threads including the calling one. First exception is rethrown after all finish.
+static void RunWorkers(uint32_t Count, const std::function<void()> &Worker)
+{
+	std::exception_ptr Error;
+	std::mutex ErrorMutex;
+
+	auto Run = [&]()
+	{
+		try
+		{
+			Worker();
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> Lock(ErrorMutex);
+
+			if (!Error)
+				Error = std::current_exception();
+		}
+	};
+
+	std::vector<std::thread> Threads;
+
+	for (uint32_t i = 1; i < Count; i++)
+		Threads.emplace_back(Run);
+
+	Run();
+
+	for (std::thread &Thread : Threads)
+		Thread.join();
+
+	if (Error)
+		std::rethrow_exception(Error);
+}
+
+static std::string ToLower(const std::string &Str)
+{
+	std::string Result = Str;
+
+	for (char &c : Result)
+		c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+
+	return Result;
+}
+
+static const CScanModule *FindModule(const std::vector<CScanModule> &Modules, uint64_t Addr, uint32_t *pIndex)
+{
+	auto It = std::upper_bound(Modules.begin(), Modules.end(), Addr,
+		[](uint64_t Value, const CScanModule &Module) { return Value < Module.Base; });
+
+	if (It == Modules.begin())
+		return nullptr;
+
+	--It;
+
+	if (Addr - It->Base >= It->Size)
+		return nullptr;
+
+	*pIndex = static_cast<uint32_t>(It - Modules.begin());
+	return &*It;
+}
+
+static bool IsInRegions(const std::vector<CScanRegion> &Regions, uint64_t Addr)
+{
+	auto It = std::upper_bound(Regions.begin(), Regions.end(), Addr,
+		[](uint64_t Value, const CScanRegion &Region) { return Value < Region.Base; });
+
+	if (It == Regions.begin())
+		return false;
+
+	--It;
+
+	return Addr - It->Base < It->Size;
+}
+
+static uint64_t LoadPointer(const uint8_t *p, uint32_t PointerSize)
+{
+	if (PointerSize == 8)
+	{
+		uint64_t Value;
+		memcpy(&Value, p, sizeof(Value));
+		return Value;
+	}
+
+	uint32_t Value;
+	memcpy(&Value, p, sizeof(Value));
+	return Value;
+}
+
+static bool FollowPath(uint64_t Base, const CPointerPath &Path, const CPointerScanSource &Source, uint64_t *pAddress)
+{
+	uint32_t PointerSize = Source.GetPointerSize();
+	uint64_t Address = Base + Path.BaseOffset;
+
+	for (int64_t Offset : Path.Offsets)
+	{
+		uint8_t Value[8];
+
+		if (!Source.Read(Address, PointerSize, Value))
+			return false;
+
+		Address = LoadPointer(Value, PointerSize) + static_cast<uint64_t>(Offset);
+	}
+
+	*pAddress = Address;
+	return true;
+}
+
+static const char *RemoveExisting(const char *pPath)
+{
+	// Old index may be bigger than new one
+	std::remove(pPath);
+	return pPath;
+}
+
+CBufferScanSource::CBufferScanSource(uint32_t PointerSize) :
+	m_PointerSize(PointerSize)
+{
+	if (PointerSize != 4 && PointerSize != 8)
+		throw std::runtime_error("CBufferScanSource pointer size must be 4 or 8");
+}
+
+void CBufferScanSource::AddRegion(uint64_t Base, std::vector<uint8_t> Data)
+{
+	auto It = std::upper_bound(m_Regions.begin(), m_Regions.end(), Base,
+		[](uint64_t Value, const CBufferRegion &Region) { return Value < Region.Base; });
+
+	m_Regions.insert(It, CBufferRegion{ Base, std::move(Data) });
+}
+
+void CBufferScanSource::AddModule(const std::string &Name, uint64_t Base, uint64_t Size)
+{
+	m_Modules.push_back(CScanModule{ Name, Base, Size });
+}
+
+const CBufferScanSource::CBufferRegion *CBufferScanSource::FindRegion(uint64_t Addr, size_t Size) const
+{
+	auto It = std::upper_bound(m_Regions.begin(), m_Regions.end(), Addr,
+		[](uint64_t Value, const CBufferRegion &Region) { return Value < Region.Base; });
+
+	if (It == m_Regions.begin())
+		return nullptr;
+
+	--It;
+
+	uint64_t Offset = Addr - It->Base;
+
+	if (Offset > It->Data.size() || Size > It->Data.size() - Offset)
+		return nullptr;
+
+	return &*It;
+}
+
+bool CBufferScanSource::Write(uint64_t Addr, size_t Size, const void *From)
+{
+	const CBufferRegion *pRegion = FindRegion(Addr, Size);
+
+	if (pRegion == nullptr)
+		return false;
+
+	memcpy(const_cast<uint8_t *>(pRegion->Data.data()) + (Addr - pRegion->Base), From, Size);
+	return true;
+}
+
+std::vector<CScanRegion> CBufferScanSource::GetRegions() const
+{
+	std::vector<CScanRegion> Regions;
+	Regions.reserve(m_Regions.size());
+
+	for (const CBufferRegion &Region : m_Regions)
+		Regions.push_back(CScanRegion{ Region.Base, Region.Data.size() });
+
+	return Regions;
+}
+
+std::vector<CScanModule> CBufferScanSource::GetModules() const
+{
+	return m_Modules;
+}
+
+bool CBufferScanSource::Read(uint64_t Addr, size_t Size, void *Out) const
+{
+	const CBufferRegion *pRegion = FindRegion(Addr, Size);
+
+	if (pRegion == nullptr)
+		return false;
+
+	memcpy(Out, pRegion->Data.data() + (Addr - pRegion->Base), Size);
+	return true;
+}
+
+CPointerScanIndex::CPointerScanIndex(const char *pPath, const CPointerScanSource &Source, uint32_t ThreadCount) :
+	m_File(RemoveExisting(pPath), sizeof(CPointerScanHeader))
+{
+	Build(Source, ThreadCount);
+	LoadModules();
+}
+
+CPointerScanIndex::CPointerScanIndex(const char *pPath) :
+	m_File(pPath, 0, true)
+{
+	const CPointerScanHeader *pHeader = Header();
+
+	bool Valid = m_File.Size() >= sizeof(CPointerScanHeader) &&
+		pHeader->Magic == PointerScanMagic &&
+		pHeader->Version == PointerScanVersion &&
+		(pHeader->PointerSize == 4 || pHeader->PointerSize == 8) &&
+		pHeader->ModulesOffset + pHeader->ModuleCount * sizeof(CPointerScanModuleEntry) <= pHeader->RecordsOffset &&
+		pHeader->RecordsOffset <= m_File.Size() &&
+		pHeader->RecordCount <= (m_File.Size() - pHeader->RecordsOffset) / sizeof(CPointerScanRecord);
+
+	if (!Valid)
+		throw std::runtime_error("CPointerScanIndex bad index file");
+
+	LoadModules();
+}
+
+const CPointerScanHeader *CPointerScanIndex::Header() const
+{
+	return m_File.At<CPointerScanHeader>(0);
+}
+
+const CPointerScanRecord *CPointerScanIndex::Records() const
+{
+	return m_File.At<CPointerScanRecord>(static_cast<size_t>(Header()->RecordsOffset));
+}
+
+uint32_t CPointerScanIndex::GetPointerSize() const
+{
+	return Header()->PointerSize;
+}
+
+uint64_t CPointerScanIndex::GetRecordCount() const
+{
+	return Header()->RecordCount;
+}
+
+void CPointerScanIndex::LoadModules()
+{
+	const CPointerScanHeader *pHeader = Header();
+	const CPointerScanModuleEntry *pEntries = m_File.At<CPointerScanModuleEntry>(static_cast<size_t>(pHeader->ModulesOffset));
+
+	m_Modules.clear();
+	m_Modules.reserve(pHeader->ModuleCount);
+
+	for (uint32_t i = 0; i < pHeader->ModuleCount; i++)
+	{
+		const CPointerScanModuleEntry &Entry = pEntries[i];
+		m_Modules.push_back(CScanModule{ std::string(Entry.Name, strnlen(Entry.Name, sizeof(Entry.Name))), Entry.Base, Entry.Size });
+	}
+}
+
+void CPointerScanIndex::Build(const CPointerScanSource &Source, uint32_t ThreadCount)
+{
+	uint32_t PointerSize = Source.GetPointerSize();
+
+	if (PointerSize != 4 && PointerSize != 8)
+		throw std::runtime_error("CPointerScanIndex pointer size must be 4 or 8");
+
+	std::vector<CScanRegion> Regions = Source.GetRegions();
+	std::sort(Regions.begin(), Regions.end(), [](const CScanRegion &a, const CScanRegion &b) { return a.Base < b.Base; });
+
+	std::vector<CScanModule> Modules = Source.GetModules();
+	std::sort(Modules.begin(), Modules.end(), [](const CScanModule &a, const CScanModule &b) { return a.Base < b.Base; });
+
+	uint64_t ModulesOffset = sizeof(CPointerScanHeader);
+	uint64_t RecordsOffset = (ModulesOffset + Modules.size() * sizeof(CPointerScanModuleEntry) + 63) & ~static_cast<uint64_t>(63);
+
+	m_File.Resize(static_cast<size_t>(RecordsOffset + FlushRecordCount * sizeof(CPointerScanRecord)));
+
+	CPointerScanHeader *pHeader = m_File.At<CPointerScanHeader>(0);
+	pHeader->Magic = 0;
+	pHeader->Version = PointerScanVersion;
+	pHeader->PointerSize = PointerSize;
+	pHeader->ModuleCount = static_cast<uint32_t>(Modules.size());
+	pHeader->RecordCount = 0;
+	pHeader->ModulesOffset = ModulesOffset;
+	pHeader->RecordsOffset = RecordsOffset;
+
+	CPointerScanModuleEntry *pEntries = m_File.At<CPointerScanModuleEntry>(static_cast<size_t>(ModulesOffset));
+
+	for (size_t i = 0; i < Modules.size(); i++)
+	{
+		memset(&pEntries[i], 0, sizeof(pEntries[i]));
+		pEntries[i].Base = Modules[i].Base;
+		pEntries[i].Size = Modules[i].Size;
+		memcpy(pEntries[i].Name, Modules[i].Name.c_str(), std::min(Modules[i].Name.size(), sizeof(pEntries[i].Name) - 1));
+	}
+
+	std::vector<CScanRegion> Chunks;
+
+	for (const CScanRegion &Region : Regions)
+	{
+		for (uint64_t Offset = 0; Offset < Region.Size; Offset += ScanChunkSize)
+			Chunks.push_back(CScanRegion{ Region.Base + Offset, std::min(ScanChunkSize, Region.Size - Offset) });
+	}
+
+	// Quick reject for values outside of any region
+	uint64_t Lowest = Regions.empty() ? 0 : Regions.front().Base;
+	uint64_t Highest = 0;
+
+	for (const CScanRegion &Region : Regions)
+		Highest = std::max(Highest, Region.Base + Region.Size);
+
+	std::mutex FileMutex;
+	uint64_t RecordCount = 0;
+	std::atomic<size_t> NextChunk(0);
+
+	auto Append = [&](std::vector<CPointerScanRecord> &Local)
+	{
+		std::lock_guard<std::mutex> Lock(FileMutex);
+
+		size_t Needed = static_cast<size_t>(RecordsOffset + (RecordCount + Local.size()) * sizeof(CPointerScanRecord));
+
+		if (Needed > m_File.Size())
+			m_File.Resize(std::max(Needed, m_File.Size() * 2));
+
+		CPointerScanRecord *pRecords = m_File.At<CPointerScanRecord>(static_cast<size_t>(RecordsOffset));
+		memcpy(pRecords + RecordCount, Local.data(), Local.size() * sizeof(CPointerScanRecord));
+
+		RecordCount += Local.size();
+		Local.clear();
+	};
+
+	auto ScanBuffer = [&](uint64_t Base, const uint8_t *pData, uint64_t Size, std::vector<CPointerScanRecord> &Local)
+	{
+		for (uint64_t Offset = 0; Offset + PointerSize <= Size; Offset += PointerSize)
+		{
+			uint64_t Value = LoadPointer(pData + Offset, PointerSize);
+
+			if (Value < Lowest || Value >= Highest || !IsInRegions(Regions, Value))
+				continue;
+
+			Local.push_back(CPointerScanRecord{ Value, Base + Offset });
+
+			if (Local.size() == FlushRecordCount)
+				Append(Local);
+		}
+	};
+
+	uint32_t Workers = WorkerCount(ThreadCount);
+
+	RunWorkers(Workers, [&]()
+	{
+		std::vector<uint8_t> Buffer(static_cast<size_t>(ScanChunkSize));
+		std::vector<CPointerScanRecord> Local;
+		Local.reserve(FlushRecordCount);
+
+		for (size_t i = NextChunk++; i < Chunks.size(); i = NextChunk++)
+		{
+			const CScanRegion &Chunk = Chunks[i];
+
+			if (Source.Read(Chunk.Base, static_cast<size_t>(Chunk.Size), Buffer.data()))
+			{
+				ScanBuffer(Chunk.Base, Buffer.data(), Chunk.Size, Local);
+				continue;
+			}
+
+			for (uint64_t Offset = 0; Offset < Chunk.Size; Offset += ScanPageSize)
+			{
+				uint64_t PageSize = std::min(ScanPageSize, Chunk.Size - Offset);
+
+				if (Source.Read(Chunk.Base + Offset, static_cast<size_t>(PageSize), Buffer.data()))
+					ScanBuffer(Chunk.Base + Offset, Buffer.data(), PageSize, Local);
+			}
+		}
+
+		if (!Local.empty())
+			Append(Local);
+	});
+
+	// Sort parts in parallel, then merge neighbours level by level
+	CPointerScanRecord *pRecords = m_File.At<CPointerScanRecord>(static_cast<size_t>(RecordsOffset));
+
+	uint64_t PartCount = std::max<uint64_t>(1, std::min<uint64_t>(Workers, RecordCount / FlushRecordCount));
+	std::vector<uint64_t> Bounds;
+
+	for (uint64_t i = 0; i <= PartCount; i++)
+		Bounds.push_back(RecordCount * i / PartCount);
+
+	std::atomic<size_t> NextPart(0);
+
+	RunWorkers(static_cast<uint32_t>(PartCount), [&]()
+	{
+		for (size_t i = NextPart++; i < PartCount; i = NextPart++)
+			std::sort(pRecords + Bounds[i], pRecords + Bounds[i + 1]);
+	});
+
+	for (uint64_t Width = 1; Width < PartCount; Width *= 2)
+	{
+		std::vector<uint64_t> Starts;
+
+		for (uint64_t i = 0; i + Width < PartCount; i += Width * 2)
+			Starts.push_back(i);
+
+		std::atomic<size_t> NextMerge(0);
+
+		RunWorkers(static_cast<uint32_t>(std::min<size_t>(Workers, Starts.size())), [&]()
+		{
+			for (size_t i = NextMerge++; i < Starts.size(); i = NextMerge++)
+			{
+				uint64_t First = Bounds[Starts[i]];
+				uint64_t Middle = Bounds[Starts[i] + Width];
+				uint64_t Last = Bounds[std::min(Starts[i] + Width * 2, PartCount)];
+
+				std::inplace_merge(pRecords + First, pRecords + Middle, pRecords + Last);
+			}
+		});
+	}
+
+	pHeader = m_File.At<CPointerScanHeader>(0);
+	pHeader->RecordCount = RecordCount;
+	pHeader->Magic = PointerScanMagic;
+
+	m_File.Flush();
+}
+
+namespace
+{
+	struct CSearchNode
+	{
+		uint64_t Address;
+
+		// From target side, reversed in result
+		std::vector<int64_t> Offsets;
+	};
+
+	// State shared by search workers
+	struct CPointerSearch
+	{
+		const CPointerScanRecord *pRecords;
+		uint64_t RecordCount;
+		const std::vector<CScanModule> &Modules;
+		const CPointerScanOptions &Options;
+		std::atomic<size_t> ResultCount;
+
+		CPointerSearch(const CPointerScanRecord *pRecords, uint64_t RecordCount, const std::vector<CScanModule> &Modules, const CPointerScanOptions &Options) :
+			pRecords(pRecords),
+			RecordCount(RecordCount),
+			Modules(Modules),
+			Options(Options),
+			ResultCount(0)
+		{
+		}
+
+		bool Full() const
+		{
+			return ResultCount.load(std::memory_order_relaxed) >= Options.MaxResults;
+		}
+
+		// Referrers of values in [Address - MaxOffset, Address]
+		template <typename Function>
+		void ForEachReferrer(uint64_t Address, Function Callback) const
+		{
+			uint64_t Low = Address >= Options.MaxOffset ? Address - Options.MaxOffset : 0;
+
+			const CPointerScanRecord *pEnd = pRecords + RecordCount;
+			const CPointerScanRecord *p = std::lower_bound(pRecords, pEnd, CPointerScanRecord{ Low, 0 });
+
+			for (; p != pEnd && p->Target <= Address; p++)
+			{
+				if (!Callback(p->Referrer, static_cast<int64_t>(Address - p->Target)))
+					return;
+			}
+		}
+
+		// Returns true if `Referrer` is a root and path was ended
+		bool TryEmit(uint64_t Referrer, const std::vector<int64_t> &Offsets, std::vector<CPointerPath> &Results)
+		{
+			uint32_t ModuleIndex;
+			const CScanModule *pModule = FindModule(Modules, Referrer, &ModuleIndex);
+
+			if (pModule == nullptr)
+				return false;
+
+			if (ResultCount++ < Options.MaxResults)
+				Results.push_back(CPointerPath{ ModuleIndex, Referrer - pModule->Base, std::vector<int64_t>(Offsets.rbegin(), Offsets.rend()) });
+
+			return true;
+		}
+
+		void Walk(uint64_t Address, std::vector<int64_t> &Offsets, uint32_t DepthLeft, std::vector<CPointerPath> &Results)
+		{
+			ForEachReferrer(Address, [&](uint64_t Referrer, int64_t Offset)
+			{
+				if (Full())
+					return false;
+
+				Offsets.push_back(Offset);
+
+				if (!TryEmit(Referrer, Offsets, Results) && DepthLeft > 1)
+					Walk(Referrer, Offsets, DepthLeft - 1, Results);
+
+				Offsets.pop_back();
+				return true;
+			});
+		}
+	};
+}
+
+std::vector<CPointerPath> CPointerScanIndex::Search(uint64_t Target, const CPointerScanOptions &Options) const
+{
+	CPointerSearch Search(Records(), GetRecordCount(), m_Modules, Options);
+	uint32_t Workers = WorkerCount(Options.ThreadCount);
+
+	std::vector<CPointerPath> Results;
+	std::vector<CSearchNode> Frontier = { CSearchNode{ Target, {} } };
+	uint32_t Depth = 0;
+
+	// Breadth first until there is enough independent work for all threads
+	while (!Frontier.empty() && Depth < Options.MaxDepth && Frontier.size() < Workers * 16 && !Search.Full())
+	{
+		std::vector<CSearchNode> Next;
+
+		for (const CSearchNode &Node : Frontier)
+		{
+			Search.ForEachReferrer(Node.Address, [&](uint64_t Referrer, int64_t Offset)
+			{
+				CSearchNode Child = { Referrer, Node.Offsets };
+				Child.Offsets.push_back(Offset);
+
+				if (!Search.TryEmit(Referrer, Child.Offsets, Results))
+					Next.push_back(std::move(Child));
+
+				return !Search.Full();
+			});
+		}
+
+		Frontier.swap(Next);
+		Depth++;
+	}
+
+	if (Depth >= Options.MaxDepth || Search.Full())
+		return Results;
+
+	std::mutex ResultsMutex;
+	std::atomic<size_t> NextNode(0);
+
+	RunWorkers(static_cast<uint32_t>(std::min<size_t>(Workers, Frontier.size())), [&]()
+	{
+		std::vector<CPointerPath> Local;
+
+		for (size_t i = NextNode++; i < Frontier.size() && !Search.Full(); i = NextNode++)
+		{
+			std::vector<int64_t> Offsets = Frontier[i].Offsets;
+			Search.Walk(Frontier[i].Address, Offsets, Options.MaxDepth - Depth, Local);
+		}
+
+		std::lock_guard<std::mutex> Lock(ResultsMutex);
+		Results.insert(Results.end(), std::make_move_iterator(Local.begin()), std::make_move_iterator(Local.end()));
+	});
+
+	return Results;
+}
+
+bool CPointerScanIndex::Resolve(const CPointerPath &Path, const CPointerScanSource &Source, uint64_t *pAddress) const
+{
+	if (Path.Module >= m_Modules.size())
+		return false;
+
+	std::string Name = ToLower(m_Modules[Path.Module].Name);
+
+	for (const CScanModule &Module : Source.GetModules())
+	{
+		if (ToLower(Module.Name) == Name)
+			return FollowPath(Module.Base, Path, Source, pAddress);
+	}
+
+	return false;
+}
+
+std::vector<CPointerPath> CPointerScanIndex::Validate(const std::vector<CPointerPath> &Paths, const CPointerScanSource &Source, uint64_t Target, uint32_t ThreadCount) const
+{
+	// Index module -> base in later snapshot, 0 if not loaded there
+	std::vector<uint64_t> Bases(m_Modules.size(), 0);
+	std::vector<CScanModule> LaterModules = Source.GetModules();
+
+	for (size_t i = 0; i < m_Modules.size(); i++)
+	{
+		std::string Name = ToLower(m_Modules[i].Name);
+
+		for (const CScanModule &Module : LaterModules)
+		{
+			if (ToLower(Module.Name) == Name)
+			{
+				Bases[i] = Module.Base;
+				break;
+			}
+		}
+	}
+
+	std::vector<uint8_t> Keep(Paths.size(), 0);
+	std::atomic<size_t> NextPath(0);
+
+	RunWorkers(static_cast<uint32_t>(std::min<size_t>(WorkerCount(ThreadCount), std::max<size_t>(1, Paths.size()))), [&]()
+	{
+		for (size_t i = NextPath++; i < Paths.size(); i = NextPath++)
+		{
+			const CPointerPath &Path = Paths[i];
+			uint64_t Address;
+
+			if (Path.Module < Bases.size() && Bases[Path.Module] != 0 && FollowPath(Bases[Path.Module], Path, Source, &Address))
+				Keep[i] = Address == Target;
+		}
+	});
+
+	std::vector<CPointerPath> Result;
+
+	for (size_t i = 0; i < Paths.size(); i++)
+	{
+		if (Keep[i])
+			Result.push_back(Paths[i]);
+	}
+
+	return Result;
+}
@@ -0,0 +1,150 @@
+#ifndef _POINTER_SCAN_H_
+#define _POINTER_SCAN_H_
+
+#include "mappedfile.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct CScanRegion
+{
+	uint64_t Base;
+	uint64_t Size;
+};
+
+struct CScanModule
+{
+	std::string Name;
+	uint64_t Base;
+	uint64_t Size;
+};
+
+/**
+ * Address space seen by pointer scanner.
+ * Read is called from several threads at once.
+ */
+class CPointerScanSource
+{
+public:
+
+	virtual ~CPointerScanSource() = default;
+
+	// Committed readable memory, any order
+	virtual std::vector<CScanRegion> GetRegions() const = 0;
+
+	// Modules that can be roots of pointer paths
+	virtual std::vector<CScanModule> GetModules() const = 0;
+
+	// 4 or 8
+	virtual uint32_t GetPointerSize() const = 0;
+
+	// Returns false if any byte can't be read
+	virtual bool Read(uint64_t Addr, size_t Size, void *Out) const = 0;
+};
+
+/**
+ * Address space made of plain buffers.
+ * Useful for synthetic spaces and saved dumps.
+ */
+class CBufferScanSource : public CPointerScanSource
+{
+	struct CBufferRegion
+	{
+		uint64_t Base;
+		std::vector<uint8_t> Data;
+	};
+
+	std::vector<CBufferRegion> m_Regions;
+	std::vector<CScanModule> m_Modules;
+	uint32_t m_PointerSize;
+
+	const CBufferRegion *FindRegion(uint64_t Addr, size_t Size) const;
+
+public:
+
+	explicit CBufferScanSource(uint32_t PointerSize = 8);
+
+	// Regions must not overlap
+	void AddRegion(uint64_t Base, std::vector<uint8_t> Data);
+	void AddModule(const std::string &Name, uint64_t Base, uint64_t Size);
+
+	bool Write(uint64_t Addr, size_t Size, const void *From);
+
+	std::vector<CScanRegion> GetRegions() const override;
+	std::vector<CScanModule> GetModules() const override;
+	uint32_t GetPointerSize() const override { return m_PointerSize; }
+	bool Read(uint64_t Addr, size_t Size, void *Out) const override;
+};
+
+/**
+ * Static path to dynamic address.
+ * Address is `Modules[Module].Base + BaseOffset`, then for each offset: read pointer at address and add offset.
+ */
+struct CPointerPath
+{
+	uint32_t Module;
+	uint64_t BaseOffset;
+	std::vector<int64_t> Offsets;
+};
+
+struct CPointerScanOptions
+{
+	// Max count of dereferences in path
+	uint32_t MaxDepth = 5;
+
+	// Max distance from pointer value to next address in path
+	uint32_t MaxOffset = 0x1000;
+
+	size_t MaxResults = 100000;
+
+	// 0 means count of hardware threads
+	uint32_t ThreadCount = 0;
+};
+
+/**
+ * Reverse pointer index (target -> referrers) in memory mapped file.
+ * Only aligned pointer-sized values pointing into committed memory are indexed.
+ */
+class CPointerScanIndex
+{
+	CMappedFile m_File;
+	std::vector<CScanModule> m_Modules;
+
+	const struct CPointerScanHeader *Header() const;
+	const struct CPointerScanRecord *Records() const;
+
+	void Build(const CPointerScanSource &Source, uint32_t ThreadCount);
+	void LoadModules();
+
+public:
+
+	// Scans `Source` and writes new index to `pPath`
+	CPointerScanIndex(const char *pPath, const CPointerScanSource &Source, uint32_t ThreadCount = 0);
+
+	// Opens index written before
+	explicit CPointerScanIndex(const char *pPath);
+
+	CPointerScanIndex(const CPointerScanIndex &) = delete;
+	CPointerScanIndex &operator=(const CPointerScanIndex &) = delete;
+
+	uint32_t GetPointerSize() const;
+	uint64_t GetRecordCount() const;
+
+	// Sorted by base
+	const std::vector<CScanModule> &GetModules() const { return m_Modules; }
+
+	// Backward search from `Target` to module roots
+	std::vector<CPointerPath> Search(uint64_t Target, const CPointerScanOptions &Options = CPointerScanOptions()) const;
+
+	// Returns false if path breaks in `Source`
+	bool Resolve(const CPointerPath &Path, const CPointerScanSource &Source, uint64_t *pAddress) const;
+
+	/**
+	 * Keeps paths which still lead to `Target` in later snapshot `Source`.
+	 * Modules are matched by name, so they may be loaded at other bases.
+	 */
+	std::vector<CPointerPath> Validate(const std::vector<CPointerPath> &Paths, const CPointerScanSource &Source, uint64_t Target, uint32_t ThreadCount = 0) const;
+};
+
+#endif // _POINTER_SCAN_H_
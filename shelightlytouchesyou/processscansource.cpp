@@ -0,0 +1,55 @@
+#include "processscansource.hpp"
+
+#include <windows.h>
+#include <stdexcept>
+
+CProcessScanSource::CProcessScanSource(const CDriverProcessHelper &Process, const CRemotePEParser &Parser, const std::vector<std::string> &ModuleNames, bool ResidentOnly) :
+	m_Process(Process),
+	m_PointerSize(sizeof(void *)),
+	m_ResidentOnly(ResidentOnly)
+{
+	for (const std::string &Name : ModuleNames)
+	{
+		void *Base = Parser.GetModuleBase(Name.c_str());
+
+		if (m_Modules.empty())
+			m_PointerSize = Parser.GetModule(Base).Is64() ? 8 : 4;
+
+		m_Modules.push_back(CScanModule{ Name, reinterpret_cast<uint64_t>(Base), Parser.ReadIdentity(Base).SizeOfImage });
+	}
+}
+
+std::vector<CScanRegion> CProcessScanSource::GetRegions() const
+{
+	const uint32_t ReadableMask = PAGE_READONLY | PAGE_READWRITE | PAGE_WRITECOPY | PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY;
+
+	std::vector<CScanRegion> Regions;
+
+	for (const CMemoryRegion &Region : m_Process.QueryRegions())
+	{
+		if ((Region.protect & ReadableMask) == 0 || (Region.protect & PAGE_GUARD) != 0)
+			continue;
+
+		Regions.push_back(CScanRegion{ reinterpret_cast<uint64_t>(Region.base), Region.size });
+	}
+
+	return Regions;
+}
+
+bool CProcessScanSource::Read(uint64_t Addr, size_t Size, void *Out) const
+{
+	try
+	{
+		// Partially resident chunk fails as a whole, scanner then retries it page by page
+		if (m_ResidentOnly)
+			return m_Process.ReadResident(reinterpret_cast<void *>(Addr), Size, Out);
+
+		m_Process.ReadProcessMemory(reinterpret_cast<void *>(Addr), Size, Out);
+		return true;
+	}
+	catch (const std::runtime_error &)
+	{
+		// Region was freed or protected since it was listed
+		return false;
+	}
+}
@@ -0,0 +1,36 @@
+#ifndef _PROCESS_SCAN_SOURCE_H_
+#define _PROCESS_SCAN_SOURCE_H_
+
+#include "driverapi.hpp"
+#include "peparser.hpp"
+#include "pointerscan.hpp"
+
+#include <string>
+#include <vector>
+
+/**
+ * Live process seen through the driver as pointer scanner source.
+ * Requires driver with DRIVER_FEATURE_QUERY_REGIONS.
+ */
+class CProcessScanSource : public CPointerScanSource
+{
+	const CDriverProcessHelper &m_Process;
+	std::vector<CScanModule> m_Modules;
+	uint32_t m_PointerSize;
+	bool m_ResidentOnly;
+
+public:
+
+	/**
+	 * Roots are limited to `ModuleNames`, their bases are resolved once here.
+	 * `ResidentOnly` skips paged out memory instead of faulting it in, requires DRIVER_FEATURE_RESIDENCY.
+	 */
+	CProcessScanSource(const CDriverProcessHelper &Process, const CRemotePEParser &Parser, const std::vector<std::string> &ModuleNames, bool ResidentOnly = false);
+
+	std::vector<CScanRegion> GetRegions() const override;
+	std::vector<CScanModule> GetModules() const override { return m_Modules; }
+	uint32_t GetPointerSize() const override { return m_PointerSize; }
+	bool Read(uint64_t Addr, size_t Size, void *Out) const override;
+};
+
+#endif // _PROCESS_SCAN_SOURCE_H_
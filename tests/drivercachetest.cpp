@@ -0,0 +1,210 @@
+#include "drivercache.hpp"
+#include "driverhostbackend.hpp"
+
+extern "C"
+{
+#include "driverhost.h"
+}
+
+#include "testcheck.hpp"
+
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+static void *const TestPid = reinterpret_cast<void *>(1234);
+static const uint64_t RegionBase = 0x10000;
+static const size_t RegionSize = 0x100000;
+
+// Last page is written by tests, reads with checks of pattern stay before it
+static const uint64_t WritablePage = RegionBase + RegionSize - DRIVER_PAGE_SIZE;
+
+static const WCHAR ModuleName[] = { 'g', 'a', 'm', 'e', '.', 'e', 'x', 'e', 0 };
+
+// Every shared reader reads all of these, each starting from other page
+static const uint64_t SharedBase = RegionBase + 0x40000;
+static const uint64_t SharedPages = 64;
+
+static uint8_t Pattern(uint64_t Addr)
+{
+	return (uint8_t)(Addr * 7 + 3);
+}
+
+static std::string BrokerPath()
+{
+	return "/dev/shm/drivercachetest." + std::to_string(getpid());
+}
+
+// Message of exception thrown by `Function`, empty if none was
+template <typename F>
+static std::string ThrownBy(F Function)
+{
+	try
+	{
+		Function();
+	}
+	catch (const std::runtime_error &e)
+	{
+		return e.what();
+	}
+
+	return std::string();
+}
+
+// Every read is byte exact, failures of backend reach client
+static void RunReader(const char *pPath, int Index)
+{
+	CDriverCacheClient Client(pPath, 100000);
+
+	for (int i = 0; i < 200; i++)
+	{
+		uint64_t Offset = (uint64_t)(i * 9973 + Index * 131) % (WritablePage - RegionBase - 0x3000);
+		size_t Size = 1 + (size_t)(i * 37) % 0x2f00;
+
+		std::vector<uint8_t> Buffer(Size);
+		Client.ReqReadProcessMemory(TestPid, reinterpret_cast<void *>(RegionBase + Offset), Size, Buffer.data());
+
+		for (size_t k = 0; k < Size; k++)
+			TEST_CHECK(Buffer[k] == Pattern(RegionBase + Offset + k));
+	}
+
+	uint32_t Value;
+	TEST_CHECK(!ThrownBy([&]() { Client.ReqReadProcessMemory(TestPid, reinterpret_cast<void *>(0x200000), sizeof(Value), &Value); }).empty());
+
+	// Read crossing the end of region fails as a whole
+	std::vector<uint8_t> Buffer(0x2000);
+	TEST_CHECK(!ThrownBy([&]() { Client.ReqReadProcessMemory(TestPid, reinterpret_cast<void *>(RegionBase + RegionSize - 0x1000), Buffer.size(), Buffer.data()); }).empty());
+
+	TEST_CHECK(Client.ReqGetModuleBase(TestPid, L"game.exe", 8) == reinterpret_cast<void *>(RegionBase));
+	TEST_CHECK(ThrownBy([&]() { Client.ReqGetModuleBase(TestPid, L"other.exe", 9); }).find("ReqGetModuleBase") != std::string::npos);
+
+	CMemoryRegion Regions[4];
+	TEST_CHECK(Client.ReqQueryRegions(TestPid, nullptr, Regions, 4) == 1);
+	TEST_CHECK(Regions[0].base == reinterpret_cast<void *>(RegionBase) && Regions[0].size == RegionSize);
+}
+
+// Page read by broker for one client is served to the others from cache
+static void RunSharedReader(const char *pPath, int Index)
+{
+	CDriverCacheClient Client(pPath, 60000000);
+
+	for (uint64_t i = 0; i < SharedPages; i++)
+	{
+		uint64_t Page = SharedBase + (i + Index * 16) % SharedPages * DRIVER_PAGE_SIZE;
+
+		std::vector<uint8_t> Buffer(DRIVER_PAGE_SIZE);
+		Client.ReqReadProcessMemory(TestPid, reinterpret_cast<void *>(Page), Buffer.size(), Buffer.data());
+
+		for (size_t k = 0; k < Buffer.size(); k++)
+			TEST_CHECK(Buffer[k] == Pattern(Page + k));
+	}
+}
+
+static void RunClients(const char *pPath, int Clients, void (*pRun)(const char *, int))
+{
+	for (int i = 0; i < Clients; i++)
+	{
+		if (fork() == 0)
+		{
+			pRun(pPath, i);
+			_exit(0);
+		}
+	}
+
+	for (int i = 0; i < Clients; i++)
+	{
+		int Status = 0;
+		TEST_CHECK(wait(&Status) > 0);
+		TEST_CHECK(WIFEXITED(Status) && WEXITSTATUS(Status) == 0);
+	}
+}
+
+// Written page is not served from copy made before write
+static void TestWrite(const char *pPath)
+{
+	CDriverCacheClient Client(pPath, 10000000);
+
+	uint8_t Before[16];
+	Client.ReqReadProcessMemory(TestPid, reinterpret_cast<void *>(WritablePage), sizeof(Before), Before);
+	TEST_CHECK(Before[0] == Pattern(WritablePage));
+
+	uint8_t Written[16];
+
+	for (size_t i = 0; i < sizeof(Written); i++)
+		Written[i] = (uint8_t)(0xA0 + i);
+
+	Client.ReqWriteProcessMemory(TestPid, reinterpret_cast<void *>(WritablePage), sizeof(Written), Written);
+
+	uint8_t After[16];
+	Client.ReqReadProcessMemory(TestPid, reinterpret_cast<void *>(WritablePage), sizeof(After), After);
+	TEST_CHECK(memcmp(After, Written, sizeof(After)) == 0);
+
+	std::string Error = ThrownBy([&]() { Client.ReqWriteProcessMemory(TestPid, reinterpret_cast<void *>(0x200000), sizeof(Written), Written); });
+	TEST_CHECK(Error.find("ReqWriteProcessMemory") != std::string::npos);
+
+	TEST_CHECK(!ThrownBy([&]() { Client.ReqAtomic(TestPid, nullptr, 0, nullptr); }).empty());
+}
+
+// Client which claimed ring cell and died before filling it doesn't block the others for good
+static void TestDeadClaim(const char *pPath)
+{
+	{
+		// Claim of ring cell, as made by client before it fills the cell
+		CMappedFile File(pPath, 0);
+		File.At<std::atomic<uint64_t>>(CDriverCacheBroker::RingHeadOffset)->fetch_add(1);
+	}
+
+	CDriverCacheClient Client(pPath, 0, 3000);
+
+	uint8_t Value;
+	Client.ReqReadProcessMemory(TestPid, reinterpret_cast<void *>(RegionBase + 0x5000), sizeof(Value), &Value);
+	TEST_CHECK(Value == Pattern(RegionBase + 0x5000));
+}
+
+int main()
+{
+	CDriverHost *pHost = DriverHostCreate();
+	TEST_CHECK(pHost != nullptr);
+
+	uint8_t *pMemory = DriverHostAddRegion(pHost, TestPid, reinterpret_cast<void *>(RegionBase), RegionSize, 0x04);
+	TEST_CHECK(pMemory != nullptr);
+
+	for (size_t i = 0; i < RegionSize; i++)
+		pMemory[i] = Pattern(RegionBase + i);
+
+	TEST_CHECK(NT_SUCCESS(DriverHostAddModule(pHost, TestPid, ModuleName, 8, reinterpret_cast<void *>(RegionBase))));
+
+	std::string Path = BrokerPath();
+
+	{
+		CDriverHostBackend Backend(pHost);
+		CDriverCacheBroker Broker(Backend, Path.c_str(), 256);
+
+		const int Clients = 4;
+
+		RunClients(Path.c_str(), Clients, RunSharedReader);
+
+		// Driver traffic follows distinct pages, not clients. Clients missing one page at the same time may each have it
+		// read, so a few pages may come twice, but far from once per client.
+		TEST_CHECK(Broker.GetServedPages() >= SharedPages);
+		TEST_CHECK(Broker.GetServedPages() <= SharedPages + SharedPages / 4);
+
+		RunClients(Path.c_str(), Clients, RunReader);
+
+		TestWrite(Path.c_str());
+		TestDeadClaim(Path.c_str());
+	}
+
+	// Broker is gone
+	TEST_CHECK(!ThrownBy([&]() { CDriverCacheClient Client(Path.c_str(), 0); }).empty());
+
+	unlink(Path.c_str());
+	DriverHostDestroy(pHost);
+
+	std::printf("drivercachetest passed\n");
+	return 0;
+}
@@ -0,0 +1,152 @@
+#include "offsetcache.hpp"
+
+#include "testcheck.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static const char *const CachePath = "offsetcachetest.bin";
+
+static const CModuleIdentity Module = { 0x5F000000, 0x200000, 0x1234 };
+
+// Same build but other checksum, e.g. patched binary
+static const CModuleIdentity OtherModule = { 0x5F000000, 0x200000, 0x1235 };
+
+static std::string Key(const char *pPrefix, uint32_t Index)
+{
+	return pPrefix + std::to_string(Index);
+}
+
+static bool Has(COffsetCache &Cache, const CModuleIdentity &Identity, const std::string &Name, uint32_t Expected)
+{
+	uint32_t Rva = 0;
+	return Cache.Find(Identity, Name.c_str(), Rva) && Rva == Expected;
+}
+
+// Entries survive reopen and are bound to module identity
+static void TestHitMiss()
+{
+	{
+		COffsetCache Cache(CachePath, 16, 64);
+		Cache.Store(Module, "export:Foo", 0x1000);
+
+		uint32_t Rva;
+		TEST_CHECK(!Cache.Find(Module, "export:Bar", Rva));
+		TEST_CHECK(Has(Cache, Module, "export:Foo", 0x1000));
+
+		std::vector<uint32_t> Hits = { 0x10, 0x20, 0x30 };
+		Cache.StoreHits(Module, "scan:48 8B", Hits);
+		Cache.StoreHits(Module, "scan:CC", std::vector<uint32_t>());
+		Cache.Flush();
+	}
+
+	COffsetCache Cache(CachePath, 16, 64);
+
+	TEST_CHECK(Has(Cache, Module, "export:Foo", 0x1000));
+	TEST_CHECK(!Has(Cache, OtherModule, "export:Foo", 0x1000));
+
+	std::vector<uint32_t> Hits;
+	TEST_CHECK(Cache.FindHits(Module, "scan:48 8B", Hits));
+	TEST_CHECK(Hits == std::vector<uint32_t>({ 0x10, 0x20, 0x30 }));
+
+	TEST_CHECK(Cache.FindHits(Module, "scan:CC", Hits) && Hits.empty());
+	TEST_CHECK(!Cache.FindHits(OtherModule, "scan:48 8B", Hits));
+
+	Cache.Clear();
+	TEST_CHECK(!Has(Cache, Module, "export:Foo", 0x1000));
+}
+
+// Table grows up to max capacity, then drops entries not used since open
+static void TestGrowEvict()
+{
+	{
+		COffsetCache Cache(CachePath, 16, 64);
+
+		for (uint32_t i = 0; i < 40; i++)
+			Cache.Store(Module, Key("old", i).c_str(), i);
+
+		for (uint32_t i = 0; i < 40; i++)
+			TEST_CHECK(Has(Cache, Module, Key("old", i), i));
+	}
+
+	COffsetCache Cache(CachePath, 16, 64);
+
+	// Used by this open, so kept by eviction
+	for (uint32_t i = 0; i < 10; i++)
+		TEST_CHECK(Has(Cache, Module, Key("old", i), i));
+
+	for (uint32_t i = 0; i < 20; i++)
+		Cache.Store(OtherModule, Key("new", i).c_str(), i + 100);
+
+	for (uint32_t i = 0; i < 10; i++)
+		TEST_CHECK(Has(Cache, Module, Key("old", i), i));
+
+	for (uint32_t i = 10; i < 40; i++)
+		TEST_CHECK(!Has(Cache, Module, Key("old", i), i));
+
+	for (uint32_t i = 0; i < 20; i++)
+		TEST_CHECK(Has(Cache, OtherModule, Key("new", i), i + 100));
+}
+
+// Damaged or foreign files read as cold cache instead of hanging or crashing
+static void TestCorrupt()
+{
+	{
+		COffsetCache Cache(CachePath, 16, 64);
+		Cache.Clear();
+		Cache.Store(Module, "export:Foo", 0x1000);
+	}
+
+	{
+		// Header stays valid with small count, but no slot is empty
+		CMappedFile File(CachePath, 0);
+		memset(File.At<uint8_t>(COffsetCache::HeaderSize), 0xFF, File.Size() - COffsetCache::HeaderSize);
+	}
+
+	{
+		COffsetCache Cache(CachePath, 16, 64);
+		TEST_CHECK(!Has(Cache, Module, "export:Foo", 0x1000));
+
+		Cache.Store(Module, "export:Foo", 0x2000);
+		TEST_CHECK(Has(Cache, Module, "export:Foo", 0x2000));
+
+		for (uint32_t i = 0; i < 40; i++)
+			Cache.Store(Module, Key("big", i).c_str(), i);
+	}
+
+	{
+		// Table of 64 entries is above max capacity of this open
+		COffsetCache Cache(CachePath, 16, 16);
+		TEST_CHECK(!Has(Cache, Module, "export:Foo", 0x2000));
+	}
+
+	{
+		CMappedFile File(CachePath, 0);
+		memset(File.Data(), 0xAB, COffsetCache::HeaderSize);
+	}
+
+	COffsetCache Cache(CachePath, 16, 64);
+	TEST_CHECK(!Has(Cache, Module, "export:Foo", 0x2000));
+
+	Cache.Store(Module, "export:Foo", 0x3000);
+	TEST_CHECK(Has(Cache, Module, "export:Foo", 0x3000));
+}
+
+int main()
+{
+	std::remove(CachePath);
+
+	TestHitMiss();
+
+	std::remove(CachePath);
+
+	TestGrowEvict();
+	TestCorrupt();
+
+	std::remove(CachePath);
+
+	std::printf("offsetcachetest passed\n");
+	return 0;
+}
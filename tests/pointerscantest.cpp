@@ -0,0 +1,279 @@
+#include "pointerscan.hpp"
+
+#include "testcheck.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <tuple>
+
+// game.exe+0x100 -> [+0x18] -> [+0x30] -> target
+static const uint64_t ModuleBase = 0x400000;
+static const uint64_t ModuleSize = 0x2000;
+static const uint64_t HeapBase = 0x10000000;
+static const uint64_t HeapSize = 0x10000;
+
+static const uint64_t RootOffset = 0x100;
+static const int64_t FirstOffset = 0x18;
+static const int64_t SecondOffset = 0x30;
+
+static void WritePointer(CBufferScanSource &Source, uint64_t Addr, uint64_t Value)
+{
+	TEST_CHECK(Source.Write(Addr, sizeof(Value), &Value));
+}
+
+// Same chain with module and heap at given bases. Returns address of target.
+static uint64_t BuildChain(CBufferScanSource &Source, uint64_t Module, uint64_t Heap, uint64_t NodeOffset)
+{
+	Source.AddRegion(Module, std::vector<uint8_t>(ModuleSize));
+	Source.AddRegion(Heap, std::vector<uint8_t>(HeapSize));
+	Source.AddModule("game.exe", Module, ModuleSize);
+
+	uint64_t First = Heap + 0x100;
+	uint64_t Second = Heap + NodeOffset;
+
+	WritePointer(Source, Module + RootOffset, First);
+	WritePointer(Source, First + FirstOffset, Second);
+
+	return Second + SecondOffset;
+}
+
+static bool IsExpectedPath(const CPointerPath &Path)
+{
+	return Path.Module == 0 &&
+		Path.BaseOffset == RootOffset &&
+		Path.Offsets.size() == 2 &&
+		Path.Offsets[0] == FirstOffset &&
+		Path.Offsets[1] == SecondOffset;
+}
+
+static bool ContainsExpectedPath(const std::vector<CPointerPath> &Paths)
+{
+	for (const CPointerPath &Path : Paths)
+	{
+		if (IsExpectedPath(Path))
+			return true;
+	}
+
+	return false;
+}
+
+// Tree for parallel search: target <- 8 nodes <- 8 nodes each <- chain of 3 nodes <- module root, 64 paths of depth 6.
+// Nodes are further apart than MaxOffset, so every node is reached only through its own links.
+static const uint64_t TreeModuleBase = 0x400000;
+static const uint64_t TreeHeapBase = 0x10000000;
+static const uint64_t TreeHeapSize = 0x80000;
+static const uint64_t TreeNodeStride = 0x400;
+static const int64_t TreeLinkOffset = 0x10;
+static const uint32_t TreeFanOut = 8;
+static const uint32_t TreeChainLength = 3;
+static const uint32_t TreeDepth = 2 + TreeChainLength + 1;
+
+// Pointers which point into sink only, so index gets more records than FlushRecordCount per worker without new paths
+static const uint64_t NoiseBase = 0x20000000;
+static const uint64_t NoiseSize = 0x400000;
+static const uint64_t SinkBase = 0x30000000;
+static const uint64_t SinkSize = 0x10000;
+
+static uint64_t BuildTree(CBufferScanSource &Source)
+{
+	Source.AddRegion(TreeModuleBase, std::vector<uint8_t>(ModuleSize));
+	Source.AddRegion(TreeHeapBase, std::vector<uint8_t>(TreeHeapSize));
+	Source.AddModule("game.exe", TreeModuleBase, ModuleSize);
+
+	std::vector<uint8_t> Noise(NoiseSize);
+	uint64_t State = 0x9E3779B97F4A7C15ull;
+
+	for (uint64_t Offset = 0; Offset < NoiseSize; Offset += sizeof(uint64_t))
+	{
+		State ^= State << 13;
+		State ^= State >> 7;
+		State ^= State << 17;
+
+		uint64_t Value = SinkBase + (State % SinkSize & ~7ull);
+		memcpy(Noise.data() + Offset, &Value, sizeof(Value));
+	}
+
+	Source.AddRegion(NoiseBase, std::move(Noise));
+	Source.AddRegion(SinkBase, std::vector<uint8_t>(SinkSize));
+
+	// Links point below their nodes, so the first node is not at the very start of region
+	uint64_t NextNode = TreeHeapBase + TreeNodeStride;
+
+	auto AddNode = [&](uint64_t Child)
+	{
+		uint64_t Node = NextNode;
+		NextNode += TreeNodeStride;
+
+		WritePointer(Source, Node, Child - TreeLinkOffset);
+		return Node;
+	};
+
+	uint64_t Target = NextNode;
+	NextNode += TreeNodeStride;
+
+	uint64_t Root = TreeModuleBase + 0x100;
+
+	for (uint32_t i = 0; i < TreeFanOut; i++)
+	{
+		uint64_t First = AddNode(Target);
+
+		for (uint32_t k = 0; k < TreeFanOut; k++)
+		{
+			uint64_t Node = AddNode(First);
+
+			for (uint32_t Link = 0; Link < TreeChainLength; Link++)
+				Node = AddNode(Node);
+
+			WritePointer(Source, Root, Node - TreeLinkOffset);
+			Root += sizeof(uint64_t);
+		}
+	}
+
+	TEST_CHECK(NextNode <= TreeHeapBase + TreeHeapSize);
+
+	return Target;
+}
+
+static std::vector<std::tuple<uint32_t, uint64_t, std::vector<int64_t>>> Sorted(const std::vector<CPointerPath> &Paths)
+{
+	std::vector<std::tuple<uint32_t, uint64_t, std::vector<int64_t>>> Result;
+
+	for (const CPointerPath &Path : Paths)
+		Result.emplace_back(Path.Module, Path.BaseOffset, Path.Offsets);
+
+	std::sort(Result.begin(), Result.end());
+	return Result;
+}
+
+// Index big enough for parallel sort and merges, and tree wide enough for parallel walk, give results of one thread
+static void TestParallel()
+{
+	const char *pSinglePath = "pointerscantest_single.idx";
+	const char *pParallelPath = "pointerscantest_parallel.idx";
+
+	CBufferScanSource Source;
+	uint64_t Target = BuildTree(Source);
+
+	std::remove(pSinglePath);
+	std::remove(pParallelPath);
+
+	CPointerScanOptions Options;
+	Options.MaxDepth = TreeDepth;
+	Options.MaxOffset = 0x100;
+
+	std::vector<CPointerPath> Single;
+	std::vector<CPointerPath> Parallel;
+
+	{
+		CPointerScanIndex Index(pSinglePath, Source, 1);
+
+		Options.ThreadCount = 1;
+		Single = Index.Search(Target, Options);
+	}
+
+	{
+		// 4 workers flush several times each and sort 4 parts, which are merged in 2 levels
+		CPointerScanIndex Index(pParallelPath, Source, 4);
+		TEST_CHECK(Index.GetRecordCount() > 4 * 0x10000);
+
+		// Breadth first phase stops with 64 nodes at depth 2, the rest is walked by 4 threads
+		Options.ThreadCount = 4;
+		Parallel = Index.Search(Target, Options);
+
+		for (const CPointerPath &Path : Parallel)
+		{
+			uint64_t Address = 0;
+			TEST_CHECK(Path.Offsets.size() == TreeDepth);
+			TEST_CHECK(Index.Resolve(Path, Source, &Address) && Address == Target);
+		}
+
+		CPointerScanIndex SingleIndex(pSinglePath);
+		TEST_CHECK(SingleIndex.GetRecordCount() == Index.GetRecordCount());
+	}
+
+	TEST_CHECK(Parallel.size() == TreeFanOut * TreeFanOut);
+	TEST_CHECK(Sorted(Parallel) == Sorted(Single));
+
+	std::remove(pSinglePath);
+	std::remove(pParallelPath);
+}
+
+int main()
+{
+	const char *pIndexPath = "pointerscantest.idx";
+
+	CPointerScanOptions Options;
+	Options.MaxDepth = 3;
+	Options.MaxOffset = 0x100;
+	Options.ThreadCount = 2;
+
+	CBufferScanSource Source;
+	uint64_t Target = BuildChain(Source, ModuleBase, HeapBase, 0x2000);
+
+	std::remove(pIndexPath);
+
+	std::vector<CPointerPath> Paths;
+	uint64_t RecordCount;
+
+	{
+		CPointerScanIndex Index(pIndexPath, Source, 2);
+
+		TEST_CHECK(Index.GetPointerSize() == 8);
+		TEST_CHECK(Index.GetRecordCount() == 2);
+		TEST_CHECK(Index.GetModules().size() == 1);
+
+		Paths = Index.Search(Target, Options);
+		RecordCount = Index.GetRecordCount();
+
+		TEST_CHECK(Paths.size() == 1);
+		TEST_CHECK(IsExpectedPath(Paths[0]));
+
+		uint64_t Address = 0;
+		TEST_CHECK(Index.Resolve(Paths[0], Source, &Address));
+		TEST_CHECK(Address == Target);
+
+		// Too shallow search can't reach module
+		CPointerScanOptions Shallow = Options;
+		Shallow.MaxDepth = 1;
+		TEST_CHECK(Index.Search(Target, Shallow).empty());
+	}
+
+	// Index written above serves the same results after reopen
+	{
+		CPointerScanIndex Index(pIndexPath);
+
+		TEST_CHECK(Index.GetRecordCount() == RecordCount);
+		TEST_CHECK(Index.GetModules().size() == 1);
+		TEST_CHECK(Index.GetModules()[0].Name == "game.exe");
+		TEST_CHECK(Index.GetModules()[0].Base == ModuleBase);
+
+		std::vector<CPointerPath> Reopened = Index.Search(Target, Options);
+
+		TEST_CHECK(Reopened.size() == Paths.size());
+		TEST_CHECK(ContainsExpectedPath(Reopened));
+
+		// Later run: module and heap moved, chain kept its shape
+		CBufferScanSource Moved;
+		uint64_t MovedTarget = BuildChain(Moved, 0x7FF600000000, 0x20000000, 0x3000);
+
+		std::vector<CPointerPath> Valid = Index.Validate(Paths, Moved, MovedTarget, 2);
+
+		TEST_CHECK(Valid.size() == 1);
+		TEST_CHECK(IsExpectedPath(Valid[0]));
+
+		// Later run where the last link points elsewhere
+		CBufferScanSource Broken;
+		uint64_t BrokenTarget = BuildChain(Broken, ModuleBase, HeapBase, 0x2000);
+		WritePointer(Broken, HeapBase + 0x100 + FirstOffset, HeapBase + 0x4000);
+
+		TEST_CHECK(Index.Validate(Paths, Broken, BrokenTarget, 2).empty());
+	}
+
+	std::remove(pIndexPath);
+
+	TestParallel();
+
+	std::printf("pointerscantest passed\n");
+
+	return 0;
+}
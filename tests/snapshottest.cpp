@@ -0,0 +1,192 @@
+#include "driversnapshot.hpp"
+#include "driverhostbackend.hpp"
+
+extern "C"
+{
+#include "driverhost.h"
+}
+
+#include "testcheck.hpp"
+
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+static void *const TestPid = reinterpret_cast<void *>(1234);
+
+// Heap starts with ZeroSize of zero pages, every other page of it and of module is unique
+static const uint64_t HeapBase = 0x10000;
+static const size_t HeapSize = 0x300000;
+static const size_t ZeroSize = 0x100000;
+
+static const uint64_t GuardBase = 0x400000;
+static const size_t GuardSize = 0x2000;
+
+static const uint64_t ModuleBase = 0x800000;
+static const size_t ModuleSize = 0x5000;
+
+static const uint64_t ChangedAddress = HeapBase + 0x200000;
+
+static const WCHAR ModuleName[] = { 'g', 'a', 'm', 'e', '.', 'e', 'x', 'e', 0 };
+
+static const char *const StorePath = "snapshottest.bin";
+
+// Bytes of page index are mixed in, so no two pages are equal
+static uint8_t Pattern(uint64_t Addr)
+{
+	if (Addr >= HeapBase && Addr < HeapBase + ZeroSize)
+		return 0;
+
+	return (uint8_t)((Addr * 7 + 3) ^ ((Addr >> 12) >> ((Addr & 3) * 8)));
+}
+
+static uint64_t PageCount(size_t Size)
+{
+	return Size / DRIVER_PAGE_SIZE;
+}
+
+template <typename F>
+static bool Throws(F Function)
+{
+	try
+	{
+		Function();
+	}
+	catch (const std::runtime_error &)
+	{
+		return true;
+	}
+
+	return false;
+}
+
+static void CheckSnapshot(uint32_t Snapshot, bool Changed)
+{
+	CSnapshotBackend Backend(StorePath, Snapshot);
+
+	TEST_CHECK(Backend.GetPid() == TestPid);
+
+	std::vector<uint8_t> Buffer(HeapSize);
+	Backend.ReqReadProcessMemory(TestPid, reinterpret_cast<void *>(HeapBase), Buffer.size(), Buffer.data());
+
+	for (size_t i = 0; i < Buffer.size(); i++)
+	{
+		uint64_t Addr = HeapBase + i;
+		TEST_CHECK(Buffer[i] == (Changed && Addr == ChangedAddress ? 0x55 : Pattern(Addr)));
+	}
+
+	Buffer.resize(ModuleSize);
+	Backend.ReqReadProcessMemory(TestPid, reinterpret_cast<void *>(ModuleBase), Buffer.size(), Buffer.data());
+
+	for (size_t i = 0; i < Buffer.size(); i++)
+		TEST_CHECK(Buffer[i] == Pattern(ModuleBase + i));
+
+	// No access region is recorded, but not its pages
+	uint8_t Value;
+	TEST_CHECK(Throws([&]() { Backend.ReqReadProcessMemory(TestPid, reinterpret_cast<void *>(GuardBase), sizeof(Value), &Value); }));
+
+	uint8_t Present = 0xFF;
+	Backend.ReqQueryResidency(TestPid, reinterpret_cast<void *>(GuardBase), GuardSize, &Present);
+	TEST_CHECK(Present == 0);
+
+	// Last two pages of heap and two past it
+	Backend.ReqQueryResidency(TestPid, reinterpret_cast<void *>(HeapBase + HeapSize - 2 * DRIVER_PAGE_SIZE), 4 * DRIVER_PAGE_SIZE, &Present);
+	TEST_CHECK(Present == 0x03);
+
+	CMemoryRegion Regions[8];
+	TEST_CHECK(Backend.ReqQueryRegions(TestPid, nullptr, Regions, 8) == 3);
+
+	TEST_CHECK(Backend.ReqGetModuleBase(TestPid, L"GAME.exe", 8) == reinterpret_cast<void *>(ModuleBase));
+	TEST_CHECK(Throws([&]() { Backend.ReqReadProcessMemory(reinterpret_cast<void *>(1), reinterpret_cast<void *>(HeapBase), sizeof(Value), &Value); }));
+}
+
+// Backend refuses record whose region points past its pages
+static void TestCorruptRegion()
+{
+	{
+		CMappedFile File(StorePath, 0);
+
+		// Header keeps block of newest record at 16, first region follows 48 byte record, FirstPage is at 32 in region
+		uint64_t Record = *File.At<uint64_t>(16) * DRIVER_PAGE_SIZE;
+		*File.At<uint64_t>(Record + 48 + 32) = UINT32_MAX;
+	}
+
+	TEST_CHECK(Throws([&]() { CSnapshotBackend Backend(StorePath); }));
+}
+
+int main()
+{
+	std::remove(StorePath);
+
+	CDriverHost *pHost = DriverHostCreate();
+	TEST_CHECK(pHost != nullptr);
+
+	uint8_t *pHeap = DriverHostAddRegion(pHost, TestPid, reinterpret_cast<void *>(HeapBase), HeapSize, 0x04);
+	uint8_t *pGuard = DriverHostAddRegion(pHost, TestPid, reinterpret_cast<void *>(GuardBase), GuardSize, 0x01);
+	uint8_t *pModule = DriverHostAddRegion(pHost, TestPid, reinterpret_cast<void *>(ModuleBase), ModuleSize, 0x20);
+	TEST_CHECK(pHeap != nullptr && pGuard != nullptr && pModule != nullptr);
+
+	for (size_t i = 0; i < HeapSize; i++)
+		pHeap[i] = Pattern(HeapBase + i);
+
+	for (size_t i = 0; i < ModuleSize; i++)
+		pModule[i] = Pattern(ModuleBase + i);
+
+	TEST_CHECK(NT_SUCCESS(DriverHostAddModule(pHost, TestPid, ModuleName, 8, reinterpret_cast<void *>(ModuleBase))));
+
+	CDriverHostBackend Backend(pHost);
+	const wchar_t *ppModuleNames[] = { L"game.exe" };
+
+	uint64_t UniquePages = 1 + PageCount(HeapSize - ZeroSize) + PageCount(ModuleSize);
+
+	{
+		CSnapshotStore Store(StorePath);
+
+		TEST_CHECK(Store.DumpProcess(Backend, TestPid, ppModuleNames, 1) == 0);
+
+		// Zero pages are stored once
+		TEST_CHECK(Store.GetNewPages() == UniquePages);
+		TEST_CHECK(Store.GetSharedPages() == PageCount(ZeroSize) - 1);
+	}
+
+	pHeap[ChangedAddress - HeapBase] = 0x55;
+
+	{
+		// Reopened store shares pages of first snapshot
+		CSnapshotStore Store(StorePath);
+
+		TEST_CHECK(Store.GetSnapshotCount() == 1);
+		TEST_CHECK(Store.DumpProcess(Backend, TestPid, ppModuleNames, 1) == 1);
+
+		TEST_CHECK(Store.GetNewPages() == 1);
+		TEST_CHECK(Store.GetSharedPages() == PageCount(HeapSize) + PageCount(ModuleSize) - 1);
+	}
+
+	{
+		// Index includes page added by second snapshot
+		CSnapshotStore Store(StorePath);
+
+		pHeap[ChangedAddress - HeapBase] = Pattern(ChangedAddress);
+		TEST_CHECK(Store.DumpProcess(Backend, TestPid, ppModuleNames, 1) == 2);
+		pHeap[ChangedAddress - HeapBase] = 0x55;
+		TEST_CHECK(Store.DumpProcess(Backend, TestPid, ppModuleNames, 1) == 3);
+
+		TEST_CHECK(Store.GetNewPages() == 0);
+	}
+
+	CheckSnapshot(0, false);
+	CheckSnapshot(1, true);
+	CheckSnapshot(2, false);
+	CheckSnapshot(CSnapshotBackend::LatestSnapshot, true);
+
+	TEST_CHECK(Throws([&]() { CSnapshotBackend Snapshot(StorePath, 4); }));
+
+	TestCorruptRegion();
+
+	std::remove(StorePath);
+	DriverHostDestroy(pHost);
+
+	std::printf("snapshottest passed\n");
+	return 0;
+}
@@ -0,0 +1,18 @@
+#ifndef _TEST_CHECK_H_
+#define _TEST_CHECK_H_
+
+#include <cstdio>
+#include <cstdlib>
+
+// Tests are plain executables run by ctest: first failed check prints its location and exits with 1
+#define TEST_CHECK(Condition) \
+	do \
+	{ \
+		if (!(Condition)) \
+		{ \
+			std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #Condition); \
+			std::exit(1); \
+		} \
+	} while (0)
+
+#endif // _TEST_CHECK_H_
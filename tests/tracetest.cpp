@@ -0,0 +1,93 @@
+#include "drivertrace.hpp"
+
+#include "testcheck.hpp"
+
+#include <cstring>
+#include <thread>
+
+static void RecordCalls(const char *pCallSite, size_t Count)
+{
+	for (size_t i = 0; i < Count; i++)
+	{
+		CDriverTraceRecord Record = {};
+		Record.pCallSite = pCallSite;
+		Record.Size = i;
+		Record.Start = CDriverTrace::ReadTimestamp();
+		Record.End = Record.Start + 1;
+
+		CDriverTrace::Record(Record);
+	}
+}
+
+static size_t CountCallSite(const std::vector<CDriverTraceRecord> &Records, const char *pCallSite)
+{
+	size_t Count = 0;
+
+	for (const CDriverTraceRecord &Record : Records)
+	{
+		if (strcmp(Record.pCallSite, pCallSite) == 0)
+			Count++;
+	}
+
+	return Count;
+}
+
+// Records of exited thread stay visible after its ring is reused by next thread
+static void TestExitedThreads()
+{
+	std::thread([]() { RecordCalls("first", 100); }).join();
+	std::thread([]() { RecordCalls("second", 200); }).join();
+
+	std::vector<CDriverTraceRecord> Records = CDriverTrace::Collect();
+
+	TEST_CHECK(CountCallSite(Records, "first") == 100);
+	TEST_CHECK(CountCallSite(Records, "second") == 200);
+
+	for (size_t i = 1; i < Records.size(); i++)
+		TEST_CHECK(Records[i - 1].Start <= Records[i].Start);
+
+	CDriverTrace::Clear();
+	TEST_CHECK(CDriverTrace::Collect().empty());
+}
+
+// Only RingSize latest records of exited threads are kept
+static void TestRetiredBound()
+{
+	for (int i = 0; i < 3; i++)
+		std::thread([]() { RecordCalls("churn", CDriverTrace::RingSize); }).join();
+
+	TEST_CHECK(CDriverTrace::Collect().size() == CDriverTrace::RingSize);
+
+	CDriverTrace::Clear();
+}
+
+// Live thread records into its own ring alongside records of exited ones
+static void TestLiveThread()
+{
+	std::thread([]() { RecordCalls("exited", 10); }).join();
+
+	RecordCalls("main", 20);
+
+	std::vector<CDriverTraceRecord> Records = CDriverTrace::Collect();
+
+	TEST_CHECK(CountCallSite(Records, "exited") == 10);
+	TEST_CHECK(CountCallSite(Records, "main") == 20);
+
+	std::vector<CDriverTraceSummary> Summary = CDriverTrace::Summarize(Records);
+
+	TEST_CHECK(Summary.size() == 2);
+
+	CDriverTrace::Clear();
+}
+
+int main()
+{
+	CDriverTrace::SetEnabled(true);
+
+	TestExitedThreads();
+	TestRetiredBound();
+	TestLiveThread();
+
+	std::printf("tracetest passed\n");
+	return 0;
+}